@@ -0,0 +1,973 @@
+/*----------------------------------------------------------------------------
+ * File    : tybench.c
+ * Program : tybench
+ * OS      : UNIX
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all 
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN 
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" 
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Benchmark of the API functions that applications use the most. The
+ *   program generates a database definition from its parameters, compiles
+ *   it with ddlp and runs each test against a fresh database in its work
+ *   directory. The results are written as JSON, one object per test with
+ *   the throughput and the latency percentiles of the timed calls, so they
+ *   can be compared between releases.
+ *
+ *   Tests:
+ *     fillnew		- Insert the records in random key order.
+ *     keyfind		- Look up random keys.
+ *     keynext		- Scan the primary key from the first key.
+ *     recnext		- Scan the records in file order.
+ *     recwrite		- Update random records.
+ *     vlradd		- Insert variable length records of random size.
+ *     vlrread		- Read random variable length records.
+ *     vlrwrite		- Update random variable length records to random sizes.
+ *					  Fails if the data file keeps growing, i.e. if the
+ *					  space freed by the updates is not reused.
+ *     getsequence	- Get numbers from a sequence.
+ *     contention	- Several processes reading and updating random records
+ *					  in shared mode.
+ *     delete		- Delete half of the records in random order.
+ *
+ *   fillnew is always run because the other tests need its records, and
+ *   vlradd is run if vlrread or vlrwrite is selected.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include "environ.h"
+#include "typhoon.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+/* Names in the generated database definition. Records are numbered 1000,
+ * 2000, ... and their fields 1001, 1002, ... by ddlp.
+ */
+#define ITEM			1000L
+#define ITEM_ID			1001L
+#define BLOB			2000L
+#define BLOB_ID			2001L
+#define BENCH_SEQ		0L
+
+typedef struct {					/* Layout of the blob record			*/
+	unsigned long	id;
+	unsigned short	len;
+	char			payload[1];
+} Blob;
+
+typedef struct {					/* Result of a test						*/
+	char		   *test;			/* Name of the test						*/
+	unsigned long	ops;			/* Number of timed calls				*/
+	unsigned long	elapsed;		/* Wall clock time in nanoseconds		*/
+	unsigned long  *lat;			/* Latency of each call in nanoseconds	*/
+	int				have_stats;		/* Are <stats> valid?					*/
+	DB_STATS		stats;			/* I/O done by the test					*/
+} Result;
+
+/*-------------------------- Function prototypes ---------------------------*/
+static unsigned long	now			PRM( (void); )
+static unsigned long	rnd			PRM( (void); )
+static void				fail		PRM( (char *, int); )
+static int				selected	PRM( (char *); )
+static void				make_key	PRM( (char *, unsigned long); )
+static int				lat_cmp		PRM( (const void *, const void *); )
+static void				begin		PRM( (Result *, char *); )
+static void				end			PRM( (Result *); )
+static void				report		PRM( (Result *); )
+static void				create_db	PRM( (void); )
+static void				open_db		PRM( (int); )
+static void				t_fillnew	PRM( (void); )
+static void				t_keyfind	PRM( (void); )
+static void				t_keynext	PRM( (void); )
+static void				t_recnext	PRM( (void); )
+static void				t_recwrite	PRM( (void); )
+static void				t_vlradd	PRM( (void); )
+static void				t_vlrread	PRM( (void); )
+static void				t_vlrwrite	PRM( (void); )
+static void				t_getsequence PRM( (void); )
+static void				t_contention PRM( (void); )
+static void				t_delete	PRM( (void); )
+static void				help		PRM( (void); )
+int						main		PRM( (int, char **); )
+
+/*---------------------------- Global variables ----------------------------*/
+static unsigned long	records		= 100000;	/* Dataset size				*/
+static int				key_string	= 0;		/* String keys?				*/
+static int				key_size	= 16;		/* Size of string keys		*/
+static int				node_size	= 512;		/* Node size of key files	*/
+static int				rec_size	= 100;		/* Bytes after the key		*/
+static int				vlr_size	= 2000;		/* Max variable record size	*/
+static int				procs		= 4;		/* Contention processes		*/
+static char				mode[2]		= "x";		/* Open mode of the tests	*/
+static char			   *tests		= NULL;		/* Tests to report. NULL=all*/
+static unsigned long	seed		= 1;		/* Random seed				*/
+static unsigned long	first_seed;				/* Seed given with -S		*/
+static char				ddlp[512]	= "../util/ddlp";
+static char			   *workdir		= "benchdb";
+static FILE			   *out;					/* JSON output				*/
+static int				results		= 0;		/* Results written so far	*/
+
+static unsigned long   *keys;					/* Keys in insertion order	*/
+static char			   *item;					/* Item record buffer		*/
+static Blob			   *blob;					/* Blob record buffer		*/
+static unsigned long	blobs;					/* Number of blobs			*/
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : now
+ *
+ * Purpose   : Read the clock.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Time in nanoseconds.
+ *
+ */
+static unsigned long now()
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long)tv.tv_sec * 1000000000UL + tv.tv_usec * 1000UL;
+#endif
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : rnd
+ *
+ * Purpose   : Random number generator. The same seed gives the same
+ *			   sequence on all platforms.
+ *
+ * Parameters: None.
+ *
+ * Returns   : A random number.
+ *
+ */
+static unsigned long rnd()
+{
+	seed = seed * 1103515245UL + 12345UL;
+	return (seed >> 16) & 0x7fffffffUL;
+}
+
+
+static void fail(what, status)
+char *what;
+int status;
+{
+	fprintf(stderr, "tybench: %s failed (db_status %d)\n", what, status);
+	exit(1);
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : selected
+ *
+ * Purpose   : Check if a test should be reported.
+ *
+ * Parameters: test		- Name of the test.
+ *
+ * Returns   : 1 if the test was selected with -t or no tests were given.
+ *
+ */
+static int selected(test)
+char *test;
+{
+	char *p;
+	int len = strlen(test);
+
+	if( !tests )
+		return 1;
+
+	for( p = tests; (p = strstr(p, test)) != NULL; p += len )
+		if( (p == tests || p[-1] == ',') && (p[len] == ',' || !p[len]) )
+			return 1;
+
+	return 0;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : make_key
+ *
+ * Purpose   : Store a key value in a record buffer. String keys are zero
+ *			   padded numbers, so they sort in the same order as numbers.
+ *
+ * Parameters: buf		- Buffer.
+ *			   n		- Key value.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void make_key(buf, n)
+char *buf;
+unsigned long n;
+{
+	if( key_string )
+		sprintf(buf, "%0*lu", key_size - 1, n);
+	else
+		memcpy(buf, &n, sizeof n);
+}
+
+
+static int lat_cmp(a, b)
+const void *a, *b;
+{
+	unsigned long x = *(unsigned long *)a, y = *(unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : begin
+ *
+ * Purpose   : Start a test.
+ *
+ * Parameters: r		- Result to initialize.
+ *			   test		- Name of the test.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void begin(r, test)
+Result *r;
+char *test;
+{
+	r->test		  = test;
+	r->ops		  = 0;
+	r->have_stats = d_getstats(-1, &r->stats) == S_OKAY;
+	r->elapsed	  = now();
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : end
+ *
+ * Purpose   : End a test and report it if it was selected.
+ *
+ * Parameters: r		- Result.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void end(r)
+Result *r;
+{
+	DB_STATS after;
+
+	r->elapsed = now() - r->elapsed;
+
+	if( r->have_stats && d_getstats(-1, &after) == S_OKAY )
+	{
+		r->stats.reads	= after.reads - r->stats.reads;
+		r->stats.writes	= after.writes - r->stats.writes;
+		r->stats.splits	= after.splits - r->stats.splits;
+		r->stats.merges	= after.merges - r->stats.merges;
+	}
+	else
+		r->have_stats = 0;
+
+	if( selected(r->test) )
+		report(r);
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : report
+ *
+ * Purpose   : Write the result of a test as a JSON object.
+ *
+ * Parameters: r		- Result.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void report(r)
+Result *r;
+{
+	static struct {
+		char   *name;
+		int		permille;
+	} pct[] = {
+		{ "min", 0 }, { "p50", 500 }, { "p90", 900 }, { "p99", 990 },
+		{ "p999", 999 }, { "max", 1000 }
+	};
+	double secs = r->elapsed / 1e9;
+	int i;
+
+	qsort(r->lat, r->ops, sizeof *r->lat, lat_cmp);
+
+	fprintf(out, "%s\n    {\n", results++ ? "," : "");
+	fprintf(out, "      \"test\": \"%s\",\n", r->test);
+	fprintf(out, "      \"ops\": %lu,\n", r->ops);
+	fprintf(out, "      \"seconds\": %.6f,\n", secs);
+	fprintf(out, "      \"ops_per_sec\": %.1f,\n", secs > 0 ? r->ops / secs : 0.0);
+	if( r->have_stats )
+		fprintf(out, "      \"io\": { \"reads\": %lu, \"writes\": %lu, "
+					 "\"splits\": %lu, \"merges\": %lu },\n",
+				r->stats.reads, r->stats.writes, r->stats.splits,
+				r->stats.merges);
+	fprintf(out, "      \"latency_us\": {");
+	for( i=0; i<sizeof pct / sizeof pct[0]; i++ )
+		fprintf(out, "%s \"%s\": %.3f", i ? "," : "", pct[i].name,
+			r->ops ? r->lat[(r->ops - 1) * pct[i].permille / 1000] / 1e3 : 0.0);
+	fprintf(out, " }\n    }");
+	fflush(out);
+
+	fprintf(stderr, "%-12s %9lu ops %12.1f ops/s  p50 %8.3f us  p99 %8.3f us\n",
+		r->test, r->ops, secs > 0 ? r->ops / secs : 0.0,
+		r->ops ? r->lat[(r->ops - 1) / 2] / 1e3 : 0.0,
+		r->ops ? r->lat[(r->ops - 1) * 99 / 100] / 1e3 : 0.0);
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : create_db
+ *
+ * Purpose   : Generate the database definition from the parameters,
+ *			   compile it and remove the files of a previous run.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void create_db()
+{
+	char cmd[600];
+	FILE *fp;
+
+	if( !(fp = fopen("bench.ddl", "w")) )
+	{
+		perror("bench.ddl");
+		exit(1);
+	}
+
+	fprintf(fp, "database bench {\n");
+	fprintf(fp, "\tdata file \"item.dat\" contains item;\n");
+	fprintf(fp, "\tkey file [%d] \"item.ix1\" contains item.id;\n", node_size);
+	fprintf(fp, "\tdata file \"blob.dat\" contains blob;\n");
+	fprintf(fp, "\tkey file [%d] \"blob.ix1\" contains blob.id;\n", node_size);
+	fprintf(fp, "\trecord item {\n");
+	if( key_string )
+		fprintf(fp, "\t\tchar id[%d];\n", key_size);
+	else
+		fprintf(fp, "\t\tulong id;\n");
+	fprintf(fp, "\t\tchar payload[%d];\n", rec_size);
+	fprintf(fp, "\t\tprimary key id;\n\t}\n");
+	fprintf(fp, "\trecord blob {\n");
+	fprintf(fp, "\t\tulong id;\n\t\tushort len;\n");
+	fprintf(fp, "\t\tchar payload[%d] variable by len;\n", vlr_size);
+	fprintf(fp, "\t\tprimary key id;\n\t}\n");
+	fprintf(fp, "\tsequence bench_seq 1 asc by 1;\n");
+	fprintf(fp, "}\n");
+	fclose(fp);
+
+	sprintf(cmd, "%s bench > ddlp.log", ddlp);
+	if( system(cmd) != 0 )
+	{
+		fprintf(stderr, "tybench: '%s' failed, see %s/ddlp.log\n", cmd, workdir);
+		exit(1);
+	}
+
+	d_destroy("bench");
+	unlink("sequence.dat");
+}
+
+
+static void open_db(m)
+int m;
+{
+	if( d_open("bench", m == 's' ? "s" : "x") != S_OKAY )
+		fail("d_open", db_status);
+}
+
+
+static void t_fillnew()
+{
+	Result r;
+	unsigned long i, t;
+
+	memset(item, 'x', (key_string ? key_size : sizeof(unsigned long)) + rec_size);
+	r.lat = (unsigned long *)malloc(records * sizeof(unsigned long));
+
+	begin(&r, "fillnew");
+	for( i=0; i<records; i++ )
+	{
+		make_key(item, keys[i]);
+		t = now();
+		if( d_fillnew(ITEM, item) != S_OKAY )
+			fail("d_fillnew", db_status);
+		r.lat[r.ops++] = now() - t;
+	}
+	end(&r);
+	free(r.lat);
+}
+
+
+static void t_keyfind()
+{
+	Result r;
+	unsigned long i, t;
+	char key[256];
+
+	r.lat = (unsigned long *)malloc(records * sizeof(unsigned long));
+
+	begin(&r, "keyfind");
+	for( i=0; i<records; i++ )
+	{
+		make_key(key, keys[rnd() % records]);
+		t = now();
+		if( d_keyfind(ITEM_ID, key) != S_OKAY )
+			fail("d_keyfind", db_status);
+		r.lat[r.ops++] = now() - t;
+	}
+	end(&r);
+	free(r.lat);
+}
+
+
+static void t_keynext()
+{
+	Result r;
+	unsigned long t;
+	int rc;
+
+	r.lat = (unsigned long *)malloc(records * sizeof(unsigned long));
+
+	begin(&r, "keynext");
+	if( d_keyfrst(ITEM_ID) != S_OKAY )
+		fail("d_keyfrst", db_status);
+	for( ;; )
+	{
+		t = now();
+		rc = d_keynext(ITEM_ID);
+		if( rc != S_OKAY )
+			break;
+		r.lat[r.ops++] = now() - t;
+	}
+	end(&r);
+	free(r.lat);
+
+	if( rc != S_NOTFOUND || r.ops != records - 1 )
+		fail("d_keynext", rc);
+}
+
+
+static void t_recnext()
+{
+	Result r;
+	unsigned long t;
+	int rc;
+
+	r.lat = (unsigned long *)malloc(records * sizeof(unsigned long));
+
+	begin(&r, "recnext");
+	if( d_recfrst(ITEM) != S_OKAY )
+		fail("d_recfrst", db_status);
+	for( ;; )
+	{
+		t = now();
+		rc = d_recnext(ITEM);
+		if( rc != S_OKAY )
+			break;
+		r.lat[r.ops++] = now() - t;
+	}
+	end(&r);
+	free(r.lat);
+
+	/* The end of a record chain is reported as S_INVADDR */
+	if( (rc != S_NOTFOUND && rc != S_INVADDR) || r.ops != records - 1 )
+		fail("d_recnext", rc);
+}
+
+
+static void t_recwrite()
+{
+	Result r;
+	unsigned long i, t, n;
+
+	r.lat = (unsigned long *)malloc(records * sizeof(unsigned long));
+
+	begin(&r, "recwrite");
+	for( i=0; i<records; i++ )
+	{
+		n = keys[rnd() % records];
+		make_key(item, n);
+		if( d_keyfind(ITEM_ID, item) != S_OKAY )
+			fail("d_keyfind", db_status);
+		item[(key_string ? key_size : sizeof n) + i % rec_size] = 'a' + i % 26;
+		t = now();
+		if( d_recwrite(item) != S_OKAY )
+			fail("d_recwrite", db_status);
+		r.lat[r.ops++] = now() - t;
+	}
+	end(&r);
+	free(r.lat);
+}
+
+
+static void t_vlradd()
+{
+	Result r;
+	unsigned long i, t;
+
+	r.lat = (unsigned long *)malloc(blobs * sizeof(unsigned long));
+
+	begin(&r, "vlradd");
+	for( i=1; i<=blobs; i++ )
+	{
+		blob->id  = i;
+		blob->len = (unsigned short)(rnd() % vlr_size + 1);
+		memset(blob->payload, 'a' + i % 26, blob->len);
+		t = now();
+		if( d_fillnew(BLOB, blob) != S_OKAY )
+			fail("d_fillnew", db_status);
+		r.lat[r.ops++] = now() - t;
+	}
+	end(&r);
+	free(r.lat);
+}
+
+
+static void t_vlrread()
+{
+	Result r;
+	unsigned long i, t, id;
+
+	r.lat = (unsigned long *)malloc(blobs * sizeof(unsigned long));
+
+	begin(&r, "vlrread");
+	for( i=0; i<blobs; i++ )
+	{
+		id = rnd() % blobs + 1;
+		if( d_keyfind(BLOB_ID, &id) != S_OKAY )
+			fail("d_keyfind", db_status);
+		t = now();
+		if( d_recread(blob) != S_OKAY )
+			fail("d_recread", db_status);
+		r.lat[r.ops++] = now() - t;
+		if( blob->id != id || blob->payload[blob->len - 1] != 'a' + id % 26 )
+			fail("d_recread (wrong data)", db_status);
+	}
+	end(&r);
+	free(r.lat);
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : t_vlrwrite
+ *
+ * Purpose   : Update random variable length records to random sizes, 20
+ *			   times as many updates as there are records. The size of the
+ *			   data file is taken after half of the updates, when the free
+ *			   space has reached its steady state, and again at the end.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing. Exits if the file grew more than 10% in the second
+ *			   half or a record was read back wrong.
+ *
+ */
+static void t_vlrwrite()
+{
+	Result r;
+	unsigned long i, t, id, ops = blobs * 20, half = 0;
+	struct stat st;
+
+	r.lat = (unsigned long *)malloc(ops * sizeof(unsigned long));
+
+	begin(&r, "vlrwrite");
+	for( i=0; i<ops; i++ )
+	{
+		if( i == ops / 2 )
+		{
+			stat("blob.dat", &st);
+			half = st.st_size;
+		}
+
+		id = rnd() % blobs + 1;
+		if( d_keyfind(BLOB_ID, &id) != S_OKAY )
+			fail("d_keyfind", db_status);
+		blob->id  = id;
+		blob->len = (unsigned short)(rnd() % vlr_size + 1);
+		memset(blob->payload, 'a' + id % 26, blob->len);
+		t = now();
+		if( d_recwrite(blob) != S_OKAY )
+			fail("d_recwrite", db_status);
+		r.lat[r.ops++] = now() - t;
+	}
+	end(&r);
+	free(r.lat);
+
+	stat("blob.dat", &st);
+	if( (unsigned long)st.st_size > half + half / 10 )
+	{
+		fprintf(stderr, "tybench: blob.dat grew from %lu to %lu bytes\n",
+				half, (unsigned long)st.st_size);
+		exit(1);
+	}
+
+	for( id=1; id<=blobs; id++ )
+		if( d_keyfind(BLOB_ID, &id) != S_OKAY || d_recread(blob) != S_OKAY
+		||  blob->id != id || blob->payload[blob->len - 1] != 'a' + id % 26 )
+			fail("d_recread (wrong data)", db_status);
+}
+
+
+static void t_getsequence()
+{
+	Result r;
+	unsigned long i, t, n;
+
+	r.lat = (unsigned long *)malloc(records * sizeof(unsigned long));
+
+	begin(&r, "getsequence");
+	for( i=0; i<records; i++ )
+	{
+		t = now();
+		if( d_getsequence(BENCH_SEQ, &n) != S_OKAY )
+			fail("d_getsequence", db_status);
+		r.lat[r.ops++] = now() - t;
+	}
+	end(&r);
+	free(r.lat);
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : t_contention
+ *
+ * Purpose   : Run <procs> processes that open the database in shared mode
+ *			   and read (80%) or update (20%) random records. Each process
+ *			   sends its start and end times and the latencies of its calls
+ *			   to the parent through a pipe.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void t_contention()
+{
+	Result r;
+	unsigned long per_proc = records / procs, first = 0, last = 0;
+	unsigned long i, t, n, hdr[3];
+	int p, (*fd)[2];
+	pid_t pid;
+
+	if( !per_proc )
+		per_proc = 1;
+
+	d_close();
+
+	fd = malloc(procs * sizeof *fd);
+	r.lat = (unsigned long *)malloc(procs * per_proc * sizeof(unsigned long));
+	r.test		 = "contention";
+	r.ops		 = 0;
+	r.have_stats = 0;
+
+	for( p=0; p<procs; p++ )
+	{
+		if( pipe(fd[p]) == -1 || (pid = fork()) == -1 )
+		{
+			perror("tybench");
+			exit(1);
+		}
+
+		if( pid )
+		{
+			close(fd[p][1]);
+			continue;
+		}
+
+		/* Child */
+		close(fd[p][0]);
+		seed += p + 1;
+		open_db('s');
+
+		hdr[0] = now();
+		for( i=0; i<per_proc; i++ )
+		{
+			n = keys[rnd() % records];
+			make_key(item, n);
+			t = now();
+			if( d_keyfind(ITEM_ID, item) != S_OKAY || d_recread(item) != S_OKAY )
+				fail("d_keyfind/d_recread", db_status);
+			if( rnd() % 5 == 0 )
+			{
+				item[(key_string ? key_size : sizeof n) + i % rec_size] = 'a' + i % 26;
+				if( d_recwrite(item) != S_OKAY )
+					fail("d_recwrite", db_status);
+			}
+			r.lat[i] = now() - t;
+		}
+		hdr[1] = now();
+		hdr[2] = per_proc;
+		d_close();
+
+		write(fd[p][1], hdr, sizeof hdr);
+		write(fd[p][1], r.lat, per_proc * sizeof(unsigned long));
+		_exit(0);
+	}
+
+	for( p=0; p<procs; p++ )
+	{
+		FILE *fp = fdopen(fd[p][0], "r");
+
+		if( fread(hdr, sizeof hdr, 1, fp) != 1
+		||  fread(r.lat + r.ops, sizeof(unsigned long), hdr[2], fp) != hdr[2] )
+		{
+			fprintf(stderr, "tybench: contention process %d failed\n", p);
+			exit(1);
+		}
+		fclose(fp);
+
+		if( !p || hdr[0] < first )
+			first = hdr[0];
+		if( hdr[1] > last )
+			last = hdr[1];
+		r.ops += hdr[2];
+	}
+
+	while( wait(NULL) > 0 )
+		;
+
+	r.elapsed = last - first;
+	if( selected(r.test) )
+		report(&r);
+	free(r.lat);
+	free(fd);
+
+	open_db(mode[0]);
+}
+
+
+static void t_delete()
+{
+	Result r;
+	unsigned long i, t;
+
+	r.lat = (unsigned long *)malloc(records * sizeof(unsigned long));
+
+	begin(&r, "delete");
+	for( i=0; i<records; i += 2 )
+	{
+		make_key(item, keys[i]);
+		if( d_keyfind(ITEM_ID, item) != S_OKAY )
+			fail("d_keyfind", db_status);
+		t = now();
+		if( d_delete() != S_OKAY )
+			fail("d_delete", db_status);
+		r.lat[r.ops++] = now() - t;
+	}
+	end(&r);
+	free(r.lat);
+}
+
+
+static void help()
+{
+	puts("Syntax: tybench [option]...\n"
+		 "Options:\n"
+		 "    -n<records>     Dataset size (default 100000)\n"
+		 "    -k<type>        Key type: ulong or string (default ulong)\n"
+		 "    -K<size>        Size of string keys incl. '\\0' (default 16)\n"
+		 "    -N<size>        Node size of the key files (default 512)\n"
+		 "    -r<size>        Record size after the key (default 100)\n"
+		 "    -v<size>        Max size of variable length records (default 2000)\n"
+		 "    -p<procs>       Processes in the contention test (default 4)\n"
+		 "    -s              Open the database in shared mode\n"
+		 "    -t<test,...>    Tests to report (default all)\n"
+		 "    -S<seed>        Random seed (default 1)\n"
+		 "    -d<dir>         Work directory (default benchdb)\n"
+		 "    -D<ddlp>        ddlp program (default ../util/ddlp)\n"
+		 "    -o<file>        JSON output file (default stdout)");
+	exit(1);
+}
+
+
+int main(argc, argv)
+int argc;
+char *argv[];
+{
+	char *outname = NULL, cwd[256];
+	unsigned long i, j, t;
+	int a;
+
+	for( a=1; a<argc; a++ )
+	{
+		char *arg = argv[a] + 2;
+
+		if( argv[a][0] != '-' )
+			help();
+
+		switch( argv[a][1] )
+		{
+			case 'n':	records	  = strtoul(arg, NULL, 10);	break;
+			case 'K':	key_size  = atoi(arg);				break;
+			case 'N':	node_size = atoi(arg);				break;
+			case 'r':	rec_size  = atoi(arg);				break;
+			case 'v':	vlr_size  = atoi(arg);				break;
+			case 'p':	procs	  = atoi(arg);				break;
+			case 's':	mode[0]	  = 's';					break;
+			case 't':	tests	  = arg;					break;
+			case 'S':	seed	  = strtoul(arg, NULL, 10);	break;
+			case 'd':	workdir	  = arg;					break;
+			case 'o':	outname	  = arg;					break;
+			case 'D':
+				strncpy(ddlp, arg, sizeof ddlp - 1);
+				break;
+			case 'k':
+				if( !strcmp(arg, "string") )
+					key_string = 1;
+				else if( strcmp(arg, "ulong") )
+					help();
+				break;
+			default:
+				help();
+		}
+	}
+
+	if( records < 2 || key_size < 12 || key_size > 200 || node_size < 512
+	||  rec_size < 1 || vlr_size < 1 || vlr_size > 65535 || procs < 1 )
+	{
+		fprintf(stderr, "tybench: invalid parameter\n");
+		help();
+	}
+
+	if( outname && !(out = fopen(outname, "w")) )
+	{
+		perror(outname);
+		exit(1);
+	}
+	if( !out )
+		out = stdout;
+
+	/* ddlp is found relative to the directory tybench was started in */
+	if( ddlp[0] != '/' && getcwd(cwd, sizeof cwd - 1) )
+	{
+		char tmp[sizeof cwd + sizeof ddlp];
+
+		sprintf(tmp, "%s/%s", cwd, ddlp);
+		strncpy(ddlp, tmp, sizeof ddlp - 1);
+	}
+
+	if( mkdir(workdir, 0777) == -1 && errno != EEXIST )
+	{
+		perror(workdir);
+		exit(1);
+	}
+	if( chdir(workdir) == -1 )
+	{
+		perror(workdir);
+		exit(1);
+	}
+
+	keys = (unsigned long *)malloc(records * sizeof(unsigned long));
+	item = (char *)malloc(key_size + sizeof(unsigned long) + rec_size + 16);
+	blob = (Blob *)malloc(sizeof(Blob) + vlr_size + 16);
+	if( !keys || !item || !blob )
+	{
+		fprintf(stderr, "tybench: out of memory\n");
+		exit(1);
+	}
+
+	/* The records are inserted in random order */
+	first_seed = seed;
+	for( i=0; i<records; i++ )
+		keys[i] = i + 1;
+	for( i=records-1; i>0; i-- )
+	{
+		j = rnd() % (i + 1);
+		t = keys[i];
+		keys[i] = keys[j];
+		keys[j] = t;
+	}
+	blobs = records / 10 ? records / 10 : 1;
+
+	create_db();
+	d_dbdpath(".");
+	d_dbfpath(".");
+	open_db(mode[0]);
+
+	fprintf(out, "{\n  \"program\": \"tybench\",\n");
+	fprintf(out, "  \"parameters\": { \"records\": %lu, \"key_type\": \"%s\", "
+				 "\"key_size\": %d, \"node_size\": %d, \"record_size\": %d, "
+				 "\"vlr_size\": %d, \"processes\": %d, \"mode\": \"%s\", "
+				 "\"seed\": %lu },\n",
+			records, key_string ? "string" : "ulong",
+			key_string ? key_size : (int)sizeof(unsigned long), node_size,
+			rec_size, vlr_size, procs, mode, first_seed);
+	fprintf(out, "  \"results\": [");
+
+	t_fillnew();
+	if( selected("keyfind") )		t_keyfind();
+	if( selected("keynext") )		t_keynext();
+	if( selected("recnext") )		t_recnext();
+	if( selected("recwrite") )		t_recwrite();
+	if( selected("vlradd") || selected("vlrread") || selected("vlrwrite") )
+		t_vlradd();
+	if( selected("vlrread") )		t_vlrread();
+	if( selected("vlrwrite") )		t_vlrwrite();
+	if( selected("getsequence") )	t_getsequence();
+	if( selected("contention") )	t_contention();
+	if( selected("delete") )		t_delete();
+
+	fprintf(out, "\n  ]\n}\n");
+
+	d_close();
+	if( out != stdout )
+		fclose(out);
+
+	return 0;
+}
+
+/* end-of-file */
@@ -81,6 +81,24 @@ typedef struct {
 	unsigned long	recno;
 } DB_ADDR;
 
+#define STAT_BUCKETS		20		/* Buckets in a latency histogram		*/
+
+typedef struct {						/* I/O statistics (d_getstats)		*/
+	unsigned long	reads;				/* Nodes, records or blocks read	*/
+	unsigned long	writes;				/* Nodes, records or blocks written	*/
+	unsigned long	cache_hits;			/* Reads saved by a cache			*/
+	unsigned long	splits;				/* B-tree node splits				*/
+	unsigned long	merges;				/* B-tree node merges				*/
+	unsigned long	reopens;			/* Reopens of a closed file			*/
+	unsigned long	locks;				/* Database lock requests			*/
+	/* Latency histograms. Bucket i counts the calls that took less than
+	 * 2^i microseconds, the last bucket counts the rest.
+	 */
+	unsigned long	read_time[STAT_BUCKETS];
+	unsigned long	write_time[STAT_BUCKETS];
+	unsigned long	lock_time[STAT_BUCKETS];
+} DB_STATS;
+
 extern unsigned long curr_rec;
 extern int db_status;					/* See S_... constants				*/
 extern long db_subcode;
@@ -103,7 +121,19 @@ extern long db_subcode;
 CL d_block			PRM( (void);									)
 CL d_unblock		PRM( (void);									)
 CL d_setfiles		PRM( (int);										)
+CL d_filestat		PRM( (unsigned long *, unsigned long *);		)
+CL d_setcache		PRM( (int);										)
+CL d_recbitmap		PRM( (int);										)
+CL d_vlrcompress	PRM( (int);										)
+CL d_keycompress	PRM( (int);										)
+CL d_cachestat		PRM( (unsigned long *, unsigned long *);		)
+CL d_getstats		PRM( (int, DB_STATS *);							)
+CL d_resetstats		PRM( (void);									)
 CL d_keybuild		PRM( (void (*)(char *, ulong, ulong));			)
+CL d_keybuildprocs	PRM( (int);										)
+CL d_keybloom		PRM( (unsigned long, unsigned long);			)
+CL d_keycompact		PRM( (unsigned long);							)
+CL d_reccluster		PRM( (unsigned long, unsigned long);			)
 CL d_open			PRM( (char *, char *);							)
 CL d_close			PRM( (void);       						        )
 CL d_destroy		PRM( (char *);                                  )
@@ -114,6 +144,9 @@ CL d_keynext		PRM( (unsigned long);							)
 CL d_keyprev		PRM( (unsigned long);							)
 CL d_keyread		PRM( (void *);									)
 CL d_fillnew		PRM( (unsigned long, void *);					)
+CL d_fillbatch		PRM( (unsigned long, void *, unsigned, int *);	)
+CL d_loadbegin		PRM( (unsigned long);							)
+CL d_loadend		PRM( (void);									)
 CL d_keystore		PRM( (unsigned long);							)
 CL d_recwrite		PRM( (void *);									)
 CL d_recread		PRM( (void *);									)
@@ -124,6 +157,12 @@ CL d_recfrst       	PRM( (unsigned long);	          			    )
 CL d_reclast       	PRM( (unsigned long);	          			    )
 CL d_recnext       	PRM( (unsigned long);	          			    )
 CL d_recprev       	PRM( (unsigned long);	          			    )
+CL d_colscan		PRM( (unsigned long, int, unsigned long *, void **, unsigned,
+						   unsigned long *, unsigned *);				)
+CL d_scanparts		PRM( (unsigned long, int, unsigned long *);		)
+CL d_scanopen		PRM( (unsigned long, unsigned long, unsigned long, void **);)
+CL d_scanread		PRM( (void *, void *, unsigned, unsigned *);	)
+CL d_scanclose		PRM( (void *);									)
 
 CL d_crget			PRM( (DB_ADDR *);								)
 CL d_crset			PRM( (DB_ADDR *);								)
@@ -151,6 +190,7 @@ CL d_recprev		PRM( (unsigned long);							)
 CL d_recnext		PRM( (unsigned long);							)
 
 CL d_getsequence	PRM( (unsigned long, unsigned long *);			)
+CL d_seqcache		PRM( (int);										)
 
 CL d_replicationlog	PRM( (int);										)
 CL d_addsite		PRM( (unsigned long);							)
@@ -0,0 +1,400 @@
+/*----------------------------------------------------------------------------
+ * File    : bt_build.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Contains functions for building a B-tree bottom-up from keys that are
+ *   already sorted. The nodes are filled from left to right one level at a
+ *   time, so each node is written only once and without searching the tree.
+ *
+ *   Only the rightmost node of each level is kept in memory. When a node
+ *   has one tuple more than the fill count and another tuple arrives, the
+ *   node is written without its last tuple, which moves up to the parent
+ *   level, and the new tuple starts the next node of the level. The nodes
+ *   on the right edge of the tree may therefore be less than half full.
+ *
+ * Functions:
+ *   btree_buildopen	- Start building an empty index.
+ *   btree_buildadd		- Add the next key.
+ *   btree_buildclose	- Write the rest of the tree.
+ *   btree_copy			- Copy the keys of an index into an empty index.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <stdio.h>
+#include "environ.h"
+#ifndef CONFIG_UNIX
+#	include <stdlib.h>
+#else
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#endif
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_prot.h"
+#include "btree.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+/*--------------------------- Function prototypes --------------------------*/
+static int buildtuple	PRM( (BTBUILD *, int, void *, ulong, ix_addr); )
+static int copynode		PRM( (BTBUILD *, INDEX *, char **, int, ix_addr); )
+
+
+/*------------------------------ btree_buildopen ---------------------------*\
+ *
+ * Purpose	 : Starts building an index from sorted keys. The index must be
+ *			   empty. The root is reserved right away, so that the other
+ *			   nodes never get its page.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   fill		- Percentage of each node to fill (50-100). Full
+ *						  nodes are split by the next insertion.
+ *
+ * Returns	 : The build descriptor, or NULL if the build could not be
+ *			   started. db_status is then set to
+ *
+ *			   S_INVPARM- The index is not empty.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- The root could not be written.
+ *
+ */
+
+BTBUILD *btree_buildopen(I, fill)
+INDEX *I;
+int fill;
+{
+	BTBUILD *B;
+	int i;
+
+	btree_getheader(I);
+
+	if( I->H.keys )
+	{
+		db_status = S_INVPARM;
+		return NULL;
+	}
+
+	if( !(B = (BTBUILD *)calloc(1, sizeof *B)) )
+	{
+		db_status = S_NOMEM;
+		return NULL;
+	}
+
+	/* A node may get one tuple more than <fill> before it is written */
+	B->I	= I;
+	B->fill	= (int)((long)I->H.order * fill / 100);
+	if( B->fill > I->H.order - 1 )
+		B->fill = I->H.order - 1;
+	if( B->fill < I->H.order / 2 )
+		B->fill = I->H.order / 2;
+
+	for( i=0; i<BTREE_DEPTH_MAX; i++ )
+		if( !(B->node[i] = (char *)calloc(1, I->H.nodesize + I->tsize)) )
+		{
+			while( i-- )
+				free(B->node[i]);
+			free(B);
+			db_status = S_NOMEM;
+			return NULL;
+		}
+
+	if( nodewrite(I, B->node[0], ROOT) == (ix_addr)-1 )
+	{
+		btree_buildclose(B);
+		db_status = S_IOFATAL;
+		return NULL;
+	}
+
+	return B;
+}
+
+
+/*-------------------------------- buildtuple ------------------------------*\
+ *
+ * Purpose	 : Appends a tuple to the rightmost node of a level.
+ *
+ * Parameters: B		- Build descriptor.
+ *			   level	- Level. 0 = leaves.
+ *			   key		- Key value.
+ *			   ref		- Reference.
+ *			   child	- The child to the left of the key.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_INVPARM- The tree would be too deep.
+ *			   S_IOFATAL- A node could not be written.
+ *
+ */
+
+static int buildtuple(B, level, key, ref, child)
+BTBUILD *B;
+int level;
+void *key;
+ulong ref;
+ix_addr child;
+{
+	INDEX *I = B->I;
+	char *N;
+	ix_addr addr;
+	int rc;
+
+	if( level == BTREE_DEPTH_MAX )
+		RETURN S_INVPARM;
+
+	if( level == B->levels )
+	{
+		NSIZE(B->node[level]) = 0;
+		B->levels++;
+	}
+
+	N = B->node[level];
+
+	if( NSIZE(N) > B->fill )
+	{
+		/* Write the node without its last tuple, whose child becomes the
+		 * rightmost child of the node. The last tuple separates the node
+		 * from the next one on the parent level.
+		 */
+		NSIZE(N) = B->fill;
+		if( (addr = nodewrite(I, N, NEWPOS)) == (ix_addr)-1 )
+			RETURN S_IOFATAL;
+
+		if( (rc = buildtuple(B, level+1, KEY(N, B->fill), (ulong)REF(N, B->fill),
+							 addr)) != S_OKAY )
+			return rc;
+
+		NSIZE(N) = 0;
+	}
+
+	CHILD(N, NSIZE(N)) = child;
+	memcpy(KEY(N, NSIZE(N)), key, I->H.keysize);
+	REF(N, NSIZE(N)) = ref;
+	NSIZE(N)++;
+
+	return S_OKAY;
+}
+
+
+/*------------------------------ btree_buildadd ----------------------------*\
+ *
+ * Purpose	 : Adds a key to an index being built. The keys must be added
+ *			   in the order given by the comparison function of the index.
+ *
+ * Parameters: B		- Build descriptor.
+ *			   key		- Key value.
+ *			   ref		- Reference.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_INVPARM- The tree would be too deep.
+ *			   S_IOFATAL- A node could not be written.
+ *
+ */
+
+int btree_buildadd(B, key, ref)
+BTBUILD *B;
+void *key;
+ulong ref;
+{
+	int rc;
+
+	if( (rc = buildtuple(B, 0, key, ref, 0)) == S_OKAY )
+		B->keys++;
+
+	return rc;
+}
+
+
+/*----------------------------- btree_buildclose ---------------------------*\
+ *
+ * Purpose	 : Writes the rightmost node of each level, the top node being
+ *			   the root, and frees the build descriptor.
+ *
+ * Parameters: B		- Build descriptor.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- A node could not be written.
+ *
+ */
+
+int btree_buildclose(B)
+BTBUILD *B;
+{
+	INDEX *I = B->I;
+	ix_addr child = 0;
+	int level, rc = S_OKAY;
+
+	for( level=0; level<B->levels; level++ )
+	{
+		char *N = B->node[level];
+
+		CHILD(N, NSIZE(N)) = child;
+		child = nodewrite(I, N, level == B->levels-1 ? ROOT : NEWPOS);
+
+		if( child == (ix_addr)-1 )
+			rc = S_IOFATAL;
+	}
+
+	I->H.keys = B->keys;
+	I->H.timestamp++;
+	I->curr = 0;
+	I->hold = 0;
+	btree_putheader(I);
+
+	for( level=0; level<BTREE_DEPTH_MAX; level++ )
+		free(B->node[level]);
+	free(B);
+
+	if( rc != S_OKAY )
+		RETURN rc;
+
+	return S_OKAY;
+}
+
+
+/*--------------------------------- copynode -------------------------------*\
+ *
+ * Purpose	 : Adds the keys of a subtree to an index being built, in key
+ *			   order.
+ *
+ * Parameters: B		- Build descriptor.
+ *			   I		- Index file the subtree belongs to.
+ *			   node		- Node buffer of each level.
+ *			   level	- Level of the subtree root. 0 = the root.
+ *			   page		- Page of the subtree root.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_INVPARM- The tree is too deep.
+ *			   S_IOFATAL- A node could not be read or written.
+ *
+ */
+
+static int copynode(B, I, node, level, page)
+BTBUILD *B;
+INDEX *I;
+char **node;
+int level;
+ix_addr page;
+{
+	char *N = node[level];
+	int i, rc;
+
+	if( level == BTREE_DEPTH_MAX )
+		RETURN S_INVPARM;
+
+	/* An empty index has no root */
+	if( noderead(I, N, page) == (ix_addr)-1 )
+	{
+		if( page != ROOT )
+			RETURN S_IOFATAL;
+		NSIZE(N) = 0;
+		CHILD(N, 0) = 0;
+	}
+
+	if( NSIZE(N) < 0 || NSIZE(N) > I->H.order )
+		RETURN S_IOFATAL;
+
+	/* The deeper levels use their own buffers, so N is left intact */
+	for( i=0; i<=NSIZE(N); i++ )
+	{
+		if( CHILD(N, i) )
+			if( (rc = copynode(B, I, node, level+1, CHILD(N, i))) != S_OKAY )
+				return rc;
+
+		if( i < NSIZE(N) )
+			if( (rc = btree_buildadd(B, KEY(N, i), (ulong)REF(N, i))) != S_OKAY )
+				return rc;
+	}
+
+	return S_OKAY;
+}
+
+
+/*-------------------------------- btree_copy ------------------------------*\
+ *
+ * Purpose	 : Copies the keys of an index into an empty index with the
+ *			   same key size and node size. The tree is walked in key order
+ *			   and the copy is built bottom-up, so the copy has no deleted
+ *			   nodes and its nodes are filled as given by <fill>. The
+ *			   timestamp of the copy is set to a newer one than that of the
+ *			   original.
+ *
+ * Parameters: I		- Index file to copy.
+ *			   to		- Empty index file to build.
+ *			   fill		- Percentage of each node to fill (50-100).
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_INVPARM- <to> is not empty, or <I> is too deep.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- A node could not be read or written.
+ *
+ */
+
+int btree_copy(I, to, fill)
+INDEX *I, *to;
+int fill;
+{
+	BTBUILD *B;
+	char *node[BTREE_DEPTH_MAX];
+	int i, rc;
+
+	if( I->H.keysize != to->H.keysize || I->H.nodesize != to->H.nodesize )
+		RETURN S_INVPARM;
+
+	for( i=0; i<BTREE_DEPTH_MAX; i++ )
+		if( !(node[i] = (char *)malloc(I->H.nodesize)) )
+		{
+			while( i-- )
+				free(node[i]);
+			RETURN S_NOMEM;
+		}
+
+	btree_getheader(I);
+
+	if( !(B = btree_buildopen(to, fill)) )
+		rc = db_status;
+	else
+	{
+		to->H.timestamp = I->H.timestamp;
+
+		rc = copynode(B, I, node, 0, ROOT);
+
+		if( btree_buildclose(B) != S_OKAY && rc == S_OKAY )
+			rc = db_status;
+	}
+
+	for( i=0; i<BTREE_DEPTH_MAX; i++ )
+		free(node[i]);
+
+	if( rc != S_OKAY )
+		RETURN rc;
+
+	RETURN S_OKAY;
+}
+
+/* end-of-file */
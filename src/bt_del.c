@@ -99,7 +99,8 @@ static void replace_with_leftmost_tuple
 
 /*----------------------------- delchain_insert ----------------------------*\
  *
- * Purpose	 : Inserts a deleted B-tree node in the delete chain.
+ * Purpose	 : Inserts a deleted B-tree node in the delete chain. Nodes of
+ *			   compressed index files are freed instead.
  *
  * Parameters: I		- B-tree index file descriptor.
  *			   addr		- Address of node to insert in delete chain.
@@ -112,6 +113,11 @@ static void delchain_insert(I, addr)
 INDEX *I;
 ix_addr addr;
 {
+	nodefree(I, addr);
+
+	if( I->map )
+		return;
+
 	lseek(I->fh, (off_t) ((ulong)I->H.nodesize * (ulong)addr), SEEK_SET);
 	write(I->fh, &I->H.first_deleted, sizeof I->H.first_deleted);
 	I->H.first_deleted = addr;
@@ -146,6 +152,8 @@ int		zi, *i;
 char	*znode;
 char	*ynode;
 {
+	STAT_COUNT(I->stats, merges, 1);
+
 	if( rsib )
 	{
 		/* copy parent key */
@@ -481,9 +489,8 @@ ulong ref;
 		}
 	}
 
-	I->H.keys--;
-
 out:
+	I->H.keys--;
 
 	if( !NSIZE(I->node) )                  /* if index is empty, truncate	*/
 	{
@@ -498,6 +505,9 @@ out:
 		ftruncate(I->fh, I->H.nodesize);
 #endif
 #endif
+		if( I->map )
+			nodemap_reset(I);
+		nodecache_reset(I);
 	}
 	else
 		nodewrite(I, I->node, p);  			/* else update node p			*/
@@ -136,6 +136,7 @@ ulong ref;
  
         /* split node */
         mid = I->H.order / 2;
+		STAT_COUNT(I->stats, splits, 1);
  
         /* write left part of node at its old position */
         NSIZE(I->node) = mid;
@@ -259,6 +260,9 @@ INDEX *I;
 #else
 	chsize(I->fh, I->H.nodesize);
 #endif
+	if( I->map )
+		nodemap_reset(I);
+	nodecache_reset(I);
 	I->curr = 0;
     I->hold = 0;
 	btree_putheader(I);
@@ -26,9 +26,27 @@
  * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
  *
  * Description:
- *   Contains functions for opening and closing B-tree index files.
+ *   Contains functions for reading and writing B-tree nodes.
+ *
+ *   Nodes of compressed index files are stored in slots of variable size
+ *   (see btree.h). The page map tells where the slot of each page is. It is
+ *   kept in memory while the file is open and saved after the last slot when
+ *   the file is closed. If the file was not closed properly the map is
+ *   rebuilt by walking the slots.
+ *
+ *   The last few nodes read or written are kept (uncompressed) in a small
+ *   direct mapped cache, unless the file is opened in shared mode where
+ *   other processes may change the nodes. Compressed files can only be
+ *   opened in exclusive mode, so they always have a cache.
  *
  * Functions:
+ *   noderead		- Read a node.
+ *   nodewrite		- Write a node.
+ *   nodefree		- Free a node.
+ *   nodecache_reset- Empty the node cache.
+ *   nodemap_open	- Load or rebuild the page map of a compressed index.
+ *   nodemap_close	- Save and free the page map of a compressed index.
+ *   nodemap_reset	- Empty the page map of a compressed index.
  *
  *--------------------------------------------------------------------------*/
 
@@ -37,34 +55,623 @@
 #include "environ.h"
 #ifndef CONFIG_UNIX
 #	include <io.h>
+#	include <stdlib.h>
 #else
 #	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
 #endif
 #include <sys/types.h>
 #include "typhoon.h"
 #include "ty_dbd.h"
 #include "ty_type.h"
+#include "ty_prot.h"
 #include "btree.h"
 
 static CONFIG_CONST char rcsid[] = "$Id: bt_io.c,v 1.5 1999/10/03 23:28:28 kaz Exp $";
 
+/*--------------------------------- Macros ---------------------------------*/
+#define UNITS(n)		(((ulong)(n) + SLOT_UNIT - 1) / SLOT_UNIT)
+#define UNITPOS(I,u)	((long)(I)->H.nodesize + (long)(u) * SLOT_UNIT)
+#define SLACK(u)		((u) / 4 + 1)
+#define CACHED(I,p)		((I)->cached[(p) % NODECACHE_SIZE])
+#define CACHENODE(I,p)	((I)->cache + ((p) % NODECACHE_SIZE) * (I)->H.nodesize)
+
+/*--------------------------- Function prototypes --------------------------*/
+static int		map_grow	PRM( (NODEMAP *, ulong); 					)
+static int		map_load	PRM( (INDEX *);								)
+static int		map_scan	PRM( (INDEX *);								)
+static void		map_zero	PRM( (INDEX *, ulong, ulong);				)
+static int		run_push	PRM( (NODEMAP *, ulong, int);				)
+static void		run_free	PRM( (INDEX *, ulong, int);					)
+static ulong	run_alloc	PRM( (INDEX *, int);						)
+static ix_addr	zread		PRM( (INDEX *, char *, ix_addr);			)
+static ix_addr	zwrite		PRM( (INDEX *, char *, ix_addr);			)
+static ix_addr	filewrite	PRM( (INDEX *, char *, ix_addr);			)
+
+
+/*-------------------------------- map_grow --------------------------------*\
+ *
+ * Purpose	 : Ensures that the page map has room for at least <pages> pages.
+ *
+ * Parameters: M		- Page map.
+ *			   pages	- Number of pages.
+ *
+ * Returns	 : 0		- Ok.
+ *			   -1		- Out of memory.
+ *
+ */
+
+static int map_grow(M, pages)
+NODEMAP *M;
+ulong pages;
+{
+	ulong alloc = M->alloc ? M->alloc : 64;
+	ulong *pos;
+	ushort *units;
+
+	if( pages <= M->alloc )
+		return 0;
+
+	while( alloc < pages )
+		alloc *= 2;
+
+	if( !(pos = (ulong *)realloc(M->pos, alloc * sizeof *pos)) )
+		return -1;
+	M->pos = pos;
+
+	if( !(units = (ushort *)realloc(M->units, alloc * sizeof *units)) )
+		return -1;
+	M->units = units;
+
+	memset(pos + M->alloc, 0, (alloc - M->alloc) * sizeof *pos);
+	memset(units + M->alloc, 0, (alloc - M->alloc) * sizeof *units);
+	M->alloc = alloc;
+
+	return 0;
+}
+
+
+/*-------------------------------- run_push --------------------------------*\
+ *
+ * Purpose	 : Adds a free slot to the free slots of its size.
+ *
+ * Parameters: M		- Page map.
+ *			   pos		- First unit of slot.
+ *			   units	- Size of slot in units.
+ *
+ * Returns	 : 0		- Ok.
+ *			   -1		- Out of memory. The slot is lost.
+ *
+ */
+
+static int run_push(M, pos, units)
+NODEMAP *M;
+ulong pos;
+int units;
+{
+	FREERUNS *F = M->free + units;
+	ulong *p;
+
+	if( F->n == F->max )
+	{
+		if( !(p = (ulong *)realloc(F->pos, (F->max + 16) * 2 * sizeof *p)) )
+			return -1;
+		F->pos = p;
+		F->max = (F->max + 16) * 2;
+	}
+
+	F->pos[F->n++] = pos;
+
+	return 0;
+}
+
+
+/*-------------------------------- run_free --------------------------------*\
+ *
+ * Purpose	 : Frees a slot. A free slot header is written in the slot, so
+ *			   that map_scan() can skip it.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   pos		- First unit of slot.
+ *			   units	- Size of slot in units.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void run_free(I, pos, units)
+INDEX *I;
+ulong pos;
+int units;
+{
+	SLOTHEAD head;
+
+	memset(&head, 0, sizeof head);
+	head.units = units;
+
+	lseek(I->fh, UNITPOS(I, pos), SEEK_SET);
+	write(I->fh, &head, sizeof head);
+
+	run_push(I->map, pos, units);
+}
+
+
+/*-------------------------------- run_alloc -------------------------------*\
+ *
+ * Purpose	 : Allocates a slot of <units> units. The smallest free slot that
+ *			   is big enough is used and the rest of it is freed. If there is
+ *			   no such slot, the slot is allocated at the end of the file.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   units	- Size of slot in units.
+ *
+ * Returns	 : The first unit of the slot.
+ *
+ */
+
+static ulong run_alloc(I, units)
+INDEX *I;
+int units;
+{
+	NODEMAP *M = I->map;
+	ulong pos;
+	int u;
+
+	for( u=units; u<=M->maxunits; u++ )
+	{
+		if( M->free[u].n )
+		{
+			pos = M->free[u].pos[--M->free[u].n];
+
+			if( u > units )
+				run_free(I, pos + units, u - units);
+
+			return pos;
+		}
+	}
+
+	pos = M->endunit;
+	M->endunit += units;
+
+	return pos;
+}
+
+
+/*-------------------------------- map_zero --------------------------------*\
+ *
+ * Purpose	 : Zeroes a range of units. The units after the last slot must be
+ *			   zero or beyond the end of the file, otherwise map_scan() would
+ *			   take them for slots.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   pos		- First unit.
+ *			   units	- Number of units.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void map_zero(I, pos, units)
+INDEX *I;
+ulong pos, units;
+{
+	NODEMAP *M = I->map;
+	ulong n;
+
+	memset(M->zbuf, 0, M->maxunits * SLOT_UNIT);
+	lseek(I->fh, UNITPOS(I, pos), SEEK_SET);
+
+	while( units )
+	{
+		n = units < (ulong)M->maxunits ? units : M->maxunits;
+		write(I->fh, M->zbuf, (unsigned)n * SLOT_UNIT);
+		units -= n;
+	}
+}
+
+
+/*-------------------------------- map_load --------------------------------*\
+ *
+ * Purpose	 : Loads the page map saved by nodemap_close(). The map consists
+ *			   of the slot positions and sizes of all pages followed by the
+ *			   free slots of each size, preceded by their number.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *
+ * Returns	 : 0		- Ok.
+ *			   -1		- The map could not be read.
+ *
+ */
+
+static int map_load(I)
+INDEX *I;
+{
+	NODEMAP *M = I->map;
+	ulong pages = I->H.mappages;
+	ulong n, total, *p;
+	unsigned size;
+	int u;
+
+	if( map_grow(M, pages) == -1 )
+		return -1;
+
+	lseek(I->fh, UNITPOS(I, I->H.maptab - 1), SEEK_SET);
+
+	size = (unsigned)(pages * sizeof *M->pos);
+	if( read(I->fh, M->pos, size) != size )
+		return -1;
+	size = (unsigned)(pages * sizeof *M->units);
+	if( read(I->fh, M->units, size) != size )
+		return -1;
+	total = pages * (sizeof *M->pos + sizeof *M->units);
+
+	for( u=1; u<=M->maxunits; u++ )
+	{
+		if( read(I->fh, &n, sizeof n) != sizeof n )
+			return -1;
+		total += sizeof n;
+
+		if( n > M->free[u].max )
+		{
+			if( !(p = (ulong *)realloc(M->free[u].pos, n * sizeof *p)) )
+				return -1;
+			M->free[u].pos = p;
+			M->free[u].max = n;
+		}
+
+		size = (unsigned)(n * sizeof(ulong));
+		if( read(I->fh, M->free[u].pos, size) != size )
+			return -1;
+		M->free[u].n = n;
+		total += size;
+	}
+
+	M->pages	= pages;
+	M->endunit	= I->H.maptab - 1;
+	M->gen		= I->H.mapgen;
+
+	/* The map is rewritten when the file is closed */
+	map_zero(I, M->endunit, UNITS(total));
+
+	return 0;
+}
+
+
+/*-------------------------------- map_scan --------------------------------*\
+ *
+ * Purpose	 : Rebuilds the page map by walking the slots of the file. If a
+ *			   page is found in more than one slot, the slot with the highest
+ *			   generation is used and the others are freed.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *
+ * Returns	 : 0		- Ok.
+ *			   -1		- Out of memory.
+ *
+ */
+
+static int map_scan(I)
+INDEX *I;
+{
+	NODEMAP *M = I->map;
+	SLOTHEAD head;
+	ulong *gens = NULL, *p;
+	ulong pos, total, alloc = 0;
+	long size;
+
+	size  = lseek(I->fh, 0L, SEEK_END) - I->H.nodesize;
+	total = size > 0 ? UNITS(size) : 0;
+
+	for( pos=0; pos<total; pos += head.units )
+	{
+		lseek(I->fh, UNITPOS(I, pos), SEEK_SET);
+		if( read(I->fh, &head, sizeof head) != sizeof head
+		||  !head.units || head.units > M->maxunits
+		||  head.len + sizeof head > (ulong)head.units * SLOT_UNIT
+		||  pos + UNITS(sizeof head + head.len) > total
+		||  head.method > SLOT_LZ || head.page > total )
+			break;
+
+		if( head.gen > M->gen )
+			M->gen = head.gen;
+
+		if( !head.page )
+		{
+			run_push(M, pos, head.units);
+			continue;
+		}
+
+		if( map_grow(M, head.page + 1) == -1 )
+			goto nomem;
+		if( alloc < M->alloc )
+		{
+			if( !(p = (ulong *)realloc(gens, M->alloc * sizeof *gens)) )
+				goto nomem;
+			gens = p;
+			memset(gens + alloc, 0, (M->alloc - alloc) * sizeof *gens);
+			alloc = M->alloc;
+		}
+
+		if( M->pos[head.page] && gens[head.page] > head.gen )
+		{
+			run_free(I, pos, head.units);
+			continue;
+		}
+
+		if( M->pos[head.page] )
+			run_free(I, M->pos[head.page] - 1, M->units[head.page]);
+
+		M->pos[head.page]	= pos + 1;
+		M->units[head.page]	= head.units;
+		gens[head.page]		= head.gen;
+
+		if( head.page >= M->pages )
+			M->pages = head.page + 1;
+	}
+
+	/* Anything after the last slot is garbage from an interrupted write.
+	 * The last slot itself may extend beyond the end of the file.
+	 */
+	M->endunit = pos;
+	if( pos < total )
+		map_zero(I, pos, total - pos);
+
+	FREE(gens);
+	return 0;
+
+nomem:
+	FREE(gens);
+	return -1;
+}
+
+
+/*--------------------------------- zread ----------------------------------*\
+ *
+ * Purpose	 : Reads a node of a compressed index file.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   node		- Buffer to read node into (nodesize bytes).
+ *			   page		- Page number.
+ *
+ * Returns	 : The page number, or -1 if the page does not exist.
+ *
+ */
+
+static ix_addr zread(I, node, page)
+INDEX   *I;
+char    *node;
+ix_addr  page;
+{
+	NODEMAP *M = I->map;
+	SLOTHEAD *head = (SLOTHEAD *)M->zbuf;
+	unsigned size;
+	long len;
+
+	if( !page || page >= M->pages || !M->pos[page] )
+		return (ix_addr)-1;
+
+	size = M->units[page] * SLOT_UNIT;
+	lseek(I->fh, UNITPOS(I, M->pos[page] - 1), SEEK_SET);
+	if( read(I->fh, M->zbuf, size) < (int)sizeof *head
+	||  head->page != page || head->len + sizeof *head > size )
+		return (ix_addr)-1;
+
+	if( head->method == SLOT_LZ )
+	{
+		if( (len = lz_uncompress(head + 1, head->len, node, I->H.nodesize)) == -1 )
+			return (ix_addr)-1;
+	}
+	else
+	{
+		len = head->len;
+		memcpy(node, head + 1, head->len);
+	}
+	memset(node + len, 0, I->H.nodesize - len);
+
+	return page;
+}
+
+
+/*--------------------------------- zwrite ---------------------------------*\
+ *
+ * Purpose	 : Writes a node of a compressed index file. Only the used part
+ *			   of the node is stored. If the node still fits in its slot it
+ *			   is written in place, otherwise it is moved to another slot.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   node		- Node to write.
+ *			   page		- Page number. NEWPOS = allocate a new page.
+ *
+ * Returns	 : The page number.
+ *
+ */
+
+static ix_addr zwrite(I, node, page)
+INDEX   *I;
+char    *node;
+ix_addr  page;
+{
+	NODEMAP *M = I->map;
+	SLOTHEAD *head = (SLOTHEAD *)M->zbuf;
+	unsigned size;
+	ulong pos, oldpos;
+	int units, oldunits = 0;
+
+	if( page == NEWPOS )
+	{
+		/* Page 0 holds the header and page 1 is the root */
+		for( page = M->freepage < 2 ? 2 : M->freepage;
+			 page < M->pages && M->pos[page]; page++ )
+			;
+		M->freepage = page + 1;
+	}
+
+	if( page >= M->pages )
+	{
+		if( map_grow(M, page + 1) == -1 )
+			return (ix_addr)-1;
+		M->pages = page + 1;
+	}
+
+	size = sizeof(N_type) + sizeof(A_type) + I->tsize * NSIZE(node);
+	if( size > I->H.nodesize )
+		size = I->H.nodesize;
+
+	if( (head->len = lz_compress(node, size, head + 1, size)) != 0 )
+		head->method = SLOT_LZ;
+	else
+	{
+		head->len	 = size;
+		head->method = SLOT_STORED;
+		memcpy(head + 1, node, size);
+	}
+
+	units		= (int)UNITS(sizeof *head + head->len);
+	head->page	= page;
+	head->gen	= ++M->gen;
+
+	if( M->pos[page] && M->units[page] >= units
+	&&  M->units[page] <= units + SLACK(units) )
+	{
+		/* The node still fits in its slot */
+		pos		 = M->pos[page] - 1;
+		units	 = M->units[page];
+		oldpos	 = 0;
+	}
+	else
+	{
+		/* Leave room for the node to grow. The old slot is freed when the
+		 * node has been written to the new one.
+		 */
+		units	+= SLACK(units);
+		if( units > M->maxunits )
+			units = M->maxunits;
+		pos		 = run_alloc(I, units);
+		oldpos	 = M->pos[page];
+		oldunits = M->units[page];
+	}
+
+	head->units = units;
+	lseek(I->fh, UNITPOS(I, pos), SEEK_SET);
+	write(I->fh, head, sizeof *head + head->len);
+
+	if( oldpos )
+		run_free(I, oldpos - 1, oldunits);
+
+	M->pos[page]	= pos + 1;
+	M->units[page]	= units;
+
+	return page;
+}
+
+
+/*-------------------------------- noderead --------------------------------*\
+ *
+ * Purpose	 : Reads a node.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   node		- Buffer to read node into (nodesize bytes).
+ *			   page		- Page number.
+ *
+ * Returns	 : The page number, or -1 if the node could not be read.
+ *
+ */
+
 ix_addr noderead(I, node, page)
 INDEX   *I;
 char    *node;
 ix_addr  page;
 {
-    lseek(I->fh, (long)page * I->H.nodesize, SEEK_SET);
-    if( read(I->fh, node, I->H.nodesize) < I->H.nodesize )
-        return (ix_addr)-1;
+	ulong start;
+
+	if( I->cache && page && CACHED(I, page) == page )
+	{
+		memcpy(node, CACHENODE(I, page), I->H.nodesize);
+		I->cache_hits++;
+		STAT_COUNT(I->stats, cache_hits, 1);
+		return page;
+	}
+
+	start = stats_clock(I->stats);
+
+	if( I->map )
+	{
+		if( zread(I, node, page) == (ix_addr)-1 )
+			return (ix_addr)-1;
+	}
+	else
+	{
+	    lseek(I->fh, (long)page * I->H.nodesize, SEEK_SET);
+	    if( read(I->fh, node, I->H.nodesize) < I->H.nodesize )
+	        return (ix_addr)-1;
+	}
+
+	stats_io(I->stats, STAT_READ, start, 1);
+
+	if( I->cache && page )
+	{
+		memcpy(CACHENODE(I, page), node, I->H.nodesize);
+		CACHED(I, page) = page;
+	}
  
     return page;
 }
 
 
+/*-------------------------------- nodewrite -------------------------------*\
+ *
+ * Purpose	 : Writes a node.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   node		- Node to write.
+ *			   page		- Page number. NEWPOS = allocate a new page.
+ *
+ * Returns	 : The page number.
+ *
+ */
+
 ix_addr nodewrite(I, node, page)
 INDEX   *I;
 char    *node;
 ix_addr  page;
+{
+	ulong start = stats_clock(I->stats);
+
+	if( I->map )
+		page = zwrite(I, node, page);
+	else
+		page = filewrite(I, node, page);
+
+	stats_io(I->stats, STAT_WRITE, start, 1);
+
+	if( I->cache && page != (ix_addr)-1 )
+	{
+		memcpy(CACHENODE(I, page), node, I->H.nodesize);
+		CACHED(I, page) = page;
+	}
+
+	return page;
+}
+
+
+/*-------------------------------- filewrite -------------------------------*\
+ *
+ * Purpose	 : Writes a node of an index file that is not compressed.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   node		- Node to write.
+ *			   page		- Page number. NEWPOS = allocate a new page.
+ *
+ * Returns	 : The page number.
+ *
+ */
+
+static ix_addr filewrite(I, node, page)
+INDEX   *I;
+char    *node;
+ix_addr  page;
 {
     if( page == NEWPOS )
     {
@@ -83,5 +690,187 @@ ix_addr  page;
 
     return page;
 }
- 
-/* end-of-file */					
+
+
+/*-------------------------------- nodefree --------------------------------*\
+ *
+ * Purpose	 : Frees a node. The node is removed from the cache and, in a
+ *			   compressed index file, its slot is freed. Nodes of other index
+ *			   files are put in the delete chain by the caller.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   page		- Page number.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void nodefree(I, page)
+INDEX *I;
+ix_addr page;
+{
+	NODEMAP *M = I->map;
+
+	if( I->cache && CACHED(I, page) == page )
+		CACHED(I, page) = 0;
+
+	if( !M || page >= M->pages || !M->pos[page] )
+		return;
+
+	run_free(I, M->pos[page] - 1, M->units[page]);
+	M->pos[page]	= 0;
+	M->units[page]	= 0;
+
+	if( page < M->freepage )
+		M->freepage = page;
+}
+
+
+/*----------------------------- nodecache_reset ----------------------------*\
+ *
+ * Purpose	 : Empties the node cache. Must be called when all nodes have
+ *			   been removed from the file.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void nodecache_reset(I)
+INDEX *I;
+{
+	memset(I->cached, 0, sizeof I->cached);
+}
+
+
+/*------------------------------ nodemap_open ------------------------------*\
+ *
+ * Purpose	 : Allocates the page map of a compressed index file and loads
+ *			   it from the file. If the file was not closed properly the map
+ *			   is rebuilt. The map in the file is marked as invalid until
+ *			   the file is closed.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *
+ */
+
+int nodemap_open(I)
+INDEX *I;
+{
+	NODEMAP *M;
+
+	if( !(M = (NODEMAP *)calloc(1, sizeof *M)) )
+		RETURN S_NOMEM;
+
+	I->map		= M;
+	M->maxunits	= (int)UNITS(sizeof(SLOTHEAD) + I->H.nodesize);
+
+	if( !(M->free = (FREERUNS *)calloc(M->maxunits + 1, sizeof *M->free))
+	||  !(M->zbuf = (char *)malloc(M->maxunits * SLOT_UNIT)) )
+		goto nomem;
+
+	if( !I->H.maptab || map_load(I) == -1 )
+	{
+		nodemap_reset(I);
+		if( map_scan(I) == -1 )
+			goto nomem;
+	}
+
+	I->H.maptab = 0;
+	btree_putheader(I);
+
+	RETURN S_OKAY;
+
+nomem:
+	nodemap_close(I);
+	RETURN S_NOMEM;
+}
+
+
+/*------------------------------ nodemap_close -----------------------------*\
+ *
+ * Purpose	 : Saves the page map of a compressed index file after the last
+ *			   slot and frees it. The map is not saved if the file is not
+ *			   open.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void nodemap_close(I)
+INDEX *I;
+{
+	NODEMAP *M = I->map;
+	int u;
+
+	if( M->free && M->zbuf && I->fh != -1 )
+	{
+		lseek(I->fh, UNITPOS(I, M->endunit), SEEK_SET);
+		write(I->fh, M->pos, (unsigned)(M->pages * sizeof *M->pos));
+		write(I->fh, M->units, (unsigned)(M->pages * sizeof *M->units));
+
+		for( u=1; u<=M->maxunits; u++ )
+		{
+			write(I->fh, &M->free[u].n, sizeof M->free[u].n);
+			write(I->fh, M->free[u].pos, (unsigned)(M->free[u].n * sizeof(ulong)));
+		}
+
+		I->H.maptab		= M->endunit + 1;
+		I->H.mappages	= M->pages;
+		I->H.mapgen		= M->gen;
+		btree_putheader(I);
+	}
+
+	if( M->free )
+	{
+		for( u=0; u<=M->maxunits; u++ )
+			FREE(M->free[u].pos);
+		free(M->free);
+	}
+
+	FREE(M->pos);
+	FREE(M->units);
+	FREE(M->zbuf);
+	free(M);
+	I->map = NULL;
+}
+
+
+/*------------------------------ nodemap_reset -----------------------------*\
+ *
+ * Purpose	 : Empties the page map of a compressed index file. Must be
+ *			   called when all nodes have been removed from the file.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void nodemap_reset(I)
+INDEX *I;
+{
+	NODEMAP *M = I->map;
+	int u;
+
+	if( M->alloc )
+	{
+		memset(M->pos, 0, M->alloc * sizeof *M->pos);
+		memset(M->units, 0, M->alloc * sizeof *M->units);
+	}
+
+	for( u=0; u<=M->maxunits; u++ )
+		M->free[u].n = 0;
+
+	M->pages	= 0;
+	M->freepage	= 0;
+	M->endunit	= 0;
+}
+
+/* end-of-file */
@@ -66,7 +66,9 @@ int find_firstoccurrence  PRM( (INDEX *, void *, ix_addr *, int *); )
 
 /*----------------------------- btree_getheader ----------------------------*\
  *
- * Purpose	 : Reads the header of a B-tree index file.
+ * Purpose	 : Reads the header of a B-tree index file. Once a file that
+ *			   is not shared has been opened (and has a node cache) the
+ *			   header in memory is always up to date, so it is not read.
  *
  * Parameters: I		- Pointer to index file descriptor.
  *
@@ -77,6 +79,9 @@ int find_firstoccurrence  PRM( (INDEX *, void *, ix_addr *, int *); )
 void btree_getheader(I)
 INDEX *I;
 {
+	if( I->cache )
+		return;
+
     lseek(I->fh, 0L, SEEK_SET);
     read(I->fh, &I->H, sizeof I->H);
 }
@@ -106,6 +111,8 @@ INDEX *I;
  *			   does not already exist, the file is created. If the version of
  *			   the existing file does not match the version of the B-tree
  *			   library db_status is set to S_VERSION, and NULL is returned.
+ *			   New files are compressed if d_keycompress() has been called,
+ *			   unless they are opened in shared mode.
  *
  * Parameters: fname		- File name.
  *			   keysize		- Key size.
@@ -122,7 +129,8 @@ INDEX *I;
  * 			   S_NOMEM		- Out of memory.
  * 			   S_IOFATAL	- File could not be opened.
  * 			   S_VERSION	- B-tree file on disk has wrong version.
- *			   S_UNAVAIL	- The file is already opened in non-shared mode.
+ *			   S_NOTAVAIL	- The file is already opened in non-shared mode,
+ *							  or it is compressed and <shared> is true.
  *
  */
 
@@ -189,15 +197,25 @@ CMPFUNC cmpfunc;
         I->H.dups           = dups;
         I->H.nodesize       = nodesize;
         I->H.keys			= 0;
+        I->H.maptab			= 0;
+        I->H.mappages		= 0;
+        I->H.mapgen			= 0;
         strcpy(I->H.id, KEYVERSION_ID);
         memset(I->H.spare, 0, sizeof I->H.spare);
+
+		/* Compressed index files cannot be shared */
+		if( typhoon.key_compress && !shared )
+		{
+			I->H.version = KEYZVERSION_NUM;
+			strcpy(I->H.id, KEYZVERSION_ID);
+		}
         btree_putheader(I);
     }
 	else
 	{
 		btree_getheader(I);
 
-		if( I->H.version != KEYVERSION_NUM )
+		if( I->H.version != KEYVERSION_NUM && I->H.version != KEYZVERSION_NUM )
 		{
 			db_status = S_VERSION;
 			os_close(fh);
@@ -207,6 +225,33 @@ CMPFUNC cmpfunc;
 		}
 	}
 
+	/* Only other processes can make cached nodes out of date */
+	if( !shared && !(I->cache = (char *)malloc(NODECACHE_SIZE * I->H.nodesize)) )
+	{
+		db_status = S_NOMEM;
+		os_close(fh);
+		free(I->curkey);
+		free(I);
+		return NULL;
+	}
+
+	if( I->H.version == KEYZVERSION_NUM )
+	{
+		if( shared )
+			db_status = S_NOTAVAIL;
+		else
+			nodemap_open(I);
+
+		if( db_status != S_OKAY )
+		{
+			os_close(fh);
+			FREE(I->cache);
+			free(I->curkey);
+			free(I);
+			return NULL;
+		}
+	}
+
     I->cmpfunc  	    = cmpfunc;
     I->tsize    	    = tuplesize;
     I->hold				= 0;
@@ -233,9 +278,17 @@ CMPFUNC cmpfunc;
 void btree_close(I)
 INDEX *I;
 {
+	/* The page map is freed even if the file cannot be reopened to save it */
+	if( I->map )
+	{
+		btree_dynopen(I);
+		nodemap_close(I);
+	}
+
 	if( I->fh != -1 )
 	   	os_close(I->fh);
 
+	FREE(I->cache);
 	free(I->curkey);
     free(I);
 }
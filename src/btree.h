@@ -44,10 +44,16 @@
 /*--------------------------------------------------------------------------*/
 #define KEYVERSION_ID	"KeyMan121"		/* Version ID						*/
 #define KEYVERSION_NUM	121				/* Version number					*/
+#define KEYZVERSION_ID	"KeyMan122"		/* Version ID (compressed nodes)	*/
+#define KEYZVERSION_NUM	122				/* Version number (compressed nodes)*/
 
 #define NEWPOS          (ix_addr)-1		/* Indicates new pos for nodewrite	*/
 #define ROOT			1				/* Root is always node 1			*/
 
+#define SLOT_UNIT		64				/* Allocation unit of node slots	*/
+#define SLOT_STORED		0				/* Slot holds the node as is		*/
+#define SLOT_LZ			1				/* Slot holds the compressed node	*/
+
 typedef ix_addr A_type;         /* node address type                        */
 typedef long R_type;            /* record reference type                    */
 #ifdef CONFIG_RISC
@@ -68,6 +74,23 @@ typedef short N_type;
  *
  */
 
+/*
+ * In a compressed index file (version KEYZVERSION_NUM) the first <nodesize>
+ * bytes contain the header. Each node is stored in a slot of one or more
+ * units of SLOT_UNIT bytes following the header. The slot starts with a
+ * SLOTHEAD followed by the used part of the node, compressed if that makes
+ * it smaller. Free slots have page 0, so the page map can be rebuilt by
+ * walking the slots from the first unit.
+ */
+
+typedef struct {
+	ix_addr	page;					/* Page number. 0 = free slot			*/
+	ulong	gen;					/* Generation. The highest one wins		*/
+	ushort	len;					/* Number of data bytes					*/
+	ushort	units;					/* Size of slot in units. 0 = end		*/
+	ushort	method;					/* SLOT_STORED or SLOT_LZ				*/
+} SLOTHEAD;
+
 /*
  * The following macros are used to easily access the elements of a node. The
  * macros KEY, CHILD and REF assume that a variable <I->node> points to the
@@ -113,6 +136,11 @@ int		d_search		PRM( (INDEX *, void *, ix_addr *, int *);		)
 /*--------------------------------- bt_io.c --------------------------------*/
 ix_addr noderead        PRM( (INDEX *, char *, ix_addr);                )
 ix_addr nodewrite       PRM( (INDEX *, char *, ix_addr);                )
+void	nodefree		PRM( (INDEX *, ix_addr);						)
+void	nodecache_reset	PRM( (INDEX *);									)
+int		nodemap_open	PRM( (INDEX *);									)
+void	nodemap_close	PRM( (INDEX *);									)
+void	nodemap_reset	PRM( (INDEX *);									)
 
 #endif
 /* end-of-file */
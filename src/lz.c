@@ -0,0 +1,282 @@
+/*----------------------------------------------------------------------------
+ * File    : lz.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Contains a small LZ77 compressor used for variable length records.
+ *   The compressed data is a sequence of tokens. Each token consists of
+ *
+ *     - a byte with the number of literals in the high nibble and the
+ *       match length minus LZ_MINMATCH in the low nibble. A nibble of 15
+ *       means that the length continues in the following bytes, each of
+ *       which adds up to 255 to the length,
+ *     - the literals,
+ *     - the match offset in two bytes, least significant byte first,
+ *     - the rest of the match length.
+ *
+ *   The last token only contains literals. Decompression is a simple loop
+ *   of copies and all lengths and offsets are checked, so corrupted data
+ *   cannot make it write outside the output buffer.
+ *
+ * Functions:
+ *   lz_compress	- Compress a buffer.
+ *   lz_uncompress	- Uncompress a buffer.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "environ.h"
+#ifdef CONFIG_UNIX
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#endif
+#include <string.h>
+#include <stdio.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_prot.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+/*--------------------------------- Macros ---------------------------------*/
+#define LZ_HASHBITS		12
+#define LZ_MINMATCH		4
+#define LZ_MAXOFFSET	65535L
+#define LZ_HASH(p)		((((ulong)(p)[0] | (ulong)(p)[1] << 8 | (ulong)(p)[2] << 16 | \
+						   (ulong)(p)[3] << 24) * 2654435761UL & 0xffffffffUL) >> \
+						   (32 - LZ_HASHBITS))
+
+/*--------------------------- Function prototypes --------------------------*/
+static uchar *putlen	PRM( (uchar *, uchar *, unsigned); )
+
+/*-------------------------------- Variables -------------------------------*/
+static long hashtab[1 << LZ_HASHBITS];	/* Last position of each hash + 1	*/
+
+
+/*--------------------------------- putlen ---------------------------------*\
+ *
+ * Purpose	 : Writes the part of a length that does not fit in a nibble.
+ *
+ * Parameters: op		- Output pointer.
+ *			   oend		- End of output buffer.
+ *			   len		- Length minus 15.
+ *
+ * Returns	 : The new output pointer, or NULL if the output buffer is full.
+ *
+ */
+
+static uchar *putlen(op, oend, len)
+uchar *op, *oend;
+unsigned len;
+{
+	for( ;; )
+	{
+		if( op == oend )
+			return NULL;
+
+		if( len < 255 )
+		{
+			*op++ = len;
+			return op;
+		}
+
+		*op++ = 255;
+		len -= 255;
+	}
+}
+
+
+/*------------------------------- lz_compress ------------------------------*\
+ *
+ * Purpose	 : Compresses <srclen> bytes from <src> to <dst>.
+ *
+ * Parameters: src		- Data to compress.
+ *			   srclen	- Number of bytes in <src>.
+ *			   dst		- Output buffer.
+ *			   dstsize	- Size of output buffer.
+ *
+ * Returns	 : The size of the compressed data, or 0 if it does not fit in
+ *			   <dst>.
+ *
+ */
+
+unsigned lz_compress(src, srclen, dst, dstsize)
+void *src;
+unsigned srclen;
+void *dst;
+unsigned dstsize;
+{
+	uchar *base   = (uchar *)src;
+	uchar *ip	  = base;
+	uchar *anchor = base;
+	uchar *iend   = base + srclen;
+	uchar *op	  = (uchar *)dst;
+	uchar *oend   = op + dstsize;
+	uchar *ref, *token;
+	unsigned lits, len;
+	ulong h;
+
+	memset(hashtab, 0, sizeof hashtab);
+
+	while( ip + LZ_MINMATCH <= iend )
+	{
+		h	= LZ_HASH(ip);
+		ref = hashtab[h] ? base + hashtab[h] - 1 : NULL;
+		hashtab[h] = ip - base + 1;
+
+		if( !ref || ip - ref > LZ_MAXOFFSET || memcmp(ref, ip, LZ_MINMATCH) )
+		{
+			ip++;
+			continue;
+		}
+
+		for( len = LZ_MINMATCH; ip + len < iend && ref[len] == ip[len]; len++ )
+			;
+
+		/* Write token and literals */
+		lits = ip - anchor;
+		if( op == oend )
+			return 0;
+		token  = op++;
+		*token = (lits < 15 ? lits : 15) << 4;
+		if( lits >= 15 && !(op = putlen(op, oend, lits - 15)) )
+			return 0;
+		if( op + lits + 2 > oend )
+			return 0;
+		memcpy(op, anchor, lits);
+		op += lits;
+
+		/* Write match */
+		*op++ = (ip - ref) & 0xff;
+		*op++ = (ip - ref) >> 8;
+		len  -= LZ_MINMATCH;
+		*token |= len < 15 ? len : 15;
+		if( len >= 15 && !(op = putlen(op, oend, len - 15)) )
+			return 0;
+
+		ip	   += len + LZ_MINMATCH;
+		anchor	= ip;
+	}
+
+	/* The last token only contains literals */
+	lits = iend - anchor;
+	if( op == oend )
+		return 0;
+	token  = op++;
+	*token = (lits < 15 ? lits : 15) << 4;
+	if( lits >= 15 && !(op = putlen(op, oend, lits - 15)) )
+		return 0;
+	if( op + lits > oend )
+		return 0;
+	memcpy(op, anchor, lits);
+	op += lits;
+
+	return op - (uchar *)dst;
+}
+
+
+/*------------------------------ lz_uncompress -----------------------------*\
+ *
+ * Purpose	 : Uncompresses data compressed by lz_compress().
+ *
+ * Parameters: src		- Compressed data.
+ *			   srclen	- Number of bytes in <src>.
+ *			   dst		- Output buffer.
+ *			   dstsize	- Size of output buffer.
+ *
+ * Returns	 : The size of the uncompressed data, or -1 if the compressed
+ *			   data is invalid.
+ *
+ */
+
+long lz_uncompress(src, srclen, dst, dstsize)
+void *src;
+unsigned srclen;
+void *dst;
+unsigned dstsize;
+{
+	uchar *ip	= (uchar *)src;
+	uchar *iend = ip + srclen;
+	uchar *op	= (uchar *)dst;
+	uchar *oend = op + dstsize;
+	uchar *ref;
+	unsigned token, len, offset;
+
+	while( ip < iend )
+	{
+		token = *ip++;
+
+		/* Copy literals */
+		if( (len = token >> 4) == 15 )
+			do
+			{
+				if( ip == iend )
+					return -1;
+				len += *ip;
+			}
+			while( *ip++ == 255 );
+
+		if( len > (unsigned)(iend - ip) || len > (unsigned)(oend - op) )
+			return -1;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		if( ip == iend )
+			break;
+
+		/* Copy match */
+		if( iend - ip < 2 )
+			return -1;
+		offset = ip[0] | (unsigned)ip[1] << 8;
+		ip += 2;
+
+		if( (len = token & 15) == 15 )
+			do
+			{
+				if( ip == iend )
+					return -1;
+				len += *ip;
+			}
+			while( *ip++ == 255 );
+		len += LZ_MINMATCH;
+
+		if( offset == 0 || offset > (unsigned)(op - (uchar *)dst)
+		||  len > (unsigned)(oend - op) )
+			return -1;
+
+		/* The match may overlap the output, so copy byte by byte */
+		for( ref = op - offset; len--; )
+			*op++ = *ref++;
+	}
+
+	return op - (uchar *)dst;
+}
+
+/* end-of-file */
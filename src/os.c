@@ -32,6 +32,8 @@
  * Functions:
  *   os_lock		Get exclusive access to the database.
  *   os_unlock		Release the lock.
+ *   stats_clock	Get the time an operation starts.
+ *   stats_io		Count an operation and its latency.
  *
  *--------------------------------------------------------------------------*/
 
@@ -39,7 +41,10 @@
 #ifdef CONFIG_UNIX
 #  include <sys/types.h>
 #  include <sys/stat.h>
+#  include <sys/time.h>
 #  include <unistd.h>
+#else
+#  include <time.h>
 #endif
 #ifdef _MSC_VER
 #  include <sys/types.h>
@@ -98,10 +103,10 @@ unsigned bytes;
 #ifdef CONFIG_USE_FLOCK
     flk.l_type = F_WRLCK;
     flk.l_whence = SEEK_SET;
-    flk.l_start = 0;
+    flk.l_start = offset;
     flk.l_len = bytes;
 
-    if (fcntl(fh, F_SETLK, &flk) == -1)
+    if (fcntl(fh, type == 'w' ? F_SETLKW : F_SETLK, &flk) == -1)
 		puts("fcntl() F_SETLK failed");
 #else
 	if( lockf(fh, type == 't' ? F_TLOCK : F_LOCK, bytes) == -1 )
@@ -189,4 +194,83 @@ int mode;
 #endif
 }
 
+
+/*------------------------------- stats_clock ------------------------------*\
+ *
+ * Purpose	 : Returns the time an operation starts. The clock is only read
+ *			   if the operation is counted.
+ *
+ * Parameters: stats	- Statistics entry (or NULL).
+ *
+ * Returns	 : Time in microseconds. 0 if <stats> is NULL.
+ *
+ */
+
+ulong stats_clock(stats)
+DB_STATS *stats;
+{
+#ifdef CONFIG_UNIX
+	struct timeval tv;
+
+	if( !stats )
+		return 0;
+
+	gettimeofday(&tv, NULL);
+	return (ulong)tv.tv_sec * 1000000L + tv.tv_usec;
+#else
+	return stats ? (ulong)clock() * (1000000L / CLOCKS_PER_SEC) : 0;
+#endif
+}
+
+
+/*-------------------------------- stats_io --------------------------------*\
+ *
+ * Purpose	 : Counts an operation and adds its latency to the histogram of
+ *			   its kind.
+ *
+ * Parameters: stats	- Statistics entry (or NULL).
+ *			   kind		- STAT_READ, STAT_WRITE or STAT_LOCK.
+ *			   start	- Value returned by stats_clock().
+ *			   n		- Number of nodes, records or blocks.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void stats_io(stats, kind, start, n)
+DB_STATS *stats;
+int kind;
+ulong start, n;
+{
+	ulong elapsed, *hist;
+	int bucket;
+
+	if( !stats )
+		return;
+
+	switch( kind )
+	{
+		case STAT_READ:
+			STAT_ADD(stats->reads, n);
+			hist = stats->read_time;
+			break;
+		case STAT_WRITE:
+			STAT_ADD(stats->writes, n);
+			hist = stats->write_time;
+			break;
+		default:
+			STAT_ADD(stats->locks, n);
+			hist = stats->lock_time;
+			break;
+	}
+
+	elapsed = stats_clock(stats) - start;
+
+	for( bucket=0; bucket < STAT_BUCKETS-1 && elapsed >= (1UL << bucket); bucket++ )
+		;
+
+	STAT_ADD(hist[bucket], 1);
+}
+
+
 /* end-of-file */
@@ -28,6 +28,30 @@
  * Description:
  *   Contains record file functions.
  *
+ *   A record file is organized in one of two ways. In the original
+ *   organization (version 120) the records are kept in a doubly linked
+ *   chain and deleted records in a delete chain. In the bitmap organization
+ *   (version 121) there are no chains. Instead a bitmap with one bit per
+ *   slot tells which slots are in use. The bitmap is kept in memory and
+ *   saved in the file <fname>.fsm. Scans simply skip the free slots, so
+ *   records are returned in physical order. In a bitmap file the header
+ *   fields <first_deleted> and <last> contain the generation number of the
+ *   bitmap and the number of slots in the file, respectively.
+ *
+ *   In non-shared mode the bitmap file is only written when the record
+ *   file is closed. Until then it is marked as not clean, and a bitmap file
+ *   that is not clean or does not match the record file is rebuilt from
+ *   the delete flags of the records. In shared mode the bitmap file is
+ *   updated along with the records, and a process rereads the bitmap when
+ *   another process has changed it.
+ *
+ *   Between rec_addbegin() and rec_addend() records appended to the end of
+ *   the file are collected in a buffer and written with a single write when
+ *   the buffer is full. The other functions write the buffer before they
+ *   access the file, so the buffering is not visible to them. The caller
+ *   must hold the database lock, because in shared mode other processes
+ *   do not see the buffered records until they are written.
+ *
  * Functions:
  *   rec_open		- Open a record file.
  *   rec_close		- Close a record file.
@@ -41,6 +65,11 @@
  *   rec_prev		- Read the previous record in a file.
  *   rec_numrecords	- Return the number of records in a file.
  *   rec_reccurr	- Return the record number of the current record.
+ *   rec_setcurr	- Make a record current without reading it.
+ *   rec_readslots	- Read a block of consecutive slots.
+ *   rec_slots		- Return the range of slots in a file.
+ *   rec_addbegin	- Start buffering records appended to a file.
+ *   rec_addend		- Write the buffered records to a file.
  *
  *--------------------------------------------------------------------------*/
 
@@ -74,17 +103,47 @@ static CONFIG_CONST char rcsid[] = "$Id: record.c,v 1.8 1999/10/04 03:45:07 kaz
 /*--------------------------- Function prototypes --------------------------*/
 static void putheader   PRM( (RECORD *);            )
 static void getheader   PRM( (RECORD *);            )
+static void reloadhead  PRM( (RECORD *);            )
+static int  map_grow    PRM( (RECORD *, ulong);     )
+static int  map_open    PRM( (RECORD *);            )
+static int  map_load    PRM( (RECORD *);            )
+static int  map_rebuild PRM( (RECORD *);            )
+static void map_save    PRM( (RECORD *, int);       )
+static void map_sync    PRM( (RECORD *);            )
+static void map_write   PRM( (RECORD *, ulong);     )
+static int  map_scan    PRM( (RECORD *, void *, long, int); )
+static long filesize    PRM( (RECORD *);            )
+static int  rec_bitmapadd    PRM( (RECORD *, void *, ulong *); )
+static int  rec_bitmapdelete PRM( (RECORD *, ulong);           )
+static int  addflush    PRM( (RECORD *);            )
 
 /*--------------------------------- Macros ---------------------------------*/
 #define recseek(R,pos)  lseek(R->fh, R->H.recsize * (pos), SEEK_SET)
 #define RECVERSION_ID   "RecMan120"
 #define RECVERSION_NUM  120
+#define RECBITMAP_ID    "RecMan121"
+#define RECBITMAP_NUM   121
+#define MAPVERSION_ID   "FreeMap100"
+#define MAPBYTES(slots) (((slots) + 7) / 8)
+#define INUSE(R,slot)   (R->map[(slot) >> 3] & (1 << ((slot) & 7)))
+#define SETBIT(R,slot)  (R->map[(slot) >> 3] |= (1 << ((slot) & 7)))
+#define CLRBIT(R,slot)  (R->map[(slot) >> 3] &= ~(1 << ((slot) & 7)))
+#define SCANBUF_SIZE    32768
+#define ADDBUF_SIZE     65536
+#define addsync(R)      if( (R)->acount ) addflush(R)
+#define snapsave(R,n)   snap_save(&(R)->snap, (R)->fh, (R)->fname, n)
+
+typedef struct {                    /* Free-space bitmap file header        */
+    char        id[16];             /* Version id                           */
+    ushort      clean;              /* Was the file closed properly?        */
+} MAPHEAD;
 
 
 static void putheader(R)
 RECORD *R;
 {
     recseek(R, 0L);
+    snapsave(R, sizeof(R->H));
     write(R->fh, &R->H, sizeof(R->H));
 }
 
@@ -92,11 +151,354 @@ RECORD *R;
 static void getheader(R)
 RECORD *R;
 {
+	/* Only other processes can make the header in memory out of date.
+	 * While records are buffered the database is locked.
+	 */
+	if( !R->share || R->abuf )
+		return;
+
     recseek(R, 0L);
     read(R->fh, &R->H, sizeof(R->H));
 }
 
 
+static long filesize(R)
+RECORD *R;
+{
+	return lseek(R->fh, 0L, SEEK_END);
+}
+
+
+/*-------------------------------- map_grow --------------------------------*\
+ *
+ * Purpose	 : Ensures that the bitmap can hold <slots> slots. New bytes are
+ *			   cleared.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *			   slots	- Number of slots.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Not enough memory.
+ *
+ */
+
+static int map_grow(R, slots)
+RECORD *R;
+ulong slots;
+{
+	ulong size = MAPBYTES(slots);
+	uchar *map;
+
+	if( size <= R->mapsize )
+		return S_OKAY;
+
+	/* Grow by at least half the current size to amortize the copying */
+	if( size < R->mapsize + R->mapsize / 2 )
+		size = R->mapsize + R->mapsize / 2;
+
+	if( !(map = (uchar *)realloc(R->map, (size_t) size)) )
+		RETURN S_NOMEM;
+
+	memset(map + R->mapsize, 0, (size_t) (size - R->mapsize));
+	R->map		= map;
+	R->mapsize	= size;
+
+	return S_OKAY;
+}
+
+
+/*-------------------------------- map_load --------------------------------*\
+ *
+ * Purpose	 : Reads the bitmap from the bitmap file. The bitmap is only
+ *			   used if the file was closed properly and the bitmap matches
+ *			   the record file header.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *
+ * Returns	 : S_OKAY		- The bitmap was read.
+ *			   S_NOTFOUND	- The bitmap file must be rebuilt.
+ *			   S_NOMEM		- Not enough memory.
+ *
+ */
+
+static int map_load(R)
+RECORD *R;
+{
+	MAPHEAD head;
+	ulong slot, count, bytes;
+
+	lseek(R->mapfh, 0L, SEEK_SET);
+	if( read(R->mapfh, &head, sizeof head) != sizeof head
+	||  strcmp(head.id, MAPVERSION_ID) || !head.clean )
+		return S_NOTFOUND;
+
+	/* The slot count in the header must match the size of the file */
+	if( R->H.last < R->first_possible_rec
+	||  (filesize(R) + R->H.recsize - 1) / R->H.recsize != R->H.last )
+		return S_NOTFOUND;
+
+	if( map_grow(R, R->H.last) != S_OKAY )
+		return db_status;
+
+	bytes = MAPBYTES(R->H.last);
+	if( read(R->mapfh, R->map, (unsigned) bytes) != bytes )
+		return S_NOTFOUND;
+
+	for( count=0, slot=R->first_possible_rec; slot < R->H.last; slot++ )
+		if( INUSE(R, slot) )
+			count++;
+
+	if( count != R->H.numrecords )
+		return S_NOTFOUND;
+
+	return S_OKAY;
+}
+
+
+/*------------------------------- map_rebuild ------------------------------*\
+ *
+ * Purpose	 : Rebuilds the bitmap from the delete flags of the records. The
+ *			   number of slots and records in the file header are updated.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Not enough memory.
+ *
+ */
+
+static int map_rebuild(R)
+RECORD *R;
+{
+	char *buf;
+	ulong slots, slot, count;
+	unsigned per_read, numread, i;
+
+	slots = (filesize(R) + R->H.recsize - 1) / R->H.recsize;
+	if( slots < R->first_possible_rec )
+		slots = R->first_possible_rec;
+
+	if( map_grow(R, slots) != S_OKAY )
+		return db_status;
+	memset(R->map, 0, (size_t) R->mapsize);
+
+	if( (per_read = SCANBUF_SIZE / R->H.recsize) == 0 )
+		per_read = 1;
+
+	if( !(buf = (char *)malloc(per_read * R->H.recsize)) )
+		RETURN S_NOMEM;
+
+	count = 0;
+	slot  = R->first_possible_rec;
+	recseek(R, (off_t) slot);
+
+	while( slot < slots )
+	{
+		numread = read(R->fh, buf, per_read * R->H.recsize) / R->H.recsize;
+
+		/* A partly written record at the end of the file is free */
+		if( numread == 0 )
+			break;
+
+		for( i=0; i<numread; i++, slot++ )
+		{
+			RECORDHEAD *head = (RECORDHEAD *)(buf + i * R->H.recsize);
+
+			if( !(head->flags & BIT_DELETED) )
+			{
+				SETBIT(R, slot);
+				count++;
+			}
+		}
+	}
+
+	free(buf);
+
+	R->H.last		= slots;
+	R->H.numrecords	= count;
+	putheader(R);
+
+	return S_OKAY;
+}
+
+
+/*-------------------------------- map_save --------------------------------*\
+ *
+ * Purpose	 : Writes the bitmap to the bitmap file.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *			   clean	- Mark the bitmap file as clean?
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void map_save(R, clean)
+RECORD *R;
+int clean;
+{
+	MAPHEAD head;
+
+	memset(&head, 0, sizeof head);
+	strcpy(head.id, MAPVERSION_ID);
+	head.clean = clean;
+
+	lseek(R->mapfh, 0L, SEEK_SET);
+	write(R->mapfh, &head, sizeof head);
+	write(R->mapfh, R->map, (unsigned) MAPBYTES(R->H.last));
+}
+
+
+/*-------------------------------- map_open --------------------------------*\
+ *
+ * Purpose	 : Opens the bitmap file of a record file and loads the bitmap.
+ *			   If the bitmap file is missing or out of date, it is rebuilt.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The bitmap file could not be opened.
+ *			   S_NOMEM	- Not enough memory.
+ *
+ */
+
+static int map_open(R)
+RECORD *R;
+{
+	char fname[sizeof(R->fname) + 5];
+
+	sprintf(fname, "%s.fsm", R->fname);
+
+	if( (R->mapfh = os_open(fname, CONFIG_O_BINARY|O_RDWR|O_CREAT,CONFIG_CREATMASK)) == -1 )
+		RETURN S_IOFATAL;
+
+	switch( map_load(R) )
+	{
+		case S_OKAY:
+			break;
+		case S_NOTFOUND:
+			if( map_rebuild(R) != S_OKAY )
+				return db_status;
+			if( R->share )
+				map_save(R, 1);
+			break;
+		default:
+			return db_status;
+	}
+
+	/* In non-shared mode the bitmap file is out of date until it is closed */
+	if( !R->share )
+		map_save(R, 0);
+
+	R->generation	= R->H.first_deleted;
+	R->freehint		= R->first_possible_rec;
+
+	return S_OKAY;
+}
+
+
+/*-------------------------------- map_sync --------------------------------*\
+ *
+ * Purpose	 : In shared mode, reads the file header and rereads the bitmap
+ *			   if another process has changed it.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void map_sync(R)
+RECORD *R;
+{
+	if( !R->share )
+		return;
+
+	getheader(R);
+
+	if( R->H.first_deleted != R->generation )
+	{
+		if( map_grow(R, R->H.last) != S_OKAY )
+			return;
+
+		lseek(R->mapfh, (long) sizeof(MAPHEAD), SEEK_SET);
+		read(R->mapfh, R->map, (unsigned) MAPBYTES(R->H.last));
+
+		R->generation	= R->H.first_deleted;
+		R->freehint		= R->first_possible_rec;
+	}
+}
+
+
+/*-------------------------------- map_write -------------------------------*\
+ *
+ * Purpose	 : In shared mode, writes the bitmap byte containing <slot> to
+ *			   the bitmap file.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *			   slot		- Slot that has changed.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void map_write(R, slot)
+RECORD *R;
+ulong slot;
+{
+	if( !R->share )
+		return;
+
+	lseek(R->mapfh, (long) (sizeof(MAPHEAD) + (slot >> 3)), SEEK_SET);
+	write(R->mapfh, R->map + (slot >> 3), 1);
+}
+
+
+/*-------------------------------- map_scan --------------------------------*\
+ *
+ * Purpose	 : Reads the first record in use from <slot> and on in the
+ *			   direction given by <dir>.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *			   data		- Record buffer.
+ *			   slot		- First slot to examine.
+ *			   dir		- 1 = forwards, -1 = backwards.
+ *
+ * Returns	 : S_OKAY		- A record was read.
+ *			   S_NOTFOUND	- There are no more records.
+ *
+ */
+
+static int map_scan(R, data, slot, dir)
+RECORD *R;
+void *data;
+long slot;
+int dir;
+{
+	int rc;
+
+	while( slot >= (long)R->first_possible_rec && slot < (long)R->H.last )
+	{
+		/* Skip eight free slots at a time */
+		if( !R->map[slot >> 3] )
+		{
+			slot = dir > 0 ? (slot | 7) + 1 : (slot & ~7L) - 1;
+			continue;
+		}
+
+		/* A slot in use can contain a deleted record if another process
+		 * was interrupted while adding or deleting it. Skip it.
+		 */
+		if( INUSE(R, slot) && (rc = rec_read(R, data, (ulong) slot)) != S_DELETED )
+			return rc;
+
+		slot += dir;
+	}
+
+	RETURN S_NOTFOUND;
+}
+
+
 /*-------------------------------- rec_open ----=---------------------------*\
  *
  * Purpose	 : Opens a record file.
@@ -144,6 +546,9 @@ int shared;
 
 	R->fh = fh;
     R->recno = 0;
+	R->share = shared;
+	R->mapfh = -1;
+	strcpy(R->fname, fname);
 
     if( isnew )
     {
@@ -155,10 +560,20 @@ int shared;
         R->H.first          = 0;
         R->H.last           = 0;
         R->H.numrecords     = 0;
-        R->H.version        = RECVERSION_NUM;
-        strcpy(R->H.id, RECVERSION_ID);
 
 		R->first_possible_rec = (sizeof(R->H) + R->H.recsize - 1) / R->H.recsize;
+
+		if( typhoon.rec_bitmap )
+		{
+	        R->H.version	= RECBITMAP_NUM;
+			R->H.last		= R->first_possible_rec;
+    	    strcpy(R->H.id, RECBITMAP_ID);
+		}
+		else
+		{
+	        R->H.version	= RECVERSION_NUM;
+    	    strcpy(R->H.id, RECVERSION_ID);
+		}
    
 		/* Beware that the record can be smaller than the header */
         if( R->H.recsize < sizeof(R->H) )
@@ -175,7 +590,7 @@ int shared;
 
 		R->first_possible_rec = (sizeof(R->H) + R->H.recsize - 1) / R->H.recsize;
 
-		if( R->H.version != RECVERSION_NUM )
+		if( R->H.version != RECVERSION_NUM && R->H.version != RECBITMAP_NUM )
 		{
 			db_status = S_VERSION;
 			os_close(fh);
@@ -184,7 +599,15 @@ int shared;
 		}
 	}
 
-	strcpy(R->fname, fname);
+	if( R->H.version == RECBITMAP_NUM && map_open(R) != S_OKAY )
+	{
+		if( R->mapfh != -1 )
+			os_close(R->mapfh);
+		os_close(fh);
+		FREE(R->map);
+		free(R);
+		return NULL;
+	}
 
     db_status = S_OKAY;
 
@@ -195,8 +618,30 @@ int shared;
 int rec_close(R)
 RECORD *R;
 {
+	if( R->abuf )
+	{
+		if( R->fh != -1 )
+			addflush(R);
+		free(R->abuf);
+	}
+
+	if( R->map )
+	{
+		/* In non-shared mode the header and bitmap are saved on close */
+		if( !R->share && rec_dynopen(R) == S_OKAY )
+		{
+			putheader(R);
+			map_save(R, 1);
+		}
+
+		if( R->mapfh != -1 )
+			os_close(R->mapfh);
+		free(R->map);
+	}
+
 	if( R->fh != -1 )
 	    os_close(R->fh);
+	snap_free(&R->snap);
     free(R);
     R = NULL;
 
@@ -209,10 +654,18 @@ RECORD *R;
 {
 	if( R->fh != -1 )
 	{
+		if( R->abuf )
+			addflush(R);
 		close(R->fh);
 		R->fh = -1;
 	}
 
+	if( R->mapfh != -1 )
+	{
+		close(R->mapfh);
+		R->mapfh = -1;
+	}
+
 	RETURN S_OKAY;
 }
 
@@ -223,18 +676,281 @@ RECORD *R;
 	    if( (R->fh=os_open(R->fname, CONFIG_O_BINARY|O_RDWR|O_CREAT,CONFIG_CREATMASK)) == -1 )
 			RETURN S_IOFATAL;
 
+	if( R->map && R->mapfh == -1 )
+	{
+		char fname[sizeof(R->fname) + 5];
+
+		sprintf(fname, "%s.fsm", R->fname);
+	    if( (R->mapfh=os_open(fname, CONFIG_O_BINARY|O_RDWR|O_CREAT,CONFIG_CREATMASK)) == -1 )
+			RETURN S_IOFATAL;
+	}
+
 	RETURN S_OKAY;
 }
 
 
+/*-------------------------------- addflush --------------------------------*\
+ *
+ * Purpose	 : Writes the records in the append buffer to the file. In a
+ *			   chained file the header is written too, because rec_add()
+ *			   does not write it while records are buffered.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The records could not be written.
+ *
+ */
+
+static int addflush(R)
+RECORD *R;
+{
+	unsigned size = R->acount * R->H.recsize;
+	ulong start;
+
+	if( R->acount )
+	{
+		start = stats_clock(R->stats);
+		recseek(R, (off_t) R->afirst);
+		snapsave(R, size);
+		if( write(R->fh, R->abuf, size) != size )
+			RETURN S_IOFATAL;
+		stats_io(R->stats, STAT_WRITE, start, R->acount);
+
+		R->afirst += R->acount;
+		R->acount  = 0;
+	}
+
+	if( !R->map )
+		putheader(R);
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------ rec_addbegin ------------------------------*\
+ *
+ * Purpose	 : Starts buffering records appended to a file. If the buffer
+ *			   cannot be allocated the records are written one at a time as
+ *			   usual.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *
+ */
+
+int rec_addbegin(R)
+RECORD *R;
+{
+	if( R->abuf )
+		RETURN S_OKAY;
+
+	getheader(R);
+
+	if( (R->amax = ADDBUF_SIZE / R->H.recsize) == 0 )
+		R->amax = 1;
+	R->abuf   = (char *)malloc(R->amax * R->H.recsize);
+	R->acount = 0;
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- rec_addend -------------------------------*\
+ *
+ * Purpose	 : Writes the buffered records and stops buffering.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The records could not be written.
+ *
+ */
+
+int rec_addend(R)
+RECORD *R;
+{
+	int rc = S_OKAY;
+
+	if( R->abuf )
+	{
+		rc = addflush(R);
+		free(R->abuf);
+		R->abuf = NULL;
+	}
+
+	RETURN rc;
+}
+
+
+/*------------------------------ rec_bitmapadd -----------------------------* *
+ * Purpose	 : Adds a record to a bitmap file. The record is put in the first
+ *			   free slot, or at the end of the file if there are no free
+ *			   slots.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *			   data		- Record data.
+ *			   rec		- Will contain the record number.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Not enough memory.
+ *			   S_IOFATAL- The record could not be written.
+ *
+ */
+
+static int rec_bitmapadd(R, data, rec)
+RECORD *R;
+void *data;
+ulong *rec;
+{
+	ulong recno;
+
+	map_sync(R);
+
+	for( recno = R->freehint; recno < R->H.last; recno++ )
+	{
+		if( R->map[recno >> 3] == 0xff )
+			recno |= 7;
+		else if( !INUSE(R, recno) )
+			break;
+	}
+
+	if( recno >= R->H.last )
+	{
+		recno = R->H.last;
+		if( map_grow(R, recno+1) != S_OKAY )
+			return db_status;
+		R->H.last++;
+	}
+
+	/* In shared mode the slot is marked as used before the record is
+	 * written, so that another process never sees a record outside the
+	 * bitmap.
+	 */
+	SETBIT(R, recno);
+	map_write(R, recno);
+
+	R->rec.prev  = 0;
+	R->rec.next  = 0;
+	R->rec.flags = 0;
+	R->reload	 = 0;
+    memcpy(R->rec.data, data, R->H.datasize);
+
+	/* Records appended to the end of the file are buffered */
+	if( R->abuf && (R->acount ? R->afirst + R->acount == recno : recno + 1 == R->H.last) )
+	{
+		if( R->acount == R->amax && addflush(R) != S_OKAY )
+		{
+			CLRBIT(R, recno);
+			map_write(R, recno);
+			return db_status;
+		}
+
+		if( !R->acount )
+			R->afirst = recno;
+		memcpy(R->abuf + R->acount++ * R->H.recsize, &R->rec, R->H.recsize);
+	}
+	else
+	{
+		ulong start = stats_clock(R->stats);
+
+		recseek(R, (off_t) recno);
+		snapsave(R, R->H.recsize);
+		if( write(R->fh, &R->rec, R->H.recsize) != R->H.recsize )
+		{
+			CLRBIT(R, recno);
+			map_write(R, recno);
+			RETURN S_IOFATAL;
+		}
+		stats_io(R->stats, STAT_WRITE, start, 1);
+	}
+
+	R->freehint = recno + 1;
+	R->H.numrecords++;
+
+	if( R->share )
+	{
+		R->H.first_deleted = ++R->generation;
+		putheader(R);
+	}
+
+	*rec = recno;
+
+	return S_OKAY;
+}
+
+
+/*----------------------------- rec_bitmapdelete ---------------------------* *
+ * Purpose	 : Deletes a record from a bitmap file. Only the delete flag of
+ *			   the record is written.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *			   recno	- Record number.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_DELETED- The record is already deleted.
+ *			   S_INVADDR- Invalid record number.
+ *
+ */
+
+static int rec_bitmapdelete(R, recno)
+RECORD *R;
+ulong recno;
+{
+	map_sync(R);
+
+	if( recno < R->first_possible_rec )
+		RETURN S_INVADDR;
+
+	if( recno >= R->H.last || !INUSE(R, recno) )
+		RETURN S_DELETED;
+
+	addsync(R);
+
+	/* Get the head of the record to be deleted */
+	lseek(R->fh, (off_t) (R->H.recsize * recno), SEEK_SET);
+	read(R->fh, &R->rec, sizeof R->rec);
+	R->reload = 0;
+
+	/* Delete-mark the record */
+	R->rec.flags |= BIT_DELETED;
+	lseek(R->fh, (off_t) (R->H.recsize * recno + (long)offsetof(RECORDHEAD, flags)), SEEK_SET);
+	snapsave(R, sizeof R->rec.flags);
+	write(R->fh, &R->rec.flags, sizeof R->rec.flags);
+
+	CLRBIT(R, recno);
+	map_write(R, recno);
+
+	if( recno < R->freehint )
+		R->freehint = recno;
+	R->H.numrecords--;
+
+	if( R->share )
+	{
+		R->H.first_deleted = ++R->generation;
+		putheader(R);
+	}
+
+    RETURN S_OKAY;
+}
+
+
 int rec_add(R,data,rec)
 RECORD *R;                  /* record file                                  */
 void *data;
 ulong *rec;
 {
 	long recno;
+	int append = 0;
+	ulong start;
 
-    getheader(R);
+	if( R->map )
+		return rec_bitmapadd(R, data, rec);
+
+	/* The header is read by rec_addbegin() while records are buffered */
+	if( !R->abuf )
+	    getheader(R);
 
 	if( R->H.first_deleted )
 	{
@@ -245,18 +961,30 @@ ulong *rec;
 		read(R->fh, &R->H.first_deleted, sizeof(R->H.first_deleted));
 	}
 	else
-		recno = (lseek(R->fh, 0L, SEEK_END) + R->H.recsize - 1) / R->H.recsize;
+	{
+		if( R->abuf && R->acount )
+			recno = R->afirst + R->acount;
+		else
+			recno = (lseek(R->fh, 0L, SEEK_END) + R->H.recsize - 1) / R->H.recsize;
+		append = 1;
+	}
 
 	if( R->H.numrecords )
 	{
 		long pos; 
 
 		/* Adjust next-pointer of last record */
-		pos = R->H.last * R->H.recsize;
-		pos += offsetof(RECORDHEAD, next);
+		if( R->acount && R->H.last >= R->afirst && R->H.last < R->afirst + R->acount )
+			((RECORDHEAD *)(R->abuf + (R->H.last - R->afirst) * R->H.recsize))->next = recno;
+		else
+		{
+			pos = R->H.last * R->H.recsize;
+			pos += offsetof(RECORDHEAD, next);
 
-		lseek(R->fh, pos, SEEK_SET);
-		write(R->fh, &recno, sizeof recno);
+			lseek(R->fh, pos, SEEK_SET);
+			snapsave(R, sizeof recno);
+			write(R->fh, &recno, sizeof recno);
+		}
 
 		/* Set prev-pointer of new record */
 		R->rec.prev = R->H.last;		
@@ -273,12 +1001,31 @@ ulong *rec;
 	R->H.numrecords++;
 
 	R->rec.flags = 0;
+	R->reload	 = 0;
     memcpy(R->rec.data, data, R->H.datasize);	/* Copy data to buffer		*/
+
+	/* Records appended to the end of the file are buffered */
+	if( R->abuf && append )
+	{
+		if( R->acount == R->amax && addflush(R) != S_OKAY )
+			return db_status;
+
+		if( !R->acount )
+			R->afirst = recno;
+		memcpy(R->abuf + R->acount++ * R->H.recsize, &R->rec, R->H.recsize);
+		*rec = recno;
+
+		return S_OKAY;
+	}
+
+	start = stats_clock(R->stats);
 	lseek(R->fh, recno * R->H.recsize, SEEK_SET);
 	if( write(R->fh, &R->rec, R->H.recsize) != R->H.recsize )		/* Write chain and record	*/
 		RETURN S_IOFATAL;
+	stats_io(R->stats, STAT_WRITE, start, 1);
 	
-    putheader(R);
+	if( !R->abuf )
+	    putheader(R);
 	*rec = recno;
 
 	return S_OKAY;
@@ -290,11 +1037,17 @@ RECORD *R;
 void *data;
 ulong recno;
 {
+	ulong start;
+
 	if( recno < R->first_possible_rec )
 		RETURN S_INVADDR;
 
+	addsync(R);
+	start = stats_clock(R->stats);
 	lseek(R->fh, (off_t) (R->H.recsize * recno + (long)offsetof(RECORDHEAD, data[0])), SEEK_SET);
+	snapsave(R, R->H.datasize);
 	write(R->fh, data, R->H.datasize);
+	stats_io(R->stats, STAT_WRITE, start, 1);
 
     RETURN S_OKAY;
 }
@@ -304,11 +1057,18 @@ int rec_delete(R, recno)
 RECORD *R;
 ulong recno;
 {
+	ulong start;
+
+	if( R->map )
+		return rec_bitmapdelete(R, recno);
+
+	addsync(R);
     getheader(R);
 
 	/* Get previous and next pointers of record to be deleted */
 	lseek(R->fh, (off_t) (R->H.recsize * recno), SEEK_SET);
 	read(R->fh, &R->rec, sizeof R->rec);
+	R->reload = 0;
 
 	if( R->rec.flags & BIT_DELETED )
 		RETURN S_DELETED;
@@ -319,6 +1079,7 @@ ulong recno;
 	else
 	{
 		lseek(R->fh, (off_t) (R->H.recsize * R->rec.prev + (long)offsetof(RECORDHEAD, next)), SEEK_SET);
+		snapsave(R, sizeof R->rec.next);
 		write(R->fh, &R->rec.next, sizeof R->rec.next);
 	}
 	
@@ -328,6 +1089,7 @@ ulong recno;
 	else
 	{
 		lseek(R->fh, (off_t) (R->H.recsize * R->rec.next + (long)offsetof(RECORDHEAD, prev)), SEEK_SET);
+		snapsave(R, sizeof R->rec.prev);
 		write(R->fh, &R->rec.prev, sizeof R->rec.prev);
 	}	
 
@@ -336,8 +1098,11 @@ ulong recno;
 	R->rec.next = R->H.first_deleted;
 	R->rec.prev = 0;
 
+	start = stats_clock(R->stats);
 	lseek(R->fh, (off_t) (R->H.recsize * recno), SEEK_SET);
+	snapsave(R, sizeof R->rec);
 	write(R->fh, &R->rec, sizeof R->rec);
+	stats_io(R->stats, STAT_WRITE, start, 1);
 	R->H.first_deleted = recno;
 	R->H.numrecords--;
 
@@ -352,12 +1117,18 @@ RECORD *R;
 void *data;
 ulong recno;
 {
+	ulong start;
+
 	if( recno < R->first_possible_rec )
 		RETURN S_INVADDR;
 
+    addsync(R);
+    start = stats_clock(R->stats);
     recseek(R, (off_t) recno);
+    R->reload = 0;
     if( read(R->fh, &R->rec, R->H.recsize) < R->H.recsize )
     	RETURN S_NOTFOUND;
+    stats_io(R->stats, STAT_READ, start, 1);
 
     if( R->rec.flags & BIT_DELETED )
     	RETURN S_DELETED;    
@@ -369,10 +1140,99 @@ ulong recno;
 }
 
 
+/*------------------------------ rec_readslots -----------------------------*\
+ *
+ * Purpose	 : Reads up to <slots> consecutive slots starting at <recno> with
+ *			   a single read. Each slot consists of a RECORDHEAD and the
+ *			   record data. Free slots are read too, so the caller must skip
+ *			   the slots with BIT_DELETED set in their flags.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *			   buf		- Buffer (at least <slots> * H.recsize bytes).
+ *			   recno	- First slot to read. If it is before the first
+ *						  slot of the file it is moved to the first slot.
+ *			   slots	- Number of slots to read.
+ *
+ * Returns	 : The number of slots read. 0 = end of file.
+ *
+ */
+
+unsigned rec_readslots(R, buf, recno, slots)
+RECORD *R;
+void *buf;
+ulong *recno;
+unsigned slots;
+{
+	long n;
+	ulong start;
+
+	if( *recno < R->first_possible_rec )
+		*recno = R->first_possible_rec;
+
+	addsync(R);
+
+	/* Slots after the last slot of a bitmap file have never been used */
+	if( R->map )
+	{
+		map_sync(R);
+		if( *recno >= R->H.last )
+			return 0;
+		if( slots > R->H.last - *recno )
+			slots = (unsigned)(R->H.last - *recno);
+	}
+
+	start = stats_clock(R->stats);
+	recseek(R, (off_t) *recno);
+	if( (n = read(R->fh, buf, slots * R->H.recsize)) <= 0 )
+		return 0;
+	stats_io(R->stats, STAT_READ, start, (ulong)(n / R->H.recsize));
+
+	return (unsigned)(n / R->H.recsize);
+}
+
+
+/*-------------------------------- rec_slots -------------------------------*\
+ *
+ * Purpose	 : Returns the range of record slots in a file.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *			   first	- Will contain the number of the first slot.
+ *			   end		- Will contain the number of the slot after the
+ *						  last slot.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void rec_slots(R, first, end)
+RECORD *R;
+ulong *first, *end;
+{
+	*first = R->first_possible_rec;
+
+	if( R->map )
+	{
+		map_sync(R);
+		*end = R->H.last;
+	}
+	else
+		*end = filesize(R) / R->H.recsize;
+
+	if( *end < *first )
+		*end = *first;
+}
+
+
 int rec_frst(R, data)
 RECORD *R;
 void *data;
 {
+	if( R->map )
+	{
+		map_sync(R);
+		return map_scan(R, data, (long) R->first_possible_rec, 1);
+	}
+
     getheader(R);
 
     return rec_read(R, data, R->H.first);
@@ -383,16 +1243,69 @@ int rec_last(R, data)
 RECORD *R;
 void *data;
 {
+	if( R->map )
+	{
+		map_sync(R);
+		return map_scan(R, data, (long) R->H.last - 1, -1);
+	}
+
     getheader(R);
 
     return rec_read(R, data, R->H.last);
 }
 
 
+/*------------------------------- rec_setcurr ------------------------------*\
+ *
+ * Purpose	 : Makes <recno> the current record of the file without reading
+ *			   it. This is used when the record was found in the record
+ *			   cache. The record's prev and next pointers are read when the
+ *			   chain is followed from it.
+ *
+ * Parameters: R		- Pointer to record file descriptor.
+ *			   recno	- Record number.
+ *
+ * Returns	 : S_OKAY
+ *
+ */
+
+int rec_setcurr(R, recno)
+RECORD *R;
+ulong recno;
+{
+	R->recno  = recno;
+	R->reload = 1;
+
+	RETURN S_OKAY;
+}
+
+
+static void reloadhead(R)
+RECORD *R;
+{
+	addsync(R);
+
+	if( R->reload )
+	{
+		recseek(R, (off_t) R->recno);
+		read(R->fh, &R->rec, (unsigned) offsetof(RECORDHEAD, data[0]));
+		R->reload = 0;
+	}
+}
+
+
 int rec_next(R, data)
 RECORD *R;
 void *data;
 {
+	if( R->map && CURR_REC )
+	{
+		map_sync(R);
+		return map_scan(R, data, (long) R->recno + 1, 1);
+	}
+
+	reloadhead(R);
+
 	if( CURR_REC )
 		return rec_read(R, data, R->rec.next);
 	else
@@ -404,6 +1317,14 @@ int rec_prev(R, data)
 RECORD *R;
 void *data;
 {
+	if( R->map && CURR_REC )
+	{
+		map_sync(R);
+		return map_scan(R, data, (long) R->recno - 1, -1);
+	}
+
+	reloadhead(R);
+
 	if( CURR_REC )
 		return rec_read(R, data, R->rec.prev);
 	else
@@ -415,7 +1336,9 @@ ulong rec_numrecords(R, number)
 RECORD *R;
 ulong *number;
 {
-    getheader(R);
+	/* In non-shared mode the header of a bitmap file is kept in memory */
+	if( !R->map || R->share )
+	    getheader(R);
 
     if( number )
         *number = R->H.numrecords;
@@ -434,6 +1357,7 @@ ulong *recno;
     RETURN R->recno ? S_OKAY : S_NOCR;
 }
 
+
 /* end-of-file */
 
 
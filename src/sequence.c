@@ -28,7 +28,34 @@
  * Description:
  *   This file contains all the code that handles sequences.
  *
+ *   The next number of each sequence is stored in sequence.dat, one ulong
+ *   per sequence. A process reserves a range of <seq_cache> numbers at a
+ *   time by locking the slot of the sequence, advancing the stored number
+ *   past the range and unlocking it. The numbers in the range are then
+ *   handed out from memory. Only the slot of the sequence is locked, so
+ *   processes using different sequences never wait for each other.
+ *
+ *   Numbers reserved but not handed out before the database is closed are
+ *   never used, so with a range of more than one number a sequence may
+ *   have gaps, and numbers from different processes are interleaved.
+ *
+ *   On UNIX the first SEQ_SHM_MAX sequences are kept in the shared memory
+ *   of the database, and a range is reserved with an atomic add to the
+ *   number of steps issued, without any lock. sequence.dat is only
+ *   updated when the numbers issued pass the number stored in it, which
+ *   is then moved SEQ_SHM_AHEAD steps ahead. The file therefore never
+ *   holds a number that has been handed out, so no number is used twice
+ *   after a restart. When the last process closes the database the exact
+ *   next number is written back.
+ *
  * Functions:
+ *   seq_open		- Open the sequence file.
+ *   seq_close		- Close the sequence file.
+ *   seq_value		- Get the number a number of steps into a sequence.
+ *   seq_filereserve- Reserve a range of numbers in sequence.dat.
+ *   seq_shmreserve	- Reserve a range of numbers in shared memory.
+ *   d_seqcache		- Set the number of sequence numbers reserved at a time.
+ *   d_getsequence	- Get the next number in a sequence.
  *
  *--------------------------------------------------------------------------*/
 
@@ -58,9 +85,19 @@
 
 static CONFIG_CONST char rcsid[] = "$Id: sequence.c,v 1.5 1999/10/03 23:28:29 kaz Exp $";
 
-/*---------------------------- Global varibles ----------------------------*/
-static int		seq_max = 0;
-static ulong	*seq_tab = NULL;
+/* The shared memory sequences need an atomic add */
+#if defined(CONFIG_UNIX) && defined(__GNUC__)
+#	define SEQ_ATOMIC
+#	define ATOMIC_ADD(p,n)	__sync_fetch_and_add(p, n)
+#	define MEMORY_BARRIER()	__sync_synchronize()
+#endif
+
+/*--------------------------- Function prototypes --------------------------*/
+static ulong	seq_value		PRM( (Sequence *, ulong, ulong);			)
+static int		seq_filereserve	PRM( (Id, ulong, ulong *);					)
+#ifdef SEQ_ATOMIC
+static int		seq_shmreserve	PRM( (Id, ulong, ulong *);					)
+#endif
 
 
 /*----------------------------- sequence_open -----------------------------*\
@@ -78,6 +115,7 @@ Dbentry *db;
 {
     int isnew, i;
     char fname[128];
+	ulong *tab;
 
 	sprintf(fname, "%ssequence.dat", db->dbfpath);
 
@@ -90,28 +128,29 @@ Dbentry *db;
     	return -1;
     }
 
-	if( db->header.sequences > seq_max )
+	if( !(db->seqrange = (SeqRange *)calloc(db->header.sequences + 1, sizeof(SeqRange))) )
 	{
-		void *ptr;
-	
-		if( !(ptr = (void *)realloc(seq_tab, sizeof(*seq_tab) * db->header.sequences)) )
+		close(db->seq_fh);
+		db_status = S_NOMEM;
+		return -1;
+	}
+
+	if( isnew && db->header.sequences )
+	{
+		if( !(tab = (ulong *)malloc(sizeof(*tab) * db->header.sequences)) )
 		{
+			free(db->seqrange);
 			close(db->seq_fh);
 			db_status = S_NOMEM;
 			return -1;
 		}
 
-		seq_tab = (ulong *)ptr;	
-		seq_max = db->header.sequences;
-	}
-
-	if( isnew )
-	{
 		/* Initialize sequences */
 		for( i=0; i<db->header.sequences; i++ )
-			seq_tab[i] = db->sequence[i].start;
+			tab[i] = db->sequence[i].start;
 
-		write(db->seq_fh, seq_tab, sizeof(*seq_tab) * DB->header.sequences);
+		write(db->seq_fh, tab, sizeof(*tab) * db->header.sequences);
+		free(tab);
 	}
 
 	return 0;
@@ -120,7 +159,8 @@ Dbentry *db;
 
 /*----------------------------- sequence_close ----------------------------*\
  *
- * Purpose	 : Closes the sequence file.
+ * Purpose	 : Closes the sequence file. The numbers reserved but not used
+ *			   are lost.
  *
  * Parameters: db		- Pointer to db struct.
  *
@@ -130,19 +170,202 @@ Dbentry *db;
 int seq_close(db)
 Dbentry *db;
 {
-	close(DB->seq_fh);
+#ifdef SEQ_ATOMIC
+	SeqShm *S;
+	ulong value;
+	int i;
 
-	if( typhoon.dbs_open == 1 )
+	/* The last process writes the next number of each sequence back */
+	if( db->shm && db->shm->use_count == 1 )
 	{
-		free(seq_tab);
-		seq_tab = NULL;
-		seq_max = 0;
+		for( i=0, S=db->shm->seq; i<db->header.sequences && i<SEQ_SHM_MAX; i++, S++ )
+		{
+			if( !S->loaded )
+				continue;
+
+			value = seq_value(db->sequence + i, S->base, S->issued);
+			lseek(db->seq_fh, (long) i * sizeof(ulong), SEEK_SET);
+			write(db->seq_fh, &value, sizeof value);
+		}
 	}
+#endif
+
+	close(db->seq_fh);
+
+	FREE(db->seqrange);
+	db->seqrange = NULL;
 	
 	return 0;
 }
 
 
+/*------------------------------- d_seqcache ------------------------------*\
+ *
+ * Purpose	 : Sets the number of sequence numbers reserved by this process
+ *			   at a time. The default is 1, which gives sequences without
+ *			   gaps. A larger number means fewer updates of sequence.dat,
+ *			   but the numbers not used when the database is closed are
+ *			   lost. The new size is used when the next range is reserved.
+ *
+ * Parameters: numbers	- Numbers reserved at a time.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_INVPARM- <numbers> is less than 1.
+ *
+ */
+int d_seqcache(numbers)
+int numbers;
+{
+	if( numbers < 1 )
+		RETURN_RAP(S_INVPARM);
+
+	typhoon.seq_cache = numbers;
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- seq_value -------------------------------*\
+ *
+ * Purpose	 : Gets the number <steps> steps after <base> in a sequence.
+ *
+ * Parameters: seq		- Sequence.
+ *			   base		- First number.
+ *			   steps	- Number of steps.
+ *
+ * Returns	 : The number.
+ *
+ */
+static ulong seq_value(seq, base, steps)
+Sequence *seq;
+ulong base, steps;
+{
+	return seq->asc ? base + steps * seq->step : base - steps * seq->step;
+}
+
+
+/*---------------------------- seq_filereserve ----------------------------*\
+ *
+ * Purpose	 : Reserves <count> numbers of a sequence by advancing the
+ *			   number in sequence.dat while the slot of the sequence is
+ *			   locked.
+ *
+ * Parameters: id		- Sequence id.
+ *			   count	- Number of numbers to reserve.
+ *			   first	- Will contain the first number reserved.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The sequence file could not be read.
+ *
+ */
+static int seq_filereserve(id, count, first)
+Id id;
+ulong count, *first;
+{
+	ulong value, next;
+	long pos = (long) id * sizeof(ulong);
+
+	os_lock(DB->seq_fh, pos, sizeof(ulong), 'w');
+
+	lseek(DB->seq_fh, pos, SEEK_SET);
+	if( read(DB->seq_fh, &value, sizeof value) != sizeof value )
+	{
+		os_unlock(DB->seq_fh, pos, sizeof(ulong));
+		return S_IOFATAL;
+	}
+
+	next = seq_value(DB->sequence + id, value, count);
+
+	lseek(DB->seq_fh, pos, SEEK_SET);
+	write(DB->seq_fh, &next, sizeof next);
+
+	os_unlock(DB->seq_fh, pos, sizeof(ulong));
+
+	*first = value;
+
+	return S_OKAY;
+}
+
+
+#ifdef SEQ_ATOMIC
+
+/*----------------------------- seq_shmreserve ----------------------------*\
+ *
+ * Purpose	 : Reserves <count> numbers of a sequence kept in shared memory.
+ *			   The slot of the sequence in sequence.dat is only locked when
+ *			   the sequence is loaded and when the number stored in the
+ *			   file must be moved ahead.
+ *
+ * Parameters: id		- Sequence id.
+ *			   count	- Number of numbers to reserve.
+ *			   first	- Will contain the first number reserved.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The sequence file could not be read.
+ *
+ */
+static int seq_shmreserve(id, count, first)
+Id id;
+ulong count, *first;
+{
+	SeqShm *S = DB->shm->seq + id;
+	Sequence *seq = DB->sequence + id;
+	ulong n, value, stored;
+	long pos = (long) id * sizeof(ulong);
+
+	if( !S->loaded )
+	{
+		os_lock(DB->seq_fh, pos, sizeof(ulong), 'w');
+
+		if( !S->loaded )
+		{
+			lseek(DB->seq_fh, pos, SEEK_SET);
+			if( read(DB->seq_fh, &value, sizeof value) != sizeof value )
+			{
+				os_unlock(DB->seq_fh, pos, sizeof(ulong));
+				return S_IOFATAL;
+			}
+
+			S->base   = value;
+			S->issued = 0;
+			S->stored = 0;
+			MEMORY_BARRIER();
+			S->loaded = 1;
+		}
+
+		os_unlock(DB->seq_fh, pos, sizeof(ulong));
+	}
+
+	n = ATOMIC_ADD(&S->issued, count);
+
+	if( n + count > S->stored )
+	{
+		os_lock(DB->seq_fh, pos, sizeof(ulong), 'w');
+
+		/* The numbers must be covered by the file before they are used */
+		if( n + count > S->stored )
+		{
+			stored = n + count + SEQ_SHM_AHEAD;
+			value  = seq_value(seq, S->base, stored);
+
+			lseek(DB->seq_fh, pos, SEEK_SET);
+			write(DB->seq_fh, &value, sizeof value);
+
+			MEMORY_BARRIER();
+			S->stored = stored;
+		}
+
+		os_unlock(DB->seq_fh, pos, sizeof(ulong));
+	}
+
+	*first = seq_value(seq, S->base, n);
+
+	return S_OKAY;
+}
+
+#endif
+
+
 /*----------------------------- d_getsequence -----------------------------*\
  *
  * Purpose	 : Gets the next number in a sequence.
@@ -152,6 +375,7 @@ Dbentry *db;
  *
  * Returns	 : S_NOCD	- No current database.
  *			   S_INVSEQ	- Invalid sequence id.
+ *			   S_IOFATAL- The sequence file could not be read.
  *			   S_OKAY	- Succesful.
  *
  */
@@ -159,28 +383,45 @@ int d_getsequence(id, number)
 Id id;
 ulong *number;
 {
+	Sequence *seq;
+	SeqRange *range;
+	ulong first;
+	int rc;
+
 	if( CURR_DB == -1 )
 		RETURN_RAP(S_NOCD);
 
 	if( id >= DB->header.sequences )
 		RETURN_RAP(S_INVSEQ);
 
-	ty_lock();
+	seq	  = DB->sequence + id;
+	range = DB->seqrange + id;
 
-	lseek(DB->seq_fh, 0, SEEK_SET);
-	read(DB->seq_fh, seq_tab, sizeof(*seq_tab) * DB->header.sequences);
-	
-	*number = seq_tab[id];
+	if( !range->left )
+	{
+		/* Reserve the next range of numbers */
+#ifdef SEQ_ATOMIC
+		if( DB->shm && id < SEQ_SHM_MAX )
+			rc = seq_shmreserve(id, (ulong) typhoon.seq_cache, &first);
+		else
+#endif
+			rc = seq_filereserve(id, (ulong) typhoon.seq_cache, &first);
+
+		if( rc != S_OKAY )
+			RETURN_RAP(rc);
+
+		range->next = first;
+		range->left = typhoon.seq_cache;
+	}
+
+	*number = range->next;
 	
-	if( DB->sequence[id].asc )
-		seq_tab[id] += DB->sequence[id].step;
+	if( seq->asc )
+		range->next += seq->step;
 	else
-		seq_tab[id] -= DB->sequence[id].step;
-
-	lseek(DB->seq_fh, 0, SEEK_SET);
-	write(DB->seq_fh, seq_tab, sizeof(*seq_tab) * DB->header.sequences);
+		range->next -= seq->step;
 
-	ty_unlock();
+	range->left--;
 
 	RETURN S_OKAY;
 }
@@ -292,7 +292,7 @@ ulong *ref;
 {
     CURR_KEY = key - DB->key;
 
-	return ty_keyfind(key, set_keyptr(key, buf), ref);
+	return ty_keytest(key, set_keyptr(key, buf), ref);
 }
 
 
@@ -415,7 +415,8 @@ void *buf;
 /*------------------------------ update_recbuf -----------------------------*\
  *
  * Purpose	 : Makes sure that the contents of the current record is the same
- *			   in DB->recbuf as on the disk.
+ *			   in DB->recbuf as on the disk. The record is taken from the
+ *			   record cache if possible.
  *
  * Parameters: None.
  *
@@ -434,10 +435,23 @@ int update_recbuf()
 
 	DB->recbuf = DB->real_recbuf + rec->preamble;
 
-	if( rec->is_vlr )
-		rc = ty_vlrread(rec, DB->real_recbuf, CURR_REC, &recsize);
+	if( cache_fetch(rec, CURR_REC, DB->real_recbuf) == S_OKAY )
+	{
+		if( !rec->is_vlr )
+			ty_recsetcurr(rec, CURR_REC);
+		rc = S_OKAY;
+	}
+	else if( rec->is_vlr )
+	{
+		recsize = 0;
+		if( (rc = ty_vlrread(rec, DB->real_recbuf, CURR_REC, &recsize)) == S_OKAY && recsize )
+			cache_store(rec, CURR_REC, DB->real_recbuf, recsize);
+	}
 	else
-		rc = ty_recread(rec, DB->real_recbuf, CURR_REC);
+	{
+		if( (rc = ty_recread(rec, DB->real_recbuf, CURR_REC)) == S_OKAY )
+			cache_store(rec, CURR_REC, DB->real_recbuf, rec->preamble + rec->size);
+	}
 
 	CURR_BUFREC		= CURR_REC;
 	CURR_BUFRECID	= CURR_RECID;
@@ -0,0 +1,531 @@
+/*----------------------------------------------------------------------------
+ * File    : ty_bloom.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Contains the optional Bloom filters of the index files. A Bloom filter
+ *   is kept in the file <index file>.blm and is loaded when the index is
+ *   opened. If the filter says that a key value is not in the index, the
+ *   B-tree need not be searched at all. The filter is only used when the
+ *   database is opened in exclusive or one-user mode, because other
+ *   processes could otherwise add keys without updating the filter.
+ *
+ *   Keys are never removed from a filter, so after a key has been deleted
+ *   the filter may answer 'maybe' for it. This only costs a B-tree search.
+ *
+ * Functions:
+ *   bloom_open		- Load the Bloom filter of an index file (if any).
+ *   bloom_close	- Save and free the Bloom filter of an index file.
+ *   bloom_add		- Add a key value to a Bloom filter.
+ *   bloom_test		- Test whether a key value may be in an index.
+ *   d_keybloom		- Create or remove the Bloom filter of a key.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "environ.h"
+#ifdef CONFIG_UNIX
+#	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#	include <io.h>
+#endif
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+/*-------------------------------- Constants -------------------------------*/
+#define BLOOMVERSION_ID	"TyBloom100"	/* Version ID						*/
+#define BLOOM_HASHES	4				/* Number of hash functions			*/
+#define BLOOM_MINBITS	64				/* Minimum size of filter			*/
+#define BLOOM_KEYBITS	10				/* Bits per key of a rebuilt filter	*/
+#define HASH_MASK		0xffffffffUL
+
+/*--------------------------- Function prototypes --------------------------*/
+static ulong	bloom_hash		PRM( (Key *, void *); 						)
+static void		bloom_fname		PRM( (INDEX *, char *);						)
+static int		bloom_save		PRM( (INDEX *, int);						)
+static void		bloom_build		PRM( (Key *, INDEX *);						)
+static void		bloom_free		PRM( (INDEX *);								)
+
+
+/*------------------------------- bloom_hash -------------------------------*\
+ *
+ * Purpose	 : Computes the hash value of a key value. Key values that are
+ *			   equal according to the comparison functions must have the
+ *			   same hash value, so strings are hashed through the sort table
+ *			   up to the terminating zero and floating point zeros are
+ *			   normalized.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   value	- Pointer to key value.
+ *
+ * Returns	 : The hash value.
+ *
+ */
+
+static ulong bloom_hash(key, value)
+Key *key;
+void *value;
+{
+	KeyField *keyfld = DB->keyfield + key->first_keyfield;
+	uchar *sorttable = DB->header.sorttable;
+	Field *fld;
+	uchar *p;
+	ulong h = 2166136261UL;
+	int n = key->fields;
+	int i, size;
+	float f;
+	double d;
+
+	while( n-- )
+	{
+		fld = DB->field + keyfld->field;
+		p	= (uchar *)value + (key->fields > 1 ? keyfld->offset : 0);
+
+		switch( FT_GETBASIC(fld->type) )
+		{
+			case FT_CHARSTR:
+				for( i=0; i<fld->size && p[i]; i++ )
+					h = ((h ^ sorttable[p[i]]) * 16777619UL) & HASH_MASK;
+				size = 0;
+				break;
+			case FT_CHAR:	size = sizeof(char);	break;
+			case FT_SHORT:	size = sizeof(short);	break;
+			case FT_INT:	size = sizeof(int);		break;
+			case FT_LONG:	size = sizeof(long);	break;
+			case FT_FLOAT:
+				memcpy(&f, p, sizeof f);
+				if( f == 0 )
+					f = 0;
+				p 	 = (uchar *)&f;
+				size = sizeof f;
+				break;
+			case FT_DOUBLE:
+				memcpy(&d, p, sizeof d);
+				if( d == 0 )
+					d = 0;
+				p 	 = (uchar *)&d;
+				size = sizeof d;
+				break;
+			default:
+				size = fld->size;
+				break;
+		}
+
+		for( i=0; i<size; i++ )
+			h = ((h ^ p[i]) * 16777619UL) & HASH_MASK;
+
+		keyfld++;
+	}
+
+	return h;
+}
+
+
+static void bloom_fname(I, fname)
+INDEX *I;
+char *fname;
+{
+	sprintf(fname, "%s.blm", I->fname);
+}
+
+
+/*------------------------------- bloom_save -------------------------------*\
+ *
+ * Purpose	 : Writes the Bloom filter of an index file to disk.
+ *
+ * Parameters: I		- Pointer to index file descriptor.
+ *			   clean	- Is the filter saved by a close? If not the filter
+ *						  is rebuilt the next time the index is opened.
+ *
+ * Returns	 : S_OKAY	- The filter was saved.
+ *			   S_IOFATAL- The filter file could not be written.
+ *
+ */
+
+static int bloom_save(I, clean)
+INDEX *I;
+int clean;
+{
+	BLOOM *B = I->bloom;
+	char fname[90];
+	int fh;
+
+	bloom_fname(I, fname);
+
+	if( (fh = os_open(fname, O_CREAT|O_RDWR|CONFIG_O_BINARY, CONFIG_CREATMASK)) == -1 )
+		RETURN S_IOFATAL;
+
+	B->H.keys  = I->H.keys;
+	B->H.clean = clean;
+
+	write(fh, &B->H, sizeof B->H);
+	if( clean || B->dirty )
+		write(fh, B->map, (unsigned) (B->H.bits / 8));
+	os_close(fh);
+
+	if( clean )
+		B->dirty = 0;
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- bloom_build ------------------------------*\
+ *
+ * Purpose	 : Rebuilds a Bloom filter from the keys in its index.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   I		- Pointer to index file descriptor.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void bloom_build(key, I)
+Key *key;
+INDEX *I;
+{
+	ulong keys, ref;
+	int rc;
+
+	memset(I->bloom->map, 0, (size_t) (I->bloom->H.bits / 8));
+	I->bloom->dirty = 1;
+
+	btree_getheader(I);
+	keys = I->H.keys;
+
+	for( rc = btree_frst(I, &ref); keys-- && rc == S_OKAY; rc = btree_next(I, &ref) )
+		bloom_add(key, I, I->curkey);
+
+	I->curr = 0;
+	I->hold = 0;
+}
+
+
+static void bloom_free(I)
+INDEX *I;
+{
+	free(I->bloom->map);
+	free(I->bloom);
+	I->bloom = NULL;
+}
+
+
+/*------------------------------- bloom_open -------------------------------*\
+ *
+ * Purpose	 : Loads the Bloom filter of an index file if it has one. If the
+ *			   filter was not saved by a close or the number of keys in the
+ *			   index has changed since, the filter is rebuilt.
+ *
+ *			   In shared mode the filter is not loaded. Instead it is marked
+ *			   as unclean, so that it will be rebuilt the next time it is
+ *			   loaded.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   I		- Pointer to index file descriptor.
+ *
+ * Returns	 : S_OKAY	- The filter was loaded or the index has no filter.
+ *			   S_NOMEM	- Not enough memory to load the filter.
+ *			   S_VERSION- The filter file has the wrong version.
+ *
+ */
+
+int bloom_open(key, I)
+Key *key;
+INDEX *I;
+{
+	BLOOM *B;
+	char fname[90];
+	int fh;
+
+	I->bloom = NULL;
+	bloom_fname(I, fname);
+
+	if( (fh = os_open(fname, O_RDWR|CONFIG_O_BINARY, 0)) == -1 )
+		RETURN S_OKAY;
+
+	if( !(B = (BLOOM *)calloc(sizeof *B, 1)) )
+	{
+		os_close(fh);
+		RETURN S_NOMEM;
+	}
+
+	if( read(fh, &B->H, sizeof B->H) != sizeof B->H
+	||  strcmp(B->H.id, BLOOMVERSION_ID) )
+	{
+		os_close(fh);
+		free(B);
+		RETURN S_VERSION;
+	}
+
+	if( I->shared )
+	{
+		B->H.clean = 0;
+		lseek(fh, 0L, SEEK_SET);
+		write(fh, &B->H, sizeof B->H);
+		os_close(fh);
+		free(B);
+		RETURN S_OKAY;
+	}
+
+	/* A filter with an invalid size is rebuilt with 10 bits per key */
+	if( B->H.bits == 0 || (B->H.bits & 7) || B->H.hashes == 0 )
+	{
+		B->H.bits	= I->H.keys * BLOOM_KEYBITS;
+		B->H.hashes	= BLOOM_HASHES;
+		B->H.clean	= 0;
+
+		if( B->H.bits < BLOOM_MINBITS )
+			B->H.bits = BLOOM_MINBITS;
+		B->H.bits = (B->H.bits + 7) & ~7UL;
+	}
+
+	if( !(B->map = (uchar *)malloc((size_t) (B->H.bits / 8))) )
+	{
+		os_close(fh);
+		free(B);
+		RETURN S_NOMEM;
+	}
+
+	if( read(fh, B->map, (unsigned) (B->H.bits / 8)) != (int) (B->H.bits / 8) )
+		B->H.clean = 0;
+	os_close(fh);
+
+	I->bloom = B;
+
+	if( !B->H.clean || B->H.keys != I->H.keys )
+		bloom_build(key, I);
+
+	/* Mark the filter as unclean on disk until it is closed */
+	return bloom_save(I, 0);
+}
+
+
+/*------------------------------- bloom_close ------------------------------*\
+ *
+ * Purpose	 : Saves the Bloom filter of an index file and frees it.
+ *
+ * Parameters: I		- Pointer to index file descriptor.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void bloom_close(I)
+INDEX *I;
+{
+	if( I->bloom )
+	{
+		bloom_save(I, 1);
+		bloom_free(I);
+	}
+}
+
+
+/*-------------------------------- bloom_add -------------------------------*\
+ *
+ * Purpose	 : Adds a key value to the Bloom filter of an index.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   I		- Pointer to index file descriptor.
+ *			   value	- Pointer to key value.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void bloom_add(key, I, value)
+Key *key;
+INDEX *I;
+void *value;
+{
+	BLOOM *B = I->bloom;
+	ulong h1, h2, bit;
+	int i;
+
+	h1 = bloom_hash(key, value);
+	h2 = (((h1 >> 17) | (h1 << 15)) & HASH_MASK) | 1;
+
+	for( i=0; i<B->H.hashes; i++ )
+	{
+		bit = (h1 + i * h2) % B->H.bits;
+		B->map[bit >> 3] |= 1 << (bit & 7);
+	}
+
+	B->dirty = 1;
+}
+
+
+/*------------------------------- bloom_test -------------------------------*\
+ *
+ * Purpose	 : Tests whether a key value may be in an index.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   I		- Pointer to index file descriptor.
+ *			   value	- Pointer to key value.
+ *
+ * Returns	 : 0		- The key value is definitely not in the index.
+ *			   1		- The key value may be in the index.
+ *
+ */
+
+int bloom_test(key, I, value)
+Key *key;
+INDEX *I;
+void *value;
+{
+	BLOOM *B = I->bloom;
+	ulong h1, h2, bit;
+	int i;
+
+	h1 = bloom_hash(key, value);
+	h2 = (((h1 >> 17) | (h1 << 15)) & HASH_MASK) | 1;
+
+	for( i=0; i<B->H.hashes; i++ )
+	{
+		bit = (h1 + i * h2) % B->H.bits;
+		if( !(B->map[bit >> 3] & (1 << (bit & 7))) )
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/*------------------------------ bloom_create ------------------------------*\
+ *
+ * Purpose	 : Creates, resizes or removes the Bloom filter of an index. The
+ *			   index file must be open.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   I		- Pointer to index file descriptor.
+ *			   bits		- Size of filter in bits. 0 removes the filter.
+ *
+ * Returns	 : S_OKAY	- The filter was created or removed.
+ *			   S_NOMEM	- Not enough memory for the filter.
+ *			   S_IOFATAL- The filter file could not be written.
+ *
+ */
+
+int bloom_create(key, I, bits)
+Key *key;
+INDEX *I;
+ulong bits;
+{
+	BLOOM *B;
+	char fname[90];
+
+	if( I->bloom )
+		bloom_free(I);
+
+	if( bits == 0 )
+	{
+		bloom_fname(I, fname);
+		unlink(fname);
+		RETURN S_OKAY;
+	}
+
+	if( bits < BLOOM_MINBITS )
+		bits = BLOOM_MINBITS;
+	bits = (bits + 7) & ~7UL;
+
+	if( !(B = (BLOOM *)calloc(sizeof *B, 1)) )
+		RETURN S_NOMEM;
+
+	if( !(B->map = (uchar *)malloc((size_t) (bits / 8))) )
+	{
+		free(B);
+		RETURN S_NOMEM;
+	}
+
+	strcpy(B->H.id, BLOOMVERSION_ID);
+	B->H.bits	= bits;
+	B->H.hashes	= BLOOM_HASHES;
+	I->bloom	= B;
+
+	bloom_build(key, I);
+
+	return bloom_save(I, 0);
+}
+
+
+/*------------------------------- d_keybloom -------------------------------*\
+ *
+ * Purpose	 : Creates or removes the Bloom filter of a key. About 10 bits
+ *			   per key value gives a false positive rate of 1-2%. The filter
+ *			   is filled with the key values already in the index and is
+ *			   maintained from then on. It is kept when the indexes are
+ *			   rebuilt with d_keybuild().
+ *
+ * Parameters: id		- Field ID or compound key ID.
+ *			   bits		- Size of filter in bits. 0 removes the filter.
+ *
+ * Returns	 : S_OKAY	- The filter was created or removed.
+ *			   S_NOCD	- No current database.
+ *			   S_NOTKEY	- The ID is not a key ID or it is a foreign key.
+ *			   S_NOTAVAIL- The database is opened in shared mode.
+ *			   S_NOMEM	- Not enough memory for the filter.
+ *
+ */
+
+FNCLASS int d_keybloom(id, bits)
+Id id;
+ulong bits;
+{
+	Key *key;
+	int rc;
+
+	if( CURR_DB == -1 )
+		RETURN_RAP(S_NOCD);
+
+	if( (rc = aux_getkey(id, &key)) != S_OKAY )
+		return rc;
+
+	if( KEY_ISFOREIGN(key) )
+		RETURN_RAP(S_NOTKEY);
+
+	if( DB->mode == 's' )
+		RETURN_RAP(S_NOTAVAIL);
+
+	ty_lock();
+	rc = ty_keybloom(key, bits);
+	ty_unlock();
+
+	return rc;
+}
+
+/* end-of-file */
@@ -0,0 +1,415 @@
+/*----------------------------------------------------------------------------
+ * File    : ty_bulk.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Contains d_fillbatch(), which adds many records of the same type with
+ *   one call. The records are written to the data file in the order given,
+ *   but the keys are not inserted until all records have been written.
+ *   Then the keys of each index are sorted and inserted in key order, so
+ *   consecutive insertions go to the same B-tree nodes instead of to
+ *   random places in the index. Records appended to the end of the data
+ *   file are buffered and written with a few large writes.
+ *
+ *   The foreign keys are checked the same way: the rows are sorted by each
+ *   foreign key and the parent of each distinct value is looked up once.
+ *   In a table that refers to itself the parent of a row may be another row
+ *   of the batch, which is not in the index yet. Such rows are added one at
+ *   a time with d_fillnew() after the rest of the batch.
+ *
+ * Functions:
+ *   d_fillbatch	- Add a batch of records to the database.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "environ.h"
+#ifdef CONFIG_UNIX
+#	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#endif
+#include <string.h>
+#include <stdio.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+#include "ty_log.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+/*-------------------------------- Constants -------------------------------*/
+#define ROW_DEFERRED	-1			/* Row is added after the batch			*/
+
+/*--------------------------- Function prototypes --------------------------*/
+static int		rowcmp			PRM( (CONFIG_CONST void *, CONFIG_CONST void *);)
+static unsigned	sortrows		PRM( (Key *, unsigned *, int *, unsigned);	)
+
+/*-------------------------------- Variables -------------------------------*/
+static Key		*sort_key;			/* Key used by rowcmp()					*/
+static char		*sort_buf;			/* Rows compared by rowcmp()			*/
+static unsigned	sort_size;			/* Size of a row						*/
+
+
+/*--------------------------------- rowcmp ---------------------------------*\
+ *
+ * Purpose	 : qsort() function that compares two rows of a batch by the
+ *			   value of <sort_key>. Rows with equal keys are ordered by their
+ *			   position in the batch.
+ *
+ * Parameters: a		- Pointer to row number.
+ *			   b		- Pointer to row number.
+ *
+ * Returns	 : < 0, 0 or > 0.
+ *
+ */
+
+static int rowcmp(a, b)
+CONFIG_CONST void *a, *b;
+{
+	unsigned ra = *(unsigned *)a;
+	unsigned rb = *(unsigned *)b;
+	int diff;
+
+	if( (diff = reckeycmp(sort_key, sort_buf + ra * sort_size,
+								    sort_buf + rb * sort_size)) )
+		return diff;
+
+	return ra < rb ? -1 : ra > rb;
+}
+
+
+/*-------------------------------- sortrows --------------------------------*\
+ *
+ * Purpose	 : Sorts the rows of a batch that have S_OKAY in <status> and
+ *			   a value for <key>, i.e. rows where an optional key is null
+ *			   are left out.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   order	- Will contain the sorted row numbers.
+ *			   status	- Status of each row.
+ *			   count	- Number of rows in the batch.
+ *
+ * Returns	 : The number of row numbers in <order>.
+ *
+ */
+
+static unsigned sortrows(key, order, status, count)
+Key *key;
+unsigned *order;
+int *status;
+unsigned count;
+{
+	unsigned i, n = 0;
+
+	for( i=0; i<count; i++ )
+	{
+		if( status[i] != S_OKAY )
+			continue;
+
+		if( KEY_ISOPTIONAL(key) && null_indicator(key, sort_buf + i * sort_size) )
+			continue;
+
+		order[n++] = i;
+	}
+
+	sort_key = key;
+	qsort(order, n, sizeof *order, rowcmp);
+
+	return n;
+}
+
+
+/*------------------------------- d_fillbatch ------------------------------*\
+ *
+ * Purpose	 : Adds <count> records of the type <record> to the database.
+ *			   Each record is checked as by d_fillnew(), and the result of
+ *			   the check is stored in <status>. A record is also rejected
+ *			   with S_DUPLICATE if an earlier record in the batch has the
+ *			   same value of a unique key.
+ *
+ *			   The database is locked for the duration of the call, and
+ *			   the keys are inserted in sorted order after the records have
+ *			   been written. The current record is set to the last record
+ *			   added.
+ *
+ * Parameters: record	- Record id.
+ *			   buf		- The records, stored one after another. Each
+ *						  record occupies the size of the record.
+ *			   count	- Number of records in <buf>.
+ *			   status	- Will contain the result of each record, i.e.
+ *						  S_OKAY, S_DUPLICATE, S_FOREIGN or S_RECSIZE.
+ *
+ * Returns	 : S_OKAY	- The batch was processed. See <status> for the
+ *						  result of each record.
+ *			   S_NOCD	- No current database.
+ *			   S_INVREC - Invalid record id.
+ *			   S_NOMEM	- Out of memory.
+ *			   Other	- An I/O error occurred. Some of the records may
+ *						  have been added.
+ *
+ */
+
+FNCLASS int d_fillbatch(record, buf, count, status)
+Id record;
+void *buf;
+unsigned count;
+int *status;
+{
+	Record *rec;
+	Key *key;
+	ulong *refs, *parents = NULL, ref;
+	unsigned *order, i, j, first, n, added;
+	int rc, k, fks = 0, found, deferred = 0;
+
+	if( (rc = set_recfld(record, &rec, NULL)) != S_OKAY )
+		return rc;
+
+	CURR_REC = 0;
+
+	if( !count )
+		RETURN S_OKAY;
+
+	order = (unsigned *)malloc(count * sizeof *order);
+	refs  = (ulong *)malloc(count * sizeof *refs);
+
+	/* The parent of foreign key <k> of row <i> is stored in
+	 * parents[i * fks + k]. Null keys are left as 0.
+	 */
+	if( rec->first_foreign != -1 )
+	{
+		fks		= rec->keys - (rec->first_foreign - rec->first_key);
+		parents = (ulong *)calloc((size_t) count * fks, sizeof *parents);
+	}
+
+	if( !order || !refs || (fks && !parents) )
+	{
+		free(order);
+		free(refs);
+		free(parents);
+		RETURN_RAP(S_NOMEM);
+	}
+
+	for( i=0; i<count; i++ )
+		status[i] = S_OKAY;
+
+	sort_buf  = (char *)buf;
+	sort_size = rec->size;
+
+	ty_lock();
+	ty_recappend(rec, 1);
+
+	DB->recbuf = DB->real_recbuf + rec->preamble;
+
+	/* Reject records with the same unique key as an earlier record */
+	key = DB->key + rec->first_key;
+
+	for( k=rec->keys; k-- && !KEY_ISFOREIGN(key); key++ )
+	{
+		if( !(key->type & KT_UNIQUE) )
+			continue;
+
+		n = sortrows(key, order, status, count);
+
+		for( first=0, j=1; j<n; j++ )
+		{
+			if( reckeycmp(key, sort_buf + order[first] * sort_size,
+							   sort_buf + order[j] * sort_size) )
+				first = j;
+			else
+				status[order[j]] = S_DUPLICATE;
+		}
+	}
+
+	/* Find the parents of the rows. Rows with the same foreign key value
+	 * are next to each other after sorting, so each parent is only looked
+	 * up once. A row whose parent is not found is deferred if the parent
+	 * can be a row of this batch.
+	 */
+	for( k=0; k<fks; k++ )
+	{
+		key = DB->key + rec->first_foreign + k;
+		n	= sortrows(key, order, status, count);
+
+		for( first=0; first<n; first=j )
+		{
+			found = find_parent(key, sort_buf + order[first] * sort_size, &ref);
+
+			for( j=first; j<n; j++ )
+			{
+				if( j > first && reckeycmp(key, sort_buf + order[first] * sort_size,
+												sort_buf + order[j] * sort_size) )
+					break;
+
+				if( found == S_OKAY )
+					parents[order[j] * fks + k] = ref;
+				else if( DB->record + key->parent == rec )
+				{
+					status[order[j]] = ROW_DEFERRED;
+					deferred++;
+				}
+				else
+					status[order[j]] = S_FOREIGN;
+			}
+		}
+	}
+
+	/* Check the records against the database and write them */
+	for( i=0; i<count; i++ )
+	{
+		char *row = sort_buf + i * sort_size;
+
+		if( status[i] != S_OKAY )
+			continue;
+
+		if( fks )
+			set_foreign_keys(rec, row, parents + i * fks);
+
+		key = DB->key + rec->first_key;
+
+		for( k=rec->keys; k-- && !KEY_ISFOREIGN(key); key++ )
+		{
+			if( !(key->type & KT_UNIQUE) )
+				continue;
+
+			if( KEY_ISOPTIONAL(key) && null_indicator(key, row) )
+				continue;
+
+			if( keyfind(key, row, &ref) == S_OKAY )
+			{
+				status[i] = S_DUPLICATE;
+				break;
+			}
+		}
+
+		if( status[i] != S_OKAY )
+			continue;
+
+		if( rec->is_vlr )
+		{
+			unsigned size;
+
+			if( (status[i] = compress_vlr(COMPRESS, rec, DB->recbuf, row,
+										  &size)) != S_OKAY )
+				continue;
+
+			rc = ty_vlradd(rec, DB->real_recbuf, size, &refs[i]);
+		}
+		else
+		{
+			memcpy(DB->recbuf, row, rec->size);
+			rc = ty_recadd(rec, DB->real_recbuf, &refs[i]);
+		}
+
+		if( rc != S_OKAY )
+			break;
+
+		CURR_RECID	= rec - DB->record;
+		CURR_REC	= refs[i];
+
+		/* Store references to parent records */
+		update_foreign_keys(rec, 1);
+
+#ifdef CONFIG_UNIX
+		if( DB->logging )
+			ty_log('u');
+
+		log_update(CURR_RECID, CURR_REC, rec->size, row);
+#endif
+	}
+
+	if( ty_recappend(rec, 0) != S_OKAY && rc == S_OKAY )
+		rc = db_status;
+
+	/* Records that were not reached because of an error were not added */
+	for( ; i<count; i++ )
+		if( status[i] == S_OKAY )
+			status[i] = rc;
+
+	/* Insert the keys of each index in sorted order */
+	key = DB->key + rec->first_key;
+
+	for( k=rec->keys; rc == S_OKAY && k-- && !KEY_ISFOREIGN(key); key++ )
+	{
+		n = sortrows(key, order, status, count);
+
+		for( j=0; j<n; j++ )
+			if( (rc = keyadd(key, sort_buf + order[j] * sort_size,
+							 refs[order[j]])) != S_OKAY )
+				break;
+	}
+
+	ty_unlock();
+
+	/* Add the deferred rows one at a time. A row whose parent is another
+	 * deferred row succeeds in a later pass.
+	 */
+	for( added=1; rc == S_OKAY && deferred && added; )
+	{
+		for( added=0, i=0; i<count; i++ )
+		{
+			if( status[i] != ROW_DEFERRED )
+				continue;
+
+			status[i] = d_fillnew(record, (char *)buf + i * rec->size);
+
+			if( status[i] == S_FOREIGN )
+			{
+				status[i] = ROW_DEFERRED;
+				continue;
+			}
+
+			added++;
+			deferred--;
+
+			if( status[i] != S_OKAY && status[i] != S_DUPLICATE
+			&&  status[i] != S_RECSIZE )
+			{
+				rc = status[i];
+				break;
+			}
+		}
+	}
+
+	for( i=0; i<count; i++ )
+		if( status[i] == ROW_DEFERRED )
+			status[i] = rc == S_OKAY ? S_FOREIGN : rc;
+
+	free(order);
+	free(refs);
+	free(parents);
+
+	if( rc != S_OKAY )
+		RETURN rc;
+
+	RETURN S_OKAY;
+}
+
+/* end-of-file */
@@ -0,0 +1,343 @@
+/*----------------------------------------------------------------------------
+ * File    : ty_cache.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Contains the record cache used by update_recbuf(). The cache is direct
+ *   mapped: a record can only be in the slot given by its record id and
+ *   record number, so a lookup is a single comparison.
+ *
+ *   Records are written through the cache, i.e. a record that is changed
+ *   by this process is updated in the cache as well as on disk. In shared
+ *   mode other processes may change records too, so every record update
+ *   increments a counter in shared memory. A slot is only valid if the
+ *   counter has not changed since the slot was filled.
+ *
+ * Functions:
+ *   cache_open		- Allocate the record cache of a database.
+ *   cache_close	- Free the record cache of a database.
+ *   cache_fetch	- Get a record from the cache.
+ *   cache_store	- Put a record in the cache.
+ *   cache_forget	- Remove a record from the cache.
+ *   d_setcache		- Set the number of slots in the record cache.
+ *   d_cachestat	- Get the hit and miss counts of the record cache.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "environ.h"
+#ifdef CONFIG_UNIX
+#	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#endif
+#include <string.h>
+#include <stdio.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+#define SLOT(recid, recno)	(DB->cache + ((recno) * 31 + (recid)) % DB->cache_slots)
+
+/*--------------------------- Function prototypes --------------------------*/
+static ulong	cache_stamp		PRM( (void); 								)
+
+
+/*------------------------------- cache_stamp ------------------------------*\
+ *
+ * Purpose	 : Returns the number of record updates performed by all
+ *			   processes using the current database. The caller must hold
+ *			   the lock.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : The update counter.
+ *
+ */
+
+static ulong cache_stamp()
+{
+#ifdef CONFIG_UNIX
+	if( DB->mode == 's' )
+		return DB->shm->rec_updates;
+#endif
+	return 0;
+}
+
+
+/*------------------------------- cache_open -------------------------------*\
+ *
+ * Purpose	 : Allocates the record cache of a database. If the cache cannot
+ *			   be allocated the database is used without a cache.
+ *
+ * Parameters: _db		- Pointer to database entry.
+ *			   slots	- Number of slots. 0 = no cache.
+ *
+ * Returns	 : S_OKAY	- The cache was allocated.
+ *			   S_NOMEM	- Not enough memory for the cache.
+ *
+ */
+
+int cache_open(_db, slots)
+Dbentry *_db;
+int slots;
+{
+	char *data;
+	int i;
+
+	_db->cache			= NULL;
+	_db->cache_slots	= 0;
+
+#ifndef CONFIG_UNIX
+	/* Without shared memory the cache cannot be validated */
+	if( _db->mode == 's' )
+		return S_OKAY;
+#endif
+
+	if( slots <= 0 )
+		return S_OKAY;
+
+	if( !(_db->cache = (CacheSlot *)calloc(slots, sizeof(CacheSlot))) )
+		RETURN S_NOMEM;
+
+	if( !(data = (char *)malloc((size_t) slots * _db->biggest_rec)) )
+	{
+		free(_db->cache);
+		_db->cache = NULL;
+		RETURN S_NOMEM;
+	}
+
+	for( i=0; i<slots; i++ )
+		_db->cache[i].data = data + i * _db->biggest_rec;
+
+	_db->cache_slots = slots;
+
+	return S_OKAY;
+}
+
+
+/*------------------------------- cache_close ------------------------------*\
+ *
+ * Purpose	 : Frees the record cache of a database.
+ *
+ * Parameters: _db		- Pointer to database entry.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void cache_close(_db)
+Dbentry *_db;
+{
+	if( _db->cache )
+	{
+		free(_db->cache[0].data);
+		free(_db->cache);
+		_db->cache = NULL;
+	}
+	_db->cache_slots = 0;
+}
+
+
+/*------------------------------- cache_fetch ------------------------------*\
+ *
+ * Purpose	 : Copies a record from the cache to <buf>.
+ *
+ * Parameters: rec		- Pointer to record table entry.
+ *			   recno	- Record number.
+ *			   buf		- Buffer to copy the record to (incl. preamble).
+ *
+ * Returns	 : S_OKAY		- The record was found in the cache.
+ *			   S_NOTFOUND	- The record is not in the cache.
+ *
+ */
+
+int cache_fetch(rec, recno, buf)
+Record *rec;
+ulong recno;
+void *buf;
+{
+	CacheSlot *slot;
+	ulong recid = rec - DB->record;
+
+	if( !DB->cache )
+		return S_NOTFOUND;
+
+	slot = SLOT(recid, recno);
+
+	if( slot->recno != recno || slot->recid != recid
+	||  slot->stamp != cache_stamp() )
+	{
+		DB->cache_misses++;
+		return S_NOTFOUND;
+	}
+
+	memcpy(buf, slot->data, slot->size);
+	DB->cache_hits++;
+	STAT_COUNT(DB->fh[rec->fileid].any->stats, cache_hits, 1);
+
+	return S_OKAY;
+}
+
+
+/*------------------------------- cache_store ------------------------------*\
+ *
+ * Purpose	 : Puts a record in the cache. Any other record in the same slot
+ *			   is replaced.
+ *
+ * Parameters: rec		- Pointer to record table entry.
+ *			   recno	- Record number.
+ *			   buf		- Buffer containing the record (incl. preamble).
+ *			   size		- Number of bytes in <buf>.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void cache_store(rec, recno, buf, size)
+Record *rec;
+ulong recno;
+void *buf;
+unsigned size;
+{
+	CacheSlot *slot;
+	ulong recid = rec - DB->record;
+
+	if( !DB->cache || size > DB->biggest_rec )
+		return;
+
+	slot = SLOT(recid, recno);
+
+	slot->recid = recid;
+	slot->recno = recno;
+	slot->stamp = cache_stamp();
+	slot->size	= size;
+	memcpy(slot->data, buf, size);
+}
+
+
+/*------------------------------ cache_forget ------------------------------*\
+ *
+ * Purpose	 : Must be called whenever a record is added, updated or deleted.
+ *			   Removes the record from the cache and, in shared mode, tells
+ *			   the other processes that their caches may be out of date.
+ *
+ * Parameters: rec		- Pointer to record table entry.
+ *			   recno	- Record number.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void cache_forget(rec, recno)
+Record *rec;
+ulong recno;
+{
+	CacheSlot *slot;
+	ulong recid = rec - DB->record;
+
+#ifdef CONFIG_UNIX
+	if( DB->mode == 's' )
+		DB->shm->rec_updates++;
+#endif
+
+	if( !DB->cache )
+		return;
+
+	slot = SLOT(recid, recno);
+
+	if( slot->recno == recno && slot->recid == recid )
+		slot->recno = 0;
+}
+
+
+/*------------------------------- d_setcache -------------------------------*\
+ *
+ * Purpose	 : Set the number of records kept in the record cache of each
+ *			   database. The size of the current database's cache is changed
+ *			   right away, other databases opened later get a cache of the
+ *			   new size.
+ *
+ * Parameters: slots	- Number of records in the cache. 0 = no cache.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_INVPARM- The number of slots is invalid.
+ *			   S_NOMEM	- Not enough memory for the cache.
+ *
+ */
+
+FNCLASS int d_setcache(slots)
+int slots;
+{
+	if( slots < 0 )
+		RETURN S_INVPARM;
+
+	typhoon.cache_slots = slots;
+
+	if( CURR_DB != -1 )
+	{
+		cache_close(DB);
+		if( cache_open(DB, slots) != S_OKAY )
+			return db_status;
+	}
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- d_cachestat ------------------------------*\
+ *
+ * Purpose	 : Get the number of records found in and read past the record
+ *			   cache of the current database since it was opened. The hit
+ *			   ratio is hits / (hits + misses).
+ *
+ * Parameters: hits		- Will contain the number of cache hits.
+ *			   misses	- Will contain the number of cache misses.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOCD	- No current database.
+ *
+ */
+
+FNCLASS int d_cachestat(hits, misses)
+ulong *hits, *misses;
+{
+	if( CURR_DB == -1 )
+		RETURN_RAP(S_NOCD);
+
+	*hits	= DB->cache_hits;
+	*misses	= DB->cache_misses;
+
+	RETURN S_OKAY;
+}
+
+/* end-of-file */
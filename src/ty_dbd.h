@@ -74,7 +74,8 @@
 #define KT_PRIMARY		0x01	/* Primary key (preceedes alternate in key[]*/
 #define KT_ALTERNATE	0x02	/* Alternate key (preceedes foreign in key[]*/
 #define KT_FOREIGN		0x03	/* Foreign key								*/
-#define KT_CASCADE		0x08	/* Used with KT_FOREIGN						*/
+#define KT_CASCADEUPD	0x04	/* Used with KT_FOREIGN (on update cascade)	*/
+#define KT_CASCADE		0x08	/* Used with KT_FOREIGN (on delete cascade)	*/
 #define KT_RESTRICT		0x10	/* Used with KT_FOREIGN						*/
 #define KT_OPTIONAL		0x20	/* Used with KT_FOREIGN and KT_ALTERNATE	*/
 #define KT_UNIQUE  	FT_UNIQUE	/* Must be the same bit as FT_UNIQUE		*/
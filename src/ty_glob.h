@@ -61,9 +61,17 @@ TyphoonGlobals typhoon = {
 	{ { { 0 } } },							/* dbtab 						*/
 	NULL,									/* db							*/
 	0,										/* do_rebuild					*/
+	1,										/* rebuild_procs				*/
 	0,										/* dbs_open						*/
 	0,										/* cur_open						*/
 	20,										/* max_open						*/
+	0,										/* file_reopens					*/
+	0,										/* file_closes					*/
+	64,										/* cache_slots					*/
+	0,										/* rec_bitmap					*/
+	0,										/* vlr_compress					*/
+	0,										/* key_compress					*/
+	1,										/* seq_cache					*/
 	{ 0 },									/* curr_keybuf					*/
 	0,										/* curr_key						*/
 	-1,										/* curr_db						*/
@@ -86,6 +94,9 @@ extern long db_subcode;
 #endif
 
 extern		 CMPFUNC keycmp[];				/* Comparison function table	*/
+#ifdef CONFIG_UNIX
+extern		 DB_STATS *lock_stats;			/* Counts ty_lock() calls (unix.c)	*/
+#endif
 
 
 #define DB				typhoon.db
@@ -139,6 +139,9 @@ FNCLASS int d_unblock()
  *							  referenced the record to be deleted. 
  *							  (db_subcode holds the foreign key ID).
  *
+ *			   If the primary key is updated, the foreign keys of dependent
+ *			   records with the cascade rule are updated too.
+ *
  */
 FNCLASS int d_recwrite(buf)
 void *buf;
@@ -161,15 +164,18 @@ void *buf;
     	return rc;
     }
 
-	/* Check foreign keys (if any) */
-	if( (rc = check_foreign_keys(rec, buf, 0)) != S_OKAY )
+	/* Check dependent tables (if any). This must be done before the
+	 * foreign keys are checked, because the preamble in DB->real_recbuf
+	 * is reread while the dependents are checked.
+	 */
+	if( (rc = check_dependent_tables(rec, buf, 'u')) != S_OKAY )
 	{
 		ty_unlock();
 		return rc;
 	}
 
-	/* Check dependent tables (if any) */
-	if( (rc = check_dependent_tables(rec, buf, 'u')) != S_OKAY )
+	/* Check foreign keys (if any) */
+	if( (rc = check_foreign_keys(rec, buf, 0)) != S_OKAY )
 	{
 		ty_unlock();
 		return rc;
@@ -204,6 +210,16 @@ void *buf;
 		}
     }
 
+	/* Update the foreign keys of dependent records with cascade rule. This
+	 * is done before the record itself is changed, so that a cascade that
+	 * fails (and is undone) leaves the record as it was.
+	 */
+	if( (rc = cascade_dependents(rec)) != S_OKAY )
+	{
+		ty_unlock();
+		return rc;
+	}
+
 	for( n=0; n<keys_changed; n++ )
 	{
 		key = keyptr[n];
@@ -455,6 +471,10 @@ void *buf;
  *							  to be deleted. db_subcode holds the foreign
  *							  key ID.
  *
+ *			   Dependent records with the cascade rule are deleted together
+ *			   with the record, as are their own dependents with the
+ *			   cascade rule.
+ *
  */
 
 FNCLASS int d_delete()
@@ -481,8 +501,11 @@ FNCLASS int d_delete()
 		return rc;
 	}
 
-	/* Check dependent tables (if any) */
-	if( (rc = check_dependent_tables(rec, DB->recbuf, 'd')) != S_OKAY )
+	/* Check dependent tables (if any), then delete the dependent records
+	 * with cascade rule.
+	 */
+	if( (rc = check_dependent_tables(rec, DB->recbuf, 'd')) != S_OKAY
+	||	(rc = cascade_dependents(rec)) != S_OKAY )
 	{
 		ty_unlock();
 		return rc;
@@ -40,6 +40,13 @@
  * |   C language read/write     |
  * +-----------------------------+
  *
+ *   At most <max_open> files are open at a time. The open files are kept
+ *   in a doubly linked list, most recently used first, so the file to
+ *   close when another one must be opened is found at the end of the list.
+ *   An index file whose node cache has been used since it was last
+ *   considered is moved to the front instead, because its cached nodes
+ *   make it cheap to keep open.
+ *
  * Functions:
  *
  *--------------------------------------------------------------------------*/
@@ -47,7 +54,14 @@
 #include "environ.h"
 #ifdef CONFIG_UNIX
 #	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#	include <io.h>
 #endif
+#include <fcntl.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
@@ -65,73 +79,130 @@ static CONFIG_CONST char rcsid[] = "$Id: ty_io.c,v 1.9 1999/10/04 03:45:08 kaz E
 
 /*-------------------------- Function prototypes ---------------------------*/
 static int	checkfile				PRM( (Id); )
+static void	keyreopen				PRM( (void); )
+static void	lru_link				PRM( (FILEHEAD *); )
+static void	lru_unlink				PRM( (FILEHEAD *); )
+static int	recopen					PRM( (Record *, char *, Fh *); )
+static int	copyfile				PRM( (char *, char *); )
 
 /*---------------------------- Global variables ----------------------------*/
-static ulong seqno = 1;				/* Current sequence number (always > 0)	*/
+static FILEHEAD *lru_first = NULL;	/* Most recently used open file			*/
+static FILEHEAD *lru_last  = NULL;	/* Least recently used open file		*/
 
 
 
+/*-------------------------------- lru_link --------------------------------*\
+ *
+ * Purpose	 : Inserts an open file at the front of the list of open files.
+ *
+ * Parameters: f		- File descriptor.
+ *
+ * Returns	 : Nothing.
+ *
+ */
 
-int ty_closeafile()
+static void lru_link(f)
+FILEHEAD *f;
+{
+	f->lru_prev = NULL;
+	f->lru_next = lru_first;
+
+	if( lru_first )
+		lru_first->lru_prev = f;
+	else
+		lru_last = f;
+
+	lru_first = f;
+}
+
+
+/*------------------------------- lru_unlink -------------------------------*\
+ *
+ * Purpose	 : Removes a file from the list of open files.
+ *
+ * Parameters: f		- File descriptor.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void lru_unlink(f)
+FILEHEAD *f;
 {
-	ulong lowest_seqno = seqno;
-	int			dbs, fhs;			/* Used for scanning tables				*/
-	Dbentry		*db =typhoon.dbtab;	/* Used for scanning tables				*/
-	Fh			*fh;				/* Used for scanning tables				*/
-	Fh			*foundfh = NULL;	/* The filehandle found to be closed	*/
+	if( f->lru_prev )
+		f->lru_prev->lru_next = f->lru_next;
+	else
+		lru_first = f->lru_next;
+
+	if( f->lru_next )
+		f->lru_next->lru_prev = f->lru_prev;
+	else
+		lru_last = f->lru_prev;
+
+	f->lru_prev = f->lru_next = NULL;
+}
+
+
+/*------------------------------ ty_closeafile -----------------------------*\
+ *
+ * Purpose	 : Closes the least recently used open file to make room for
+ *			   another one. The file is opened again by checkfile() when it
+ *			   is used. An index file with a node cache that has been used
+ *			   since the file was last spared is moved to the front of the
+ *			   list instead, once per new cache hit, so the file closed is
+ *			   still found in constant time on average.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : 0		- A file was closed.
+ *			   -1		- No file is open.
+ *
+ */
 
-	/* Find the file least recently accessed open file */
-	dbs = DB_MAX;
+int ty_closeafile()
+{
+	FILEHEAD *f;
+	INDEX *I;
+	int n;
 
-	while( dbs-- )
+	for( n = typhoon.cur_open; n-- > 0 && (f = lru_last); )
 	{
-		if( db->clients )
-		{
-			fh	= db->fh;
-			fhs	= db->header.files;
+		if( f->type != 'k' && f->type != 'r' )
+			break;
 
-			while( fhs-- )
-			{
-				if( fh->any && fh->any->fh != -1 )
-				{
-					if( lowest_seqno > fh->any->seqno )
-					{
-						lowest_seqno = fh->any->seqno;
-						foundfh		 = fh;
-					}
-				}
-				fh++;
-			}	
-		}
-		db++;
+		I = (INDEX *) f;
+		if( !I->cache || I->cache_hits == I->lru_hits )
+			break;
+
+		I->lru_hits = I->cache_hits;
+		lru_unlink(f);
+		lru_link(f);
 	}
 
-	if( foundfh == NULL )
+	if( !(f = lru_last) )
 	{
 		printf("\a*** Could not close a file **");
 		return -1;
 	}
 
-	/* If the file is already closed, we just return */
-	if( foundfh->any->fh == -1 )
-		return S_OKAY;
-
-	switch( foundfh->any->type )
+	switch( f->type )
 	{
 		case 'k':
 		case 'r':
-			btree_dynclose(foundfh->key); 
+			btree_dynclose((INDEX *) f);
 			break;
 		case 'd': 
-			rec_dynclose(foundfh->rec);	
+			rec_dynclose((RECORD *) f);
 			break;
         case 'v': 
-			vlr_dynclose(foundfh->vlr);	
+			vlr_dynclose((VLR *) f);
 			break;
 	}
 
 	/* Mark the file as closed */
+	lru_unlink(f);
 	typhoon.cur_open--;
+	typhoon.file_closes++;
 
   	return 0;
 }
@@ -147,12 +218,21 @@ Id fileid;
 
 	fh = &DB->fh[fileid];
 
-	/* If the file is open we set the file's sequence number to seqno to
-	 * indicate that it is the most recently accessed file.
+#ifdef CONFIG_UNIX
+	if( DB->mode == 's' && DB->key_gen != DB->shm->key_gen )
+		keyreopen();
+#endif
+
+	/* If the file is open we move it to the front of the list to indicate
+	 * that it is the most recently accessed file.
 	 */
 	if( fh->any->fh != -1 )
 	{
-		fh->any->seqno = seqno++;
+		if( fh->any != lru_first )
+		{
+			lru_unlink(fh->any);
+			lru_link(fh->any);
+		}
 		return S_OKAY;
 	}
 
@@ -184,13 +264,43 @@ Id fileid;
 			break;
 	}
 
-	fh->any->seqno = seqno++;
-	typhoon.cur_open++;
+	if( rc == S_OKAY )
+	{
+		lru_link(fh->any);
+		typhoon.cur_open++;
+		typhoon.file_reopens++;
+		STAT_COUNT(fh->any->stats, reopens, 1);
+	}
 
 	return rc;
 }
 
 
+/*-------------------------------- keyreopen -------------------------------*\
+ *
+ * Purpose	 : Reopens the open index files after another process has
+ *			   replaced one of them with d_keycompact(), so that the old
+ *			   file is no longer used. The files that are closed at the
+ *			   moment are opened by name when they are used.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void keyreopen()
+{
+	int i;
+
+	for( i=0; i<DB->header.files; i++ )
+		if( DB->file[i].type == 'k' || DB->file[i].type == 'r' )
+			ty_reopenfile(DB->fh + i);
+
+	DB->key_gen = DB->shm->key_gen;
+}
+
+
 /*------------------------------ ty_openfile -------------------------------*\
  *
  * Purpose	 : Opens a database file.
@@ -250,6 +360,10 @@ int shared;
 
 			fh->key = btree_open(fname, key->size, fp->pagesize, cmp,
             					(key->type & KT_UNIQUE) ? 0 : 1, shared);
+
+			/* A Bloom filter that cannot be loaded is just not used */
+			if( fh->key && bloom_open(key, fh->key) != S_OKAY )
+				db_status = S_OKAY;
             break;
 		case 'd':
 			/* Add the preamble to the size of the record */
@@ -264,7 +378,8 @@ int shared;
 	if( db_status == S_OKAY )
 	{
 		fh->any->type  = fp->type;
-		fh->any->seqno = seqno++;
+		fh->any->stats = DB->stats ? DB->stats + (fh - DB->fh) : NULL;
+		lru_link(fh->any);
 		typhoon.cur_open++;
 	}
 /*
@@ -290,11 +405,17 @@ Fh *fh;
 {
 	/* If the file is already closed, we just return */
 	if( fh->any->fh != -1 )
+	{
+		lru_unlink(fh->any);
 		typhoon.cur_open--;
+	}
 
 	switch( fh->any->type )
 	{
 		case 'k':
+			bloom_close(fh->key);
+			btree_close(fh->key);
+			break;
 		case 'r':
 			btree_close(fh->key); 
 			break;
@@ -311,6 +432,55 @@ Fh *fh;
 
 
 
+/*------------------------------ ty_reopenfile -----------------------------*\
+ *
+ * Purpose	 : Closes and reopens an open data file, so that a child process
+ *			   gets a file descriptor of its own instead of sharing the
+ *			   file position with its parent.
+ *
+ * Parameters: fh	- Pointer to file handle table entry.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The file could not be reopened.
+ *
+ */
+
+int ty_reopenfile(fh)
+Fh *fh;
+{
+	int rc = S_OKAY;
+
+	/* A file that has been closed temporarily is reopened when it is used */
+	if( fh->any->fh == -1 )
+		RETURN S_OKAY;
+
+	switch( fh->any->type )
+	{
+		case 'k':
+		case 'r':
+			btree_dynclose(fh->key);
+			rc = btree_dynopen(fh->key);
+			break;
+		case 'd':
+			rec_dynclose(fh->rec);
+			rc = rec_dynopen(fh->rec);
+			break;
+		case 'v':
+			vlr_dynclose(fh->vlr);
+			rc = vlr_dynopen(fh->vlr);
+			break;
+	}
+
+	if( rc != S_OKAY )
+	{
+		lru_unlink(fh->any);
+		typhoon.cur_open--;
+	}
+
+	return rc;
+}
+
+
 int ty_keyadd(key, value, ref)
 Key *key;
 void *value;
@@ -323,9 +493,16 @@ ulong ref;
 		return rc;
 
 	idx = DB->fh[key->fileid].key;
+
+	if( idx->load )
+		return load_add(idx, value, ref);
+
 	rc = btree_add(idx, value, ref);
 	btree_keyread(idx, CURR_KEYBUF);
 
+	if( rc == S_OKAY && idx->bloom )
+		bloom_add(key, idx, value);
+
 	return rc;
 }
 
@@ -342,6 +519,57 @@ ulong *ref;
 		return rc;
 
 	idx = DB->fh[key->fileid].key;
+	rc = idx->load ? load_find(idx, value, ref) : btree_find(idx, value, ref);
+	btree_keyread(idx, CURR_KEYBUF);
+
+	return rc;
+}
+
+
+/*------------------------------- ty_keytest -------------------------------*\
+ *
+ * Purpose	 : Finds a key like ty_keyfind(), but if the index has a Bloom
+ *			   filter that rules out the key value, the B-tree is not
+ *			   searched. The caller must therefore not rely on the position
+ *			   in the index after an unsuccessful search.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   value	- Key value to find.
+ *			   ref		- Contains reference when function returns.
+ *
+ * Returns	 : S_OKAY		- The key value was found.
+ *			   S_NOTFOUND	- The key value was not found.
+ *
+ */
+
+int ty_keytest(key, value, ref)
+Key *key;
+void *value;
+ulong *ref;
+{
+	INDEX *idx;
+	int rc;
+
+	if( (rc = checkfile(key->fileid)) != S_OKAY )
+		return rc;
+
+	idx = DB->fh[key->fileid].key;
+
+	/* The Bloom filter is updated when a load ends */
+	if( idx->load )
+	{
+		rc = load_find(idx, value, ref);
+		btree_keyread(idx, CURR_KEYBUF);
+		return rc;
+	}
+
+	if( idx->bloom && !bloom_test(key, idx, value) )
+	{
+		idx->curr = 0;
+		idx->hold = 0;
+		RETURN S_NOTFOUND;
+	}
+
 	rc = btree_find(idx, value, ref);
 	btree_keyread(idx, CURR_KEYBUF);
 
@@ -349,6 +577,186 @@ ulong *ref;
 }
 
 
+/*------------------------------- ty_keystamp ------------------------------*\
+ *
+ * Purpose	 : Gets the timestamp of an index. The timestamp changes when a
+ *			   key is deleted from the index or the index is rebuilt, so a
+ *			   reference found by a search is still valid as long as the
+ *			   timestamp is unchanged.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   stamp	- Will contain the timestamp.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   S_NOTAVAIL	- The index is being loaded and has no valid
+ *							  timestamp.
+ *
+ */
+
+int ty_keystamp(key, stamp)
+Key *key;
+ulong *stamp;
+{
+	INDEX *idx;
+	int rc;
+
+	if( (rc = checkfile(key->fileid)) != S_OKAY )
+		return rc;
+
+	idx = DB->fh[key->fileid].key;
+
+	if( idx->load )
+		return S_NOTAVAIL;
+
+	btree_getheader(idx);
+	*stamp = idx->H.timestamp;
+
+	return S_OKAY;
+}
+
+
+/*-------------------------------- ty_keycopy ------------------------------*\
+ *
+ * Purpose	 : Copies an index into a new file in key order. The copy has
+ *			   the same format as the index and its nodes are full.
+ *
+ * Parameters: key		- Key.
+ *			   fname	- Name of the new file. An existing file is
+ *						  replaced.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOTAVAIL- The index is being loaded.
+ *			   Other	- From btree_open() or btree_copy(). The new file
+ *						  is removed.
+ *
+ */
+
+int ty_keycopy(key, fname)
+Key *key;
+char *fname;
+{
+	INDEX *idx, *to;
+	int rc, compress = typhoon.key_compress;
+
+	if( (rc = checkfile(key->fileid)) != S_OKAY )
+		return rc;
+
+	idx = DB->fh[key->fileid].key;
+
+	if( idx->load )
+		RETURN S_NOTAVAIL;
+
+	unlink(fname);
+
+	/* The copy is compressed if the index is */
+	typhoon.key_compress = idx->map != NULL;
+	to = btree_open(fname, idx->H.keysize, idx->H.nodesize, idx->cmpfunc,
+					idx->H.dups, idx->shared);
+	typhoon.key_compress = compress;
+
+	if( !to )
+		return db_status;
+
+	rc = btree_copy(idx, to, 100);
+	btree_close(to);
+
+	if( rc != S_OKAY )
+	{
+		unlink(fname);
+		RETURN rc;
+	}
+
+	RETURN S_OKAY;
+}
+
+
+/*-------------------------------- ty_keyswap ------------------------------*\
+ *
+ * Purpose	 : Replaces an index file with a copy made by ty_keycopy() and
+ *			   reopens it. If the index has a current key, the first key
+ *			   with the same value becomes the current key of the copy.
+ *
+ * Parameters: key		- Key.
+ *			   fname	- Name of the copy.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The file could not be replaced or reopened.
+ *
+ */
+
+int ty_keyswap(key, fname)
+Key *key;
+char *fname;
+{
+	Fh *fh = DB->fh + key->fileid;
+	INDEX *idx = fh->key;
+	char *curkey = NULL;
+	ulong ref;
+
+	if( idx->curr && (curkey = (char *)malloc(idx->H.keysize)) )
+		memcpy(curkey, idx->curkey, idx->H.keysize);
+
+	if( rename(fname, idx->fname) == -1 )
+	{
+		FREE(curkey);
+		unlink(fname);
+		RETURN S_IOFATAL;
+	}
+
+	ty_closefile(fh);
+
+	if( ty_openfile(DB->file + key->fileid, fh, DB->mode == 's') != S_OKAY )
+	{
+		FREE(curkey);
+		RETURN S_IOFATAL;
+	}
+
+	if( curkey )
+	{
+		btree_find(fh->key, curkey, &ref);
+		free(curkey);
+	}
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- ty_keydelall -----------------------------*\
+ *
+ * Purpose	 : Removes all the keys of an index, so that it can be rebuilt.
+ *
+ * Parameters: key		- Key. Only <fileid> is used.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The index file could not be opened.
+ *
+ */
+
+int ty_keydelall(key)
+Key *key;
+{
+	int rc;
+
+	if( (rc = checkfile(key->fileid)) != S_OKAY )
+		return rc;
+
+	return btree_delall(DB->fh[key->fileid].key);
+}
+
+
+int ty_keybloom(key, bits)
+Key *key;
+ulong bits;
+{
+	int rc;
+
+	if( (rc = checkfile(key->fileid)) != S_OKAY )
+		return rc;
+
+	return bloom_create(key, DB->fh[key->fileid].key, bits);
+}
+
+
 
 int ty_keyfrst(key, ref)
 Key *key;
@@ -361,6 +769,11 @@ ulong *ref;
 		return rc;
 
 	idx = DB->fh[key->fileid].key;
+
+	/* A B-tree that is being loaded must be built before it is used */
+	if( idx->load )
+		load_close(key, idx);
+
 	rc = btree_frst(idx, ref);
 	btree_keyread(idx, CURR_KEYBUF);
 
@@ -379,6 +792,11 @@ ulong *ref;
 		return rc;
 
 	idx = DB->fh[key->fileid].key;
+
+	/* A B-tree that is being loaded must be built before it is used */
+	if( idx->load )
+		load_close(key, idx);
+
 	rc = btree_last(idx, ref);
 	btree_keyread(idx, CURR_KEYBUF);
 
@@ -397,6 +815,11 @@ ulong *ref;
 		return rc;
 
 	idx = DB->fh[key->fileid].key;
+
+	/* A B-tree that is being loaded must be built before it is used */
+	if( idx->load )
+		load_close(key, idx);
+
 	rc = btree_prev(idx, ref);
 	btree_keyread(idx, CURR_KEYBUF);
 
@@ -415,6 +838,11 @@ ulong *ref;
 		return rc;
 
 	idx = DB->fh[key->fileid].key;
+
+	/* A B-tree that is being loaded must be built before it is used */
+	if( idx->load )
+		load_close(key, idx);
+
 	rc = btree_next(idx, ref);
 	btree_keyread(idx, CURR_KEYBUF);
 
@@ -434,6 +862,11 @@ ulong ref;
 		return rc;
 
 	idx = DB->fh[key->fileid].key;
+
+	/* A B-tree that is being loaded must be built before it is used */
+	if( idx->load )
+		load_close(key, idx);
+
 	rc = btree_del(idx, value, ref);
 	btree_keyread(idx, CURR_KEYBUF);
 
@@ -451,7 +884,13 @@ ulong *recno;
 	if( (rc = checkfile(rec->fileid)) != S_OKAY )
 		return rc;
 
-	return rec_add(DB->fh[rec->fileid].rec, buf, recno);
+	if( (rc = rec_add(DB->fh[rec->fileid].rec, buf, recno)) == S_OKAY )
+	{
+		cache_forget(rec, *recno);
+		cache_store(rec, *recno, buf, rec->preamble + rec->size);
+	}
+
+	return rc;
 }
 
 
@@ -465,7 +904,13 @@ ulong recno;
 	if( (rc = checkfile(rec->fileid)) != S_OKAY )
 		return rc;
 
-	return rec_write(DB->fh[rec->fileid].rec, buf, recno);
+	if( (rc = rec_write(DB->fh[rec->fileid].rec, buf, recno)) == S_OKAY )
+	{
+		cache_forget(rec, recno);
+		cache_store(rec, recno, buf, rec->preamble + rec->size);
+	}
+
+	return rc;
 }
 
 
@@ -492,6 +937,8 @@ ulong recno;
 	if( (rc = checkfile(rec->fileid)) != S_OKAY )
 		return rc;
 
+	cache_forget(rec, recno);
+
 	return rec_delete(DB->fh[rec->fileid].rec, recno);
 }
 
@@ -570,6 +1017,506 @@ ulong *recno;
 	return rec_curr(DB->fh[rec->fileid].rec, recno);	
 }
 
+int ty_recsetcurr(rec, recno)
+Record *rec;
+ulong recno;
+{
+	return rec_setcurr(DB->fh[rec->fileid].rec, recno);
+}
+
+int ty_recslots(rec, buf, recno, slots, nread)
+Record *rec;
+void *buf;
+ulong *recno;
+unsigned slots, *nread;
+{
+	int rc;
+
+	if( (rc = checkfile(rec->fileid)) != S_OKAY )
+		return rc;
+
+	*nread = rec_readslots(DB->fh[rec->fileid].rec, buf, recno, slots);
+
+	RETURN S_OKAY;
+}
+
+int ty_recrange(rec, first, end)
+Record *rec;
+ulong *first, *end;
+{
+	int rc;
+
+	if( (rc = checkfile(rec->fileid)) != S_OKAY )
+		return rc;
+
+	rec_slots(DB->fh[rec->fileid].rec, first, end);
+
+	RETURN S_OKAY;
+}
+
+/*------------------------------ ty_recappend ------------------------------*\
+ *
+ * Purpose	 : Starts or ends buffering of records appended to the data file
+ *			   of a record. Variable length records are not buffered.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   on		- 1 = start, 0 = end.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The buffered records could not be written.
+ *
+ */
+
+int ty_recappend(rec, on)
+Record *rec;
+int on;
+{
+	int rc;
+
+	if( rec->is_vlr )
+		RETURN S_OKAY;
+
+	if( (rc = checkfile(rec->fileid)) != S_OKAY )
+		return rc;
+
+	if( on )
+		return rec_addbegin(DB->fh[rec->fileid].rec);
+
+	return rec_addend(DB->fh[rec->fileid].rec);
+}
+
+
+/*--------------------------------- recopen --------------------------------*\
+ *
+ * Purpose	 : Opens a data file made by ty_recclone() or ty_recdup() with
+ *			   the same organization as the data file of a record.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   fname	- Name of the file.
+ *			   to		- Will contain the handle of the file.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From rec_open() or vlr_open().
+ *
+ */
+
+static int recopen(rec, fname, to)
+Record *rec;
+char *fname;
+Fh *to;
+{
+	Fh *fh = DB->fh + rec->fileid;
+	int bitmap = typhoon.rec_bitmap, compress = typhoon.vlr_compress;
+
+	if( rec->is_vlr )
+	{
+		typhoon.vlr_compress = fh->vlr->header.codec != 0;
+		to->vlr = vlr_open(fname, DB->file[rec->fileid].pagesize, 0);
+	}
+	else
+	{
+		typhoon.rec_bitmap = fh->rec->map != NULL;
+		to->rec = rec_open(fname, (unsigned) (rec->size + rec->preamble), 0);
+	}
+
+	typhoon.rec_bitmap	 = bitmap;
+	typhoon.vlr_compress = compress;
+
+	if( !to->any )
+		return db_status;
+
+	to->any->type = rec->is_vlr ? 'v' : 'd';
+
+	RETURN S_OKAY;
+}
+
+
+/*-------------------------------- copyfile --------------------------------*\
+ *
+ * Purpose	 : Copies a file. An existing file is replaced.
+ *
+ * Parameters: from		- Name of the file.
+ *			   to		- Name of the copy.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The file could not be read or the copy written.
+ *
+ */
+
+static int copyfile(from, to)
+char *from, *to;
+{
+	char buf[8192];
+	int in, out, n, rc = S_OKAY;
+
+	if( (in = os_open(from, CONFIG_O_BINARY|O_RDONLY, 0)) == -1 )
+		RETURN S_IOFATAL;
+
+	if( (out = os_open(to, CONFIG_O_BINARY|O_RDWR|O_CREAT|O_TRUNC, CONFIG_CREATMASK)) == -1 )
+	{
+		os_close(in);
+		RETURN S_IOFATAL;
+	}
+
+	while( (n = read(in, buf, sizeof buf)) > 0 )
+		if( write(out, buf, n) != n )
+			break;
+
+	if( n != 0 )
+		rc = S_IOFATAL;
+
+	os_close(in);
+	os_close(out);
+
+	RETURN rc;
+}
+
+
+/*------------------------------- ty_recclone ------------------------------*\
+ *
+ * Purpose	 : Creates an empty data file with the same organization as the
+ *			   data file of a record. Records are copied to it by
+ *			   ty_reccopy() and it is then either swapped in by
+ *			   ty_recreplace() or removed by ty_recdiscard().
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   fname	- Name of the new file. An existing file is
+ *						  replaced.
+ *			   to		- Will contain the handle of the new file.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From rec_open() or vlr_open().
+ *
+ */
+
+int ty_recclone(rec, fname, to)
+Record *rec;
+char *fname;
+Fh *to;
+{
+	char mapname[290];
+	int rc;
+
+	if( (rc = checkfile(rec->fileid)) != S_OKAY )
+		return rc;
+
+	sprintf(mapname, "%s.fsm", fname);
+	unlink(fname);
+	unlink(mapname);
+
+	if( (rc = recopen(rec, fname, to)) != S_OKAY )
+		return rc;
+
+	/* The records are appended, so they can be written many at a time */
+	if( !rec->is_vlr )
+		rec_addbegin(to->rec);
+
+	RETURN S_OKAY;
+}
+
+
+/*-------------------------------- ty_recdup -------------------------------*\
+ *
+ * Purpose	 : Copies the data file of a record, so that records can be
+ *			   changed in the copy by ty_recput() without changing the
+ *			   data file. The records keep their record numbers. The copy
+ *			   is then either swapped in by ty_recreplace() or removed by
+ *			   ty_recdiscard().
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   fname	- Name of the copy. An existing file is replaced.
+ *			   to		- Will contain the handle of the copy.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The data file could not be copied.
+ *			   Other	- From rec_open() or vlr_open().
+ *
+ */
+
+int ty_recdup(rec, fname, to)
+Record *rec;
+char *fname;
+Fh *to;
+{
+	Fh *fh = DB->fh + rec->fileid;
+	char name[270], mapname[290];
+	int rc;
+
+	if( (rc = checkfile(rec->fileid)) != S_OKAY )
+		return rc;
+
+	sprintf(name, "%s%s", DB->dbfpath, DB->file[rec->fileid].name);
+	sprintf(mapname, "%s.fsm", fname);
+	unlink(mapname);
+
+	/* Closing the file writes its header, so the copy is up to date. The
+	 * bitmap of the copy is rebuilt when it is opened.
+	 */
+	ty_closefile(fh);
+	rc = copyfile(name, fname);
+
+	if( ty_openfile(DB->file + rec->fileid, fh, DB->mode == 's') != S_OKAY )
+		rc = S_IOFATAL;
+
+	if( rc == S_OKAY )
+		rc = recopen(rec, fname, to);
+
+	if( rc != S_OKAY )
+		unlink(fname);
+
+	return rc;
+}
+
+
+/*-------------------------------- ty_reccopy ------------------------------*\
+ *
+ * Purpose	 : Appends a record to a data file made by ty_recclone().
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   to		- Handle of the new file.
+ *			   buf		- Buffer for the record and its preamble.
+ *			   recno	- Record number in the data file of the record.
+ *			   newrecno	- Will contain the record number in the new file.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_DELETED- The record is deleted.
+ *			   Other	- From the read or the add.
+ *
+ */
+
+int ty_reccopy(rec, to, buf, recno, newrecno)
+Record *rec;
+Fh *to;
+void *buf;
+ulong recno, *newrecno;
+{
+	unsigned size = 0;
+	int rc;
+
+	if( (rc = checkfile(rec->fileid)) != S_OKAY )
+		return rc;
+
+	if( rec->is_vlr )
+	{
+		if( (rc = vlr_read(DB->fh[rec->fileid].vlr, buf, rec->size + rec->preamble,
+							recno, &size)) != S_OKAY )
+			return rc;
+
+		if( !size )
+			RETURN S_DELETED;
+
+		return vlr_add(to->vlr, buf, size, newrecno);
+	}
+
+	if( (rc = rec_read(DB->fh[rec->fileid].rec, buf, recno)) != S_OKAY )
+		return rc;
+
+	return rec_add(to->rec, buf, newrecno);
+}
+
+
+/*------------------------------- ty_recclose ------------------------------*\
+ *
+ * Purpose	 : Closes a data file made by ty_recclone() or ty_recdup(), so
+ *			   that it is complete on disk before it is swapped in. The
+ *			   file is closed even if the buffered records cannot be
+ *			   written.
+ *
+ * Parameters: to		- Handle of the file.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The buffered records could not be written.
+ *
+ */
+
+int ty_recclose(to)
+Fh *to;
+{
+	int rc = S_OKAY;
+
+	if( to->any->type == 'v' )
+		vlr_close(to->vlr);
+	else
+	{
+		rc = rec_addend(to->rec);
+		rec_close(to->rec);
+	}
+
+	to->any = NULL;
+
+	RETURN rc;
+}
+
+
+/*-------------------------------- ty_recput -------------------------------*\
+ *
+ * Purpose	 : Writes a record in a data file made by ty_recclone() or
+ *			   ty_recdup().
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   to		- Handle of the file.
+ *			   buf		- The record and its preamble.
+ *			   size		- Size of <buf> (variable length records).
+ *			   recno	- Record number in the file.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From rec_write() or vlr_write().
+ *
+ */
+
+int ty_recput(rec, to, buf, size, recno)
+Record *rec;
+Fh *to;
+void *buf;
+unsigned size;
+ulong recno;
+{
+	if( rec->is_vlr )
+		return vlr_write(to->vlr, buf, size, recno);
+
+	return rec_write(to->rec, buf, recno);
+}
+
+
+/*------------------------------ ty_recdiscard -----------------------------*\
+ *
+ * Purpose	 : Closes (unless ty_recclose() has closed it) and removes a
+ *			   data file made by ty_recclone() or ty_recdup().
+ *
+ * Parameters: to		- Handle of the new file.
+ *			   fname	- Name of the new file.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void ty_recdiscard(to, fname)
+Fh *to;
+char *fname;
+{
+	char mapname[290];
+
+	if( to->any )
+	{
+		if( to->any->type == 'v' )
+			vlr_close(to->vlr);
+		else
+			rec_close(to->rec);
+		to->any = NULL;
+	}
+
+	sprintf(mapname, "%s.fsm", fname);
+	unlink(fname);
+	unlink(mapname);
+}
+
+
+/*------------------------------ ty_recreplace -----------------------------*\
+ *
+ * Purpose	 : Replaces the data file of a record with a file made by
+ *			   ty_recclone() or ty_recdup() and opens it. All the pages of
+ *			   the new file are marked in the change bitmap, so the next
+ *			   incremental backup copies the whole file.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   to		- Handle of the new file. It is closed, unless
+ *						  ty_recclose() has closed it already.
+ *			   fname	- Name of the new file.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The new file could not be written or swapped in.
+ *						  If it could not be written, it is removed. If
+ *						  it could not be renamed, it is left for the
+ *						  caller and the old file is kept.
+ *
+ */
+
+int ty_recreplace(rec, to, fname)
+Record *rec;
+Fh *to;
+char *fname;
+{
+	Fh *fh = DB->fh + rec->fileid;
+	char name[270], mapname[280], newmapname[290];
+	SNAP *snap;
+	ulong size;
+
+	if( to->any && ty_recclose(to) != S_OKAY )
+	{
+		ty_recdiscard(to, fname);
+		RETURN S_IOFATAL;
+	}
+
+	/* The old file is closed first, because it saves its bitmap on close */
+	ty_closefile(fh);
+
+	sprintf(name, "%s%s", DB->dbfpath, DB->file[rec->fileid].name);
+	sprintf(mapname, "%s.fsm", name);
+	sprintf(newmapname, "%s.fsm", fname);
+
+	if( rename(fname, name) == -1 )
+	{
+		ty_openfile(DB->file + rec->fileid, fh, DB->mode == 's');
+		RETURN S_IOFATAL;
+	}
+
+	/* A bitmap that does not match the file is rebuilt when it is opened */
+	if( rename(newmapname, mapname) == -1 )
+		unlink(mapname);
+
+	if( ty_openfile(DB->file + rec->fileid, fh, DB->mode == 's') != S_OKAY )
+		RETURN S_IOFATAL;
+
+	size = lseek(fh->any->fh, 0, SEEK_END);
+	snap = rec->is_vlr ? &fh->vlr->snap : &fh->rec->snap;
+	snap_mark(snap, name, size);
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- ty_keyload -------------------------------*\
+ *
+ * Purpose	 : Starts or ends loading an index (see ty_load.c). Only an
+ *			   empty index is loaded, other indexes are updated as usual.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   on		- 1 = start, 0 = end.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From load_open() or load_close().
+ *
+ */
+
+int ty_keyload(key, on)
+Key *key;
+int on;
+{
+	INDEX *idx;
+	int rc;
+
+	if( (rc = checkfile(key->fileid)) != S_OKAY )
+		return rc;
+
+	idx = DB->fh[key->fileid].key;
+
+	if( on )
+	{
+		btree_getheader(idx);
+
+		if( idx->H.keys || idx->load )
+			RETURN S_OKAY;
+
+		return load_open(idx);
+	}
+
+	if( !idx->load )
+		RETURN S_OKAY;
+
+	return load_close(key, idx);
+}
+
+
 int ty_vlradd(rec, buf, size, recno)
 Record *rec;
 void *buf;
@@ -581,7 +1528,13 @@ ulong *recno;
 	if( (rc = checkfile(rec->fileid)) != S_OKAY )
 		return rc;
 
-	return vlr_add(DB->fh[rec->fileid].vlr, buf, size + rec->preamble, recno);
+	if( (rc = vlr_add(DB->fh[rec->fileid].vlr, buf, size + rec->preamble, recno)) == S_OKAY )
+	{
+		cache_forget(rec, *recno);
+		cache_store(rec, *recno, buf, size + rec->preamble);
+	}
+
+	return rc;
 }
 
 int ty_vlrwrite(rec, buf, size, recno)
@@ -595,7 +1548,13 @@ ulong recno;
 	if( (rc = checkfile(rec->fileid)) != S_OKAY )
 		return rc;
 
-	return vlr_write(DB->fh[rec->fileid].vlr, buf, size + rec->preamble, recno);
+	if( (rc = vlr_write(DB->fh[rec->fileid].vlr, buf, size + rec->preamble, recno)) == S_OKAY )
+	{
+		cache_forget(rec, recno);
+		cache_store(rec, recno, buf, size + rec->preamble);
+	}
+
+	return rc;
 }
 
 
@@ -610,7 +1569,8 @@ unsigned *size;
 	if( (rc = checkfile(rec->fileid)) != S_OKAY )
 		return rc;
 
-	return vlr_read(DB->fh[rec->fileid].vlr, buf, recno, size);
+	return vlr_read(DB->fh[rec->fileid].vlr, buf, rec->size + rec->preamble,
+					recno, size);
 }
 
 int ty_vlrdel(rec, recno)
@@ -622,7 +1582,21 @@ ulong recno;
 	if( (rc = checkfile(rec->fileid)) != S_OKAY )
 		return rc;
 
+	cache_forget(rec, recno);
+
 	return vlr_del(DB->fh[rec->fileid].vlr, recno);
 }
 
+int ty_vlrnext(rec, recno)
+Record *rec;
+ulong *recno;
+{
+	int rc;
+
+	if( (rc = checkfile(rec->fileid)) != S_OKAY )
+		return rc;
+
+	return vlr_next(DB->fh[rec->fileid].vlr, recno);
+}
+
 /* end-of-file */
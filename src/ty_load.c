@@ -0,0 +1,1090 @@
+/*----------------------------------------------------------------------------
+ * File    : ty_load.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Contains the bulk load of indexes. Between d_loadbegin() and d_loadend()
+ *   the keys added to the empty indexes of a record are not inserted in the
+ *   B-trees, but collected in memory. When the load ends the keys are
+ *   sorted and each B-tree is built bottom-up, so every node is written
+ *   once and completely filled.
+ *
+ *   Keys being loaded can still be found by ty_keyfind(), which is needed
+ *   for the duplicate and foreign key checks. The keys are kept in a number
+ *   of sorted runs. Before a search the keys added since the last search
+ *   are sorted into a new run, and the new run is merged with the run
+ *   before it while it is at least half as big. This keeps the number of
+ *   runs logarithmic, and each run is searched with a binary search.
+ *
+ *   Each entry consists of the reference followed by the key value, which
+ *   is padded to keep the entries aligned.
+ *
+ *   load_rebuild() rebuilds all the indexes of a database from its data
+ *   files, e.g. after a restore. Each data file is read sequentially, the
+ *   keys of the live records are collected and every B-tree is built
+ *   bottom-up. On UNIX the indexes can be divided between a number of
+ *   processes. Each process reopens the data files, so the file positions
+ *   are not shared, and builds its own index files.
+ *
+ * Functions:
+ *   load_open		- Start loading the keys of an index.
+ *   load_add		- Add a key to an index being loaded.
+ *   load_find		- Find a key in an index being loaded.
+ *   load_close		- Build the B-tree of an index being loaded.
+ *   load_rebuild	- Rebuild all indexes from the data files.
+ *   load_reindex	- Rebuild some indexes from the data files.
+ *   d_loadbegin	- Start loading records.
+ *   d_loadend		- Build the indexes of the records loaded.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "environ.h"
+#ifdef CONFIG_UNIX
+#	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#	include <sys/types.h>
+#	include <sys/wait.h>
+#else
+#	include <stdlib.h>
+#	include <io.h>
+#endif
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+#define ENTRY(L,n)		((L)->buf + (n) * (L)->size)
+#define ENTRY_REF(e)	(*(ulong *)(e))
+#define ENTRY_KEY(e)	((e) + sizeof(ulong))
+#define REBUILD_BLOCK	262144L		/* Bytes of slots read at a time	*/
+#define SLOTSIZE(rec)	((unsigned) offsetof(RECORDHEAD, data[0]) + \
+						 (rec)->preamble + (rec)->size)
+
+/*--------------------------- Function prototypes --------------------------*/
+static int		sort_cmp		PRM( (CONFIG_CONST void *, CONFIG_CONST void *);)
+static void		load_sort		PRM( (INDEX *);								)
+static void		load_merge		PRM( (KEYLOAD *);							)
+static int		load_keys		PRM( (Record *, int);						)
+static int		rebuild_add		PRM( (Record *, char *, ulong, char *, char *);)
+static int		rebuild_scan	PRM( (Record *, char *, void (*)(char *, ulong, ulong));)
+static int		rebuild_keys	PRM( (Record *, char *, int);				)
+static int		rebuild_files	PRM( (char *, void (*)(char *, ulong, ulong));)
+#ifdef CONFIG_UNIX
+static ulong	rebuild_size	PRM( (int);									)
+static int		rebuild_parallel PRM( (int, void (*)(char *, ulong, ulong));)
+#endif
+
+/*-------------------------------- Variables -------------------------------*/
+static INDEX	*sort_index;		/* Index used by sort_cmp()				*/
+
+
+/*-------------------------------- sort_cmp --------------------------------*\
+ *
+ * Purpose	 : qsort() function that compares two entries by key value and
+ *			   then by reference, which is the order of duplicate keys in
+ *			   the B-tree.
+ *
+ * Parameters: a		- First entry.
+ *			   b		- Second entry.
+ *
+ * Returns	 : < 0, 0 or > 0.
+ *
+ */
+
+static int sort_cmp(a, b)
+CONFIG_CONST void *a, *b;
+{
+	int diff;
+
+	if( (diff = (*sort_index->cmpfunc)(ENTRY_KEY((char *)a), ENTRY_KEY((char *)b))) )
+		return diff;
+
+	return ENTRY_REF(a) < ENTRY_REF(b) ? -1 : ENTRY_REF(a) > ENTRY_REF(b);
+}
+
+
+/*-------------------------------- load_open -------------------------------*\
+ *
+ * Purpose	 : Starts loading the keys of an empty index.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *
+ */
+
+int load_open(I)
+INDEX *I;
+{
+	KEYLOAD *L;
+
+	if( !(L = (KEYLOAD *)calloc(1, sizeof *L)) )
+		RETURN S_NOMEM;
+
+	L->size = sizeof(ulong) + (I->H.keysize + sizeof(ulong) - 1) / sizeof(ulong) * sizeof(ulong);
+	I->load = L;
+
+	RETURN S_OKAY;
+}
+
+
+/*-------------------------------- load_add --------------------------------*\
+ *
+ * Purpose	 : Adds a key to an index being loaded. The caller must check
+ *			   for duplicates.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   key		- Key value.
+ *			   ref		- Reference.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *
+ */
+
+int load_add(I, key, ref)
+INDEX *I;
+void *key;
+ulong ref;
+{
+	KEYLOAD *L = I->load;
+	char *e;
+
+	if( L->count == L->alloc )
+	{
+		ulong alloc = L->alloc ? L->alloc * 2 : 1024;
+
+		if( !(e = (char *)realloc(L->buf, alloc * L->size)) )
+			RETURN S_NOMEM;
+
+		L->buf	 = e;
+		L->alloc = alloc;
+	}
+
+	e = ENTRY(L, L->count++);
+	ENTRY_REF(e) = ref;
+	memcpy(ENTRY_KEY(e), key, I->H.keysize);
+
+	memcpy(I->curkey, key, I->H.keysize);
+	I->curr = 1;
+	I->hold = 0;
+
+	RETURN S_OKAY;
+}
+
+
+/*-------------------------------- load_merge ------------------------------*\
+ *
+ * Purpose	 : Merges the last two runs of keys. If there is not enough
+ *			   memory for the merge the runs are sorted instead.
+ *
+ * Parameters: L		- Keys being loaded.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void load_merge(L)
+KEYLOAD *L;
+{
+	ulong first = L->run[L->runs-2];
+	ulong mid	= L->run[L->runs-1];
+	ulong i, j;
+	char *tmp, *p;
+
+	L->runs--;
+
+	if( !(tmp = (char *)malloc((L->count - first) * L->size)) )
+	{
+		qsort(ENTRY(L, first), L->count - first, L->size, sort_cmp);
+		return;
+	}
+
+	for( p=tmp, i=first, j=mid; i < mid || j < L->count; p += L->size )
+	{
+		if( j == L->count || (i < mid && sort_cmp(ENTRY(L, i), ENTRY(L, j)) <= 0) )
+			memcpy(p, ENTRY(L, i++), L->size);
+		else
+			memcpy(p, ENTRY(L, j++), L->size);
+	}
+
+	memcpy(ENTRY(L, first), tmp, (L->count - first) * L->size);
+	free(tmp);
+}
+
+
+/*-------------------------------- load_sort -------------------------------*\
+ *
+ * Purpose	 : Sorts the keys added since the last search into a new run and
+ *			   merges runs of similar size.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void load_sort(I)
+INDEX *I;
+{
+	KEYLOAD *L = I->load;
+
+	if( L->sorted == L->count )
+		return;
+
+	sort_index = I;
+
+	if( L->runs == KEYLOAD_RUNS )
+	{
+		/* Too many runs. Sort everything into one */
+		qsort(L->buf, L->count, L->size, sort_cmp);
+		L->runs = 1;
+	}
+	else
+	{
+		qsort(ENTRY(L, L->sorted), L->count - L->sorted, L->size, sort_cmp);
+		L->run[L->runs++] = L->sorted;
+
+		while( L->runs > 1 && (L->count - L->run[L->runs-1]) * 2 >=
+							   L->run[L->runs-1] - L->run[L->runs-2] )
+			load_merge(L);
+	}
+
+	L->sorted = L->count;
+}
+
+
+/*-------------------------------- load_find -------------------------------*\
+ *
+ * Purpose	 : Finds a key in an index being loaded. Only exact searches
+ *			   are possible, so the index has no current key if the key is
+ *			   not found.
+ *
+ * Parameters: I		- B-tree index file descriptor.
+ *			   key		- Key value to find.
+ *			   ref		- Contains reference when function returns.
+ *
+ * Returns	 : S_OKAY		- The key value was found.
+ *			   S_NOTFOUND	- The key value was not found.
+ *
+ */
+
+int load_find(I, key, ref)
+INDEX *I;
+void *key;
+ulong *ref;
+{
+	KEYLOAD *L = I->load;
+	char *found = NULL;
+	ulong lwr, upr, mid;
+	int r, cmp;
+
+	load_sort(I);
+
+	for( r=0; r<L->runs; r++ )
+	{
+		/* Find the first entry in the run that is not less than <key> */
+		lwr = L->run[r];
+		upr = r+1 < L->runs ? L->run[r+1] : L->count;
+
+		while( lwr < upr )
+		{
+			mid = (lwr + upr) / 2;
+
+			if( (*I->cmpfunc)(ENTRY_KEY(ENTRY(L, mid)), key) < 0 )
+				lwr = mid + 1;
+			else
+				upr = mid;
+		}
+
+		if( lwr == (r+1 < L->runs ? L->run[r+1] : L->count) )
+			continue;
+
+		cmp = (*I->cmpfunc)(ENTRY_KEY(ENTRY(L, lwr)), key);
+
+		if( !cmp && (!found || ENTRY_REF(ENTRY(L, lwr)) < ENTRY_REF(found)) )
+			found = ENTRY(L, lwr);
+	}
+
+	I->hold = 0;
+
+	if( !found )
+	{
+		I->curr = 0;
+		RETURN S_NOTFOUND;
+	}
+
+	*ref = ENTRY_REF(found);
+	memcpy(I->curkey, ENTRY_KEY(found), I->H.keysize);
+	I->curr = 1;
+
+	RETURN S_OKAY;
+}
+
+
+/*-------------------------------- load_close ------------------------------*\
+ *
+ * Purpose	 : Sorts the keys of an index being loaded and builds the
+ *			   B-tree from them. The Bloom filter of the index is updated
+ *			   too.
+ *
+ * Parameters: key		- Pointer to key table entry.
+ *			   I		- B-tree index file descriptor.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- The B-tree could not be written.
+ *
+ */
+
+int load_close(key, I)
+Key *key;
+INDEX *I;
+{
+	KEYLOAD *L = I->load;
+	BTBUILD *B;
+	ulong n;
+	int rc = S_OKAY;
+
+	I->load = NULL;
+
+	if( L->count )
+	{
+		sort_index = I;
+		qsort(L->buf, L->count, L->size, sort_cmp);
+
+		if( !(B = btree_buildopen(I, 100)) )
+			rc = db_status;
+		else
+		{
+			for( n=0; n<L->count && rc == S_OKAY; n++ )
+			{
+				char *e = ENTRY(L, n);
+
+				rc = btree_buildadd(B, ENTRY_KEY(e), ENTRY_REF(e));
+
+				if( I->bloom )
+					bloom_add(key, I, ENTRY_KEY(e));
+			}
+
+			if( btree_buildclose(B) != S_OKAY && rc == S_OKAY )
+				rc = db_status;
+		}
+	}
+
+	FREE(L->buf);
+	free(L);
+
+	if( rc != S_OKAY )
+		RETURN rc;
+
+	RETURN S_OKAY;
+}
+
+
+/*-------------------------------- load_keys -------------------------------*\
+ *
+ * Purpose	 : Starts or ends loading the indexes of a record, i.e. its keys
+ *			   and the reference files of its parents.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   on		- 1 = start, 0 = end.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From ty_keyload(). The remaining indexes are
+ *						  still processed.
+ *
+ */
+
+static int load_keys(rec, on)
+Record *rec;
+int on;
+{
+	Key *key, refkey;
+	int k, rc, result = S_OKAY;
+
+	refkey.size = sizeof(REF_ENTRY);
+	key = DB->key + rec->first_key;
+
+	for( k=rec->keys; k--; key++ )
+	{
+		if( KEY_ISFOREIGN(key) )
+		{
+			refkey.fileid = DB->record[key->parent].ref_file;
+			rc = ty_keyload(&refkey, on);
+		}
+		else
+		{
+			CURR_KEY = key - DB->key;
+			rc = ty_keyload(key, on);
+		}
+
+		if( rc != S_OKAY && result == S_OKAY )
+			result = rc;
+	}
+
+	return result;
+}
+
+
+/*------------------------------- rebuild_add ------------------------------*\
+ *
+ * Purpose	 : Adds the keys of a record to the indexes being rebuilt. For
+ *			   each foreign key an entry is added to the reference file of
+ *			   the parent.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   build	- build[fileid] != 0 if the index is rebuilt.
+ *			   recno	- Record number.
+ *			   preamble	- Parent references of the record.
+ *			   data		- Record data.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From ty_keyadd().
+ *
+ */
+
+static int rebuild_add(rec, build, recno, preamble, data)
+Record *rec;
+char *build;
+ulong recno;
+char *preamble, *data;
+{
+	Key *key, refkey;
+	REF_ENTRY refentry;
+	int k, rc;
+
+	refkey.size = sizeof(REF_ENTRY);
+	key = DB->key + rec->first_key;
+
+	for( k=0; k<rec->keys; k++, key++ )
+	{
+		if( !build[key->fileid] )
+			continue;
+
+		if( KEY_ISOPTIONAL(key) && null_indicator(key, data) )
+			continue;
+
+		if( KEY_ISFOREIGN(key) )
+		{
+			memcpy(&refentry.parent, preamble + (rec->first_key + k -
+				   rec->first_foreign) * sizeof(ulong), sizeof(ulong));
+			refentry.dependent.recid = rec - DB->record;
+			refentry.dependent.recno = recno;
+			refkey.fileid = key->fileid;
+			rc = ty_keyadd(&refkey, &refentry, recno);
+		}
+		else
+			rc = keyadd(key, data, recno);
+
+		if( rc != S_OKAY )
+			return rc;
+	}
+
+	return S_OKAY;
+}
+
+
+/*------------------------------ rebuild_scan ------------------------------*\
+ *
+ * Purpose	 : Reads the data file of a record sequentially and adds the
+ *			   keys of the live records to the indexes being rebuilt.
+ *			   Fixed length records are read many slots at a time and the
+ *			   deleted slots are skipped.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   build	- build[fileid] != 0 if the index is rebuilt.
+ *			   fn		- Progress function or NULL.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *			   Other	- From ty_keyadd().
+ *
+ */
+
+static int rebuild_scan(rec, build, fn)
+Record *rec;
+char *build;
+void (*fn) PRM((char *, ulong, ulong);)
+{
+	char *buf, *data, *slot;
+	unsigned slotsize, want, got, i, size;
+	ulong recno, first, end;
+	int rc = S_OKAY;
+
+	if( rec->is_vlr )
+	{
+		if( !(buf = (char *)malloc(rec->preamble + rec->size)) )
+			RETURN S_NOMEM;
+		if( !(data = (char *)malloc(rec->size)) )
+		{
+			free(buf);
+			RETURN S_NOMEM;
+		}
+
+		if( fn )
+			fn(rec->name, 1, 0);
+
+		for( recno=0; rc == S_OKAY && ty_vlrnext(rec, &recno) == S_OKAY; )
+		{
+			size = 0;
+			if( ty_vlrread(rec, buf, recno, &size) != S_OKAY || !size ||
+				compress_vlr(UNCOMPRESS, rec, data, buf + rec->preamble, NULL) != S_OKAY )
+				continue;
+
+			rc = rebuild_add(rec, build, recno, buf, data);
+		}
+
+		if( fn )
+			fn(rec->name, 1, 1);
+
+		free(data);
+		free(buf);
+		RETURN rc;
+	}
+
+	slotsize = SLOTSIZE(rec);
+	want	 = REBUILD_BLOCK / slotsize ? (unsigned)(REBUILD_BLOCK / slotsize) : 1;
+
+	if( !(buf = (char *)malloc((size_t) want * slotsize)) )
+		RETURN S_NOMEM;
+
+	ty_recrange(rec, &first, &end);
+	if( end <= first )
+		end = first + 1;
+
+	if( fn )
+		fn(rec->name, end - first, 0);
+
+	for( recno=first; rc == S_OKAY; recno += got )
+	{
+		if( ty_recslots(rec, buf, &recno, want, &got) != S_OKAY || !got )
+			break;
+
+		for( i=0, slot=buf; i<got && rc == S_OKAY; i++, slot += slotsize )
+		{
+			if( ((RECORDHEAD *)slot)->flags & BIT_DELETED )
+				continue;
+
+			rc = rebuild_add(rec, build, recno + i, ((RECORDHEAD *)slot)->data,
+							 ((RECORDHEAD *)slot)->data + rec->preamble);
+		}
+
+		if( fn && recno + got < end )
+			fn(rec->name, end - first, recno + got - first);
+	}
+
+	if( fn )
+		fn(rec->name, end - first, end - first);
+
+	free(buf);
+	RETURN rc;
+}
+
+
+/*------------------------------ rebuild_keys ------------------------------*\
+ *
+ * Purpose	 : Starts or ends loading the indexes of a record that are
+ *			   rebuilt. The load of a reference file is ended after the
+ *			   last record with a foreign key to the parent has been
+ *			   scanned.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   build	- build[fileid] != 0 if the index is rebuilt.
+ *			   on		- 1 = start, 0 = end.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From ty_keyload(). The remaining indexes are
+ *						  still processed.
+ *
+ */
+
+static int rebuild_keys(rec, build, on)
+Record *rec;
+char *build;
+int on;
+{
+	Key *key, *key2, refkey;
+	Record *rec2;
+	int k, k2, rc, result = S_OKAY;
+
+	refkey.size = sizeof(REF_ENTRY);
+	key = DB->key + rec->first_key;
+
+	for( k=rec->keys; k--; key++ )
+	{
+		if( !build[key->fileid] )
+			continue;
+
+		if( KEY_ISFOREIGN(key) )
+		{
+			/* Is the reference file used by a record scanned later? */
+			if( !on )
+			{
+				for( rec2=rec+1; rec2 < DB->record + DB->header.records; rec2++ )
+				{
+					key2 = DB->key + rec2->first_key;
+					for( k2=rec2->keys; k2--; key2++ )
+						if( KEY_ISFOREIGN(key2) && key2->fileid == key->fileid )
+							break;
+					if( k2 >= 0 )
+						break;
+				}
+				if( rec2 < DB->record + DB->header.records )
+					continue;
+			}
+
+			refkey.fileid = key->fileid;
+			rc = ty_keyload(&refkey, on);
+		}
+		else
+		{
+			CURR_KEY = key - DB->key;
+			rc = ty_keyload(key, on);
+		}
+
+		if( rc != S_OKAY && result == S_OKAY )
+			result = rc;
+	}
+
+	return result;
+}
+
+
+/*------------------------------ rebuild_files -----------------------------*\
+ *
+ * Purpose	 : Rebuilds the index files marked in <build> by scanning the
+ *			   data files of the records that have keys in them.
+ *
+ * Parameters: build	- build[fileid] != 0 if the index is rebuilt.
+ *			   fn		- Progress function or NULL.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- The first error. The remaining records are still
+ *						  processed.
+ *
+ */
+
+static int rebuild_files(build, fn)
+char *build;
+void (*fn) PRM((char *, ulong, ulong);)
+{
+	Record *rec;
+	Key *key;
+	int i, k, rc, result = S_OKAY;
+
+	for( i=0, rec=DB->record; i<DB->header.records; i++, rec++ )
+	{
+		key = DB->key + rec->first_key;
+		for( k=rec->keys; k--; key++ )
+			if( build[key->fileid] )
+				break;
+
+		if( k < 0 )
+			continue;
+
+		rc = rebuild_keys(rec, build, 1);
+
+		if( rc == S_OKAY )
+			rc = rebuild_scan(rec, build, fn);
+
+		if( rebuild_keys(rec, build, 0) != S_OKAY && rc == S_OKAY )
+			rc = db_status;
+
+		if( rc != S_OKAY && result == S_OKAY )
+			result = rc;
+	}
+
+	return result;
+}
+
+
+#ifdef CONFIG_UNIX
+
+/*------------------------------ rebuild_size ------------------------------*\
+ *
+ * Purpose	 : Estimates the work of rebuilding an index file as the size
+ *			   of the data files that must be read to rebuild it.
+ *
+ * Parameters: fileid	- Index file id.
+ *
+ * Returns	 : Number of bytes.
+ *
+ */
+
+static ulong rebuild_size(fileid)
+int fileid;
+{
+	Record *rec;
+	Key *key;
+	char fname[256];
+	ulong size = 0;
+	int i, k, fh;
+
+	for( i=0, rec=DB->record; i<DB->header.records; i++, rec++ )
+	{
+		key = DB->key + rec->first_key;
+		for( k=rec->keys; k--; key++ )
+			if( key->fileid == fileid )
+				break;
+
+		if( k < 0 )
+			continue;
+
+		/* A path that is too long cannot be opened, so the file is skipped */
+		if( snprintf(fname, sizeof fname, "%s%s", DB->dbfpath,
+					 DB->file[rec->fileid].name) >= (int) sizeof fname )
+			continue;
+
+		if( (fh = os_open(fname, CONFIG_O_BINARY|O_RDONLY, 0)) != -1 )
+		{
+			size += lseek(fh, 0, SEEK_END);
+			os_close(fh);
+		}
+	}
+
+	return size;
+}
+
+
+/*---------------------------- rebuild_parallel ----------------------------*\
+ *
+ * Purpose	 : Rebuilds the index files in <procs> processes. The files are
+ *			   given to the processes largest first, each to the process
+ *			   with the least work so far. The index files are closed
+ *			   while the processes build them and opened again afterwards.
+ *
+ * Parameters: procs	- Number of processes.
+ *			   fn		- Progress function or NULL. It is called for each
+ *						  index file when it has been built.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- A process could not be started or failed.
+ *
+ */
+
+static int rebuild_parallel(procs, fn)
+int procs;
+void (*fn) PRM((char *, ulong, ulong);)
+{
+	int files = DB->header.files;
+	ulong *size, *work;
+	char *build;
+	int *proc, *pid;
+	int i, p, best, status, rc = S_OKAY;
+
+	size  = (ulong *)calloc(files, sizeof *size);
+	proc  = (int *)calloc(files, sizeof *proc);
+	build = (char *)calloc(files, 1);
+	work  = (ulong *)calloc(procs, sizeof *work);
+	pid	  = (int *)calloc(procs, sizeof *pid);
+
+	if( !size || !proc || !build || !work || !pid )
+	{
+		rc = S_NOMEM;
+		goto out;
+	}
+
+	for( i=0; i<files; i++ )
+	{
+		proc[i] = -1;
+		if( DB->file[i].type == 'k' || DB->file[i].type == 'r' )
+			size[i] = rebuild_size(i) + 1;
+	}
+
+	/* Give the largest remaining file to the process with the least work */
+	for( ;; )
+	{
+		for( best=-1, i=0; i<files; i++ )
+			if( size[i] && proc[i] == -1 && (best == -1 || size[i] > size[best]) )
+				best = i;
+
+		if( best == -1 )
+			break;
+
+		for( p=0, i=1; i<procs; i++ )
+			if( work[i] < work[p] )
+				p = i;
+
+		proc[best] = p;
+		work[p]   += size[best];
+	}
+
+	for( i=0; i<files; i++ )
+		if( proc[i] != -1 )
+		{
+			ty_closefile(DB->fh + i);
+			DB->fh[i].any = NULL;
+		}
+
+	fflush(stdout);
+
+	for( p=0; p<procs; p++ )
+	{
+		if( !work[p] )
+			continue;
+
+		if( (pid[p] = fork()) == -1 )
+		{
+			pid[p] = 0;
+			rc = S_IOFATAL;
+			break;
+		}
+
+		if( !pid[p] )
+		{
+			/* Get file positions of our own */
+			for( i=0; i<files; i++ )
+				if( DB->fh[i].any )
+					ty_reopenfile(DB->fh + i);
+
+			for( i=0; i<files; i++ )
+				if( (build[i] = proc[i] == p) )
+					ty_openfile(DB->file + i, DB->fh + i, 0);
+
+			rc = rebuild_files(build, NULL);
+
+			for( i=0; i<files; i++ )
+				if( build[i] )
+					ty_closefile(DB->fh + i);
+
+			_exit(rc != S_OKAY);
+		}
+	}
+
+	for( p=0; p<procs; p++ )
+		if( pid[p] && (waitpid(pid[p], &status, 0) == -1 ||
+			!WIFEXITED(status) || WEXITSTATUS(status)) )
+			rc = S_IOFATAL;
+
+	for( i=0; i<files; i++ )
+		if( proc[i] != -1 )
+		{
+			ty_openfile(DB->file + i, DB->fh + i, 0);
+
+			if( fn )
+			{
+				fn(DB->file[i].name, 1, 0);
+				fn(DB->file[i].name, 1, 1);
+			}
+		}
+
+out:
+	FREE(size);
+	FREE(proc);
+	FREE(build);
+	FREE(work);
+	FREE(pid);
+
+	RETURN rc;
+}
+
+#endif
+
+
+/*------------------------------ load_rebuild ------------------------------*\
+ *
+ * Purpose	 : Rebuilds all the indexes and reference files of the current
+ *			   database from its data files. The index files must be empty,
+ *			   i.e. removed before the database was opened; otherwise the
+ *			   keys are inserted one at a time.
+ *
+ * Parameters: procs	- Number of processes to use (UNIX only).
+ *			   fn		- Progress function or NULL. It is called with the
+ *						  name of a record (or an index file in parallel
+ *						  mode), the total and the number done so far.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- An index could not be written.
+ *
+ */
+
+int load_rebuild(procs, fn)
+int procs;
+void (*fn) PRM((char *, ulong, ulong);)
+{
+	char *build;
+	int i, rc;
+
+#ifdef CONFIG_UNIX
+	if( procs > 1 )
+		return rebuild_parallel(procs, fn);
+#endif
+
+	if( !(build = (char *)calloc(DB->header.files, 1)) )
+		RETURN S_NOMEM;
+
+	for( i=0; i<DB->header.files; i++ )
+		build[i] = DB->file[i].type == 'k' || DB->file[i].type == 'r';
+
+	rc = rebuild_files(build, fn);
+	free(build);
+
+	RETURN rc;
+}
+
+
+/*------------------------------ load_reindex ------------------------------*\
+ *
+ * Purpose	 : Empties the index files marked in <build> and rebuilds them
+ *			   from the data files, e.g. after records have been moved.
+ *
+ * Parameters: build	- build[fileid] != 0 if the index is rebuilt.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- An index could not be written.
+ *
+ */
+
+int load_reindex(build)
+char *build;
+{
+	Key key;
+	int i, rc;
+
+	for( i=0; i<DB->header.files; i++ )
+		if( build[i] )
+		{
+			key.fileid = i;
+			if( (rc = ty_keydelall(&key)) != S_OKAY )
+				return rc;
+		}
+
+	return rebuild_files(build, NULL);
+}
+
+
+/*------------------------------- d_loadbegin ------------------------------*\
+ *
+ * Purpose	 : Starts loading records of the type <record>. The keys added
+ *			   to the indexes of the record that are empty, including the
+ *			   reference files of its parents, are collected in memory
+ *			   until d_loadend() is called. Then the B-trees are built
+ *			   bottom-up from the sorted keys.
+ *
+ *			   Until d_loadend() is called the indexes being loaded can
+ *			   only be used for adding and finding keys. Any other access,
+ *			   such as deleting records or scanning an index, finishes the
+ *			   load of that index first. The load is only performed in
+ *			   exclusive or one-user mode, because other processes would
+ *			   not see the keys.
+ *
+ * Parameters: record	- Record id.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOCD	- No current database.
+ *			   S_INVREC - Invalid record id.
+ *			   S_INVPARM- A load is already in progress.
+ *			   S_NOMEM	- Out of memory.
+ *
+ */
+
+FNCLASS int d_loadbegin(record)
+Id record;
+{
+	Record *rec;
+	int rc;
+
+	if( (rc = set_recfld(record, &rec, NULL)) != S_OKAY )
+		return rc;
+
+	if( DB->loading )
+		RETURN S_INVPARM;
+
+	DB->loading = rec;
+
+	if( DB->mode == 's' )
+		RETURN S_OKAY;
+
+	ty_lock();
+	rc = load_keys(rec, 1);
+	ty_unlock();
+
+	if( rc != S_OKAY )
+	{
+		d_loadend();
+		RETURN rc;
+	}
+
+	RETURN S_OKAY;
+}
+
+
+/*-------------------------------- d_loadend -------------------------------*\
+ *
+ * Purpose	 : Ends the load started by d_loadbegin() and builds the
+ *			   indexes of the records loaded.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOCD	- No current database.
+ *			   S_INVPARM- No load is in progress.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- An index could not be written.
+ *
+ */
+
+FNCLASS int d_loadend()
+{
+	Record *rec;
+	int rc;
+
+	if( CURR_DB == -1 )
+		RETURN S_NOCD;
+
+	if( !(rec = DB->loading) )
+		RETURN S_INVPARM;
+
+	DB->loading = NULL;
+
+	if( DB->mode == 's' )
+		RETURN S_OKAY;
+
+	ty_lock();
+	rc = load_keys(rec, 0);
+	ty_unlock();
+
+	if( rc != S_OKAY )
+		RETURN rc;
+
+	RETURN S_OKAY;
+}
+
+/* end-of-file */
@@ -67,6 +67,12 @@ typedef struct {
 #define ARCHIVE_FILEDATA	4
 #define ARCHIVE_TABLE		5
 #define ARCHIVE_END			6
+#define ARCHIVE_IMAGE		7
+#define ARCHIVE_PAGES		8
+#define ARCHIVE_PAGEDATA	9
+#define ARCHIVE_ZDATA		10
+
+#define ARCHIVE_ZBLOCK_MAX	65536L		/* Max. uncompressed size of ZDATA	*/
 
 #define ARCHIVE_BLOCK		99
 
@@ -76,7 +82,12 @@ typedef struct {
 	char	spare[3];
 	long	date;						/* Date of backup					*/
 	ulong	seqno;						/* Media number in backup			*/
-	char	spare2[512];
+	long	base;						/* Date of the backup that this		*/
+										/* incremental backup is based on.	*/
+										/* 0 = full backup					*/
+	ulong	stripe;						/* Stripe number (0..stripes-1)		*/
+	ulong	stripes;					/* Number of stripes. 0 = 1			*/
+	char	spare2[512-sizeof(long)-2*sizeof(ulong)];
 } ArchiveMediaHeader;
 
 typedef struct {
@@ -97,11 +108,30 @@ typedef struct {
 	char	fname[128];
 } ArchiveFileHeader;
 
+typedef struct {
+	ulong	id;							/* = ARCHIVE_IMAGE or ARCHIVE_PAGES	*/
+	ulong	size;						/* Size of file at the snapshot		*/
+	char	fname[128];					/* Relative to the data file path	*/
+} ArchiveImageHeader;
+
+typedef struct {
+	ulong	id;							/* = ARCHIVE_PAGEDATA				*/
+	ulong	page;						/* First page (of SNAP_PAGE bytes)	*/
+	ulong	size;						/* Number of bytes. 0 = end of file	*/
+} ArchivePageDataHeader;
+
 typedef struct {
 	ulong	id;							/* = ARCHIVE_FILEDATA				*/
 	ulong	size;
 } ArchiveFileDataHeader;
 
+typedef struct {
+	ulong	id;							/* = ARCHIVE_ZDATA					*/
+	ulong	page;						/* First page (PAGES only)			*/
+	ulong	size;						/* Uncompressed number of bytes		*/
+	ulong	zsize;						/* Compressed number of bytes		*/
+} ArchiveZDataHeader;
+
 typedef struct {
 	ulong	id;							/* = ARCHIVE_END					*/
 } ArchiveEnd;
@@ -126,6 +156,40 @@ typedef struct {
 	...								|
 	[FileDataHeader size=0]		----+
 
+	[ImageHeader]				----+
+	[FileDataHeader]				|
+	data							+---	data file (snapshot)
+	[FileDataHeader]				|
+	data							|
+	...								|
+	[FileDataHeader size=0]		----+
+	...
+
+	[End]
+
+	An incremental backup contains the pages that have changed since the
+	backup given by MediaHeader.base instead of the data file images:
+
+	[ImageHeader id=PAGES]		----+
+	[PageDataHeader]				|
+	pages							+---	changed pages of data file
+	[PageDataHeader]				|
+	pages							|
+	...								|
+	[PageDataHeader size=0]		----+
+	...
+
+	A block of data file data can be replaced by a ZDataHeader followed
+	by the data compressed by lz_compress() (tybackup -z). The block is
+	stored uncompressed if it does not get smaller.
+
+	A striped backup consists of MediaHeader.stripes archives, which are
+	written and restored in parallel. Each data file is stored in one of
+	the stripes. Only stripe 0 contains the dbd-file.
+
+	Archives made before snapshots contain one table per record type
+	instead of the data file images, followed by the log file:
+
 	[TableHeader]				----+
 	[RecordHeader]					|
 	record							|
@@ -142,8 +206,6 @@ typedef struct {
 	data							|
 	...								|
 	[FileDataHeader size=0]		----+
-	
-	[End]
 */
 
 FNCLASS int d_abortwork PRM ( (void); )
@@ -61,7 +61,6 @@ static CONFIG_CONST char rcsid[] = "$Id: ty_open.c,v 1.8 1999/10/04 03:45:08 kaz
 /*--------------------------- Function prototypes --------------------------*/
 static void	fixpath			PRM( (char *, char *); )
 	   int  read_dbdfile	PRM( (Dbentry *, char *); )
-static int  perform_rebuild PRM( (unsigned); )
 
 
 static void (*rebuildverbose_fn) PRM((char *, ulong, ulong);)
@@ -186,6 +185,9 @@ int id;
 
 	typhoon.curr_db = id;
 	typhoon.db = typhoon.dbtab + id;
+#ifdef CONFIG_UNIX
+	lock_stats = DB->stats + DB->header.files;
+#endif
 
 	db_status = DB->db_status;
 
@@ -232,81 +234,131 @@ int maxfiles;
 }
 
 
+/*------------------------------- d_filestat -------------------------------*\
+ *
+ * Purpose	 : Get the number of files closed to keep the number of open
+ *			   files within the limit set by d_setfiles(), and the number of
+ *			   times a closed file has been opened again. If the numbers
+ *			   grow as fast as the number of operations, the limit is too
+ *			   low for the files in use.
+ *
+ * Parameters: reopens	- Will contain the number of files opened again.
+ *			   closes	- Will contain the number of files closed.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *
+ */
 
-FNCLASS int d_keybuild(fn)
-void (*fn)PRM((char *, ulong, ulong);)
+FNCLASS int d_filestat(reopens, closes)
+ulong *reopens, *closes;
 {
-	typhoon.do_rebuild = 1;
-	rebuildverbose_fn = fn;
-	return S_OKAY;
+	*reopens = typhoon.file_reopens;
+	*closes	 = typhoon.file_closes;
+
+	RETURN S_OKAY;
 }
 
 
-static int perform_rebuild(biggest_rec)
-unsigned biggest_rec;
-{
-	ulong		recno;
-	ulong		recid;
-	ulong		datasize;
-	ulong		records;
-	char		*buf;
-	int 		fh, i;
-	Record		*rec;
-	RECORD		filehd;
-	char		fname[128];
-	int			preamble;
-	int			foreign_keys;
-	
-	if( (buf = (void *)malloc(biggest_rec)) == NULL )
-		RETURN S_NOMEM;
+/*------------------------------- d_recbitmap ------------------------------*\
+ *
+ * Purpose	 : Selects the organization of record files created from now
+ *			   on. Existing files keep their organization.
+ *
+ * Parameters: on		- 1 = free-space bitmap, 0 = delete chain.
+ *
+ * Returns	 : S_OKAY
+ *
+ */
 
-	for( i=0, rec=DB->record; i<DB->header.records; i++, rec++ )
-	{
-		sprintf(fname, "%s%c%s_tmp", DB->dbfpath, DIR_SWITCH, 
-			DB->file[rec->fileid].name);
+FNCLASS int d_recbitmap(on)
+int on;
+{
+	typhoon.rec_bitmap = on;
 
-		fh = os_open(fname, O_RDWR|CONFIG_O_BINARY, 0);
-		read(fh, &filehd.H, sizeof filehd.H);
+	RETURN S_OKAY;
+}
 
-		recno 	= (sizeof(filehd.H) + filehd.H.recsize - 1) / filehd.H.recsize;
-		recid 	= INTERN_TO_RECID(i);
-		records	= lseek(fh, 0, SEEK_END) / filehd.H.recsize;
 
-		rebuildverbose_fn(rec->name, records, 0);
+/*------------------------------ d_vlrcompress -----------------------------*\
+ *
+ * Purpose	 : Selects whether the records in variable length record files
+ *			   created from now on are compressed. Existing files are not
+ *			   affected.
+ *
+ * Parameters: on		- 1 = compress records, 0 = store records as is.
+ *
+ * Returns	 : S_OKAY
+ *
+ */
 
-		if( rec->first_foreign == -1 )
-			foreign_keys = 0;
-		else
-			foreign_keys = rec->keys - (rec->first_foreign - rec->first_key);
-		preamble= sizeof(long) * foreign_keys + offsetof(RECORDHEAD, data[0]);
-		datasize= filehd.H.recsize - preamble;
+FNCLASS int d_vlrcompress(on)
+int on;
+{
+	typhoon.vlr_compress = on;
 
-		for( ;; )
-		{
-			lseek(fh, (off_t) (filehd.H.recsize * recno + preamble), SEEK_SET);
-			if( read(fh, buf, datasize) != datasize )
-				break;
-			
-			if( d_fillnew(recid, buf) != S_OKAY )
-				printf("%s: d_fillnew failed\n", rec->name);
+	RETURN S_OKAY;
+}
 
-			recno++;
 
-			rebuildverbose_fn(rec->name, records, recno);
-		}
-		
-		close(fh);
-		unlink(fname);
+/*------------------------------ d_keycompress -----------------------------*\
+ *
+ * Purpose	 : Selects whether the nodes of index files created from now on
+ *			   are compressed. Compressed index files can only be opened in
+ *			   exclusive mode, so files created by a database opened in
+ *			   shared mode are never compressed. Existing files are not
+ *			   affected.
+ *
+ * Parameters: on		- 1 = compress nodes, 0 = store nodes as is.
+ *
+ * Returns	 : S_OKAY
+ *
+ */
 
-		rebuildverbose_fn(rec->name, records, records);
-	}		
-	free(buf);
+FNCLASS int d_keycompress(on)
+int on;
+{
+	typhoon.key_compress = on;
 
 	RETURN S_OKAY;
 }
 
 
 
+FNCLASS int d_keybuild(fn)
+void (*fn)PRM((char *, ulong, ulong);)
+{
+	typhoon.do_rebuild = 1;
+	rebuildverbose_fn = fn;
+	return S_OKAY;
+}
+
+
+/*----------------------------- d_keybuildprocs ----------------------------*\
+ *
+ * Purpose	 : Sets the number of processes used to rebuild the indexes
+ *			   when the database is opened after d_keybuild(). The index
+ *			   files are divided between the processes. Only UNIX supports
+ *			   more than one process.
+ *
+ * Parameters: procs	- Number of processes.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_INVPARM- <procs> is less than 1.
+ *
+ */
+
+FNCLASS int d_keybuildprocs(procs)
+int procs;
+{
+	if( procs < 1 )
+		RETURN S_INVPARM;
+
+	typhoon.rebuild_procs = procs;
+
+	RETURN S_OKAY;
+}
+
+
 /*--------------------------------- d_open ---------------------------------*\
  *
  * Purpose	 : Opens a database of the name <dbname>. The dbd-file is
@@ -316,7 +368,11 @@ unsigned biggest_rec;
  *
  *			   If the database is opened in exclusive or one-user mode the
  *			   first file is locked. This will make future calls to d_open()
- *			   return S_UNAVAIL.
+ *			   return S_NOTAVAIL.
+ *
+ *			   If a d_reccluster() was interrupted while it replaced the
+ *			   data files, the new files are swapped in and all the indexes
+ *			   are rebuilt, as after d_keybuild().
  *
  * Parameters: dbname		- Database name.
  *			   mode			- [s]hared, e[x]clusive or [o]ne user mode.
@@ -424,34 +480,53 @@ char *dbname, *mode;
 	}
 #endif
 
+	if( stats_open(DB) != S_OKAY )
+	{
+		seq_close(DB);
+		ty_unlock();
+		free(DB->dbd);
+#ifdef CONFIG_UNIX
+		shm_free(DB);
+#endif
+		RETURN S_NOMEM;
+	}
+
+	/* If the cache cannot be allocated, records are read from disk */
+	DB->biggest_rec	 = biggest_rec;
+	DB->cache_hits	 = 0;
+	DB->cache_misses = 0;
+	cache_open(DB, typhoon.cache_slots);
+	DB->parent_cache  = NULL;
+	DB->parent_hits	  = 0;
+	DB->parent_misses = 0;
+	DB->loading = NULL;
+#ifdef CONFIG_UNIX
+	DB->key_gen = DB->shm->key_gen;
+#endif
+	db_status = S_OKAY;
+
 	DB->recbuf = DB->real_recbuf;
     DB->clients++;
 
-	/* If the indices should be rebuilt we'll remove them first */
+	/* A d_reccluster() that stopped while it replaced data files is
+	 * finished here, and the indexes are rebuilt from the new files.
+	 */
+	if( reorg_recover() )
+		typhoon.do_rebuild = 1;
+
+	/* If the indices should be rebuilt we'll remove them first. The data
+	 * files are left in place and read by load_rebuild().
+	 */
 	if( typhoon.do_rebuild )
 	{
 		char fname[256];
-		char new_fname[256];
 
 		for( i=0; i<DB->header.files; i++ )
-			if( DB->file[i].type == 'k' )
+			if( DB->file[i].type == 'k' || DB->file[i].type == 'r' )
 			{
 				sprintf(fname, "%s%c%s", typhoon.dbfpath, DIR_SWITCH, DB->file[i].name);
 				unlink(fname);
 			}
-			else
-			{
-				sprintf(fname, "%s%c%s", typhoon.dbfpath, DIR_SWITCH, DB->file[i].name);
-				sprintf(new_fname, "%s_tmp", fname);
-				unlink(new_fname);
-#ifndef	CONFIG_UNIX
-				rename(fname, new_fname);
-#else
-				if (link(fname, new_fname) == 0)
-					if (unlink(fname) != 0)
-						unlink(new_fname);
-#endif
-			}
 	}
 
 	/* Before opening the database we mark all file handles are closed */
@@ -474,6 +549,9 @@ char *dbname, *mode;
 #ifdef CONFIG_UNIX
 		shm_free(DB);
 #endif
+		stats_close(DB);
+		cache_close(DB);
+		parentcache_close(DB);
 		free(DB->real_recbuf);
 		free(DB->dbd);
 		seq_close(DB);
@@ -487,13 +565,21 @@ char *dbname, *mode;
 	CURR_BUFREC		= 0;
 	CURR_BUFRECID	= 0;
 
+	typhoon.dbs_open++;
+
+	/* A database with incomplete indexes is closed again */
 	if( typhoon.do_rebuild )
 	{
-		perform_rebuild(biggest_rec);
 		typhoon.do_rebuild = 0;
+		if( (i = load_rebuild(typhoon.rebuild_procs, rebuildverbose_fn)) != S_OKAY )
+		{
+			ty_unlock();
+			d_close();
+			RETURN i;
+		}
+		reorg_finish();
 	}
 
-	typhoon.dbs_open++;
 	ty_unlock();
 
 	/* Return the status of the last db_open command */
@@ -520,6 +606,10 @@ FNCLASS int d_close()
     if( CURR_DB == -1 )
         RETURN_RAP(S_NOCD);
 
+	/* Build the indexes of a load that was not ended */
+	if( DB->loading )
+		d_loadend();
+
 	ty_lock();
 
 	DB->clients--;
@@ -536,6 +626,9 @@ FNCLASS int d_close()
 	d_abortwork();
 	shm_free(DB);
 #endif
+	stats_close(DB);
+	cache_close(DB);
+	parentcache_close(DB);
 	FREE(DB->dbd);
 	FREE(DB->real_recbuf);
 
@@ -579,6 +672,10 @@ char *dbname;
     File    *file;
     Dbentry *_db = typhoon.dbtab;
 
+	/* The locking resource may not be open if no database has been opened */
+	if( ty_openlock() == -1 )
+		RETURN S_FATAL;
+
 	ty_lock();
 
     for( i=0; i<DB_MAX; i++, _db++ )        /* Find database name in table  */
@@ -607,8 +704,16 @@ char *dbname;
         close(dbdfile);
 
         for( i=0; i < header.files; i++ )   /* Now remove all files         */
+        {
             unlink(file[i].name);
 
+			if( file[i].type == 'd' )		/* Remove free-space bitmap		*/
+			{
+				sprintf(fname, "%s.fsm", file[i].name);
+				unlink(fname);
+			}
+        }
+
 		ty_unlock();
         RETURN S_OKAY;
     }
@@ -618,6 +723,12 @@ char *dbname;
     {
 		ty_closefile(DB->fh + i);           /* Close all database files     */
         unlink(DB->file[i].name);           /* and remove them              */
+
+		if( DB->file[i].type == 'd' )		/* Remove free-space bitmap		*/
+		{
+			sprintf(fname, "%s.fsm", DB->file[i].name);
+			unlink(fname);
+		}
     }
 
 	FREE(DB->dbd);
@@ -71,6 +71,10 @@ void	 update_foreign_keys	PRM( (Record *, int);					)
 int		 check_foreign_keys 	PRM( (Record *, void *, int);			)
 void	 delete_foreign_keys	PRM( (Record *);						)
 int		 check_dependent_tables PRM( (Record *, void *, int); 			)
+int		 cascade_dependents		PRM( (Record *);						)
+int		 find_parent			PRM( (Key *, void *, ulong *);			)
+void	 set_foreign_keys		PRM( (Record *, void *, ulong *);		)
+void	 parentcache_close		PRM( (Dbentry *);						)
 
 
 /*--------------------------------- ty_io.c --------------------------------*/
@@ -79,6 +83,12 @@ int      ty_closefile   PRM( (Fh *);      		                        )
 int		 ty_keyadd		PRM( (Key *, void *, ulong);   	   	  			)
 int      ty_keydel      PRM( (Key *, void *, ulong);   	   	  			)
 int		 ty_keyfind		PRM( (Key *, void *, ulong *); 	   	  			)
+int		 ty_keytest		PRM( (Key *, void *, ulong *); 	   	  			)
+int		 ty_keybloom	PRM( (Key *, ulong);						 	)
+int		 ty_keystamp	PRM( (Key *, ulong *);							)
+int		 ty_keycopy		PRM( (Key *, char *);							)
+int		 ty_keyswap		PRM( (Key *, char *);							)
+int		 ty_keydelall	PRM( (Key *);									)
 int		 ty_keyread		PRM( (Key *, void *);		   		  			)
 int		 ty_keyfrst		PRM( (Key *, ulong *);		   		  			)
 int		 ty_keylast		PRM( (Key *, ulong *);		   	   	  			)
@@ -99,11 +109,60 @@ int		 ty_vlradd		PRM( (Record *, void *, unsigned, ulong *);		)
 int		 ty_vlrwrite	PRM( (Record *, void *, unsigned, ulong); 		)
 unsigned ty_vlrread		PRM( (Record *, void *, ulong, unsigned *);		)
 int		 ty_vlrdel		PRM( (Record *, ulong);							)
+int		 ty_vlrnext		PRM( (Record *, ulong *);						)
 int		 ty_reccurr		PRM( (Record *, ulong *);						)
+int		 ty_recsetcurr	PRM( (Record *, ulong);							)
+int		 ty_recslots	PRM( (Record *, void *, ulong *, unsigned, unsigned *);)
+int		 ty_recrange	PRM( (Record *, ulong *, ulong *);				)
+int		 ty_recappend	PRM( (Record *, int);							)
+int		 ty_recclone	PRM( (Record *, char *, Fh *);					)
+int		 ty_recdup		PRM( (Record *, char *, Fh *);					)
+int		 ty_reccopy		PRM( (Record *, Fh *, void *, ulong, ulong *);	)
+int		 ty_recput		PRM( (Record *, Fh *, void *, unsigned, ulong);	)
+int		 ty_recclose	PRM( (Fh *);									)
+int		 ty_recreplace	PRM( (Record *, Fh *, char *);					)
+void	 ty_recdiscard	PRM( (Fh *, char *);							)
+int		 ty_keyload		PRM( (Key *, int);								)
 int		 ty_closeafile	PRM( (void); )
+int		 ty_reopenfile	PRM( (Fh *);									)
 
 void	 ty_logerror	PRM( (char *, ...); )
 
+/*------------------------------- ty_bloom.c -------------------------------*/
+int		 bloom_open		PRM( (Key *, INDEX *);							)
+void	 bloom_close	PRM( (INDEX *);									)
+void	 bloom_add		PRM( (Key *, INDEX *, void *);					)
+int		 bloom_test		PRM( (Key *, INDEX *, void *);					)
+int		 bloom_create	PRM( (Key *, INDEX *, ulong);					)
+
+/*------------------------------- ty_cache.c -------------------------------*/
+int		 cache_open		PRM( (Dbentry *, int);							)
+void	 cache_close	PRM( (Dbentry *);								)
+int		 cache_fetch	PRM( (Record *, ulong, void *);					)
+void	 cache_store	PRM( (Record *, ulong, void *, unsigned);		)
+void	 cache_forget	PRM( (Record *, ulong);							)
+
+/*-------------------------------- ty_load.c -------------------------------*/
+int		 load_open		PRM( (INDEX *);									)
+int		 load_add		PRM( (INDEX *, void *, ulong);					)
+int		 load_find		PRM( (INDEX *, void *, ulong *);				)
+int		 load_close		PRM( (Key *, INDEX *);							)
+int		 load_rebuild	PRM( (int, void (*)(char *, ulong, ulong));		)
+int		 load_reindex	PRM( (char *);									)
+
+/*-------------------------------- ty_reorg.c ------------------------------*/
+int		 reorg_recover	PRM( (void);									)
+void	 reorg_finish	PRM( (void);									)
+
+/*-------------------------------- ty_snap.c -------------------------------*/
+void	 snap_save		PRM( (SNAP *, int, char *, unsigned);			)
+void	 snap_free		PRM( (SNAP *);									)
+void	 snap_mark		PRM( (SNAP *, char *, ulong);					)
+
+/*------------------------------- ty_stats.c -------------------------------*/
+int		 stats_open		PRM( (Dbentry *);								)
+void	 stats_close	PRM( (Dbentry *);								)
+
 /*------------------------------- ty_repl.c --------------------------------*/
 void	 ty_log			PRM( (int); )
 
@@ -137,9 +196,20 @@ int		btree_keyread			PRM( (INDEX *, void *);					)
 /*-------------------------------- bt_del.c --------------------------------*/
 int     btree_del		PRM( (INDEX *, void *, ulong);					)
 
+/*------------------------------- bt_build.c -------------------------------*/
+BTBUILD *btree_buildopen	PRM( (INDEX *, int);						)
+int		btree_buildadd	PRM( (BTBUILD *, void *, ulong);				)
+int		btree_buildclose	PRM( (BTBUILD *);							)
+int		btree_copy		PRM( (INDEX *, INDEX *, int);					)
+
 /*--------------------------------- bt_io.c --------------------------------*/
 ix_addr noderead        PRM( (INDEX *, char *, ix_addr);                )
 ix_addr nodewrite       PRM( (INDEX *, char *, ix_addr);                )
+void	nodefree		PRM( (INDEX *, ix_addr);						)
+void	nodecache_reset	PRM( (INDEX *);									)
+int		nodemap_open	PRM( (INDEX *);									)
+void	nodemap_close	PRM( (INDEX *);									)
+void	nodemap_reset	PRM( (INDEX *);									)
 
 /*-------------------------------- record.c --------------------------------*/
 RECORD  *rec_open     	PRM( (char *, unsigned, int);				    )
@@ -158,6 +228,11 @@ int      rec_next     	PRM( (RECORD *, void *);						)
 int      rec_prev     	PRM( (RECORD *, void *);						)
 int		 rec_lock		PRM( (RECORD *, ulong, int);			     	)
 int		 rec_unlock		PRM( (RECORD *, ulong);							)
+int		 rec_setcurr	PRM( (RECORD *, ulong);							)
+unsigned rec_readslots	PRM( (RECORD *, void *, ulong *, unsigned);		)
+void	 rec_slots		PRM( (RECORD *, ulong *, ulong *);				)
+int		 rec_addbegin	PRM( (RECORD *);								)
+int		 rec_addend		PRM( (RECORD *);								)
 
 /*------------------------------- sequence.c -------------------------------*/
 int		seq_open		PRM( (Dbentry *); )
@@ -168,11 +243,16 @@ void	 vlr_close		PRM( (VLR *);									)
 VLR		*vlr_open		PRM( (char *, unsigned, int);					)
 int		 vlr_add		PRM( (VLR *, void *, unsigned, ulong *);		)
 int		 vlr_write		PRM( (VLR *, void *, unsigned, ulong);			)
-int		 vlr_read		PRM( (VLR *, void *, ulong, unsigned *);		)
+int		 vlr_read		PRM( (VLR *, void *, unsigned, ulong, unsigned *);)
 int		 vlr_del		PRM( (VLR *, ulong);							)
+int		 vlr_next		PRM( (VLR *, ulong *);							)
 int		 vlr_dynclose	PRM( (VLR *);									)
 int		 vlr_dynopen	PRM( (VLR *);									)
 
+/*----------------------------------- lz.c ---------------------------------*/
+unsigned lz_compress	PRM( (void *, unsigned, void *, unsigned);		)
+long	 lz_uncompress	PRM( (void *, unsigned, void *, unsigned);		)
+
 /*---------------------------------- readdbd.c -----------------------------*/
 
 int		 read_dbdfile	PRM( (Dbentry *, char *);						)
@@ -183,6 +263,8 @@ int		os_unlock		PRM ( (int, long, unsigned); 					)
 int		os_open			PRM ( (char *, int, int);						)
 int		os_close		PRM ( (int);									)
 int		os_access		PRM ( (char *, int);							)
+ulong	stats_clock		PRM ( (DB_STATS *);								)
+void	stats_io		PRM ( (DB_STATS *, int, ulong, ulong);			)
 
 
 /*--------------------------------- osxxx.c --------------------------------*/
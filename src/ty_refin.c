@@ -28,15 +28,45 @@
  * Description:
  *   This file contains function for handling referential integrity.
  *
+ *   Parents found by find_parent() are kept in a small direct mapped
+ *   cache, so that dependent records referring to the same few parents do
+ *   not search the parent's primary key index every time. A cached
+ *   reference is only used if the timestamp of the index is unchanged,
+ *   i.e. no key has been deleted from it since the parent was found.
+ *   Keys added to the index do not affect the parents already found, so
+ *   only successful searches are cached.
+ *
+ *   When a foreign key has the cascade rule, deleting or updating the
+ *   parent deletes or updates the dependent records too. The dependents
+ *   are found through the parent table's reference file, whose entries are
+ *   ordered by parent, and are first checked for restrict rules before any
+ *   record is changed. The check of an update also keeps the old and new
+ *   contents of every dependent, so that keys which would collide within the
+ *   cascade are found before anything is written. If a cascade nevertheless
+ *   fails half way, the records already changed are changed back; deleted
+ *   records are added again, but get new record numbers.
+ *
  * Functions:
  *   update_foreign_keys
  *   check_foreign_keys
+ *   set_foreign_keys
+ *   find_parent
+ *   parentcache_close
  *   delete_foreign_keys
  *   check_dependent_tables
+ *   cascade_dependents
  *
  *--------------------------------------------------------------------------*/
 
+#include "environ.h"
 #include <sys/types.h>
+#ifdef CONFIG_UNIX
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include "typhoon.h"
@@ -44,10 +74,33 @@
 #include "ty_type.h"
 #include "ty_glob.h"
 #include "ty_prot.h"
+#include "ty_log.h"
 
 static CONFIG_CONST char rcsid[] = "$Id: ty_refin.c,v 1.5 1999/10/03 23:28:29 kaz Exp $";
 
+#define CASCADE_BATCH	256			/* Dependents deleted at a time			*/
+#define CASCADE_DEPTH	32			/* Maximum nesting of update cascades	*/
+
 /*--------------------------- Function prototypes --------------------------*/
+static ulong	casc_find		PRM( (ulong, ulong);						)
+static int		casc_add		PRM( (ulong, ulong);						)
+static int		casc_addrow		PRM( (Record *, ulong *);					)
+static void		casc_reset		PRM( (void);								)
+static int		addrcmp			PRM( (CONFIG_CONST void *, CONFIG_CONST void *);)
+static int		rowcmp			PRM( (CONFIG_CONST void *, CONFIG_CONST void *);)
+static int		has_cascade		PRM( (Record *, int);						)
+static int		ref_entries		PRM( (Record *, ulong, REF_ENTRY **, ulong *);)
+static int		dependent_rule	PRM( (Record *, Record *, ulong, int);		)
+static void		copy_parent_key	PRM( (Record *, char *, Record *, ulong, char *);)
+static int		change_keys		PRM( (Record *, char *, char *, int, int *);)
+static int		write_dependent	PRM( (Record *, char *, char *);			)
+static int		cascade_update	PRM( (Record *, ulong, char *, int);		)
+static int		check_cascade_keys PRM( (void);								)
+static int		update_dependents PRM( (void);								)
+static int		collect_deletes	PRM( (void);								)
+static int		restore_record	PRM( (Record *, char *, char *);			)
+static void		undo_deletes	PRM( (char *, ulong);						)
+static int		delete_dependents PRM( (void);								)
 
 /*---------------------------- Global variables ----------------------------*/
 /* The ca[] table is a Communications Area used to pass information between
@@ -64,6 +117,27 @@ struct {
 								/* inserted, e.g. the key is not null		*/
 } ca[RECKEYS_MAX];
 
+/* The records reached by a cascade are kept in <casc_set> between
+   check_dependent_tables() and cascade_dependents(). <casc_hash> is used to
+   add each record only once. For an update <casc_rows> holds the old and
+   new contents of each record, as the application sees them.
+*/
+static DB_ADDR	*casc_set;			/* Records reached. [0] = the parent	*/
+static ulong	 casc_count;		/* Number of records in <casc_set>		*/
+static ulong	 casc_alloc;		/* Entries allocated in <casc_set>		*/
+static ulong	*casc_hash;			/* Index+1 of records in <casc_set>		*/
+static ulong	 casc_hashsize;		/* Slots in <casc_hash> (power of 2)	*/
+static int		 casc_action;		/* Pending cascade: 'd', 'u' or 0		*/
+static char		*casc_rows;			/* New and old rows of updated records	*/
+static ulong	 casc_rowalloc;		/* Entries allocated in <casc_rows>		*/
+
+#define CASC_NEW(i)	(casc_rows + (i) * 2 * DB->biggest_rec)
+#define CASC_OLD(i)	(CASC_NEW(i) + DB->biggest_rec)
+
+static Key		*sort_key;			/* Key used by rowcmp()					*/
+static char		*sort_buf;			/* Rows compared by rowcmp()			*/
+static unsigned	 sort_size;			/* Size of a row						*/
+
 
 
 
@@ -169,8 +243,6 @@ int is_new;
 
 	for( n=0; KEY_ISFOREIGN(key) && n < foreign_keys; n++, key++ )
 	{
-		Key *primary_key = DB->key + DB->record[key->parent].first_key;
-
 		ca[n].null = 0;
 
 		if( is_new || reckeycmp(key, buf, DB->recbuf) )
@@ -194,9 +266,7 @@ int is_new;
 				}
 			}
 
-		    CURR_KEY = primary_key - DB->key;
-
-			if( ty_keyfind(primary_key, set_keyptr(key, buf), &ref) != S_OKAY )
+			if( find_parent(key, buf, &ref) != S_OKAY )
 			{
             	db_subcode = (key->parent+1) * REC_FACTOR;
 				RETURN S_FOREIGN;
@@ -217,6 +287,132 @@ int is_new;
 
 
 
+/*---------------------------- set_foreign_keys ----------------------------*\
+ *
+ * Purpose	 : Sets up the communications area and the preamble of a new
+ *			   record whose parents have already been found, e.g. by
+ *			   d_fillbatch(). This replaces check_foreign_keys() for the
+ *			   record.
+ *
+ * Parameters: rec			- Pointer to record.
+ *			   buf			- Buffer of dependent record.
+ *			   refs			- The parent of each foreign key. 0 = null key.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+void set_foreign_keys(rec, buf, refs)
+Record *rec;
+void *buf;
+ulong *refs;
+{
+	Key *key;
+	int n;
+	int foreign_keys;
+
+	if( rec->first_foreign == -1 )
+		return;
+
+	key			 = DB->key + rec->first_foreign;
+	foreign_keys = rec->keys - (rec->first_foreign - rec->first_key);
+
+	for( n=0; KEY_ISFOREIGN(key) && n < foreign_keys; n++, key++ )
+	{
+		ca[n].ref_file	 = DB->record[key->parent].ref_file;
+		ca[n].del_parent = 0;
+		ca[n].null		 = !refs[n];
+
+		((ulong *)DB->real_recbuf)[n] = refs[n];
+	}
+}
+
+
+
+/*------------------------------- find_parent ------------------------------*\
+ *
+ * Purpose	 : Finds the parent record that a foreign key refers to. The
+ *			   parent cache is searched first, then the primary key index
+ *			   of the parent table.
+ *
+ * Parameters: key			- Pointer to foreign key.
+ *			   buf			- Buffer of dependent record.
+ *			   ref			- Will contain the parent's record number.
+ *
+ * Returns	 : S_OKAY		- The parent was found.
+ *			   S_NOTFOUND	- The parent does not exist.
+ *
+ */
+int find_parent(key, buf, ref)
+Key *key;
+void *buf;
+ulong *ref;
+{
+	Key *primary_key = DB->key + DB->record[key->parent].first_key;
+	ParentSlot *slot = NULL;
+	char *value;
+	ulong stamp, hash;
+	int i, rc;
+
+	value = (char *)set_keyptr(key, buf);
+
+	/* Without a parent cache every parent is looked up in its index */
+	if( !DB->parent_cache )
+		DB->parent_cache = (ParentSlot *)calloc(PARENTCACHE_SLOTS,
+												sizeof(ParentSlot));
+
+	if( DB->parent_cache && ty_keystamp(primary_key, &stamp) == S_OKAY )
+	{
+		for( hash=primary_key->fileid, i=0; i<key->size; i++ )
+			hash = hash * 31 + (uchar)value[i];
+
+		slot = DB->parent_cache + hash % PARENTCACHE_SLOTS;
+
+		if( slot->ref && slot->fileid == primary_key->fileid
+		&&	slot->stamp == stamp && !memcmp(slot->value, value, key->size) )
+		{
+			DB->parent_hits++;
+			*ref = slot->ref;
+			return S_OKAY;
+		}
+	}
+
+	DB->parent_misses++;
+	CURR_KEY = primary_key - DB->key;
+
+	if( (rc = ty_keytest(primary_key, value, ref)) == S_OKAY && slot )
+	{
+		slot->fileid = primary_key->fileid;
+		slot->stamp	 = stamp;
+		slot->ref	 = *ref;
+		memcpy(slot->value, value, key->size);
+	}
+
+	return rc;
+}
+
+
+
+/*---------------------------- parentcache_close ---------------------------*\
+ *
+ * Purpose	 : Frees the parent cache of a database.
+ *
+ * Parameters: _db			- Pointer to database entry.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+void parentcache_close(_db)
+Dbentry *_db;
+{
+	if( _db->parent_cache )
+	{
+		free(_db->parent_cache);
+		_db->parent_cache = NULL;
+	}
+}
+
+
+
 /*-------------------------- delete_foreign_keys ---------------------------*\
  *
  * Purpose	 : This function removes all refentries from a dependent record's
@@ -260,69 +456,1241 @@ Record *rec;
 
 
 
-/*------------------------- check_dependent_tables -------------------------*\
+/*-------------------------------- casc_find -------------------------------*\
+ *
+ * Purpose	 : Finds the slot of a record in the hash table of the records
+ *			   reached by a cascade.
+ *
+ * Parameters: recid		- Internal record id.
+ *			   recno		- Record number.
+ *
+ * Returns	 : The slot of the record, or the empty slot where it belongs.
+ *
+ */
+static ulong casc_find(recid, recno)
+ulong recid;
+ulong recno;
+{
+	ulong h = (recno * 31 + recid) & (casc_hashsize - 1);
+	ulong i;
+
+	while( (i = casc_hash[h]) != 0
+	&&	   (casc_set[i-1].recid != recid || casc_set[i-1].recno != recno) )
+		h = (h + 1) & (casc_hashsize - 1);
+
+	return h;
+}
+
+
+
+/*-------------------------------- casc_add --------------------------------*\
+ *
+ * Purpose	 : Adds a record to the set of records reached by a cascade.
+ *
+ * Parameters: recid		- Internal record id.
+ *			   recno		- Record number.
+ *
+ * Returns	 : S_OKAY		- Ok (the record may already have been there).
+ *			   S_NOMEM		- Out of memory.
+ *
+ */
+static int casc_add(recid, recno)
+ulong recid;
+ulong recno;
+{
+	DB_ADDR *set;
+	ulong *hash, h, i;
+
+	/* Keep the hash table at most half full */
+	if( casc_count * 2 >= casc_hashsize )
+	{
+		h = casc_hashsize ? casc_hashsize * 2 : 1024;
+
+		if( !(hash = (ulong *)calloc(h, sizeof *hash)) )
+			RETURN S_NOMEM;
+
+		free(casc_hash);
+		casc_hash	  = hash;
+		casc_hashsize = h;
+
+		for( i=0; i<casc_count; i++ )
+			casc_hash[casc_find(casc_set[i].recid, casc_set[i].recno)] = i + 1;
+	}
+
+	h = casc_find(recid, recno);
+
+	if( casc_hash[h] )
+		return S_OKAY;
+
+	if( casc_count == casc_alloc )
+	{
+		i = casc_alloc ? casc_alloc * 2 : 1024;
+
+		if( !(set = (DB_ADDR *)realloc(casc_set, i * sizeof *set)) )
+			RETURN S_NOMEM;
+
+		casc_set   = set;
+		casc_alloc = i;
+	}
+
+	casc_set[casc_count].recid = recid;
+	casc_set[casc_count].recno = recno;
+	casc_hash[h] = ++casc_count;
+
+	return S_OKAY;
+}
+
+
+
+/*------------------------------- casc_addrow ------------------------------*\
+ *
+ * Purpose	 : Adds the current record to the set of records reached by an
+ *			   update cascade. The first time a record is added, its
+ *			   contents in DB->recbuf are stored as both its old and its
+ *			   new contents.
+ *
+ * Parameters: rec			- Pointer to record.
+ *			   index		- Will contain the index of the record in
+ *							  <casc_set>.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   S_NOMEM		- Out of memory.
+ *
+ */
+static int casc_addrow(rec, index)
+Record *rec;
+ulong *index;
+{
+	ulong count = casc_count, i;
+	char *rows;
+	int rc;
+
+	if( (rc = casc_add(CURR_RECID, CURR_REC)) != S_OKAY )
+		return rc;
+
+	*index = i = casc_hash[casc_find(CURR_RECID, CURR_REC)] - 1;
+
+	if( casc_count == count )
+		return S_OKAY;
+
+	if( casc_rowalloc < casc_alloc )
+	{
+		if( !(rows = (char *)realloc(casc_rows,
+							(size_t) casc_alloc * 2 * DB->biggest_rec)) )
+			RETURN S_NOMEM;
+
+		casc_rows	  = rows;
+		casc_rowalloc = casc_alloc;
+	}
+
+	if( rec->is_vlr )
+	{
+		if( (rc = compress_vlr(UNCOMPRESS, rec, CASC_OLD(i), DB->recbuf, NULL)) != S_OKAY )
+			return rc;
+	}
+	else
+		memcpy(CASC_OLD(i), DB->recbuf, rec->size);
+
+	memcpy(CASC_NEW(i), CASC_OLD(i), rec->size);
+
+	return S_OKAY;
+}
+
+
+
+/*------------------------------- casc_reset -------------------------------*\
+ *
+ * Purpose	 : Forgets the records reached by the last cascade.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+static void casc_reset()
+{
+	free(casc_set);
+	free(casc_hash);
+	free(casc_rows);
+	casc_set	  = NULL;
+	casc_hash	  = NULL;
+	casc_rows	  = NULL;
+	casc_count	  = 0;
+	casc_alloc	  = 0;
+	casc_hashsize = 0;
+	casc_rowalloc = 0;
+	casc_action	  = 0;
+}
+
+
+
+/*-------------------------------- addrcmp ---------------------------------*\
+ *
+ * Purpose	 : qsort() function that orders database addresses by record
+ *			   id and record number.
+ *
+ * Parameters: a			- Pointer to address.
+ *			   b			- Pointer to address.
+ *
+ * Returns	 : < 0, 0 or > 0.
+ *
+ */
+static int addrcmp(a, b)
+CONFIG_CONST void *a, *b;
+{
+	CONFIG_CONST DB_ADDR *x = (CONFIG_CONST DB_ADDR *)a;
+	CONFIG_CONST DB_ADDR *y = (CONFIG_CONST DB_ADDR *)b;
+
+	if( x->recid != y->recid )
+		return x->recid < y->recid ? -1 : 1;
+
+	return x->recno < y->recno ? -1 : x->recno > y->recno;
+}
+
+
+
+/*--------------------------------- rowcmp ---------------------------------*\
+ *
+ * Purpose	 : qsort() function that compares two rows in <sort_buf> by the
+ *			   value of <sort_key>.
+ *
+ * Parameters: a			- Pointer to row number.
+ *			   b			- Pointer to row number.
+ *
+ * Returns	 : < 0, 0 or > 0.
+ *
+ */
+static int rowcmp(a, b)
+CONFIG_CONST void *a, *b;
+{
+	return reckeycmp(sort_key, sort_buf + *(unsigned *)a * sort_size,
+							   sort_buf + *(unsigned *)b * sort_size);
+}
+
+
+
+/*------------------------------- has_cascade ------------------------------*\
  *
- * Purpose	 : This function is called by d_fillnew() and d_delete() to check
- *			   whether this update/delete operation will have any effect on
- *			   records in dependent tables.
+ * Purpose	 : Determines whether any foreign key that references a table
+ *			   has the cascade rule for an action.
  *
  * Parameters: parent		- Pointer to parent table's record pointer.
- *			   buf			- Buffer of dependent record.
  *			   for_action	- 'd'=delete, 'u'=update
  *
- * Returns	 : S_OKAY		- No conflicts.
- *			   S_RESTRICT	- A dependent table with restrict rule has rows
- *                            which referenced the parent table. db_subcode
- *						      contains the ID of the dependent table.
+ * Returns	 : 1 if a foreign key cascades, otherwise 0.
  *
  */
-int check_dependent_tables(parent, buf, for_action)
+static int has_cascade(parent, for_action)
 Record *parent;
-void *buf;
 int for_action;
 {
-	Key *primary_key, refkey;
-	REF_ENTRY refentry;
-	ulong ref;
-	int rc;
+	Key *key = DB->key;
+	int rule = for_action == 'd' ? KT_CASCADE : KT_CASCADEUPD;
+	int n;
 
-	/* Does this table have any dependent tables? */
-    if( !parent->dependents )
-    	return S_OKAY;
+	for( n=DB->header.keys; n--; key++ )
+		if( KEY_ISFOREIGN(key) && DB->record + key->parent == parent
+		&&	(key->type & rule) )
+			return 1;
 
-    /* If the table has dependent tables, it follows that it must also have
-     * a primary key, i.e. no need to check for that.
-     */
-	primary_key = DB->key + parent->first_key;
+	return 0;
+}
 
-	/* Only perform check if the primary key has changed (if update) */
-	if( for_action == 'u' )
-		if( !reckeycmp(primary_key, buf, DB->recbuf) )
-			return S_OKAY;
 
-	refentry.parent = CURR_REC;
+
+/*------------------------------- ref_entries ------------------------------*\
+ *
+ * Purpose	 : Reads the reference entries of a parent record from the
+ *			   reference file of its table. The entries of a parent are
+ *			   stored next to each other, so they are found with one search
+ *			   followed by a scan.
+ *
+ * Parameters: parent		- Pointer to parent table's record pointer.
+ *			   precno		- Record number of the parent.
+ *			   entries		- Will point to the entries. Must be freed by
+ *							  the caller.
+ *			   count		- Will contain the number of entries.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   S_NOMEM		- Out of memory.
+ *
+ */
+static int ref_entries(parent, precno, entries, count)
+Record *parent;
+ulong precno;
+REF_ENTRY **entries;
+ulong *count;
+{
+	Key refkey;
+	REF_ENTRY refentry, *list = NULL, *tmp;
+	ulong n = 0, alloc = 0, ref;
+	int rc;
+
+	refentry.parent			 = precno;
 	refentry.dependent.recid = 0;
 	refentry.dependent.recno = 0;
 
 	refkey.size	  = sizeof(REF_ENTRY);
-    refkey.fileid = parent->ref_file;
+	refkey.fileid = parent->ref_file;
 
 	if( (rc = ty_keyfind(&refkey, &refentry, &ref)) != S_OKAY )
 		rc = ty_keynext(&refkey, &ref);
 
-    if( rc != S_OKAY )
-    	return S_OKAY;
+	for( ; rc == S_OKAY; rc = ty_keynext(&refkey, &ref) )
+	{
+		refentry = *(REF_ENTRY *)CURR_KEYBUF;
 
-	refentry = *(REF_ENTRY *)CURR_KEYBUF;
+		if( refentry.parent != precno )
+			break;
 
-    if( refentry.parent == CURR_REC )
-    {
-    	/* Set db_subcode to the ID of the dependent table */
-    	db_subcode = (refentry.dependent.recid+1) * REC_FACTOR;
-    	RETURN S_RESTRICT;
+		if( n == alloc )
+		{
+			alloc = alloc ? alloc * 2 : 64;
+
+			if( !(tmp = (REF_ENTRY *)realloc(list, alloc * sizeof *list)) )
+			{
+				free(list);
+				RETURN S_NOMEM;
+			}
+			list = tmp;
+		}
+
+		list[n++] = refentry;
 	}
 
+	*entries = list;
+	*count	 = n;
+
 	return S_OKAY;
 }
 
+
+
+/*----------------------------- dependent_rule -----------------------------*\
+ *
+ * Purpose	 : Determines what must happen to the dependent record in
+ *			   DB->real_recbuf when its parent is deleted or updated.
+ *
+ * Parameters: rec			- Pointer to dependent record.
+ *			   parent		- Pointer to parent table's record pointer.
+ *			   precno		- Record number of the parent.
+ *			   for_action	- 'd'=delete, 'u'=update
+ *
+ * Returns	 : 1			- The action must be cascaded to the record.
+ *			   0			- The record does not refer to the parent.
+ *			   -1			- A foreign key with the restrict rule refers
+ *							  to the parent.
+ *
+ */
+static int dependent_rule(rec, parent, precno, for_action)
+Record *rec;
+Record *parent;
+ulong precno;
+int for_action;
+{
+	Key *key;
+	int n, foreign_keys, rule = 0;
+	int cascade = for_action == 'd' ? KT_CASCADE : KT_CASCADEUPD;
+
+	if( rec->first_foreign == -1 )
+		return 0;
+
+	key			 = DB->key + rec->first_foreign;
+	foreign_keys = rec->keys - (rec->first_foreign - rec->first_key);
+
+	for( n=0; KEY_ISFOREIGN(key) && n < foreign_keys; n++, key++ )
+	{
+		if( DB->record + key->parent != parent
+		||	((ulong *)DB->real_recbuf)[n] != precno )
+			continue;
+
+		if( KEY_ISOPTIONAL(key) && null_indicator(key, DB->recbuf) )
+			continue;
+
+		if( !(key->type & cascade) )
+			return -1;
+
+		rule = 1;
+	}
+
+	return rule;
+}
+
+
+
+/*---------------------------- copy_parent_key -----------------------------*\
+ *
+ * Purpose	 : Copies the new primary key of a parent to the foreign keys
+ *			   of the dependent record in DB->real_recbuf that refer to it.
+ *
+ * Parameters: rec			- Pointer to dependent record.
+ *			   buf			- Dependent record to update.
+ *			   parent		- Pointer to parent table's record pointer.
+ *			   precno		- Record number of the parent.
+ *			   pbuf			- New contents of the parent.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+static void copy_parent_key(rec, buf, parent, precno, pbuf)
+Record *rec;
+char *buf;
+Record *parent;
+ulong precno;
+char *pbuf;
+{
+	Key *key, *primary_key = DB->key + parent->first_key;
+	KeyField *fkf, *pkf;
+	int n, i, foreign_keys;
+
+	key			 = DB->key + rec->first_foreign;
+	foreign_keys = rec->keys - (rec->first_foreign - rec->first_key);
+
+	for( n=0; KEY_ISFOREIGN(key) && n < foreign_keys; n++, key++ )
+	{
+		if( DB->record + key->parent != parent
+		||	((ulong *)DB->real_recbuf)[n] != precno )
+			continue;
+
+		if( KEY_ISOPTIONAL(key) && null_indicator(key, DB->recbuf) )
+			continue;
+
+		fkf = DB->keyfield + key->first_keyfield;
+		pkf = DB->keyfield + primary_key->first_keyfield;
+
+		for( i=0; i<key->fields; i++, fkf++, pkf++ )
+			memcpy(buf  + DB->field[fkf->field].offset,
+				   pbuf + DB->field[pkf->field].offset,
+						  DB->field[fkf->field].size);
+	}
+}
+
+
+
+/*------------------------------ change_keys -------------------------------*\
+ *
+ * Purpose	 : Changes the keys of the current record that differ between
+ *			   two versions of the record. If a key cannot be added, its
+ *			   old value is put back and the function stops.
+ *
+ * Parameters: rec			- Pointer to record.
+ *			   from			- Contents whose keys are in the indexes.
+ *			   to			- Contents whose keys must replace them.
+ *			   keys			- Number of keys to consider.
+ *			   done			- Will contain the number of keys considered
+ *							  before the one that failed.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   Other		- A key could not be added. db_subcode contains
+ *							  the ID of the key.
+ *
+ */
+static int change_keys(rec, from, to, keys, done)
+Record *rec;
+char *from;
+char *to;
+int keys;
+int *done;
+{
+	Key *key = DB->key + rec->first_key;
+	int n, rc;
+
+	for( n=0; n<keys && !KEY_ISFOREIGN(key); n++, key++ )
+	{
+		if( !reckeycmp(key, to, from) )
+			continue;
+
+		if( !KEY_ISOPTIONAL(key) || !null_indicator(key, from) )
+			keydel(key, from, CURR_REC);
+
+		if( KEY_ISOPTIONAL(key) && null_indicator(key, to) )
+			continue;
+
+		if( (rc = keyadd(key, to, CURR_REC)) != S_OKAY )
+		{
+			if( !KEY_ISOPTIONAL(key) || !null_indicator(key, from) )
+				keyadd(key, from, CURR_REC);
+
+			set_subcode(key);
+			*done = n;
+			RETURN rc;
+		}
+	}
+
+	*done = n;
+
+	return S_OKAY;
+}
+
+
+
+/*---------------------------- write_dependent -----------------------------*\
+ *
+ * Purpose	 : Writes a dependent record whose foreign keys have been
+ *			   changed by a cascade. The preamble of the record must be in
+ *			   DB->real_recbuf. If the record cannot be written, its keys
+ *			   are changed back, so the record is either fully updated or
+ *			   not at all.
+ *
+ * Parameters: rec			- Pointer to dependent record.
+ *			   old			- Current contents of the record.
+ *			   buf			- New contents of the record.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   Other		- The record could not be updated.
+ *
+ */
+static int write_dependent(rec, old, buf)
+Record *rec;
+char *old;
+char *buf;
+{
+	int n, rc;
+
+	if( (rc = change_keys(rec, old, buf, rec->keys, &n)) != S_OKAY )
+	{
+		change_keys(rec, buf, old, n, &n);
+		RETURN rc;
+	}
+
+	if( rec->is_vlr )
+	{
+		unsigned size;
+
+		if( (rc = compress_vlr(COMPRESS, rec, DB->recbuf, buf, &size)) == S_OKAY )
+			rc = ty_vlrwrite(rec, DB->real_recbuf, size, CURR_REC);
+	}
+	else
+	{
+		memcpy(DB->recbuf, buf, rec->size);
+		rc = ty_recwrite(rec, DB->real_recbuf, CURR_REC);
+	}
+
+	if( rc != S_OKAY )
+	{
+		change_keys(rec, buf, old, rec->keys, &n);
+		RETURN rc;
+	}
+
+#ifdef CONFIG_UNIX
+	if( DB->logging )
+		ty_log('u');
+
+	log_update(CURR_RECID, CURR_REC, rec->size, buf);
+#endif
+
+	return S_OKAY;
+}
+
+
+
+/*----------------------------- cascade_update -----------------------------*\
+ *
+ * Purpose	 : Finds the records that refer to a parent whose primary key
+ *			   has changed, and computes their new contents in <casc_rows>.
+ *			   A dependent whose primary key changes as a result has its
+ *			   own dependents updated in turn. A record reached more than
+ *			   once gets all the changes. Nothing is written; every
+ *			   dependent is checked for the restrict rule, and its changed
+ *			   unique keys are looked up in the indexes.
+ *
+ * Parameters: parent		- Pointer to parent table's record pointer.
+ *			   precno		- Record number of the parent.
+ *			   pbuf			- New contents of the parent.
+ *			   depth		- Number of parents above <parent>.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   S_RESTRICT	- A dependent table with restrict rule has rows
+ *							  that refer to a changed parent, or the
+ *							  cascade is nested too deep. db_subcode
+ *							  contains the ID of the dependent table.
+ *			   S_DUPLICATE	- An updated dependent would get a duplicate
+ *							  key. db_subcode contains the ID of the key.
+ *			   S_NOMEM		- Out of memory.
+ *
+ */
+static int cascade_update(parent, precno, pbuf, depth)
+Record *parent;
+ulong precno;
+char *pbuf;
+int depth;
+{
+	Record *rec;
+	Key *key;
+	REF_ENTRY *list;
+	char *buf;
+	ulong n, i, j, ref;
+	int rc, k, changed;
+
+	if( depth >= CASCADE_DEPTH )
+	{
+		db_subcode = (parent - DB->record + 1) * REC_FACTOR;
+		RETURN S_RESTRICT;
+	}
+
+	if( (rc = ref_entries(parent, precno, &list, &n)) != S_OKAY )
+		return rc;
+
+	if( !n )
+		return S_OKAY;
+
+	if( !(buf = (char *)malloc(DB->biggest_rec)) )
+	{
+		free(list);
+		RETURN S_NOMEM;
+	}
+
+	for( i=0; i<n && rc == S_OKAY; i++ )
+	{
+		rec		   = DB->record + list[i].dependent.recid;
+		CURR_RECID = list[i].dependent.recid;
+		CURR_REC   = list[i].dependent.recno;
+
+		if( (rc = update_recbuf()) != S_OKAY )
+			break;
+
+		if( (k = dependent_rule(rec, parent, precno, 'u')) < 0 )
+		{
+			db_subcode = (list[i].dependent.recid + 1) * REC_FACTOR;
+			rc = db_status = S_RESTRICT;
+			break;
+		}
+
+		if( !k )
+			continue;
+
+		if( (rc = casc_addrow(rec, &j)) != S_OKAY )
+			break;
+
+		/* Apply the new parent key to the changes made so far */
+		memcpy(buf, CASC_NEW(j), rec->size);
+		copy_parent_key(rec, buf, parent, precno, pbuf);
+
+		changed = rec->dependents
+			   && reckeycmp(DB->key + rec->first_key, buf, CASC_NEW(j));
+
+		memcpy(CASC_NEW(j), buf, rec->size);
+
+		/* Check the unique keys that would change */
+		key = DB->key + rec->first_key;
+
+		for( k=rec->keys; k-- && !KEY_ISFOREIGN(key); key++ )
+		{
+			if( !(key->type & KT_UNIQUE) || !reckeycmp(key, buf, CASC_OLD(j)) )
+				continue;
+
+			if( KEY_ISOPTIONAL(key) && null_indicator(key, buf) )
+				continue;
+
+			if( keyfind(key, buf, &ref) == S_OKAY && ref != CURR_REC )
+			{
+				set_subcode(key);
+				rc = db_status = S_DUPLICATE;
+				break;
+			}
+		}
+
+		if( rc == S_OKAY && changed )
+			rc = cascade_update(rec, list[i].dependent.recno, buf, depth+1);
+	}
+
+	free(buf);
+	free(list);
+
+	return rc;
+}
+
+
+
+/*--------------------------- check_cascade_keys ---------------------------*\
+ *
+ * Purpose	 : Checks that no two records reached by an update cascade get
+ *			   the same value of a unique key. The new rows of each table
+ *			   are sorted by each of its unique keys in turn, so equal
+ *			   values end up next to each other. Null keys are left out.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   S_DUPLICATE	- Two records would get the same key value.
+ *							  db_subcode contains the ID of the key.
+ *			   S_NOMEM		- Out of memory.
+ *
+ */
+static int check_cascade_keys()
+{
+	Record *rec;
+	Key *key;
+	unsigned *order, n, k;
+	ulong recid, i;
+	int keys, rc = S_OKAY;
+
+	if( casc_count < 2 )
+		return S_OKAY;
+
+	if( !(order = (unsigned *)malloc(casc_count * sizeof *order)) )
+		RETURN S_NOMEM;
+
+	sort_buf  = casc_rows;
+	sort_size = 2 * DB->biggest_rec;
+
+	for( recid=0; recid<DB->header.records && rc == S_OKAY; recid++ )
+	{
+		rec = DB->record + recid;
+		key = DB->key + rec->first_key;
+
+		for( keys=rec->keys; keys-- && !KEY_ISFOREIGN(key) && rc == S_OKAY; key++ )
+		{
+			if( !(key->type & KT_UNIQUE) )
+				continue;
+
+			for( i=n=0; i<casc_count; i++ )
+				if( casc_set[i].recid == recid
+				&&	(!KEY_ISOPTIONAL(key) || !null_indicator(key, CASC_NEW(i))) )
+					order[n++] = i;
+
+			if( n < 2 )
+				continue;
+
+			sort_key = key;
+			qsort(order, n, sizeof *order, rowcmp);
+
+			for( k=1; k<n; k++ )
+				if( !rowcmp(order + k - 1, order + k) )
+				{
+					set_subcode(key);
+					rc = db_status = S_DUPLICATE;
+					break;
+				}
+		}
+	}
+
+	free(order);
+
+	return rc;
+}
+
+
+
+/*---------------------------- update_dependents ---------------------------*\
+ *
+ * Purpose	 : Writes the new contents of the records found by
+ *			   cascade_update(), except the first one, which is the parent.
+ *			   If a record cannot be written, the records already written
+ *			   get their old contents back.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   Other		- A record could not be updated.
+ *
+ */
+static int update_dependents()
+{
+	Record *rec;
+	ulong i;
+	int rc = S_OKAY;
+
+	for( i=1; i<casc_count; i++ )
+	{
+		rec		   = DB->record + casc_set[i].recid;
+		CURR_RECID = casc_set[i].recid;
+		CURR_REC   = casc_set[i].recno;
+
+		if( (rc = update_recbuf()) != S_OKAY
+		||	(rc = write_dependent(rec, CASC_OLD(i), CASC_NEW(i))) != S_OKAY )
+			break;
+	}
+
+	if( rc == S_OKAY )
+		return S_OKAY;
+
+	while( --i > 0 )
+	{
+		rec		   = DB->record + casc_set[i].recid;
+		CURR_RECID = casc_set[i].recid;
+		CURR_REC   = casc_set[i].recno;
+
+		if( update_recbuf() == S_OKAY )
+			write_dependent(rec, CASC_NEW(i), CASC_OLD(i));
+	}
+
+	RETURN rc;
+}
+
+
+
+/*----------------------------- collect_deletes ----------------------------*\
+ *
+ * Purpose	 : Finds all the records that must be deleted together with
+ *			   the current record, i.e. the records that refer to it with
+ *			   the cascade rule, the records that refer to those, and so on.
+ *			   The current record is stored first in <casc_set>.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   S_RESTRICT	- A dependent table with restrict rule has rows
+ *							  that refer to one of the records. db_subcode
+ *							  contains the ID of the dependent table.
+ *			   S_NOMEM		- Out of memory.
+ *
+ */
+static int collect_deletes()
+{
+	Record *rec;
+	REF_ENTRY *list;
+	ulong i, j, n;
+	int rc, rule;
+
+	if( (rc = casc_add(CURR_RECID, CURR_REC)) != S_OKAY )
+		return rc;
+
+	/* Every record added to the set is scanned in turn */
+	for( i=0; i<casc_count && rc == S_OKAY; i++ )
+	{
+		rec = DB->record + casc_set[i].recid;
+
+		if( !rec->dependents )
+			continue;
+
+		if( (rc = ref_entries(rec, casc_set[i].recno, &list, &n)) != S_OKAY )
+			break;
+
+		for( j=0; j<n; j++ )
+		{
+			CURR_RECID = list[j].dependent.recid;
+			CURR_REC   = list[j].dependent.recno;
+
+			if( (rc = update_recbuf()) != S_OKAY )
+				break;
+
+			if( (rule = dependent_rule(DB->record + CURR_RECID, rec,
+									   casc_set[i].recno, 'd')) < 0 )
+			{
+				db_subcode = (CURR_RECID + 1) * REC_FACTOR;
+				rc = db_status = S_RESTRICT;
+				break;
+			}
+
+			if( rule && (rc = casc_add(CURR_RECID, CURR_REC)) != S_OKAY )
+				break;
+		}
+
+		free(list);
+	}
+
+	return rc;
+}
+
+
+
+/*----------------------------- restore_record -----------------------------*\
+ *
+ * Purpose	 : Adds a record deleted by a cascade again, the same way
+ *			   d_fillnew() adds a record. The record gets a new record
+ *			   number.
+ *
+ * Parameters: rec			- Pointer to record.
+ *			   row			- Deleted record, including the preamble.
+ *			   buf			- Buffer for the record as the application
+ *							  sees it.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   S_FOREIGN	- A parent of the record does not exist (yet).
+ *			   Other		- The record could not be added.
+ *
+ */
+static int restore_record(rec, row, buf)
+Record *rec;
+char *row;
+char *buf;
+{
+	Key *key;
+	int n, rc;
+
+	CURR_RECID = rec - DB->record;
+	CURR_REC   = 0;
+	DB->recbuf = DB->real_recbuf + rec->preamble;
+
+	if( rec->is_vlr )
+	{
+		if( (rc = compress_vlr(UNCOMPRESS, rec, buf, row + rec->preamble, NULL)) != S_OKAY )
+			return rc;
+	}
+	else
+		memcpy(buf, row + rec->preamble, rec->size);
+
+	if( (rc = check_foreign_keys(rec, buf, 1)) != S_OKAY )
+		return rc;
+
+	if( rec->is_vlr )
+	{
+		unsigned size;
+
+		if( (rc = compress_vlr(COMPRESS, rec, DB->recbuf, buf, &size)) == S_OKAY )
+			rc = ty_vlradd(rec, DB->real_recbuf, size, &CURR_REC);
+	}
+	else
+	{
+		memcpy(DB->recbuf, buf, rec->size);
+		rc = ty_recadd(rec, DB->real_recbuf, &CURR_REC);
+	}
+
+	if( rc != S_OKAY )
+		return rc;
+
+	key = DB->key + rec->first_key;
+
+	for( n=rec->keys; n-- && !KEY_ISFOREIGN(key); key++ )
+		if( !KEY_ISOPTIONAL(key) || !null_indicator(key, buf) )
+			keyadd(key, buf, CURR_REC);
+
+	update_foreign_keys(rec, 1);
+
+#ifdef CONFIG_UNIX
+	if( DB->logging )
+		ty_log('u');
+
+	log_update(CURR_RECID, CURR_REC, rec->size, buf);
+#endif
+
+	return S_OKAY;
+}
+
+
+
+/*------------------------------ undo_deletes ------------------------------*\
+ *
+ * Purpose	 : Adds the records deleted by a failed cascade again. A record
+ *			   can only be added when its parents exist, so the records are
+ *			   scanned until no more can be added.
+ *
+ * Parameters: rows			- Deleted records, one per entry in <casc_set>.
+ *			   end			- Index in <casc_set> of the first record that
+ *							  was not deleted.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+static void undo_deletes(rows, end)
+char *rows;
+ulong end;
+{
+	char *restored, *buf;
+	ulong i;
+	int progress;
+
+	restored = (char *)calloc(end, 1);
+	buf		 = (char *)malloc(DB->biggest_rec);
+
+	if( restored && buf )
+	{
+		do
+		{
+			progress = 0;
+
+			for( i=1; i<end; i++ )
+				if( !restored[i]
+				&&	restore_record(DB->record + casc_set[i].recid,
+								   rows + i * DB->biggest_rec, buf) != S_FOREIGN )
+					restored[i] = progress = 1;
+		}
+		while( progress );
+	}
+
+	free(restored);
+	free(buf);
+}
+
+
+
+/*---------------------------- delete_dependents ---------------------------*\
+ *
+ * Purpose	 : Deletes the records found by collect_deletes(), except the
+ *			   first one. The records are sorted by table and record number
+ *			   and deleted in batches. The keys of a batch are removed one
+ *			   index at a time in key order, so consecutive deletions hit
+ *			   the same B-tree nodes.
+ *
+ *			   All the records are read before any of them is deleted. If
+ *			   a record cannot be deleted, the records already deleted are
+ *			   added again by undo_deletes().
+ *
+ * Parameters: None.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   Other		- A record could not be deleted.
+ *
+ */
+static int delete_dependents()
+{
+	Record *rec;
+	Key *key;
+	char *rows;
+	unsigned *order, n, k, size;
+	ulong first, end, i;
+	int keys, rc = S_OKAY;
+
+	if( casc_count < 2 )
+		return S_OKAY;
+
+	qsort(casc_set + 1, casc_count - 1, sizeof *casc_set, addrcmp);
+
+	rows  = (char *)malloc((size_t) casc_count * DB->biggest_rec);
+	order = (unsigned *)malloc(CASCADE_BATCH * sizeof *order);
+
+	if( !rows || !order )
+	{
+		free(rows);
+		free(order);
+		RETURN S_NOMEM;
+	}
+
+	for( i=1; i<casc_count && rc == S_OKAY; i++ )
+	{
+		rec		   = DB->record + casc_set[i].recid;
+		CURR_RECID = casc_set[i].recid;
+		CURR_REC   = casc_set[i].recno;
+
+		if( (rc = update_recbuf()) == S_OKAY )
+			memcpy(rows + i * DB->biggest_rec, DB->real_recbuf,
+				   rec->preamble + rec->size);
+	}
+
+	for( first=end=1; first<casc_count && rc == S_OKAY; first=i )
+	{
+		rec	 = DB->record + casc_set[first].recid;
+		size = DB->biggest_rec;
+
+		/* Delete a batch of records of the same table */
+		for( i=first, n=0; i<casc_count && n<CASCADE_BATCH
+			 && casc_set[i].recid == casc_set[first].recid; i++, n++ )
+		{
+			CURR_RECID = casc_set[i].recid;
+			CURR_REC   = casc_set[i].recno;
+
+			if( (rc = update_recbuf()) != S_OKAY )
+				break;
+
+			if( DB->fh[rec->fileid].any->type == 'd' )
+				rc = ty_recdelete(rec, CURR_REC);
+			else
+				rc = ty_vlrdel(rec, CURR_REC);
+
+			if( rc != S_OKAY )
+				break;
+
+			delete_foreign_keys(rec);
+
+#ifdef CONFIG_UNIX
+			if( DB->logging )
+				ty_log('d');
+
+			log_delete(CURR_RECID, CURR_REC);
+#endif
+		}
+
+		end = i;
+
+		/* Remove the keys of the deleted records */
+		sort_buf  = rows + first * size + rec->preamble;
+		sort_size = size;
+		key		  = DB->key + rec->first_key;
+
+		for( keys=rec->keys; keys-- && !KEY_ISFOREIGN(key); key++ )
+		{
+			for( k=0; k<n; k++ )
+				order[k] = k;
+
+			sort_key = key;
+			qsort(order, n, sizeof *order, rowcmp);
+
+			for( k=0; k<n; k++ )
+			{
+				char *row = sort_buf + order[k] * size;
+
+				if( KEY_ISOPTIONAL(key) && null_indicator(key, row) )
+					continue;
+
+				if( keydel(key, row, casc_set[first + order[k]].recno) != S_OKAY
+				&&	rc == S_OKAY )
+					rc = db_status;
+			}
+		}
+	}
+
+	if( rc != S_OKAY )
+	{
+		undo_deletes(rows, end);
+		db_status = rc;
+	}
+
+	free(rows);
+	free(order);
+
+	return rc;
+}
+
+
+
+/*------------------------- check_dependent_tables -------------------------*\
+ *
+ * Purpose	 : This function is called by d_recwrite() and d_delete() to
+ *			   check whether this update/delete operation will have any
+ *			   effect on records in dependent tables.
+ *
+ *			   If a dependent table has the cascade rule, the records that
+ *			   must be updated or deleted are checked, but not changed.
+ *			   The caller must call cascade_dependents() to change them.
+ *			   On return DB->recbuf contains the current record again.
+ *
+ *			   The unique keys of updated dependents are checked against
+ *			   the index and against each other, and against the new
+ *			   contents of the parent in <buf>.
+ *
+ * Parameters: parent		- Pointer to parent table's record pointer.
+ *			   buf			- Buffer of dependent record.
+ *			   for_action	- 'd'=delete, 'u'=update
+ *
+ * Returns	 : S_OKAY		- No conflicts.
+ *			   S_RESTRICT	- A dependent table with restrict rule has rows
+ *                            which referenced the parent table. db_subcode
+ *						      contains the ID of the dependent table.
+ *			   S_DUPLICATE	- A cascaded update would create a duplicate
+ *							  key in a dependent table.
+ *			   S_NOMEM		- Out of memory.
+ *
+ */
+int check_dependent_tables(parent, buf, for_action)
+Record *parent;
+void *buf;
+int for_action;
+{
+	Key *primary_key, refkey;
+	REF_ENTRY refentry;
+	ulong ref, recid, recno, i;
+	int rc;
+
+	casc_reset();
+
+	/* Does this table have any dependent tables? */
+    if( !parent->dependents )
+    	return S_OKAY;
+
+    /* If the table has dependent tables, it follows that it must also have
+     * a primary key, i.e. no need to check for that.
+     */
+	primary_key = DB->key + parent->first_key;
+
+	/* Only perform check if the primary key has changed (if update) */
+	if( for_action == 'u' )
+		if( !reckeycmp(primary_key, buf, DB->recbuf) )
+			return S_OKAY;
+
+	if( has_cascade(parent, for_action) )
+	{
+		recid = CURR_RECID;
+		recno = CURR_REC;
+
+		if( for_action == 'd' )
+			rc = collect_deletes();
+		else if( (rc = casc_addrow(parent, &i)) == S_OKAY )
+		{
+			/* The parent is stored first, with its new contents */
+			memcpy(CASC_NEW(i), buf, parent->size);
+
+			if( (rc = cascade_update(parent, recno, buf, 0)) == S_OKAY )
+				rc = check_cascade_keys();
+		}
+
+		CURR_RECID = recid;
+		CURR_REC   = recno;
+		update_recbuf();
+
+		if( rc != S_OKAY )
+		{
+			casc_reset();
+			return rc;
+		}
+
+		casc_action = for_action;
+		return S_OKAY;
+	}
+
+	refentry.parent = CURR_REC;
+	refentry.dependent.recid = 0;
+	refentry.dependent.recno = 0;
+
+	refkey.size	  = sizeof(REF_ENTRY);
+    refkey.fileid = parent->ref_file;
+
+	if( (rc = ty_keyfind(&refkey, &refentry, &ref)) != S_OKAY )
+		rc = ty_keynext(&refkey, &ref);
+
+    if( rc != S_OKAY )
+    	return S_OKAY;
+
+	refentry = *(REF_ENTRY *)CURR_KEYBUF;
+
+    if( refentry.parent == CURR_REC )
+    {
+    	/* Set db_subcode to the ID of the dependent table */
+    	db_subcode = (refentry.dependent.recid+1) * REC_FACTOR;
+    	RETURN S_RESTRICT;
+	}
+
+	return S_OKAY;
+}
+
+
+
+/*--------------------------- cascade_dependents ---------------------------*\
+ *
+ * Purpose	 : Deletes or updates the dependent records found by the last
+ *			   call to check_dependent_tables(). The whole cascade is
+ *			   performed while the caller holds the lock. If a record
+ *			   cannot be changed, the records already changed are changed
+ *			   back before the function returns.
+ *
+ *			   On return DB->recbuf contains the current record again. The
+ *			   preamble is kept as it was, because check_foreign_keys() may
+ *			   already have stored new references to parents in it.
+ *
+ * Parameters: parent		- Pointer to parent table's record pointer.
+ *
+ * Returns	 : S_OKAY		- Ok.
+ *			   Other		- A dependent record could not be changed.
+ *
+ */
+int cascade_dependents(parent)
+Record *parent;
+{
+	ulong recid = CURR_RECID;
+	ulong recno = CURR_REC;
+	ulong preamble[RECKEYS_MAX];
+	int rc;
+
+	if( casc_action == 'd' )
+		rc = delete_dependents();
+	else if( casc_action == 'u' )
+	{
+		memcpy(preamble, DB->real_recbuf, parent->preamble);
+		rc = update_dependents();
+	}
+	else
+		return S_OKAY;
+
+	CURR_RECID = recid;
+	CURR_REC   = recno;
+	update_recbuf();
+
+	if( casc_action == 'u' )
+		memcpy(DB->real_recbuf, preamble, parent->preamble);
+
+	casc_reset();
+
+	return rc;
+}
+
 /* end-of-file */
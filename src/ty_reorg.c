@@ -0,0 +1,907 @@
+/*----------------------------------------------------------------------------
+ * File    : ty_reorg.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Reorganizes the files of an open database.
+ *
+ *   An index is compacted by copying it in key order into a new file,
+ *   which then replaces the old file. In shared mode the copy is made
+ *   without the lock, so the other processes are only held up while the
+ *   files are swapped. If a record was updated while the copy was made,
+ *   the copy is thrown away and made again; after KEYCOMPACT_TRIES-1
+ *   attempts the lock is kept during the copy. The other processes reopen
+ *   their index files when they see that shm->key_gen has changed.
+ *
+ *   A table is clustered by copying its records in the order of an index
+ *   into a new data file. The new record numbers are kept in a table sorted
+ *   by the old record numbers. The references to the table in the preambles
+ *   of its dependent records are changed through the table in copies of
+ *   their data files. When all the new files are complete, a journal that
+ *   lists them is written, the new files replace the old ones, and the
+ *   indexes that contain the record numbers are rebuilt from the data
+ *   files. If the process stops before the journal is written nothing has
+ *   changed; otherwise reorg_recover() swaps in the remaining new files
+ *   when the database is opened again, and the indexes are rebuilt. Since
+ *   the record numbers change, a table can only be clustered in exclusive
+ *   or one-user mode.
+ *
+ * Functions:
+ *   d_keycompact	- Compact an index.
+ *   d_reccluster	- Store the records of a table in the order of an index.
+ *   reorg_recover	- Finish a d_reccluster() that was interrupted.
+ *   reorg_finish	- Remove the journal of d_reccluster().
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "environ.h"
+#ifdef CONFIG_UNIX
+#	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#	include <io.h>
+#endif
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+/*--------------------------------- Macros ---------------------------------*/
+#define SCAN_BLOCK		65536L		/* Number of bytes read at a time	*/
+#define SLOTSIZE(rec)	((unsigned) offsetof(RECORDHEAD, data[0]) + \
+						 (rec)->preamble + (rec)->size)
+
+/*-------------------------------- Structures ------------------------------*/
+typedef struct {					/* Record moved by d_reccluster()		*/
+	ulong		old;				/* Record number in the old file		*/
+	ulong		new;				/* Record number in the new file		*/
+} RECMAP;
+
+/*--------------------------- Function prototypes --------------------------*/
+static ulong	update_stamp	PRM( (void); 								)
+static int		recmapcmp		PRM( (CONFIG_CONST void *, CONFIG_CONST void *);)
+static int		recmap_add		PRM( (ulong, ulong);						)
+static ulong	recmap_find		PRM( (ulong, ulong);						)
+static int		scan_records	PRM( (Record *, int (*)(Record *, ulong, char *, unsigned));)
+static int		copy_unindexed	PRM( (Record *, ulong, char *, unsigned);	)
+static int		remap_parents	PRM( (Record *, ulong, char *, unsigned);	)
+static int		refers_to		PRM( (Record *, Id);						)
+static int		cluster_copy	PRM( (Record *, Key *, char *);				)
+static int		cluster_remap	PRM( (Record *);							)
+static int		journal_write	PRM( (Record *);							)
+
+/*---------------------------- Global variables ----------------------------*/
+static RECMAP	*recmap;			/* New record numbers of the records	*/
+static ulong	 recmap_count;		/* Entries in <recmap>					*/
+static ulong	 recmap_alloc;		/* Entries allocated in <recmap>		*/
+static ulong	 recmap_sorted;		/* Entries sorted by old record number	*/
+static Fh		 clus_to;			/* New data file						*/
+static Fh		*clus_deps;			/* Copies of dependent tables' files	*/
+static char		*clus_buf;			/* Buffer used to copy a record			*/
+static Id		 clus_parent;		/* Record whose references are changed	*/
+
+
+/*------------------------------ update_stamp ------------------------------*\
+ *
+ * Purpose	 : Returns a number that changes when another process updates
+ *			   a record, and thereby its indexes. Must be called while
+ *			   holding the lock.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : The update counter of the database, or 0 if it is not opened
+ *			   in shared mode.
+ *
+ */
+
+static ulong update_stamp()
+{
+#ifdef CONFIG_UNIX
+	if( DB->mode == 's' )
+		return DB->shm->rec_updates;
+#endif
+	return 0;
+}
+
+
+/*------------------------------ d_keycompact ------------------------------*\
+ *
+ * Purpose	 : Compacts an index. The keys are copied in key order into a
+ *			   new file with full nodes, which replaces the index file, so
+ *			   the deleted nodes are removed and the nodes are stored in
+ *			   the order d_keynext() reads them. The current key of the
+ *			   index is kept (the first one, if the value occurs more than
+ *			   once).
+ *
+ * Parameters: id		- Field ID or compound key ID.
+ *
+ * Returns	 : S_OKAY	- The index was compacted.
+ *			   S_NOCD	- No current database.
+ *			   S_NOTKEY	- The ID is not a key ID or it is a foreign key.
+ *			   S_NOTAVAIL- The index is being loaded.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- The new file could not be written or swapped in.
+ *
+ */
+
+FNCLASS int d_keycompact(id)
+Id id;
+{
+	Key *key;
+	char fname[280];
+	ulong stamp;
+	int rc, tries, locked;
+
+	if( CURR_DB == -1 )
+		RETURN_RAP(S_NOCD);
+
+	if( (rc = aux_getkey(id, &key)) != S_OKAY )
+		return rc;
+
+	if( KEY_ISFOREIGN(key) )
+		RETURN_RAP(S_NOTKEY);
+
+	sprintf(fname, "%s%s.new", DB->dbfpath, DB->file[key->fileid].name);
+
+	for( tries=1; ; tries++ )
+	{
+		locked = DB->mode != 's' || tries == KEYCOMPACT_TRIES;
+
+		ty_lock();
+		stamp = update_stamp();
+
+		if( locked )
+		{
+			rc = ty_keycopy(key, fname);
+			break;
+		}
+
+		ty_unlock();
+
+		/* The copy may be inconsistent if the index was changed meanwhile,
+		 * so errors are not reported until the lock is kept.
+		 */
+		rc = ty_keycopy(key, fname);
+
+		ty_lock();
+		if( rc == S_OKAY && stamp == update_stamp() )
+			break;
+		ty_unlock();
+
+		unlink(fname);
+	}
+
+	if( rc == S_OKAY )
+	{
+		rc = ty_keyswap(key, fname);
+
+#ifdef CONFIG_UNIX
+		if( DB->mode == 's' )
+			DB->key_gen = ++DB->shm->key_gen;
+#endif
+	}
+
+	ty_unlock();
+
+	return rc;
+}
+
+/*-------------------------------- recmapcmp -------------------------------*\
+ *
+ * Purpose	 : qsort() function that orders moved records by their old
+ *			   record number.
+ *
+ * Parameters: a		- Pointer to entry.
+ *			   b		- Pointer to entry.
+ *
+ * Returns	 : < 0, 0 or > 0.
+ *
+ */
+
+static int recmapcmp(a, b)
+CONFIG_CONST void *a, *b;
+{
+	CONFIG_CONST RECMAP *x = (CONFIG_CONST RECMAP *)a;
+	CONFIG_CONST RECMAP *y = (CONFIG_CONST RECMAP *)b;
+
+	return x->old < y->old ? -1 : x->old > y->old;
+}
+
+
+/*------------------------------- recmap_add -------------------------------*\
+ *
+ * Purpose	 : Adds a moved record to <recmap>.
+ *
+ * Parameters: old		- Record number in the old file.
+ *			   new		- Record number in the new file.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *
+ */
+
+static int recmap_add(old, new)
+ulong old, new;
+{
+	RECMAP *p;
+	ulong n;
+
+	if( recmap_count == recmap_alloc )
+	{
+		n = recmap_alloc ? recmap_alloc * 2 : 1024;
+
+		if( !(p = (RECMAP *)realloc(recmap, (size_t) n * sizeof *p)) )
+			RETURN S_NOMEM;
+
+		recmap		 = p;
+		recmap_alloc = n;
+	}
+
+	recmap[recmap_count].old = old;
+	recmap[recmap_count].new = new;
+	recmap_count++;
+
+	return S_OKAY;
+}
+
+
+/*------------------------------- recmap_find ------------------------------*\
+ *
+ * Purpose	 : Finds the new record number of a record.
+ *
+ * Parameters: old		- Record number in the old file.
+ *			   n		- Number of sorted entries to search.
+ *
+ * Returns	 : The new record number, or 0 if the record was not moved.
+ *
+ */
+
+static ulong recmap_find(old, n)
+ulong old, n;
+{
+	ulong lo = 0, hi = n, mid;
+
+	while( lo < hi )
+	{
+		mid = (lo + hi) / 2;
+
+		if( recmap[mid].old == old )
+			return recmap[mid].new;
+
+		if( recmap[mid].old < old )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+
+/*------------------------------ scan_records ------------------------------*\
+ *
+ * Purpose	 : Reads the data file of a record sequentially and calls a
+ *			   function for each live record. Fixed length records are read
+ *			   many slots at a time.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   fn		- Function called with the record, its record number,
+ *						  the record including its preamble and its size.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *			   Other	- From <fn>.
+ *
+ */
+
+static int scan_records(rec, fn)
+Record *rec;
+int (*fn) PRM((Record *, ulong, char *, unsigned);)
+{
+	char *buf, *slot;
+	unsigned slotsize, want, got, i, size;
+	ulong recno;
+	int rc = S_OKAY;
+
+	if( rec->is_vlr )
+	{
+		if( !(buf = (char *)malloc(rec->preamble + rec->size)) )
+			RETURN S_NOMEM;
+
+		for( recno=0; rc == S_OKAY && ty_vlrnext(rec, &recno) == S_OKAY; )
+		{
+			size = 0;
+			if( ty_vlrread(rec, buf, recno, &size) != S_OKAY || !size )
+				continue;
+
+			rc = fn(rec, recno, buf, size);
+		}
+
+		free(buf);
+		return rc;
+	}
+
+	slotsize = SLOTSIZE(rec);
+	want	 = SCAN_BLOCK / slotsize ? (unsigned)(SCAN_BLOCK / slotsize) : 1;
+
+	if( !(buf = (char *)malloc((size_t) want * slotsize)) )
+		RETURN S_NOMEM;
+
+	for( recno=0; rc == S_OKAY; recno += got )
+	{
+		if( ty_recslots(rec, buf, &recno, want, &got) != S_OKAY || !got )
+			break;
+
+		for( i=0, slot=buf; i<got && rc == S_OKAY; i++, slot += slotsize )
+			if( !(((RECORDHEAD *)slot)->flags & BIT_DELETED) )
+				rc = fn(rec, recno + i, ((RECORDHEAD *)slot)->data,
+						rec->preamble + rec->size);
+	}
+
+	free(buf);
+	return rc;
+}
+
+
+/*----------------------------- copy_unindexed -----------------------------*\
+ *
+ * Purpose	 : Called by scan_records(). Copies a record to the new data
+ *			   file unless it has been copied already, i.e. a record whose
+ *			   optional clustering key is null.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   recno	- Record number.
+ *			   data		- Record (not used).
+ *			   size		- Size of record (not used).
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From ty_reccopy() or recmap_add().
+ *
+ */
+
+static int copy_unindexed(rec, recno, data, size)
+Record *rec;
+ulong recno;
+char *data;
+unsigned size;
+{
+	ulong newrecno;
+	int rc;
+
+	if( recmap_find(recno, recmap_sorted) )
+		return S_OKAY;
+
+	if( (rc = ty_reccopy(rec, &clus_to, clus_buf, recno, &newrecno)) != S_OKAY )
+		return rc;
+
+	return recmap_add(recno, newrecno);
+}
+
+
+/*------------------------------ remap_parents -----------------------------*\
+ *
+ * Purpose	 : Called by scan_records(). Changes the references to the
+ *			   clustered record in the preamble of a dependent record to the
+ *			   new record numbers and writes the record in the copy of its
+ *			   data file if any changed. A record of the clustered table
+ *			   itself is written in the new data file of the table.
+ *
+ * Parameters: rec		- Pointer to dependent record.
+ *			   recno	- Record number.
+ *			   data		- Record including its preamble.
+ *			   size		- Size of <data>.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From ty_recput().
+ *
+ */
+
+static int remap_parents(rec, recno, data, size)
+Record *rec;
+ulong recno;
+char *data;
+unsigned size;
+{
+	Key *key = DB->key + rec->first_foreign;
+	ulong ref, newref;
+	int n, changed = 0;
+
+	for( n=0; n < rec->keys - (int)(rec->first_foreign - rec->first_key); n++, key++ )
+	{
+		if( key->parent != clus_parent )
+			continue;
+
+		memcpy(&ref, data + n * sizeof(ulong), sizeof ref);
+
+		if( ref && (newref = recmap_find(ref, recmap_count)) )
+		{
+			memcpy(data + n * sizeof(ulong), &newref, sizeof newref);
+			changed = 1;
+		}
+	}
+
+	if( !changed )
+		return S_OKAY;
+
+	if( rec == DB->record + clus_parent )
+		return ty_recput(rec, &clus_to, data, size,
+						 recmap_find(recno, recmap_count));
+
+	/* The cached record is out of date once the copy replaces the file */
+	cache_forget(rec, recno);
+
+	return ty_recput(rec, clus_deps + (rec - DB->record), data, size, recno);
+}
+
+
+/*-------------------------------- refers_to -------------------------------*\
+ *
+ * Purpose	 : Determines whether a record has a foreign key that refers to
+ *			   a table.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   parent	- Internal record id of the table.
+ *
+ * Returns	 : 1 if it has, otherwise 0.
+ *
+ */
+
+static int refers_to(rec, parent)
+Record *rec;
+Id parent;
+{
+	Key *key;
+	int n;
+
+	if( rec->first_foreign == -1 )
+		return 0;
+
+	key = DB->key + rec->first_foreign;
+
+	for( n=rec->keys - (int)(rec->first_foreign - rec->first_key); n--; key++ )
+		if( key->parent == parent )
+			return 1;
+
+	return 0;
+}
+
+
+/*------------------------------- cluster_copy -----------------------------*\
+ *
+ * Purpose	 : Copies the records of a table into a new data file in the
+ *			   order of an index, followed by the records that are not in
+ *			   the index, and sorts <recmap>. If an error occurs the new
+ *			   file is removed.
+ *
+ * Parameters: rec		- Pointer to record.
+ *			   key		- Clustering key.
+ *			   fname	- Name of the new file.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Out of memory.
+ *			   Other	- From ty_recclone(), ty_reccopy() or the index.
+ *
+ */
+
+static int cluster_copy(rec, key, fname)
+Record *rec;
+Key *key;
+char *fname;
+{
+	ulong recno, newrecno;
+	int rc;
+
+	if( (rc = ty_recclone(rec, fname, &clus_to)) != S_OKAY )
+		return rc;
+
+	for( rc = ty_keyfrst(key, &recno); rc == S_OKAY; rc = ty_keynext(key, &recno) )
+	{
+		if( (rc = ty_reccopy(rec, &clus_to, clus_buf, recno, &newrecno)) != S_OKAY ||
+			(rc = recmap_add(recno, newrecno)) != S_OKAY )
+			break;
+	}
+
+	if( rc == S_NOTFOUND )
+		rc = S_OKAY;
+
+	qsort(recmap, (size_t) recmap_count, sizeof *recmap, recmapcmp);
+	recmap_sorted = recmap_count;
+
+	/* A record whose optional key is null is not in the index */
+	if( rc == S_OKAY && KEY_ISOPTIONAL(key) )
+	{
+		rc = scan_records(rec, copy_unindexed);
+
+		qsort(recmap, (size_t) recmap_count, sizeof *recmap, recmapcmp);
+		recmap_sorted = recmap_count;
+	}
+
+	if( rc != S_OKAY )
+		ty_recdiscard(&clus_to, fname);
+
+	return rc;
+}
+
+
+/*------------------------------ cluster_remap -----------------------------*\
+ *
+ * Purpose	 : Changes the references to the clustered table in the
+ *			   preambles of its dependent records. The data file of each
+ *			   other dependent table is copied by ty_recdup() and the
+ *			   records are changed in the copy; the records of the table
+ *			   itself are changed in its new data file. The data files in
+ *			   use are not changed.
+ *
+ * Parameters: rec		- Pointer to the clustered record.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   Other	- From ty_recdup() or remap_parents(). The copies
+ *						  made so far are kept in <clus_deps>.
+ *
+ */
+
+static int cluster_remap(rec)
+Record *rec;
+{
+	Record *dep;
+	char fname[280];
+	int rc = S_OKAY;
+
+	for( dep=DB->record; rc == S_OKAY && dep < DB->record + DB->header.records; dep++ )
+	{
+		if( !refers_to(dep, clus_parent) )
+			continue;
+
+		if( dep != rec )
+		{
+			sprintf(fname, "%s%s.new", DB->dbfpath, DB->file[dep->fileid].name);
+
+			if( (rc = ty_recdup(dep, fname, clus_deps + (dep - DB->record))) != S_OKAY )
+				break;
+		}
+
+		rc = scan_records(dep, remap_parents);
+	}
+
+	return rc;
+}
+
+
+/*------------------------------ journal_write -----------------------------*\
+ *
+ * Purpose	 : Writes the journal of d_reccluster(), which contains the
+ *			   file ids of the data files that are replaced by new files.
+ *			   Once it has been written the new files must be swapped in,
+ *			   either by d_reccluster() or by reorg_recover().
+ *
+ * Parameters: rec		- Pointer to the clustered record.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_IOFATAL- The journal could not be written. It is removed.
+ *
+ */
+
+static int journal_write(rec)
+Record *rec;
+{
+	char fname[280];
+	Id fileid;
+	int fh, i, rc = S_OKAY;
+
+	sprintf(fname, "%s%s.cls", DB->dbfpath, DB->name);
+
+	if( (fh = os_open(fname, CONFIG_O_BINARY|O_RDWR|O_CREAT|O_TRUNC, CONFIG_CREATMASK)) == -1 )
+		RETURN S_IOFATAL;
+
+	for( i=-1; i<(int)DB->header.records && rc == S_OKAY; i++ )
+	{
+		if( i == -1 )
+			fileid = rec->fileid;
+		else if( i != clus_parent && refers_to(DB->record + i, clus_parent) )
+			fileid = DB->record[i].fileid;
+		else
+			continue;
+
+		if( write(fh, &fileid, sizeof fileid) != sizeof fileid )
+			rc = S_IOFATAL;
+	}
+
+	os_close(fh);
+
+	if( rc != S_OKAY )
+		unlink(fname);
+
+	RETURN rc;
+}
+
+
+/*------------------------------ d_reccluster ------------------------------*\
+ *
+ * Purpose	 : Stores the records of a table in the order of one of its
+ *			   indexes, so that a scan of the index reads the data file
+ *			   sequentially. The records are copied into a new data file
+ *			   without the deleted slots, and the references to the records
+ *			   in the preambles of their dependent records are changed in
+ *			   copies of the dependents' data files. The new files then
+ *			   replace the old ones, and the indexes of the table, its
+ *			   reference file and the reference files of its parents are
+ *			   rebuilt. Records whose optional key is null are stored after
+ *			   the others.
+ *
+ *			   If the process stops while the new files replace the old
+ *			   ones or while the indexes are rebuilt, the next d_open()
+ *			   swaps in the remaining files and rebuilds all the indexes.
+ *
+ *			   The records get new record numbers, so database addresses
+ *			   of the table obtained earlier are no longer valid. The
+ *			   current record is kept, but the current keys of the rebuilt
+ *			   indexes are lost.
+ *
+ * Parameters: record	- Record id.
+ *			   id		- Field ID or compound key ID of the clustering key.
+ *
+ * Returns	 : S_OKAY	- The table was clustered.
+ *			   S_NOCD	- No current database.
+ *			   S_INVREC - Invalid record id.
+ *			   S_NOTKEY	- The ID is not a key of the record or it is a
+ *						  foreign key.
+ *			   S_NOTAVAIL- The database is opened in shared mode, records
+ *						  are being loaded, replication logging is on or a
+ *						  backup is in progress.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- The new files could not be written. Nothing has
+ *						  been changed.
+ *			   S_FATAL	- The new files could not all be swapped in, or
+ *						  the indexes could not be rebuilt. The database
+ *						  must be closed; the next d_open() finishes the
+ *						  clustering and rebuilds the indexes.
+ *
+ */
+
+FNCLASS int d_reccluster(record, id)
+Id record, id;
+{
+	Record *rec, *dep;
+	Key *key, *k;
+	char fname[280], depname[280], *build;
+	ulong curr_recid;
+	int i, n, rc, curr_key = CURR_KEY;
+
+	if( CURR_DB == -1 )
+		RETURN_RAP(S_NOCD);
+
+	/* set_recfld() changes the record type of the current record */
+	curr_recid = CURR_RECID;
+	rc = set_recfld(record, &rec, NULL);
+	CURR_RECID = curr_recid;
+
+	if( rc != S_OKAY )
+		return rc;
+
+	if( (rc = aux_getkey(id, &key)) != S_OKAY )
+		return rc;
+
+	if( KEY_ISFOREIGN(key) || key < DB->key + rec->first_key ||
+		key >= DB->key + rec->first_key + rec->keys )
+		RETURN_RAP(S_NOTKEY);
+
+	/* Other processes, a load and a backup depend on the record numbers */
+	if( DB->mode == 's' || DB->loading || DB->logging )
+		RETURN S_NOTAVAIL;
+#ifdef CONFIG_UNIX
+	if( DB->shm->backup_active || DB->shm->snap_active )
+		RETURN S_NOTAVAIL;
+#endif
+
+	build	  = (char *)calloc(DB->header.files, 1);
+	clus_deps = (Fh *)calloc(DB->header.records, sizeof *clus_deps);
+	clus_buf  = (char *)malloc(rec->preamble + rec->size);
+
+	if( !build || !clus_deps || !clus_buf )
+	{
+		FREE(build);
+		FREE(clus_deps);
+		FREE(clus_buf);
+		RETURN S_NOMEM;
+	}
+
+	sprintf(fname, "%s%s.new", DB->dbfpath, DB->file[rec->fileid].name);
+
+	recmap_count = recmap_sorted = 0;
+	clus_parent	 = rec - DB->record;
+
+	ty_lock();
+
+	/* Make all the new files. The files in use are not changed */
+	if( (rc = cluster_copy(rec, key, fname)) == S_OKAY )
+	{
+		if( rec->dependents )
+			rc = cluster_remap(rec);
+
+		if( rc == S_OKAY && (rc = ty_recclose(&clus_to)) == S_OKAY )
+			for( i=0; i<DB->header.records && rc == S_OKAY; i++ )
+				if( clus_deps[i].any )
+					rc = ty_recclose(clus_deps + i);
+
+		if( rc == S_OKAY )
+			rc = journal_write(rec);
+
+		if( rc != S_OKAY )
+		{
+			ty_recdiscard(&clus_to, fname);
+
+			for( dep=DB->record; dep < DB->record + DB->header.records; dep++ )
+				if( dep != rec && refers_to(dep, clus_parent) )
+				{
+					sprintf(depname, "%s%s.new", DB->dbfpath, DB->file[dep->fileid].name);
+					ty_recdiscard(clus_deps + (dep - DB->record), depname);
+				}
+		}
+	}
+
+	if( rc == S_OKAY )
+	{
+		/* The journal has been written, so the new files are swapped in
+		 * even if one of them fails; reorg_recover() retries the rest.
+		 */
+		if( ty_recreplace(rec, &clus_to, fname) != S_OKAY )
+			rc = S_FATAL;
+
+		for( dep=DB->record; rec->dependents &&
+			 dep < DB->record + DB->header.records; dep++ )
+		{
+			if( dep == rec || !refers_to(dep, clus_parent) )
+				continue;
+
+			sprintf(depname, "%s%s.new", DB->dbfpath, DB->file[dep->fileid].name);
+
+			if( ty_recreplace(dep, clus_deps + (dep - DB->record), depname) != S_OKAY )
+				rc = S_FATAL;
+		}
+
+		for( i=0; i<recmap_count; i++ )
+			cache_forget(rec, recmap[i].old);
+		parentcache_close(DB);
+
+		/* Rebuild the indexes that contain the record numbers */
+		for( k=DB->key+rec->first_key, n=rec->keys; n--; k++ )
+			build[KEY_ISFOREIGN(k) ? DB->record[k->parent].ref_file : k->fileid] = 1;
+		if( rec->dependents )
+			build[rec->ref_file] = 1;
+
+		if( rc == S_OKAY && load_reindex(build) != S_OKAY )
+			rc = S_FATAL;
+
+		if( rc == S_OKAY )
+			reorg_finish();
+
+		if( CURR_RECID == clus_parent && CURR_REC )
+		{
+			CURR_REC = recmap_find(CURR_REC, recmap_count);
+			if( CURR_REC && !rec->is_vlr )
+				ty_recsetcurr(rec, CURR_REC);
+		}
+
+		/* The preamble in the record buffer may be out of date */
+		CURR_BUFREC	  = 0;
+		CURR_BUFRECID = 0;
+	}
+
+	ty_unlock();
+
+	CURR_KEY = curr_key;
+	FREE(recmap);
+	recmap		 = NULL;
+	recmap_alloc = recmap_count = recmap_sorted = 0;
+	free(clus_buf);
+	free(clus_deps);
+	clus_deps = NULL;
+	free(build);
+
+	RETURN rc;
+}
+
+
+/*------------------------------ reorg_recover -----------------------------*\
+ *
+ * Purpose	 : Finishes a d_reccluster() that stopped after it had written
+ *			   its journal. The new data files listed in the journal that
+ *			   have not replaced the old files yet are renamed. Called by
+ *			   d_open() before the files are opened.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : 1 if there was a journal, i.e. the indexes must be rebuilt,
+ *			   otherwise 0.
+ *
+ */
+
+int reorg_recover()
+{
+	char fname[280], name[270], newname[280], mapname[280], newmapname[290];
+	Id fileid;
+	int fh;
+
+	sprintf(fname, "%s%s.cls", DB->dbfpath, DB->name);
+
+	if( (fh = os_open(fname, CONFIG_O_BINARY|O_RDONLY, 0)) == -1 )
+		return 0;
+
+	while( read(fh, &fileid, sizeof fileid) == sizeof fileid )
+	{
+		if( fileid >= DB->header.files )
+			continue;
+
+		sprintf(name, "%s%s", DB->dbfpath, DB->file[fileid].name);
+		sprintf(newname, "%s.new", name);
+		sprintf(mapname, "%s.fsm", name);
+		sprintf(newmapname, "%s.fsm", newname);
+
+		/* A missing file has been swapped in already */
+		if( rename(newname, name) == -1 )
+			continue;
+
+		/* A bitmap that does not match the file is rebuilt when it is opened */
+		if( rename(newmapname, mapname) == -1 )
+			unlink(mapname);
+	}
+
+	os_close(fh);
+
+	return 1;
+}
+
+
+/*------------------------------ reorg_finish ------------------------------*\
+ *
+ * Purpose	 : Removes the journal of d_reccluster() when the indexes have
+ *			   been rebuilt.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void reorg_finish()
+{
+	char fname[280];
+
+	sprintf(fname, "%s%s.cls", DB->dbfpath, DB->name);
+	unlink(fname);
+}
+
+/* end-of-file */
@@ -0,0 +1,423 @@
+/*----------------------------------------------------------------------------
+ * File    : ty_scan.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Contains functions for scanning record files in physical order. The
+ *   slots of a record file are read in large blocks and the deleted slots
+ *   are skipped, so a scan reads the file sequentially instead of following
+ *   the record chain one record at a time.
+ *
+ *   d_colscan() returns the records in column-major batches: the values
+ *   of each requested field are copied to an array of their own. Only
+ *   fields at the outermost level of fixed length records can be scanned.
+ *
+ *   A scan can also be split into partitions, i.e. ranges of slots, which
+ *   are read by different threads. d_scanparts() computes the ranges and
+ *   d_scanopen() creates a scan handle for a range. The handle has its own
+ *   file handle and buffer, so d_scanread() does not use any global state
+ *   and several threads may call it at the same time with different
+ *   handles. All other functions must be called from one thread at a time
+ *   as usual. The records are read without locks, so the database should
+ *   not be updated while the partitions are read.
+ *
+ * Functions:
+ *   d_colscan		- Read a batch of records into column arrays.
+ *   d_scanparts	- Split a record file into partitions.
+ *   d_scanopen		- Open a scan of a partition.
+ *   d_scanread		- Read a batch of records from a partition.
+ *   d_scanclose	- Close a scan of a partition.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "environ.h"
+#ifdef CONFIG_UNIX
+#	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#	include <stddef.h>
+#endif
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+/*--------------------------------- Macros ---------------------------------*/
+#define SCAN_BLOCK		65536L		/* Number of bytes read at a time	*/
+#define SLOTSIZE(rec)	((unsigned) offsetof(RECORDHEAD, data[0]) + \
+						 (rec)->preamble + (rec)->size)
+
+/*-------------------------------- Structures ------------------------------*/
+typedef struct {					/* Scan of a partition					*/
+	int			fh;					/* File handle (not shared with DB)		*/
+	unsigned	slotsize;			/* Size of a slot in the file			*/
+	unsigned	preamble;			/* Bytes before the record in the slot	*/
+	unsigned	size;				/* Record size							*/
+	ulong		recno;				/* Next slot to read from the file		*/
+	ulong		end;				/* Slot after the last slot to read		*/
+	unsigned	bufslots;			/* Number of slots that fit in <buf>	*/
+	unsigned	slots;				/* Number of slots in <buf>				*/
+	unsigned	next;				/* Next slot in <buf>					*/
+	char	   *buf;				/* Slot buffer							*/
+} SCAN;
+
+
+/*-------------------------------- d_colscan -------------------------------*\
+ *
+ * Purpose	 : Reads the next batch of records of a record type in physical
+ *			   order and copies the fields in <fields> to the arrays in
+ *			   <columns>. The value of field i in row r of the batch is
+ *			   stored at columns[i] + r * size of field i.
+ *
+ *			   <pos> is the scan position. It must be 0 before the first
+ *			   call and is updated by each call. The current record is not
+ *			   changed.
+ *
+ * Parameters: record	- Record id.
+ *			   nfields	- Number of fields.
+ *			   fields	- Field ids. The fields must belong to <record>.
+ *			   columns	- One array of <maxrows> values per field.
+ *			   maxrows	- Maximum number of rows in the batch.
+ *			   pos		- Scan position.
+ *			   rows		- Will contain the number of rows in the batch.
+ *
+ * Returns	 : S_OKAY	- <rows> rows were read.
+ *			   S_NOTFOUND- There are no more records.
+ *			   S_NOCD	- No current database.
+ *			   S_INVREC	- Invalid record id.
+ *			   S_INVFLD	- Invalid field id, or the field is not at the
+ *						  outermost level of the record.
+ *			   S_BADTYPE- The record has variable length.
+ *			   S_INVPARM- <maxrows> is 0.
+ *			   S_NOMEM	- Out of memory.
+ *
+ */
+
+FNCLASS int d_colscan(record, nfields, fields, columns, maxrows, pos, rows)
+ulong record;
+int nfields;
+ulong *fields;
+void **columns;
+unsigned maxrows;
+ulong *pos;
+unsigned *rows;
+{
+	Record *rec, *frec;
+	Field **fld;
+	char *buf, *slot;
+	unsigned slotsize, want, got, n, i;
+	ulong recno = *pos;
+	int f, rc;
+
+	*rows = 0;
+
+	if( (rc = set_recfld(record, &rec, NULL)) != S_OKAY )
+		return rc;
+
+	if( rec->is_vlr )
+		RETURN_RAP(S_BADTYPE);
+
+	if( !maxrows )
+		RETURN_RAP(S_INVPARM);
+
+	if( !(fld = (Field **)malloc((nfields ? nfields : 1) * sizeof *fld)) )
+		RETURN_RAP(S_NOMEM);
+
+	for( f=0; f<nfields; f++ )
+	{
+		if( (rc = set_recfld(fields[f], &frec, &fld[f])) != S_OKAY )
+		{
+			free(fld);
+			return rc;
+		}
+
+		if( frec != rec || fld[f]->nesting )
+		{
+			free(fld);
+			RETURN_RAP(S_INVFLD);
+		}
+	}
+
+	slotsize = SLOTSIZE(rec);
+	want	 = SCAN_BLOCK / slotsize ? (unsigned)(SCAN_BLOCK / slotsize) : 1;
+
+	if( !(buf = (char *)malloc((size_t) want * slotsize)) )
+	{
+		free(fld);
+		RETURN_RAP(S_NOMEM);
+	}
+
+	ty_lock();
+
+	for( n=0; n<maxrows; recno += got )
+	{
+		/* Never read more slots than there is room for */
+		if( (rc = ty_recslots(rec, buf, &recno, want < maxrows - n ?
+					want : maxrows - n, &got)) != S_OKAY || !got )
+			break;
+
+		for( i=0, slot=buf; i<got; i++, slot += slotsize )
+		{
+			if( ((RECORDHEAD *)slot)->flags & BIT_DELETED )
+				continue;
+
+			for( f=0; f<nfields; f++ )
+				memcpy((char *)columns[f] + n * fld[f]->size,
+					   ((RECORDHEAD *)slot)->data + rec->preamble + fld[f]->offset,
+					   fld[f]->size);
+			n++;
+		}
+	}
+
+	ty_unlock();
+
+	free(buf);
+	free(fld);
+
+	if( rc != S_OKAY )
+		return rc;
+
+	*pos  = recno;
+	*rows = n;
+
+	RETURN n ? S_OKAY : S_NOTFOUND;
+}
+
+
+/*------------------------------- d_scanparts ------------------------------*\
+ *
+ * Purpose	 : Splits the slots of a record file into <nparts> ranges of
+ *			   (almost) the same size. Partition i consists of the slots
+ *			   from bounds[i] up to but not including bounds[i+1].
+ *
+ * Parameters: record	- Record id.
+ *			   nparts	- Number of partitions.
+ *			   bounds	- Array of <nparts> + 1 slot numbers.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOCD	- No current database.
+ *			   S_INVREC	- Invalid record id.
+ *			   S_BADTYPE- The record has variable length.
+ *			   S_INVPARM- <nparts> is less than 1.
+ *
+ */
+
+FNCLASS int d_scanparts(record, nparts, bounds)
+ulong record;
+int nparts;
+ulong *bounds;
+{
+	Record *rec;
+	ulong first, end, size, rest;
+	int i, rc;
+
+	if( (rc = set_recfld(record, &rec, NULL)) != S_OKAY )
+		return rc;
+
+	if( rec->is_vlr )
+		RETURN_RAP(S_BADTYPE);
+
+	if( nparts < 1 )
+		RETURN_RAP(S_INVPARM);
+
+	ty_lock();
+	rc = ty_recrange(rec, &first, &end);
+	ty_unlock();
+
+	if( rc != S_OKAY )
+		return rc;
+
+	size = (end - first) / nparts;
+	rest = (end - first) % nparts;
+
+	for( i=0; i<=nparts; i++ )
+		bounds[i] = first + i * size + (i < rest ? i : rest);
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- d_scanopen -------------------------------*\
+ *
+ * Purpose	 : Opens a scan of the slots from <from> up to but not including
+ *			   <to> of a record file. The file is opened again, so the scan
+ *			   does not interfere with the database's own file handles.
+ *
+ * Parameters: record	- Record id.
+ *			   from		- First slot.
+ *			   to		- Slot after the last slot.
+ *			   scan		- Will contain the scan handle.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOCD	- No current database.
+ *			   S_INVREC	- Invalid record id.
+ *			   S_BADTYPE- The record has variable length.
+ *			   S_NOMEM	- Out of memory.
+ *			   S_IOFATAL- The file could not be opened.
+ *
+ */
+
+FNCLASS int d_scanopen(record, from, to, scan)
+ulong record, from, to;
+void **scan;
+{
+	Record *rec;
+	SCAN *S;
+	char fname[sizeof(DB->dbfpath) + FILENAME_LEN];
+	int rc;
+
+	if( (rc = set_recfld(record, &rec, NULL)) != S_OKAY )
+		return rc;
+
+	if( rec->is_vlr )
+		RETURN_RAP(S_BADTYPE);
+
+	if( !(S = (SCAN *)calloc(1, sizeof *S)) )
+		RETURN_RAP(S_NOMEM);
+
+	S->slotsize	= SLOTSIZE(rec);
+	S->preamble	= (unsigned) offsetof(RECORDHEAD, data[0]) + rec->preamble;
+	S->size		= rec->size;
+	S->recno	= from;
+	S->end		= to;
+	S->bufslots	= SCAN_BLOCK / S->slotsize ? (unsigned)(SCAN_BLOCK / S->slotsize) : 1;
+
+	if( !(S->buf = (char *)malloc((size_t) S->bufslots * S->slotsize)) )
+	{
+		free(S);
+		RETURN_RAP(S_NOMEM);
+	}
+
+	sprintf(fname, "%s%s", DB->dbfpath, DB->file[rec->fileid].name);
+
+	if( (S->fh = os_open(fname, CONFIG_O_BINARY|O_RDONLY, 0)) == -1 )
+	{
+		free(S->buf);
+		free(S);
+		RETURN_RAP(S_IOFATAL);
+	}
+
+	*scan = S;
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- d_scanread -------------------------------*\
+ *
+ * Purpose	 : Reads the next batch of records of a partition. The records
+ *			   are copied to <buf> one after the other, each taking up the
+ *			   size of the record (see d_getrecsize). This function does not
+ *			   set db_status, so it can be called by several threads at once.
+ *
+ * Parameters: scan		- Scan handle from d_scanopen().
+ *			   buf		- Buffer for <maxrows> records.
+ *			   maxrows	- Maximum number of records in the batch.
+ *			   rows		- Will contain the number of records in the batch.
+ *
+ * Returns	 : S_OKAY	- <rows> records were read.
+ *			   S_NOTFOUND- There are no more records in the partition.
+ *
+ */
+
+FNCLASS int d_scanread(scan, buf, maxrows, rows)
+void *scan;
+void *buf;
+unsigned maxrows;
+unsigned *rows;
+{
+	SCAN *S = (SCAN *)scan;
+	char *slot;
+	unsigned n = 0;
+	long len;
+
+	while( n < maxrows )
+	{
+		if( S->next == S->slots )
+		{
+			if( S->recno >= S->end )
+				break;
+
+			len = S->end - S->recno < S->bufslots ? S->end - S->recno : S->bufslots;
+
+			lseek(S->fh, (long) S->recno * S->slotsize, SEEK_SET);
+			if( (len = read(S->fh, S->buf, (unsigned) len * S->slotsize)) < (long)S->slotsize )
+			{
+				S->end = S->recno;
+				break;
+			}
+
+			S->slots  = (unsigned)(len / S->slotsize);
+			S->next   = 0;
+			S->recno += S->slots;
+		}
+
+		slot = S->buf + S->next++ * S->slotsize;
+
+		if( ((RECORDHEAD *)slot)->flags & BIT_DELETED )
+			continue;
+
+		memcpy((char *)buf + n++ * S->size, slot + S->preamble, S->size);
+	}
+
+	*rows = n;
+
+	return n ? S_OKAY : S_NOTFOUND;
+}
+
+
+/*------------------------------- d_scanclose ------------------------------*\
+ *
+ * Purpose	 : Closes a scan opened by d_scanopen().
+ *
+ * Parameters: scan		- Scan handle.
+ *
+ * Returns	 : S_OKAY
+ *
+ */
+
+FNCLASS int d_scanclose(scan)
+void *scan;
+{
+	SCAN *S = (SCAN *)scan;
+
+	os_close(S->fh);
+	free(S->buf);
+	free(S);
+
+	RETURN S_OKAY;
+}
+
+/* end-of-file */
@@ -0,0 +1,357 @@
+/*----------------------------------------------------------------------------
+ * File    : ty_snap.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Contains the copy-on-write side of online backup snapshots. tybackup
+ *   starts a snapshot by creating the file <data file>.snp for each data
+ *   file, holding the size of the data file, and then incrementing
+ *   snap_gen and setting snap_active in shared memory. All of this is done
+ *   while holding the lock, so no update is halfway through.
+ *
+ *   Before a data file is written, snap_save() appends the before-image
+ *   of every page that is about to change to the snapshot file, unless the
+ *   page has already been saved by this process or lies beyond the size of
+ *   the file at the snapshot. tybackup reads the data files sequentially
+ *   and uses the first before-image in the snapshot file instead of a page
+ *   that has been changed, which gives a point-in-time image of all files.
+ *
+ *   Each entry in the snapshot file is a page number (ulong) followed by
+ *   SNAP_PAGE bytes. An entry is appended with a single write() in append
+ *   mode, so entries from different processes are never mixed.
+ *
+ *   If a data file has a change bitmap, <data file>.chg, every page that is
+ *   written is also marked in it. tybackup resets the bitmaps when it takes
+ *   a snapshot, so an incremental backup only needs to copy the pages that
+ *   are marked. The bitmap is updated one byte at a time while holding the
+ *   lock, so bits set by other processes are not lost. Each process keeps
+ *   the bits it has set in memory until chg_gen in shared memory tells it
+ *   that the bitmaps have been reset.
+ *
+ * Functions:
+ *   snap_save		- Save the before-images of pages about to be written.
+ *   snap_mark		- Mark all pages of a data file as changed.
+ *   snap_free		- Free the snapshot state of a data file.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "environ.h"
+#ifdef CONFIG_UNIX
+#	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#	include <io.h>
+#endif
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+/*--------------------------- Function prototypes --------------------------*/
+static void		snap_begin		PRM( (SNAP *, char *, ulong);				)
+static void		chg_mark		PRM( (SNAP *, char *, ulong, unsigned);		)
+
+
+/*------------------------------- snap_begin -------------------------------*\
+ *
+ * Purpose	 : Prepares the snapshot state of a data file for a new
+ *			   snapshot. The size of the file at the snapshot is read from
+ *			   the snapshot file. If the file has no snapshot file (or one
+ *			   from another snapshot) no pages are saved.
+ *
+ * Parameters: S			- Snapshot state.
+ *			   fname		- Data file name.
+ *			   gen			- Generation of the current snapshot.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void snap_begin(S, fname, gen)
+SNAP *S;
+char *fname;
+ulong gen;
+{
+	SNAPHEAD head;
+	char snpname[128];
+	int fh;
+
+	FREE(S->saved);
+	S->saved = NULL;
+	S->size  = 0;
+	S->gen   = gen;
+
+	sprintf(snpname, "%s.snp", fname);
+	if( (fh = os_open(snpname, CONFIG_O_BINARY|O_RDONLY, 0)) == -1 )
+		return;
+
+	if( read(fh, &head, sizeof head) == sizeof head &&
+		!strcmp(head.id, SNAPVERSION_ID) && head.gen == gen )
+	{
+		S->size = head.size;
+
+		/* Without the bitmap a page is saved every time it is written. This
+		 * is slower but still correct, because tybackup uses the first
+		 * before-image of a page.
+		 */
+		S->saved = (uchar *)calloc(head.size / SNAP_PAGE / 8 + 1, 1);
+	}
+
+	os_close(fh);
+}
+
+
+/*-------------------------------- chg_mark --------------------------------*\
+ *
+ * Purpose	 : Marks the pages that are changed when <size> bytes are
+ *			   written at <pos> in the change bitmap of a data file, if the
+ *			   file has one.
+ *
+ * Parameters: S			- Snapshot state.
+ *			   fname		- Data file name.
+ *			   pos			- Position of the write.
+ *			   size			- Number of bytes about to be written.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void chg_mark(S, fname, pos, size)
+SNAP *S;
+char *fname;
+ulong pos;
+unsigned size;
+{
+	TyphoonSharedMemory *shm = DB->shm;
+	char chgname[128];
+	ulong page, lastpage, byte, bytes;
+	uchar *changed, bits;
+	int fh = -1;
+
+	sprintf(chgname, "%s.chg", fname);
+
+	/* The bitmaps have been reset (or created) by a backup */
+	if( !S->tracked || S->chggen != shm->chg_gen )
+	{
+		FREE(S->changed);
+		S->changed	= NULL;
+		S->chgbytes = 0;
+		S->chggen	= shm->chg_gen;
+		S->tracked	= os_access(chgname, 0) ? -1 : 1;
+	}
+
+	if( S->tracked == -1 )
+		return;
+
+	page	 = pos / SNAP_PAGE;
+	lastpage = (pos + size - 1) / SNAP_PAGE;
+
+	if( lastpage / 8 >= S->chgbytes )
+	{
+		bytes = lastpage / 8 + 1024;
+		if( !(changed = (uchar *)realloc(S->changed, bytes)) )
+			return;
+		memset(changed + S->chgbytes, 0, bytes - S->chgbytes);
+		S->changed	= changed;
+		S->chgbytes = bytes;
+	}
+
+	while( page <= lastpage )
+	{
+		/* Collect the bits of one byte of the bitmap */
+		byte = page >> 3;
+		bits = 0;
+		for( ; page <= lastpage && (page >> 3) == byte; page++ )
+			bits |= 1 << (page & 7);
+
+		if( (S->changed[byte] & bits) == bits )
+			continue;
+
+		if( fh == -1 &&
+			(fh = os_open(chgname, CONFIG_O_BINARY|O_RDWR, 0)) == -1 )
+			return;
+
+		S->changed[byte] |= bits;
+
+		lseek(fh, (long)(sizeof(CHGHEAD) + byte), SEEK_SET);
+		if( read(fh, &bits, 1) != 1 )
+			bits = 0;
+		bits |= S->changed[byte];
+		lseek(fh, (long)(sizeof(CHGHEAD) + byte), SEEK_SET);
+		write(fh, &bits, 1);
+	}
+
+	if( fh != -1 )
+		os_close(fh);
+}
+
+
+/*-------------------------------- snap_save -------------------------------*\
+ *
+ * Purpose	 : Saves the before-images of the pages that are changed when
+ *			   <size> bytes are written at the current position of <fh>, if
+ *			   a snapshot is active, and marks the pages in the change
+ *			   bitmap of the file. The file position is preserved.
+ *
+ * Parameters: S			- Snapshot state.
+ *			   fh			- Data file handle.
+ *			   fname		- Data file name.
+ *			   size			- Number of bytes about to be written.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void snap_save(S, fh, fname, size)
+SNAP *S;
+int fh;
+char *fname;
+unsigned size;
+{
+#ifdef CONFIG_UNIX
+	TyphoonSharedMemory *shm;
+	char buf[sizeof(ulong) + SNAP_PAGE];
+	char snpname[128];
+	ulong page, lastpage;
+	long pos;
+	int snpfh = -1, n;
+
+	if( !DB || !(shm = DB->shm) || !size )
+		return;
+
+	pos = lseek(fh, 0, SEEK_CUR);
+	chg_mark(S, fname, (ulong) pos, size);
+
+	if( !shm->snap_active )
+		return;
+
+	/* A new snapshot has been started since the last write */
+	if( S->gen != shm->snap_gen )
+		snap_begin(S, fname, shm->snap_gen);
+
+	page	 = pos / SNAP_PAGE;
+	lastpage = (pos + size - 1) / SNAP_PAGE;
+
+	for( ; page <= lastpage && page * SNAP_PAGE < S->size; page++ )
+	{
+		if( S->saved )
+		{
+			if( S->saved[page >> 3] & (1 << (page & 7)) )
+				continue;
+			S->saved[page >> 3] |= 1 << (page & 7);
+		}
+
+		memset(buf, 0, sizeof buf);
+		memcpy(buf, &page, sizeof page);
+
+		lseek(fh, (long) page * SNAP_PAGE, SEEK_SET);
+		if( (n = read(fh, buf + sizeof(ulong), SNAP_PAGE)) <= 0 )
+			continue;
+
+		if( snpfh == -1 )
+		{
+			sprintf(snpname, "%s.snp", fname);
+			if( (snpfh = os_open(snpname, CONFIG_O_BINARY|O_WRONLY|O_APPEND, 0)) == -1 )
+				break;
+		}
+
+		write(snpfh, buf, sizeof buf);
+	}
+
+	if( snpfh != -1 )
+		os_close(snpfh);
+
+	lseek(fh, pos, SEEK_SET);
+#endif
+}
+
+
+/*-------------------------------- snap_mark -------------------------------*\
+ *
+ * Purpose	 : Marks the first <size> bytes of a data file as changed in its
+ *			   change bitmap, if it has one. Used when the file has been
+ *			   replaced by a new one, whose pages must all be backed up.
+ *
+ * Parameters: S			- Snapshot state.
+ *			   fname		- Data file name.
+ *			   size			- Size of the data file.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void snap_mark(S, fname, size)
+SNAP *S;
+char *fname;
+ulong size;
+{
+#ifdef CONFIG_UNIX
+	ulong pos, n;
+
+	if( !DB || !DB->shm )
+		return;
+
+	for( pos=0; pos < size; pos += n )
+	{
+		n = size - pos < 0x40000000L ? size - pos : 0x40000000L;
+		chg_mark(S, fname, pos, (unsigned) n);
+	}
+#endif
+}
+
+
+/*-------------------------------- snap_free -------------------------------*\
+ *
+ * Purpose	 : Frees the snapshot state of a data file.
+ *
+ * Parameters: S			- Snapshot state.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void snap_free(S)
+SNAP *S;
+{
+	FREE(S->saved);
+	FREE(S->changed);
+	S->saved	= NULL;
+	S->changed	= NULL;
+	S->chgbytes = 0;
+	S->tracked	= 0;
+	S->gen		= 0;
+}
+
+/* end-of-file */
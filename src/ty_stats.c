@@ -0,0 +1,197 @@
+/*----------------------------------------------------------------------------
+ * File    : ty_stats.c
+ * Library : typhoon
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   I/O statistics. Each database file has a DB_STATS entry with counters
+ *   and latency histograms for its reads and writes, and the database has
+ *   one more entry for the counters that do not belong to a file, such as
+ *   lock requests. The entries are updated by the B-tree, record and VLR
+ *   routines through the stats pointer in their file descriptors, so a
+ *   file that is not opened through ty_openfile() is not counted. The
+ *   counting functions, stats_clock() and stats_io(), are found in os.c
+ *   because the utilities link with the lock functions without the rest
+ *   of the library.
+ *
+ *   On UNIX the entries are kept in the shared memory segment of the
+ *   database, right after the TyphoonSharedMemory structure. The counters
+ *   therefore cover all processes using the database, are incremented
+ *   atomically, and can be read by tystat while the database is in use.
+ *   They are cleared when the segment is created, i.e. when the first
+ *   process opens the database.
+ *
+ * Functions:
+ *   stats_open		- Set up the statistics of a database.
+ *   stats_close	- Release the statistics of a database.
+ *   d_getstats		- Get the statistics of a file or the whole database.
+ *   d_resetstats	- Clear the statistics of the current database.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "environ.h"
+#ifdef CONFIG_UNIX
+#	include <unistd.h>
+#	ifdef __STDC__
+#		include <stdlib.h>
+#	endif
+#else
+#	include <stdlib.h>
+#endif
+#include <string.h>
+#include <stdio.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+
+static CONFIG_CONST char rcsid[] = "$Id$";
+
+
+/*------------------------------- stats_open -------------------------------*\
+ *
+ * Purpose	 : Sets up the statistics of a database. On UNIX they are found
+ *			   in shared memory, so shm_alloc() must have been called.
+ *
+ * Parameters: _db		- Database table entry.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOMEM	- Not enough memory for the statistics.
+ *
+ */
+
+int stats_open(_db)
+Dbentry *_db;
+{
+#ifdef CONFIG_UNIX
+	_db->stats = (DB_STATS *)(_db->shm + 1);
+	lock_stats = _db->stats + _db->header.files;
+#else
+	_db->stats = (DB_STATS *)calloc(_db->header.files + 1, sizeof(DB_STATS));
+	if( !_db->stats )
+		RETURN S_NOMEM;
+#endif
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- stats_close ------------------------------*\
+ *
+ * Purpose	 : Releases the statistics of a database.
+ *
+ * Parameters: _db		- Database table entry.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+void stats_close(_db)
+Dbentry *_db;
+{
+#ifdef CONFIG_UNIX
+	if( lock_stats == _db->stats + _db->header.files )
+		lock_stats = NULL;
+#else
+	FREE(_db->stats);
+#endif
+	_db->stats = NULL;
+}
+
+
+/*-------------------------------- d_getstats ------------------------------*\
+ *
+ * Purpose	 : Get the I/O statistics of a file in the current database or
+ *			   of the database as a whole. On UNIX the statistics cover all
+ *			   the processes using the database.
+ *
+ * Parameters: file		- File number (as shown by dbdview). -1 = the sum of
+ *						  all files plus the lock requests of the database.
+ *			   stats	- Will contain the statistics.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOCD	- No current database.
+ *			   S_INVPARM- Invalid file number.
+ *
+ */
+
+FNCLASS int d_getstats(file, stats)
+int file;
+DB_STATS *stats;
+{
+	ulong *sum, *add;
+	int i, n;
+
+	if( CURR_DB == -1 )
+		RETURN_RAP(S_NOCD);
+
+	if( file < -1 || file >= DB->header.files )
+		RETURN_RAP(S_INVPARM);
+
+	if( file != -1 )
+	{
+		memcpy(stats, DB->stats + file, sizeof *stats);
+		RETURN S_OKAY;
+	}
+
+	/* DB_STATS only contains counters, so the entries can be added as
+	 * arrays of ulongs.
+	 */
+	memset(stats, 0, sizeof *stats);
+	for( i=0; i<=DB->header.files; i++ )
+	{
+		sum = (ulong *)stats;
+		add = (ulong *)(DB->stats + i);
+		for( n=0; n<sizeof(DB_STATS)/sizeof(ulong); n++ )
+			*sum++ += *add++;
+	}
+
+	RETURN S_OKAY;
+}
+
+
+/*------------------------------- d_resetstats -----------------------------*\
+ *
+ * Purpose	 : Clear the I/O statistics of the current database. On UNIX
+ *			   this clears them for all processes using the database.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : S_OKAY	- Ok.
+ *			   S_NOCD	- No current database.
+ *
+ */
+
+FNCLASS int d_resetstats()
+{
+	if( CURR_DB == -1 )
+		RETURN_RAP(S_NOCD);
+
+	memset(DB->stats, 0, (DB->header.files + 1) * sizeof(DB_STATS));
+
+	RETURN S_OKAY;
+}
+
+/* end-of-file */
@@ -48,19 +48,119 @@
 #define DB_MAX			10		/* Maximum number of concurrent databases	*/
 #define BTREE_DEPTH_MAX	10		/* Maximum B-tree depth						*/
 #define BIT_DELETED		0x01
+#define VLR_CLASSES		8		/* Size classes of free VLR extents			*/
+#define NODECACHE_SIZE	64		/* Uncompressed nodes kept per index file	*/
+#define KEYLOAD_RUNS	32		/* Max. sorted runs of keys being loaded	*/
+#define SNAP_PAGE		4096	/* Page size of snapshot before-images		*/
+#define SNAPVERSION_ID	"TySnap100"	/* Version ID of snapshot files			*/
+#define CHGVERSION_ID	"TyChg100"	/* Version ID of change bitmap files	*/
+#define SEQ_SHM_MAX		32		/* Sequences kept in shared memory			*/
+#define SEQ_SHM_AHEAD	1024	/* Steps stored ahead of the numbers used	*/
+#define KEYCOMPACT_TRIES 3		/* Copies made by d_keycompact() without	*/
+								/* the lock before it keeps the lock		*/
 
 /*---------- Macros --------------------------------------------------------*/
 #define FREE(p)			if( p ) free(p)
 #define RETURN          return db_status =
 #define RETURN_RAP(v)	return report_err(v);
 
+/* Statistics counters are shared by all processes using a database, so
+ * they are incremented atomically where the compiler allows it.
+ */
+#if defined(CONFIG_UNIX) && defined(__GNUC__)
+#	define STAT_ADD(v,n)	__sync_fetch_and_add(&(v), n)
+#else
+#	define STAT_ADD(v,n)	((v) += (n))
+#endif
+#define STAT_COUNT(s,f,n)	((s) ? STAT_ADD((s)->f, n) : 0)
+
+#define STAT_READ		0			/* stats_io() kinds						*/
+#define STAT_WRITE		1
+#define STAT_LOCK		2
+
 /*---------- Structures ----------------------------------------------------*/
 typedef ulong ix_addr;
 typedef int (*CMPFUNC)PRM((void *, void *));
+
+typedef struct filehead {			/* Head of INDEX, RECORD and VLR		*/
+	char	type;					/* 'd' = data, 'k' = key, 'v' = vlr file*/
+	struct filehead *lru_prev;		/* More recently used open file			*/
+	struct filehead *lru_next;		/* Less recently used open file			*/
+	int		fh;						/* File handle (-1 = closed)			*/
+	DB_STATS *stats;				/* Statistics of the file (or NULL)		*/
+} FILEHEAD;
+
+typedef struct {					/* Bloom filter of an index file		*/
+	struct {						/* Bloom filter file header				*/
+		char	id[16];				/* Version id							*/
+		ulong	bits;				/* Number of bits in the filter			*/
+		ulong	keys;				/* Number of keys in index when saved	*/
+		ushort	hashes;				/* Number of hash functions				*/
+		ushort	clean;				/* Was the filter saved by a close?		*/
+	} H;
+	int		dirty;					/* Changed since it was last saved?		*/
+	uchar  *map;					/* Bit map (H.bits/8 bytes)				*/
+} BLOOM;
+
+typedef struct {					/* Keys of an index being loaded		*/
+	unsigned size;					/* Size of an entry (ref + key value)	*/
+	char   *buf;					/* Entries								*/
+	ulong	count;					/* Number of entries in <buf>			*/
+	ulong	alloc;					/* Number of entries allocated			*/
+	ulong	sorted;					/* Entries before this one are sorted	*/
+	int		runs;					/* Number of sorted runs				*/
+	ulong	run[KEYLOAD_RUNS];		/* First entry of each sorted run		*/
+} KEYLOAD;
+
+typedef struct {					/* Snapshot file (<data file>.snp) header*/
+	char	id[16];					/* Version id							*/
+	ulong	gen;					/* Snapshot generation					*/
+	ulong	size;					/* Size of data file at the snapshot	*/
+} SNAPHEAD;
+
+typedef struct {					/* Change bitmap file (<data file>.chg)	*/
+	char	id[16];					/* Version id							*/
+	long	base;					/* Backup the changes are relative to	*/
+} CHGHEAD;							/* Followed by one bit per page			*/
+
+typedef struct {					/* Snapshot state of a data file		*/
+	ulong	gen;					/* Generation that <saved> belongs to	*/
+	ulong	size;					/* Size of file at the snapshot. Pages	*/
+									/* from here on are not saved			*/
+	uchar  *saved;					/* Pages saved in the snapshot file		*/
+	ulong	chggen;					/* Generation that <changed> belongs to	*/
+	int		tracked;				/* Are changed pages tracked? 1 = yes,	*/
+									/* -1 = no, 0 = not known yet			*/
+	uchar  *changed;				/* Pages marked in the change bitmap	*/
+	ulong	chgbytes;				/* Number of bytes in <changed>			*/
+} SNAP;
+
+typedef struct {					/* Free slots of one size				*/
+	ulong  *pos;					/* First unit of each slot				*/
+	ulong	n;						/* Number of slots						*/
+	ulong	max;					/* Number of entries allocated			*/
+} FREERUNS;
+
+typedef struct {					/* Page map of a compressed index file	*/
+	ulong  *pos;					/* First unit of each page's slot + 1.	*/
+									/* 0 = page not in use					*/
+	ushort *units;					/* Number of units in each page's slot	*/
+	ulong	pages;					/* Pages below this page may be in use	*/
+	ulong	alloc;					/* Number of entries allocated			*/
+	ulong	freepage;				/* No free page is below this page		*/
+	ulong	endunit;				/* First unit after the last slot		*/
+	ulong	gen;					/* Generation of last slot written		*/
+	int		maxunits;				/* Number of units in the largest slot	*/
+	FREERUNS *free;					/* Free slots by size (maxunits+1)		*/
+	char   *zbuf;					/* Slot buffer (maxunits units)			*/
+} NODEMAP;
+
 typedef struct {
 	char	type;  					/* = 'k'								*/
-	ulong	seqno;					/* Sequence number						*/
+	FILEHEAD *lru_prev;				/* More recently used open file			*/
+	FILEHEAD *lru_next;				/* Less recently used open file			*/
     int     fh;                     /* File handle                      	*/
+	DB_STATS *stats;				/* Statistics of the file (or NULL)		*/
     char    fname[80];              /* File name                        	*/
 	struct {						/* Index file header					*/
 	    char    id[16];         	/* Version id                           */
@@ -73,6 +173,10 @@ typedef struct {
 	    ulong	keys;				/* Number of keys in index				*/
 	    ulong	timestamp;			/* Timestamp. Changed by d_keyadd/del()	*/
 	    char    spare[2];	    	/* Not used								*/
+	    ulong	maptab;				/* Unit of page map + 1. 0 = the map	*/
+									/* must be rebuilt (compressed files)	*/
+	    ulong	mappages;			/* Number of pages in page map			*/
+	    ulong	mapgen;				/* Generation of last slot written		*/
 	} H;
     CMPFUNC cmpfunc;                /* Comparison function              	*/
     struct {						/* Path to current node and key			*/
@@ -86,9 +190,25 @@ typedef struct {
     int		curr;                   /* Do we have a current key?        	*/
 	int		hold;					/* Used by d_keynext and d_keyprev		*/
 	char   *curkey;					/* 'current key' buffer					*/
+	BLOOM  *bloom;					/* Bloom filter (NULL = none)			*/
+	NODEMAP *map;					/* Page map (NULL = not compressed)		*/
+	char   *cache;					/* Recent nodes (NULL = shared file)	*/
+	ix_addr	cached[NODECACHE_SIZE];	/* Page of each node in <cache>			*/
+	ulong	cache_hits;				/* Nodes read from <cache>				*/
+	ulong	lru_hits;				/* <cache_hits> when last spared from	*/
+									/* being closed							*/
+	KEYLOAD *load;					/* Keys being loaded (NULL = none)		*/
     char    node[1];				/* This array is size nodesize      	*/
 } INDEX;
 
+typedef struct {					/* B-tree being built bottom-up			*/
+	INDEX  *I;						/* Index file							*/
+	int		fill;					/* Tuples per node						*/
+	int		levels;					/* Number of levels so far				*/
+	ulong	keys;					/* Number of keys added					*/
+	char   *node[BTREE_DEPTH_MAX];	/* Rightmost node of each level			*/
+} BTBUILD;
+
 typedef struct {					/* Record head (found in every record)	*/
 	ulong		prev;				/* Pointer to previous record           */
 	ulong		next;				/* Pointer to next record               */
@@ -98,8 +218,10 @@ typedef struct {					/* Record head (found in every record)	*/
 
 typedef struct {
 	char			type;			/* = 'd'								*/
-	ulong			seqno;			/* Sequence number						*/
+	FILEHEAD	   *lru_prev;		/* More recently used open file			*/
+	FILEHEAD	   *lru_next;		/* Less recently used open file			*/
     int             fh;				/* File handle							*/
+	DB_STATS	   *stats;			/* Statistics of the file (or NULL)		*/
 	char			fname[80];		/* File name							*/
     struct {
         char        id[16];         /* Version id                           */
@@ -115,6 +237,18 @@ typedef struct {
 									/* record in the file					*/
 	int				share;			/* Opened in shared mode?				*/
     ulong           recno;          /* Current record number. 0 = no current*/
+	int				reload;			/* Must <rec> be reread for <recno>?	*/
+	uchar		   *map;			/* Free-space bitmap. NULL = the file	*/
+									/* uses the delete chain				*/
+	ulong			mapsize;		/* Number of bytes allocated for <map>	*/
+	int				mapfh;			/* Free-space bitmap file handle		*/
+	ulong			freehint;		/* No free slot is below this slot		*/
+	ulong			generation;		/* Generation of <map> (shared mode)	*/
+	char		   *abuf;			/* Records being appended. NULL = none	*/
+	ulong			afirst;			/* Slot of the first record in <abuf>	*/
+	unsigned		acount;			/* Number of records in <abuf>			*/
+	unsigned		amax;			/* Number of records <abuf> can hold	*/
+	SNAP			snap;			/* Snapshot state (online backup)		*/
 	RECORDHEAD		rec;
 } RECORD;
 
@@ -127,34 +261,57 @@ typedef struct {
 	char			data[1];		/* Data 								*/
 } VLRBLOCK;
 
+typedef struct {					/* Extent (found in extent VLR files)	*/
+	ulong			nextblock;		/* Next extent of record or free list	*/
+	ulong			blocks;			/* Number of blocks in extent			*/
+	unsigned		recsize;		/* Size of record. 0 = not the first	*/
+									/* extent of a record, ~0 = free extent	*/
+	char			data[1];		/* Data 								*/
+} VLREXTENT;
+
 typedef struct {
 	char			type;			/* = 'v'								*/
-	ulong			seqno;	 		/* Sequence number						*/
+	FILEHEAD	   *lru_prev;		/* More recently used open file			*/
+	FILEHEAD	   *lru_next;		/* Less recently used open file			*/
 	int 			fh;				/* File handle							*/
+	DB_STATS	   *stats;			/* Statistics of the file (or NULL)		*/
 	char			fname[80];		/* File name							*/
     int				shared;			/* Opened in shared mode?				*/
 	unsigned		datasize;		/* Number of bytes in each block		*/
 	VLRBLOCK		*block;			/* Pointer to buffer					*/
+	unsigned		bufsize;		/* Size of <block> buffer				*/
+	int				extents;		/* Are records stored in extents?		*/
+	char		   *zbuf;			/* Compression buffer					*/
+	unsigned		zbufsize;		/* Size of <zbuf>						*/
+	unsigned		hdrsize;		/* Size of header in the file			*/
+	SNAP			snap;			/* Snapshot state (online backup)		*/
 	struct {
 		char		version[32];	/* VLR version number					*/
 		char		id[32]; 		/* User provided ID 					*/
 		unsigned	blocksize;		/* Block size							*/
 		ulong		firstfree;		/* First free data block				*/
 		ulong		numrecords;		/* Number of records in file			*/
+		/* The fields below are only found in extent files */
+		ulong		freelist[VLR_CLASSES];/* Free extents by size class	*/
+		ulong		endblock;		/* First block after the last extent	*/
+		ushort		codec;			/* Record compression. 0 = none			*/
 	} header;
 } VLR;
 
 typedef union {
-	struct {
-		char 	type;				/* 'd' = data,, 'k' = key, 'v'=vlr file	*/
-		ulong	seqno;				/* Sequence number						*/
-		int		fh;
-	} *any;
+	FILEHEAD	*any;				/* Head common to all file types		*/
 	INDEX		*key;				/* Index File Descriptor				*/
 	RECORD		*rec;				/* Record File Descriptor				*/
     VLR         *vlr;               /* Variable Length Record Descriptor    */
 } Fh;
 
+typedef struct {					/* Sequence in shared memory			*/
+	volatile ulong loaded;			/* Has <base> been read from the file?	*/
+	volatile ulong base;			/* Number in sequence.dat when loaded	*/
+	volatile ulong issued;			/* Steps reserved by processes			*/
+	volatile ulong stored;			/* Steps covered by sequence.dat		*/
+} SeqShm;
+
 typedef struct {
 	int			use_count;			/* First remove shared memory when 0	*/
 	int			backup_active;
@@ -162,9 +319,39 @@ typedef struct {
 	ulong		curr_recid;
 	ulong		curr_recno;
 	ulong		num_trans_active;
-	char		spare[96];
+	ulong		rec_updates;		/* Incremented by every record update	*/
+	ulong		snap_active;		/* Is a snapshot being backed up?		*/
+	ulong		snap_gen;			/* Generation of the current snapshot	*/
+	ulong		chg_gen;			/* Incremented when change bitmaps are	*/
+									/* reset by a backup					*/
+	ulong		key_gen;			/* Incremented when an index file is	*/
+									/* replaced by d_keycompact()			*/
+	SeqShm		seq[SEQ_SHM_MAX];	/* The first sequences of the database	*/
+	char		spare[64];
 } TyphoonSharedMemory;
 
+typedef struct {					/* Record cache slot					*/
+	ulong		recid;				/* Internal record id					*/
+	ulong		recno;				/* Record number. 0 = empty slot		*/
+	ulong		stamp;				/* rec_updates when the slot was filled	*/
+	unsigned	size;				/* Number of bytes in <data>			*/
+	char		*data;				/* Record incl. preamble				*/
+} CacheSlot;
+
+#define PARENTCACHE_SLOTS	512		/* Slots in the parent key cache		*/
+
+typedef struct {					/* Parent key cache slot				*/
+	Id			fileid;				/* Index of the parent's primary key	*/
+	ulong		stamp;				/* Index timestamp when filled			*/
+	ulong		ref;				/* Parent record. 0 = empty slot		*/
+	char		value[KEYSIZE_MAX];	/* Primary key value of the parent		*/
+} ParentSlot;
+
+typedef struct {					/* Sequence numbers reserved by a process*/
+	ulong		next;				/* Next number to hand out				*/
+	ulong		left;				/* Numbers left in the range			*/
+} SeqRange;
+
 typedef struct {					/* Database table entry					*/
 	char		name[15];			/* Database name						*/
 	char		mode;				/* [s]hared, [o]ne user, e[x]clusive	*/
@@ -189,11 +376,25 @@ typedef struct {					/* Database table entry					*/
 	Sequence	*sequence;
 	TyphoonSharedMemory *shm;
 	int			seq_fh;
+	SeqRange	*seqrange;			/* Array [header.sequences] of ranges	*/
 	int			shm_id;
 	char		*recbuf;			/* This points to where the actual data	*/
 									/* starts (bypassing foreign key refs)	*/
 	char  		*real_recbuf;		/* This points to the real start of the	*/
 									/* buffer								*/
+	unsigned	biggest_rec;		/* Size of real_recbuf					*/
+	CacheSlot	*cache;				/* Record cache (NULL = no cache)		*/
+	int			cache_slots;		/* Number of slots in <cache>			*/
+	ulong		cache_hits;			/* Records found in the cache			*/
+	ulong		cache_misses;		/* Records read from disk				*/
+	ParentSlot	*parent_cache;		/* Parents found by foreign key checks	*/
+	ulong		parent_hits;		/* Parents found in <parent_cache>		*/
+	ulong		parent_misses;		/* Parents looked up in the index		*/
+	DB_STATS	*stats;				/* Array [header.files+1] of statistics.*/
+									/* The last entry is the database's own	*/
+	Record		*loading;			/* Record being loaded (d_loadbegin)	*/
+	ulong		key_gen;			/* shm->key_gen when the index files	*/
+									/* were last reopened					*/
 } Dbentry;
 
 typedef struct {
@@ -208,10 +409,18 @@ typedef struct {
 	Dbentry	*db;							/* Current database				*/
 
 	int		 do_rebuild;					/* Rebuild indexes on d_open()?	*/
+	int		 rebuild_procs;					/* Processes used to rebuild	*/
 	int		 dbs_open;
 
 	int		 cur_open;						/* Current number of open files	*/
 	int		 max_open;						/* Maximum number of open files	*/
+	ulong	 file_reopens;					/* Closed files opened again	*/
+	ulong	 file_closes;					/* Files closed to make room	*/
+	int		 cache_slots;					/* Record cache slots per db	*/
+	int		 rec_bitmap;					/* Create bitmap record files?	*/
+	int		 vlr_compress;					/* Create compressed VLR files?	*/
+	int		 key_compress;					/* Create compressed key files?	*/
+	int		 seq_cache;						/* Sequence numbers reserved	*/
 
 	ulong	 curr_keybuf[KEYSIZE_MAX/sizeof(long)];
 
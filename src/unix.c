@@ -47,6 +47,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include "typhoon.h"
 #include "ty_dbd.h"
@@ -60,6 +61,8 @@
 static CONFIG_CONST char rcsid[] = "$Id: unix.c,v 1.10 1999/10/04 04:39:42 kaz Exp $";
 
 /*---------------------------- Global variables ----------------------------*/
+DB_STATS *lock_stats = NULL;		/* Statistics of the current database	*/
+
 #ifdef SEMLOCK
 static struct sembuf sem_wait_buf[2] = {
 	0, 0, 0,						/* wait for sem to become 0			*/
@@ -130,6 +133,7 @@ void ty_lock()
 #ifdef CONFIG_USE_FLOCK
 	struct flock flk;
 #endif
+	ulong start = stats_clock(lock_stats);
 
 #ifdef SEMLOCK
 #if 1
@@ -150,7 +154,7 @@ void ty_lock()
     flk.l_start = 0;
     flk.l_len = 1;
 
-    while (fcntl(lock_fh, F_SETLK, &flk) == -1)
+    while (fcntl(lock_fh, F_SETLKW, &flk) == -1)
 	{
 		if (errno != EINTR)
 		{
@@ -171,6 +175,7 @@ void ty_lock()
 #endif
 
 #endif
+	stats_io(lock_stats, STAT_LOCK, start, 1);
 }
 
 
@@ -213,12 +218,28 @@ Dbentry *db;
 	key_t key;
 	long flags = IPC_CREAT|0770;
 	int created = 0;
+	size_t size;
+	struct shmid_ds ds;
+
+	/* The I/O statistics of the files follow the shared memory structure */
+	size = sizeof(*db->shm) + (db->header.files + 1) * sizeof(DB_STATS);
 
 	sprintf(dbdname, "%s.dbd", db->name);
 	key = ftok(dbdname, 30);
 	
-	if( (db->shm_id = shmget(key, sizeof(*db->shm), 0)) == -1 ) {
-	    if( (db->shm_id = shmget(key, sizeof(*db->shm), flags)) == -1 )
+	/* A segment that is too small was left by a process that did not
+	 * close the database. It is replaced if no process is attached to it.
+	 */
+	if( (db->shm_id = shmget(key, size, 0)) == -1 && errno == EINVAL
+	&&  (db->shm_id = shmget(key, 0, 0)) != -1
+	&&  shmctl(db->shm_id, IPC_STAT, &ds) != -1 && ds.shm_nattch == 0 )
+	{
+		shmctl(db->shm_id, IPC_RMID, NULL);
+		db->shm_id = -1;
+	}
+
+	if( db->shm_id == -1 ) {
+	    if( (db->shm_id = shmget(key, size, flags)) == -1 )
 	    	return -1;
 	    else
 	    	created = 1;
@@ -254,7 +275,7 @@ Dbentry *db;
 	}
 
 	if( created )
-		memset(db->shm, 0, sizeof *db->shm);
+		memset(db->shm, 0, size);
 	db->shm->use_count++;
 
 	return 0;
@@ -274,6 +295,7 @@ Dbentry *db;
 	}
 	else
 		shmdt((char *)db->shm);
+	db->shm = NULL;
 #if 0
 	sem_close(sem_id);
 #endif
@@ -28,6 +28,29 @@
  * Description:
  *   Contains functions for Variable Length Records.
  *
+ *   Files of version 1.00 store a record in a chain of blocks, and free
+ *   blocks are kept in a single delete chain. Files of version 1.01 store a
+ *   record in an extent, i.e. a number of contiguous blocks with a single
+ *   header, so the record can be read and written with one I/O. If an
+ *   updated record does not fit in its extent, the rest is stored in a
+ *   second extent. Free extents are kept in doubly linked free lists, one
+ *   per size class. A freed extent is merged with the free extents next to
+ *   it, and free space at the end of the file is given back to the end of
+ *   the file, so space freed by deletes and updates can be reused by larger
+ *   records. New files are created as version 1.01.
+ *
+ *   A free extent is marked by the record size EXT_FREE. The first block
+ *   holds the previous extent in the free list after the head, and the last
+ *   block ends with the block number of the head, so the extent before a
+ *   freed extent can be found. Only the heads of free extents are marked,
+ *   so the end tag is only trusted if it leads to a marked head that ends
+ *   at the freed extent.
+ *
+ *   The records of a version 1.01 file can be compressed. The codec is
+ *   stored in the file header. The first byte of a record tells whether it
+ *   is compressed, because a record that does not get smaller is stored as
+ *   is.
+ *
  * Functions:
  *
  *--------------------------------------------------------------------------*/
@@ -57,14 +80,31 @@
 #include "ty_glob.h"
 
 #define VLR_VERSION	"1.00"
+#define VLR_EXTVERSION	"1.01"
+#define VLR_CODEC_NONE	0		/* Records are not compressed				*/
+#define VLR_CODEC_LZ	1		/* Records are compressed by lz_compress()	*/
+#define PACK_STORED		0		/* The record is stored as is				*/
+#define PACK_LZ			1		/* The record is compressed					*/
+#define PACK_HEAD		(1 + sizeof(unsigned))
 #define SEM_LEN 	0
 
 #define _BLOCKSIZE		(vlr->header.blocksize)
 #define _FIRSTFREE		(vlr->header.firstfree)
 #define _NEXTBLOCK		(vlr->block->nextblock)
 #define _RECSIZE		(vlr->block->recsize)
+#define _FREELIST		(vlr->header.freelist)
+#define _ENDBLOCK		(vlr->header.endblock)
 #define filelength(fd)	lseek(fd, 0, SEEK_END)
 
+#define EXT_HEAD		((unsigned) offsetof(VLREXTENT, data[0]))
+#define EXT_CAPACITY(n)	((n) * _BLOCKSIZE - EXT_HEAD)
+#define EXT_BLOCKS(s)	(((s) + EXT_HEAD + _BLOCKSIZE - 1) / _BLOCKSIZE)
+#define EXT_FREE		((unsigned) ~0)	/* Record size of a free extent		*/
+#define EXT_ISREC(h)	((h).recsize && (h).recsize != EXT_FREE)
+#define EXT_PREV(b)		((off_t) (b) * _BLOCKSIZE + EXT_HEAD)
+#define EXT_TAG(b)		((off_t) (b) * _BLOCKSIZE - (off_t) sizeof(ulong))
+#define snapsave(v,n)	snap_save(&(v)->snap, (v)->fh, (v)->fname, n)
+
 
 static CONFIG_CONST char rcsid[] = "$Id: vlr.c,v 1.8 1999/10/04 03:45:08 kaz Exp $";
 
@@ -74,6 +114,29 @@ static void put_block		PRM( (VLR *, ulong); )
 static ulong get_nextblock	PRM( (VLR *, ulong); )
 static void get_header		PRM( (VLR *); )
 static void put_header		PRM( (VLR *); )
+static void add_blocks		PRM( (VLR *, void *, unsigned, unsigned); )
+static void free_blocks		PRM( (VLR *, ulong); )
+static int	ext_class		PRM( (ulong); )
+static int	ext_grow		PRM( (VLR *, unsigned); )
+static void ext_gethead		PRM( (VLR *, ulong, VLREXTENT *); )
+static void ext_puthead		PRM( (VLR *, ulong, VLREXTENT *); )
+static ulong ext_getlong	PRM( (VLR *, off_t); )
+static void ext_putlong		PRM( (VLR *, off_t, ulong); )
+static void ext_clear		PRM( (VLR *, ulong, ulong); )
+static void ext_link		PRM( (VLR *, ulong, ulong); )
+static void ext_unlink		PRM( (VLR *, ulong, VLREXTENT *); )
+static void ext_free		PRM( (VLR *, ulong, ulong); )
+static ulong ext_alloc		PRM( (VLR *, ulong); )
+static ulong ext_fit		PRM( (VLR *, ulong, ulong, unsigned); )
+static ulong ext_extend		PRM( (VLR *, ulong, ulong, ulong); )
+static int	ext_put			PRM( (VLR *, void *, unsigned, ulong, ulong, ulong, ulong); )
+static void ext_freechain	PRM( (VLR *, ulong); )
+static int	ext_add			PRM( (VLR *, void *, unsigned, ulong *); )
+static int	ext_write		PRM( (VLR *, void *, unsigned, ulong); )
+static int	ext_read		PRM( (VLR *, void *, unsigned, ulong, unsigned *); )
+static int	zbuf_grow		PRM( (VLR *, unsigned); )
+static int	vlr_pack		PRM( (VLR *, void *, unsigned, unsigned *); )
+static int	vlr_unpack		PRM( (VLR *, unsigned, void *, unsigned, unsigned *); )
 
 
 
@@ -81,16 +144,23 @@ static void get_block(vlr, blockno)
 VLR *vlr;
 ulong blockno;
 {
+	ulong start = stats_clock(vlr->stats);
+
 	lseek(vlr->fh, (off_t) (blockno * vlr->header.blocksize), SEEK_SET);
 	read(vlr->fh, vlr->block, vlr->header.blocksize - SEM_LEN);
+	stats_io(vlr->stats, STAT_READ, start, 1);
 }
 
 static void put_block(vlr, blockno)
 VLR *vlr;
 ulong blockno;
 {
+	ulong start = stats_clock(vlr->stats);
+
 	lseek(vlr->fh, (off_t) (blockno * vlr->header.blocksize), SEEK_SET);
+	snapsave(vlr, vlr->header.blocksize - SEM_LEN);
 	write(vlr->fh, vlr->block, vlr->header.blocksize - SEM_LEN);
+	stats_io(vlr->stats, STAT_WRITE, start, 1);
 }
 
 
@@ -117,7 +187,7 @@ static void get_header(vlr)
 VLR *vlr;
 {
 	lseek(vlr->fh, 0, SEEK_SET);
-	read(vlr->fh, &vlr->header, sizeof vlr->header);
+	read(vlr->fh, &vlr->header, vlr->hdrsize);
 }
 
 
@@ -131,7 +201,627 @@ static void put_header(vlr)
 VLR *vlr;
 {
 	lseek(vlr->fh, 0, SEEK_SET);
-	write(vlr->fh, &vlr->header, sizeof vlr->header);
+	snapsave(vlr, vlr->hdrsize);
+	write(vlr->fh, &vlr->header, vlr->hdrsize);
+}
+
+
+/*------------------------------- ext_class --------------------------------*\
+ *
+ * Return the size class of an extent of <blocks> blocks. Class 0 holds
+ * extents of 1 block, class 1 of 2 blocks, class 2 of 3-4 blocks, class 3
+ * of 5-8 blocks and so on. The last class holds all larger extents.
+ *
+ */
+
+static int ext_class(blocks)
+ulong blocks;
+{
+	int class = 0;
+
+	while( blocks > 1 && class < VLR_CLASSES-1 )
+	{
+		blocks = (blocks + 1) / 2;
+		class++;
+	}
+
+	return class;
+}
+
+
+/*-------------------------------- ext_grow --------------------------------*\
+ *
+ * Ensure that the block buffer can hold <size> bytes.
+ *
+ */
+
+static int ext_grow(vlr, size)
+VLR *vlr;
+unsigned size;
+{
+	VLRBLOCK *block;
+
+	if( size <= vlr->bufsize )
+		return S_OKAY;
+
+	if( !(block = (VLRBLOCK *)realloc(vlr->block, size)) )
+		RETURN S_NOMEM;
+
+	vlr->block	 = block;
+	vlr->bufsize = size;
+
+	return S_OKAY;
+}
+
+
+static void ext_gethead(vlr, blockno, head)
+VLR *vlr;
+ulong blockno;
+VLREXTENT *head;
+{
+	lseek(vlr->fh, (off_t) (blockno * _BLOCKSIZE), SEEK_SET);
+	if( read(vlr->fh, head, EXT_HEAD) != EXT_HEAD )
+		memset(head, 0, EXT_HEAD);
+}
+
+
+static void ext_puthead(vlr, blockno, head)
+VLR *vlr;
+ulong blockno;
+VLREXTENT *head;
+{
+	lseek(vlr->fh, (off_t) (blockno * _BLOCKSIZE), SEEK_SET);
+	snapsave(vlr, EXT_HEAD);
+	write(vlr->fh, head, EXT_HEAD);
+}
+
+
+static ulong ext_getlong(vlr, pos)
+VLR *vlr;
+off_t pos;
+{
+	ulong value;
+
+	lseek(vlr->fh, pos, SEEK_SET);
+	if( read(vlr->fh, &value, sizeof value) != sizeof value )
+		return 0;
+
+	return value;
+}
+
+
+static void ext_putlong(vlr, pos, value)
+VLR *vlr;
+off_t pos;
+ulong value;
+{
+	lseek(vlr->fh, pos, SEEK_SET);
+	snapsave(vlr, sizeof value);
+	write(vlr->fh, &value, sizeof value);
+}
+
+
+/*-------------------------------- ext_clear -------------------------------*\
+ *
+ * Write the head of an extent that is neither free nor the first extent of
+ * a record, e.g. because it has been merged into another extent.
+ *
+ */
+
+static void ext_clear(vlr, blockno, blocks)
+VLR *vlr;
+ulong blockno, blocks;
+{
+	VLREXTENT head;
+
+	head.nextblock	= 0;
+	head.blocks		= blocks;
+	head.recsize	= 0;
+	ext_puthead(vlr, blockno, &head);
+}
+
+
+/*-------------------------------- ext_link --------------------------------*\
+ *
+ * Make the blocks from <blockno> a free extent and insert it at the front
+ * of the free list of its size class. The blocks next to it must not be
+ * free.
+ *
+ */
+
+static void ext_link(vlr, blockno, blocks)
+VLR *vlr;
+ulong blockno, blocks;
+{
+	char buf[sizeof(VLREXTENT) + sizeof(ulong)];
+	VLREXTENT head;
+	ulong prev = 0;
+	int class = ext_class(blocks);
+
+	head.nextblock	= _FREELIST[class];
+	head.blocks		= blocks;
+	head.recsize	= EXT_FREE;
+
+	/* The head and the link to the previous extent are written together */
+	memcpy(buf, &head, EXT_HEAD);
+	memcpy(buf + EXT_HEAD, &prev, sizeof prev);
+
+	lseek(vlr->fh, (off_t) (blockno * _BLOCKSIZE), SEEK_SET);
+	snapsave(vlr, EXT_HEAD + sizeof prev);
+	write(vlr->fh, buf, EXT_HEAD + sizeof prev);
+
+	ext_putlong(vlr, EXT_TAG(blockno + blocks), blockno);
+
+	if( head.nextblock )
+		ext_putlong(vlr, EXT_PREV(head.nextblock), blockno);
+
+	_FREELIST[class] = blockno;
+}
+
+
+/*------------------------------- ext_unlink -------------------------------*\
+ *
+ * Remove the free extent <blockno> with the head <head> from its free list.
+ * The head is not changed.
+ *
+ */
+
+static void ext_unlink(vlr, blockno, head)
+VLR *vlr;
+ulong blockno;
+VLREXTENT *head;
+{
+	ulong prev = ext_getlong(vlr, EXT_PREV(blockno));
+
+	if( prev )
+		ext_putlong(vlr, (off_t) (prev * _BLOCKSIZE + offsetof(VLREXTENT, nextblock)),
+					head->nextblock);
+	else
+		_FREELIST[ext_class(head->blocks)] = head->nextblock;
+
+	if( head->nextblock )
+		ext_putlong(vlr, EXT_PREV(head->nextblock), prev);
+}
+
+
+/*-------------------------------- ext_free --------------------------------*\
+ *
+ * Free an extent. It is merged with the free extents before and after it,
+ * and the result is inserted in the free list of its size class. An extent
+ * at the end of the file is given back to the end of the file instead.
+ *
+ */
+
+static void ext_free(vlr, blockno, blocks)
+VLR *vlr;
+ulong blockno, blocks;
+{
+	VLREXTENT head;
+	ulong prev;
+
+	/* Merge with a free extent that follows */
+	if( blockno + blocks < _ENDBLOCK )
+	{
+		ext_gethead(vlr, blockno + blocks, &head);
+
+		if( head.recsize == EXT_FREE )
+		{
+			ext_unlink(vlr, blockno + blocks, &head);
+			ext_clear(vlr, blockno + blocks, head.blocks);
+			blocks += head.blocks;
+		}
+	}
+
+	/* Merge with a free extent that precedes, found through its end tag */
+	if( blockno > 1 && (prev = ext_getlong(vlr, EXT_TAG(blockno))) >= 1 && prev < blockno )
+	{
+		ext_gethead(vlr, prev, &head);
+
+		if( head.recsize == EXT_FREE && prev + head.blocks == blockno )
+		{
+			ext_unlink(vlr, prev, &head);
+			ext_clear(vlr, blockno, blocks);
+			blockno = prev;
+			blocks += head.blocks;
+		}
+	}
+
+	/* The head is cleared here too, so that the extent is seen as free */
+	if( blockno + blocks == _ENDBLOCK )
+	{
+		ext_clear(vlr, blockno, blocks);
+		_ENDBLOCK = blockno;
+		return;
+	}
+
+	ext_link(vlr, blockno, blocks);
+}
+
+
+/*------------------------------- ext_alloc --------------------------------*\
+ *
+ * Allocate an extent of <blocks> contiguous blocks. The free list of the
+ * size class is searched for the first extent that is big enough. If there
+ * is none the first extent in a larger size class is used. Unused blocks at
+ * the end of an extent taken from a free list are freed again. If there are
+ * no free extents, the extent is allocated at the end of the file.
+ *
+ */
+
+static ulong ext_alloc(vlr, blocks)
+VLR *vlr;
+ulong blocks;
+{
+	VLREXTENT head;
+	ulong blockno;
+	int class;
+
+	class = ext_class(blocks);
+
+	for( blockno=_FREELIST[class]; blockno; blockno=head.nextblock )
+	{
+		ext_gethead(vlr, blockno, &head);
+
+		if( head.blocks >= blocks )
+			break;
+	}
+
+	/* All extents in larger classes are big enough */
+	for( class++; !blockno && class < VLR_CLASSES; class++ )
+		if( (blockno = _FREELIST[class]) != 0 )
+			ext_gethead(vlr, blockno, &head);
+
+	if( !blockno )
+	{
+		blockno	   = _ENDBLOCK;
+		_ENDBLOCK += blocks;
+		return blockno;
+	}
+
+	ext_unlink(vlr, blockno, &head);
+
+	/* The caller writes the head of the extent. The rest cannot be next
+	 * to a free extent, so it is not merged.
+	 */
+	if( head.blocks > blocks )
+		ext_link(vlr, blockno + blocks, head.blocks - blocks);
+
+	return blockno;
+}
+
+
+/*-------------------------------- ext_fit ---------------------------------*\
+ *
+ * Shrink the extent <blockno> of <blocks> blocks to the number of blocks
+ * needed for <size> bytes. The blocks that are no longer needed are freed.
+ * Returns the new number of blocks.
+ *
+ */
+
+static ulong ext_fit(vlr, blockno, blocks, size)
+VLR *vlr;
+ulong blockno, blocks;
+unsigned size;
+{
+	ulong need = EXT_BLOCKS(size);
+
+	if( need >= blocks )
+		return blocks;
+
+	ext_free(vlr, blockno + need, blocks - need);
+
+	return need;
+}
+
+
+/*------------------------------- ext_extend -------------------------------*\
+ *
+ * Grow the extent <blockno> of <blocks> blocks to <need> blocks in place,
+ * either at the end of the file or into a free extent that follows it.
+ * Blocks of the free extent that are not needed stay free. Returns the new
+ * number of blocks, which is <blocks> if the extent cannot grow.
+ *
+ */
+
+static ulong ext_extend(vlr, blockno, blocks, need)
+VLR *vlr;
+ulong blockno, blocks, need;
+{
+	VLREXTENT next;
+
+	if( blockno + blocks == _ENDBLOCK )
+	{
+		_ENDBLOCK = blockno + need;
+		return need;
+	}
+
+	ext_gethead(vlr, blockno + blocks, &next);
+
+	if( next.recsize != EXT_FREE || blocks + next.blocks < need )
+		return blocks;
+
+	ext_unlink(vlr, blockno + blocks, &next);
+
+	/* The record may not overwrite the whole head of the free extent */
+	ext_clear(vlr, blockno + blocks, next.blocks);
+
+	if( blocks + next.blocks > need )
+		ext_link(vlr, blockno + need, blocks + next.blocks - need);
+
+	return need;
+}
+
+
+/*-------------------------------- ext_put ---------------------------------*\
+ *
+ * Write a record to the extent <blockno> of <blocks> blocks. If the record
+ * does not fit in the extent, the rest is written to the extent <nextblock>
+ * of <nextblocks> blocks, or to a new extent if <nextblock> is 0. Each
+ * extent is written with a single write.
+ *
+ */
+
+static int ext_put(vlr, buf, bufsize, blockno, blocks, nextblock, nextblocks)
+VLR *vlr;
+void *buf;
+unsigned bufsize;
+ulong blockno, blocks, nextblock, nextblocks;
+{
+	VLREXTENT *ext;
+	unsigned copy = bufsize, rest = 0;
+	ulong start = stats_clock(vlr->stats);
+
+	if( bufsize > EXT_CAPACITY(blocks) )
+	{
+		copy		= EXT_CAPACITY(blocks);
+		rest		= bufsize - copy;
+
+		if( !nextblock )
+		{
+			nextblocks	= EXT_BLOCKS(rest);
+			nextblock	= ext_alloc(vlr, nextblocks);
+		}
+	}
+	else
+		nextblock = 0;
+
+	if( ext_grow(vlr, EXT_HEAD + (copy > rest ? copy : rest)) != S_OKAY )
+		return db_status;
+
+	ext = (VLREXTENT *)vlr->block;
+	ext->nextblock	= nextblock;
+	ext->blocks		= blocks;
+	ext->recsize	= bufsize;
+	memcpy(ext->data, buf, copy);
+
+	lseek(vlr->fh, (off_t) (blockno * _BLOCKSIZE), SEEK_SET);
+	snapsave(vlr, EXT_HEAD + copy);
+	if( write(vlr->fh, ext, EXT_HEAD + copy) != EXT_HEAD + copy )
+		RETURN S_IOFATAL;
+
+	if( rest )
+	{
+		ext->nextblock	= 0;
+		ext->blocks		= nextblocks;
+		ext->recsize	= 0;
+		memcpy(ext->data, (char *)buf + copy, rest);
+
+		lseek(vlr->fh, (off_t) (nextblock * _BLOCKSIZE), SEEK_SET);
+		snapsave(vlr, EXT_HEAD + rest);
+		if( write(vlr->fh, ext, EXT_HEAD + rest) != EXT_HEAD + rest )
+			RETURN S_IOFATAL;
+	}
+
+	/* Each extent written counts as one write */
+	stats_io(vlr->stats, STAT_WRITE, start, rest ? 2 : 1);
+
+	return S_OKAY;
+}
+
+
+/*------------------------------ ext_freechain -----------------------------*\
+ *
+ * Free the extents of a record from <blockno> and on.
+ *
+ */
+
+static void ext_freechain(vlr, blockno)
+VLR *vlr;
+ulong blockno;
+{
+	VLREXTENT head;
+
+	while( blockno )
+	{
+		ext_gethead(vlr, blockno, &head);
+		ext_free(vlr, blockno, head.blocks);
+		blockno = head.nextblock;
+	}
+}
+
+
+/*-------------------------------- ext_add ---------------------------------*\
+ *
+ * Add a record to an extent file. The record is stored in one extent.
+ *
+ */
+
+static int ext_add(vlr, buf, bufsize, recno)
+VLR *vlr;
+void *buf;
+unsigned bufsize;
+ulong *recno;
+{
+	ulong blocks, blockno;
+
+	if( vlr->shared )
+		get_header(vlr);
+
+	blocks	= EXT_BLOCKS(bufsize);
+	blockno	= ext_alloc(vlr, blocks);
+
+	if( ext_put(vlr, buf, bufsize, blockno, blocks, 0L, 0L) != S_OKAY )
+		return db_status;
+
+	vlr->header.numrecords++;
+	put_header(vlr);
+
+	*recno = blockno;
+
+	return S_OKAY;
+}
+
+
+/*------------------------------- ext_write --------------------------------*\
+ *
+ * Update a record in an extent file. The record is overwritten in place,
+ * so the record number does not change. If the record has shrunk, the
+ * blocks it no longer needs are freed. If it has grown, its extent is
+ * extended at the end of the file or into a free extent that follows it,
+ * otherwise the rest is stored in the record's second extent, which is
+ * reused if it is big enough or can be extended.
+ *
+ */
+
+static int ext_write(vlr, buf, bufsize, blockno)
+VLR *vlr;
+void *buf;
+unsigned bufsize;
+ulong blockno;
+{
+	VLREXTENT head, next;
+	ulong blocks, nextblock = 0, nextblocks = 0;
+	unsigned rest;
+
+	if( vlr->shared )
+		get_header(vlr);
+
+	ext_gethead(vlr, blockno, &head);
+
+	if( !EXT_ISREC(head) )
+		RETURN S_DELETED;
+
+	blocks = head.blocks;
+
+	if( bufsize > EXT_CAPACITY(blocks) && !head.nextblock )
+		blocks = ext_extend(vlr, blockno, blocks, EXT_BLOCKS(bufsize));
+
+	if( bufsize <= EXT_CAPACITY(blocks) )
+	{
+		ext_freechain(vlr, head.nextblock);
+		blocks = ext_fit(vlr, blockno, blocks, bufsize);
+	}
+	else if( (nextblock = head.nextblock) != 0 )
+	{
+		rest = bufsize - EXT_CAPACITY(blocks);
+
+		ext_gethead(vlr, nextblock, &next);
+		ext_freechain(vlr, next.nextblock);
+		nextblocks = next.blocks;
+
+		if( rest > EXT_CAPACITY(nextblocks) )
+			nextblocks = ext_extend(vlr, nextblock, nextblocks, EXT_BLOCKS(rest));
+
+		if( rest <= EXT_CAPACITY(nextblocks) )
+			nextblocks = ext_fit(vlr, nextblock, nextblocks, rest);
+		else
+		{
+			ext_free(vlr, nextblock, nextblocks);
+			nextblock = 0;
+		}
+	}
+
+	if( ext_put(vlr, buf, bufsize, blockno, blocks, nextblock, nextblocks) != S_OKAY )
+		return db_status;
+
+	put_header(vlr);
+
+	RETURN S_OKAY;
+}
+
+
+/*-------------------------------- ext_read --------------------------------*\
+ *
+ * Read a record from an extent file. A record that fits in the block
+ * buffer is read with a single read. The buffer grows to the size of the
+ * largest extent read. If <buf> is NULL the record is read to the
+ * compression buffer, otherwise a record bigger than <bufsize> is an error.
+ *
+ */
+
+static int ext_read(vlr, buf, bufsize, blockno, sizeptr)
+VLR *vlr;
+void *buf;
+unsigned bufsize;
+ulong blockno;
+unsigned *sizeptr;
+{
+	VLREXTENT *ext = (VLREXTENT *)vlr->block;
+	unsigned size, want, copy, rest;
+	int numread;
+	ulong start, extents = 1;
+
+	if( vlr->shared )
+		get_header(vlr);
+
+	*sizeptr = 0;
+	start = stats_clock(vlr->stats);
+
+	if( blockno < 1 || blockno >= _ENDBLOCK )
+		RETURN S_OKAY;
+
+	lseek(vlr->fh, (off_t) (blockno * _BLOCKSIZE), SEEK_SET);
+	numread = read(vlr->fh, ext, vlr->bufsize);
+
+	if( numread < (int)EXT_HEAD || !EXT_ISREC(*ext) )
+		RETURN S_OKAY;
+
+	rest = size = ext->recsize;
+
+	if( buf && size > bufsize )
+		RETURN S_IOFATAL;
+
+	if( !buf )
+	{
+		if( zbuf_grow(vlr, size) != S_OKAY )
+			return db_status;
+		buf = vlr->zbuf;
+	}
+
+	for( ;; )
+	{
+		copy = rest > EXT_CAPACITY(ext->blocks) ? EXT_CAPACITY(ext->blocks) : rest;
+		want = EXT_HEAD + copy;
+
+		if( numread < (int)want )
+		{
+			/* The extent is bigger than the buffer */
+			if( ext_grow(vlr, want) != S_OKAY )
+				return db_status;
+			ext = (VLREXTENT *)vlr->block;
+			read(vlr->fh, (char *)ext + numread, want - numread);
+		}
+
+		memcpy(buf, ext->data, copy);
+		buf   = (void *)((char *)buf + copy);
+		rest -= copy;
+
+		if( !rest || !ext->nextblock )
+			break;
+
+		if( ext_grow(vlr, EXT_HEAD + rest) != S_OKAY )
+			return db_status;
+		ext = (VLREXTENT *)vlr->block;
+
+		lseek(vlr->fh, (off_t) (ext->nextblock * _BLOCKSIZE), SEEK_SET);
+		if( (numread = read(vlr->fh, ext, EXT_HEAD + rest)) < (int)EXT_HEAD )
+			break;
+		extents++;
+	}
+
+	stats_io(vlr->stats, STAT_READ, start, extents);
+	*sizeptr = size;
+	RETURN S_OKAY;
 }
 
 
@@ -141,12 +831,116 @@ VLR *vlr;
  *
  */
 
+/*------------------------------- zbuf_grow -------------------------------*\
+ *
+ * Ensure that the compression buffer can hold <size> bytes.
+ *
+ */
+
+static int zbuf_grow(vlr, size)
+VLR *vlr;
+unsigned size;
+{
+	char *zbuf;
+
+	if( size <= vlr->zbufsize )
+		return S_OKAY;
+
+	if( !(zbuf = (char *)realloc(vlr->zbuf, size)) )
+		RETURN S_NOMEM;
+
+	vlr->zbuf	  = zbuf;
+	vlr->zbufsize = size;
+
+	return S_OKAY;
+}
+
+
+/*-------------------------------- vlr_pack --------------------------------*\
+ *
+ * Compress a record to the compression buffer. If the record does not get
+ * smaller it is stored as is.
+ *
+ */
+
+static int vlr_pack(vlr, buf, bufsize, packsize)
+VLR *vlr;
+void *buf;
+unsigned bufsize, *packsize;
+{
+	unsigned size = 0;
+
+	if( zbuf_grow(vlr, PACK_HEAD + bufsize) != S_OKAY )
+		return db_status;
+
+	if( bufsize > PACK_HEAD )
+		size = lz_compress(buf, bufsize, vlr->zbuf + PACK_HEAD, bufsize - PACK_HEAD);
+
+	if( size )
+	{
+		vlr->zbuf[0] = PACK_LZ;
+		memcpy(vlr->zbuf + 1, &bufsize, sizeof bufsize);
+		*packsize = PACK_HEAD + size;
+	}
+	else
+	{
+		vlr->zbuf[0] = PACK_STORED;
+		memcpy(vlr->zbuf + 1, buf, bufsize);
+		*packsize = 1 + bufsize;
+	}
+
+	return S_OKAY;
+}
+
+
+/*------------------------------- vlr_unpack -------------------------------*\
+ *
+ * Uncompress a record of <packsize> bytes from the compression buffer to
+ * <buf>, which can hold <bufsize> bytes.
+ *
+ */
+
+static int vlr_unpack(vlr, packsize, buf, bufsize, sizeptr)
+VLR *vlr;
+unsigned packsize;
+void *buf;
+unsigned bufsize;
+unsigned *sizeptr;
+{
+	unsigned size;
+
+	if( vlr->zbuf[0] == PACK_STORED )
+	{
+		if( packsize - 1 > bufsize )
+			RETURN S_IOFATAL;
+		memcpy(buf, vlr->zbuf + 1, packsize - 1);
+		*sizeptr = packsize - 1;
+		RETURN S_OKAY;
+	}
+
+	memcpy(&size, vlr->zbuf + 1, sizeof size);
+
+	if( size > bufsize )
+		RETURN S_IOFATAL;
+
+	if( vlr->zbuf[0] != PACK_LZ || packsize < PACK_HEAD
+	||  lz_uncompress(vlr->zbuf + PACK_HEAD, packsize - PACK_HEAD, buf, size) != (long)size )
+		RETURN S_FATAL;
+
+	*sizeptr = size;
+
+	RETURN S_OKAY;
+}
+
+
 void vlr_close(vlr)
 VLR *vlr;
 {
+	FREE(vlr->zbuf);
 	free(vlr->block);
 	if( vlr->fh != -1 )
 		os_close(vlr->fh);
+	snap_free(&vlr->snap);
 	free(vlr);
 }
 
@@ -179,7 +973,8 @@ int shared;
         return NULL;
     }
 
-	vlr->fh = fh;
+	vlr->fh		 = fh;
+	vlr->bufsize = blocksize;
 
 	if( !(vlr->block = (VLRBLOCK *)malloc(blocksize)) )
 	{
@@ -191,18 +986,43 @@ int shared;
 
 	if( isnew )
 	{
-		strcpy(vlr->header.version, VLR_VERSION);
+		strcpy(vlr->header.version, VLR_EXTVERSION);
 		vlr->header.id[0] = 0;
 		vlr->header.blocksize = blocksize;
 		vlr->header.firstfree = 1;
 		vlr->header.numrecords = 0;
+		vlr->header.endblock = 1;
+		vlr->header.codec = typhoon.vlr_compress ? VLR_CODEC_LZ : VLR_CODEC_NONE;
+		vlr->extents = 1;
+		vlr->hdrsize = sizeof vlr->header;
 		put_header(vlr);
 		lseek(vlr->fh, (off_t) (blocksize-1L), SEEK_SET);
 		write(vlr->fh, "", 1);
 	}
 	else
+	{
+		/* Read the part of the header that all versions have in common */
+		vlr->hdrsize = offsetof(VLR, header.freelist[0]) - offsetof(VLR, header);
 		get_header(vlr);
 
+		if( !strcmp(vlr->header.version, VLR_EXTVERSION) )
+		{
+			vlr->extents = 1;
+			vlr->hdrsize = sizeof vlr->header;
+			get_header(vlr);
+		}
+
+		if( vlr->extents ? vlr->header.codec > VLR_CODEC_LZ
+						 : strcmp(vlr->header.version, VLR_VERSION) != 0 )
+		{
+			os_close(fh);
+			free(vlr->block);
+			free(vlr);
+			db_status = S_VERSION;
+			return NULL;
+		}
+	}
+
 	vlr->datasize = blocksize - offsetof(VLRBLOCK, data[0]) - SEM_LEN;
 	vlr->shared	  = shared;
 	strcpy(vlr->fname, fname);
@@ -238,25 +1058,21 @@ VLR *vlr;
 
 
 
-/*------------------------------- vlr_add ---------------------------------*\
+/*------------------------------ add_blocks -------------------------------*\
  *
- * Add a record to vlr file. If the delete-chain is non-empty, blocks are
- * taken from there, otherwise blocks are appended to the file.
+ * Write <buf> to a chain of blocks starting at the first free block. The
+ * first block gets the record size <recsize>.
  *
  */
 
-int vlr_add(vlr, buf, bufsize, recno)
+static void add_blocks(vlr, buf, bufsize, recsize)
 VLR *vlr;
 void *buf;
-unsigned bufsize;
-ulong *recno;
+unsigned bufsize, recsize;
 {
-	ulong		old_firstfree = _FIRSTFREE;
-	ulong		tmp_firstfree = _FIRSTFREE;
-
-	get_header(vlr);
+	ulong		tmp_firstfree;
 
-	_RECSIZE = bufsize;
+	_RECSIZE = recsize;
 
 	while( bufsize )
 	{
@@ -282,6 +1098,65 @@ ulong *recno;
 		buf = (void *)((char *)buf + vlr->datasize);
 		_RECSIZE = 0;
 	}
+}
+
+
+/*------------------------------ free_blocks ------------------------------*\
+ *
+ * Insert the chain of blocks starting at <blockno> in front of the delete
+ * chain. The blocks must not be the first blocks of records.
+ *
+ */
+
+static void free_blocks(vlr, blockno)
+VLR *vlr;
+ulong blockno;
+{
+	ulong last = blockno, next;
+
+	while( (next = get_nextblock(vlr, last)) != 0 )
+		last = next;
+
+	lseek(vlr->fh, (off_t) (last * _BLOCKSIZE + offsetof(VLRBLOCK, nextblock)), SEEK_SET);
+	snapsave(vlr, sizeof _FIRSTFREE);
+	write(vlr->fh, &_FIRSTFREE, sizeof _FIRSTFREE);
+
+	_FIRSTFREE = blockno;
+}
+
+
+/*------------------------------- vlr_add ---------------------------------*\
+ *
+ * Add a record to vlr file. If the delete-chain is non-empty, blocks are
+ * taken from there, otherwise blocks are appended to the file.
+ *
+ */
+
+int vlr_add(vlr, buf, bufsize, recno)
+VLR *vlr;
+void *buf;
+unsigned bufsize;
+ulong *recno;
+{
+	ulong		old_firstfree;
+
+	if( vlr->extents )
+	{
+		if( vlr->header.codec != VLR_CODEC_NONE )
+		{
+			if( vlr_pack(vlr, buf, bufsize, &bufsize) != S_OKAY )
+				return db_status;
+			buf = vlr->zbuf;
+		}
+
+		return ext_add(vlr, buf, bufsize, recno);
+	}
+
+	get_header(vlr);
+
+	old_firstfree = _FIRSTFREE;
+
+	add_blocks(vlr, buf, bufsize, bufsize);
 
 	vlr->header.numrecords++;
 	put_header(vlr);
@@ -295,8 +1170,10 @@ ulong *recno;
 
 /*------------------------------- vlr_write -------------------------------*\
  *
- * Update a record. The record is first deleted then inserted. This is not
- * the most efficient way to do it, but it works!
+ * Update a record. The blocks of the record are overwritten in place. If
+ * the record has grown, the rest is written to blocks taken from the
+ * delete chain. If it has shrunk, the blocks it no longer needs are put in
+ * the delete chain. The record number does not change.
  *
  */
 
@@ -306,10 +1183,60 @@ void *buf;
 unsigned bufsize;
 ulong blockno;
 {
-	ulong dummy;
+	ulong cur = blockno, next;
+	unsigned copy;
+
+	if( vlr->extents )
+	{
+		if( vlr->header.codec != VLR_CODEC_NONE )
+		{
+			if( vlr_pack(vlr, buf, bufsize, &bufsize) != S_OKAY )
+				return db_status;
+			buf = vlr->zbuf;
+		}
+
+		return ext_write(vlr, buf, bufsize, blockno);
+	}
+
+	get_header(vlr);
+
+	_RECSIZE = bufsize;
+
+	for( ;; )
+	{
+		next = get_nextblock(vlr, cur);
+
+		copy = bufsize > vlr->datasize ? vlr->datasize : bufsize;
+		memcpy(vlr->block->data, buf, copy);
+		buf = (void *)((char *)buf + copy);
+		bufsize -= copy;
+
+		if( !bufsize )
+		{
+			/* Free the blocks that are no longer used */
+			_NEXTBLOCK = 0;
+			put_block(vlr, cur);
+			if( next )
+				free_blocks(vlr, next);
+			break;
+		}
+
+		if( !next )
+		{
+			/* Write the rest to new blocks */
+			_NEXTBLOCK = _FIRSTFREE;
+			put_block(vlr, cur);
+			add_blocks(vlr, buf, bufsize, 0);
+			break;
+		}
+
+		_NEXTBLOCK = next;
+		put_block(vlr, cur);
+		_RECSIZE = 0;
+		cur = next;
+	}
 
-	vlr_del(vlr, blockno);
-	vlr_add(vlr, buf, bufsize, &dummy);
+	put_header(vlr);
 
 	RETURN S_OKAY;
 }
@@ -317,19 +1244,36 @@ ulong blockno;
 
 /*------------------------------- vlr_read --------------------------------*\
  *
- * Read a record.
+ * Read a record to <buf>, which can hold <bufsize> bytes. A record that
+ * does not fit in the buffer is reported as an I/O error.
  *
  */
 
-int vlr_read(vlr, buf, blockno, sizeptr)
+int vlr_read(vlr, buf, bufsize, blockno, sizeptr)
 VLR *vlr;
 void *buf;
+unsigned bufsize;
 ulong blockno;
 unsigned *sizeptr;
 {
 	unsigned size = 0;
 	unsigned rest, copy;
 
+	if( vlr->extents )
+	{
+		if( vlr->header.codec == VLR_CODEC_NONE )
+			return ext_read(vlr, buf, bufsize, blockno, sizeptr);
+
+		if( ext_read(vlr, NULL, 0, blockno, &size) != S_OKAY )
+			return db_status;
+
+		*sizeptr = 0;
+		if( !size )
+			RETURN S_OKAY;
+
+		return vlr_unpack(vlr, size, buf, bufsize, sizeptr);
+	}
+
 	get_header(vlr);
 	_NEXTBLOCK = blockno;
 
@@ -346,6 +1290,9 @@ unsigned *sizeptr;
 		if( !size )
 			break;
 
+		if( size > bufsize )
+			RETURN S_IOFATAL;
+
 		copy  = rest > vlr->datasize ? vlr->datasize : rest;
 		rest -= copy;
 
@@ -360,6 +1307,73 @@ unsigned *sizeptr;
 	RETURN S_OKAY;
 }
 
+/*-------------------------------- vlr_next -------------------------------*\
+ *
+ * Find the first record after the record at block <*blockno> (or the
+ * first record in the file if <*blockno> is 0) by reading the block or
+ * extent headers in file order. The first block or extent of a record is
+ * the only one with a record size, and in an extent file the search
+ * continues after the last block of the current extent. Used to rebuild
+ * the indexes.
+ *
+ */
+
+int vlr_next(vlr, blockno)
+VLR *vlr;
+ulong *blockno;
+{
+	VLREXTENT head;
+	ulong cur, end;
+
+	if( vlr->shared )
+		get_header(vlr);
+
+	cur = *blockno;
+
+	if( vlr->extents )
+	{
+		if( cur )
+		{
+			ext_gethead(vlr, cur, &head);
+			cur += head.blocks ? head.blocks : 1;
+		}
+		else
+			cur = 1;
+
+		for( ; cur < _ENDBLOCK; cur += head.blocks )
+		{
+			ext_gethead(vlr, cur, &head);
+
+			if( EXT_ISREC(head) )
+			{
+				*blockno = cur;
+				RETURN S_OKAY;
+			}
+
+			if( !head.blocks )
+				break;
+		}
+
+		RETURN S_NOTFOUND;
+	}
+
+	end = filelength(vlr->fh) / _BLOCKSIZE;
+
+	for( cur++; cur < end; cur++ )
+	{
+		get_block(vlr, cur);
+
+		if( _RECSIZE )
+		{
+			*blockno = cur;
+			RETURN S_OKAY;
+		}
+	}
+
+	RETURN S_NOTFOUND;
+}
+
+
 /*-------------------------------- vlr_del --------------------------------*\
  *
  * Delete a record. The blocks used by the record deleted, are inserted in
@@ -371,11 +1385,33 @@ int vlr_del(vlr, blockno)
 VLR *vlr;
 ulong blockno;
 {
-	ulong tmp_firstfree = _FIRSTFREE;
+	ulong tmp_firstfree;
 	ulong cur_block = blockno;
 
+	if( vlr->extents )
+	{
+		VLREXTENT head;
+
+		if( vlr->shared )
+			get_header(vlr);
+
+		ext_gethead(vlr, blockno, &head);
+
+		if( !EXT_ISREC(head) )
+			RETURN S_DELETED;
+
+		ext_freechain(vlr, blockno);
+
+		vlr->header.numrecords--;
+		put_header(vlr);
+
+		RETURN S_OKAY;
+	}
+
 	get_header(vlr);
 
+	tmp_firstfree = _FIRSTFREE;
+
 	_FIRSTFREE = blockno;
 	get_block(vlr, blockno);
 
@@ -37,6 +37,7 @@ static char rcsid[] = "$Id: backup.c,v 1.2 1999/10/03 23:36:49 kaz Exp $";
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/wait.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -56,17 +57,36 @@ static char rcsid[] = "$Id: backup.c,v 1.2 1999/10/03 23:36:49 kaz Exp $";
 #include "util.h"
 
 /*------------------------------- Constants --------------------------------*/
-#define VERSION			"1.00"
+#define VERSION			"1.10"
 #define BLOCK_SIZE		512
 #define OUTBUF_SIZE		(BLOCK_SIZE * 512)
 #define INBUF_SIZE		(64 * 1024)
+#define SNAP_ENTRY		(long)(sizeof(ulong) + SNAP_PAGE)
+#define STRIPES_MAX		16
+#define CHANGED(f,p)	((long)((p) >> 3) < chg_bytes[f] && \
+						 (chg_bits[f][(p) >> 3] & (1 << ((p) & 7))))
 
 /*-------------------------- Function prototypes ---------------------------*/
 static void		SignalHandler			PRM( (int); )
 static void		Write					PRM( (void *, ulong); )
 static void		Flush					PRM( (void); )
+static void		WriteData				PRM( (ulong, ulong, char *, ulong); )
 static void		DisplayProgress			PRM( (char *, ulong); )
-static void		BackupDatabase			PRM( (void); )
+static void		TakeChanges				PRM( (void); )
+static void		RestoreChanges			PRM( (void); )
+static void		SnapBegin				PRM( (void); )
+static void		SnapEnd					PRM( (int); )
+static void		ScanSnapshot			PRM( (void); )
+static void		SnapOpen				PRM( (int); )
+static void		SnapClose				PRM( (void); )
+static void		SnapRead				PRM( (int, ulong, char *, ulong); )
+static void		BackupImage				PRM( (int); )
+static void		BackupPages				PRM( (int); )
+static void		BackupDatabase			PRM( (int); )
+static ulong	FileLoad				PRM( (int); )
+static void		AssignStripes			PRM( (void); )
+static void		BackupStripe			PRM( (int); )
+static void		BackupStriped			PRM( (void); )
 static void 	BackupFile				PRM( (char *); )
 static void		help					PRM( (void); )
 
@@ -79,9 +99,31 @@ static int		archive_fh = -1;		/* Archive file handle				*/
 static char		*dbname = "";			/* Database name					*/
 static char		*datapath = "";			/* Path for database files			*/
 static char		*device = "/dev/null";	/* Backup device					*/
+static char		*devices[STRIPES_MAX];	/* Devices of a striped backup		*/
+static int		stripes = 0;			/* Number of entries in devices[]	*/
+static int		stripe_fh[STRIPES_MAX];	/* Device file handles				*/
+static pid_t	stripe_pid[STRIPES_MAX];/* Processes writing the stripes	*/
+static int		*image_stripe;			/* Stripe of each data file			*/
+static int		compress = 0;			/* Compress data file blocks?		*/
+static char		*zbuf;					/* Compression buffer				*/
 static char		*outbuf;				/* Output buffer					*/
 static ulong	outbytes;				/* Number of bytes in outbuf		*/
 static ulong	total_written = 0;		/* Total number of bytes written	*/
+static int		*image_fh;				/* Data file handles. -1 = not used	*/
+static ulong	*image_size;			/* Data file sizes at the snapshot	*/
+static int		snap_started = 0;		/* Has the snapshot been started?	*/
+static int		snap_fh = -1;			/* Snapshot file of current file	*/
+static long		snap_pos;				/* First entry not scanned			*/
+static long		*snap_first;			/* First before-image of each page	*/
+static ulong	snap_pages;				/* Number of pages at the snapshot	*/
+static int		incremental = 0;		/* Incremental backup?				*/
+static int		changes_taken = 0;		/* Have the change bitmaps been		*/
+										/* taken by TakeChanges()?			*/
+static uchar	**chg_bits;				/* Change bitmap of each file		*/
+static long		*chg_bytes;				/* Number of bytes in chg_bits[]	*/
+static long		*chg_base;				/* Backup chg_bits[] is relative to	*/
+static long		backup_id;				/* ID (time) of this backup			*/
+static long		base_id;				/* ID of the backup this is based on*/
 	   int		db_status;				/* Required by ../read_dbd.c		*/
 
 
@@ -99,15 +141,20 @@ static ulong	total_written = 0;		/* Total number of bytes written	*/
 static void SignalHandler(sig)
 int sig;
 {
+	int i;
+
 	if( sig == SIGSEGV )
 		puts("Segmentation violation");
 	else if( sig == SIGBUS )
 		puts("Bus error");
 
-	dbd.shm->backup_active = 0;
+	for( i=0; i<stripes; i++ )
+		if( stripe_pid[i] > 0 )
+			kill(stripe_pid[i], SIGTERM);
+
+	SnapEnd(0);
 	shm_free(&dbd);
-	unlink(LOG_FNAME);
-	puts("Restore aborted.");
+	puts("Backup aborted.");
 	exit(1);
 }
 
@@ -150,7 +197,8 @@ retry:
 		clock_off();
 		printf("Insert backup media no %d [enter, q]", mediahd.seqno);
 		fflush(stdout);
-		gets(s);
+		if( !fgets(s, sizeof s, stdin) )
+			s[0] = 'q';
 		clock_on();
 		
 		if( s[0] == 'q' )
@@ -171,6 +219,15 @@ retry:
 		}
 		else if( rc != OUTBUF_SIZE )
 		{
+			/* The stripes are written in parallel, so the media cannot
+			 * be changed.
+			 */
+			if( stripes > 1 )
+			{
+				printf("'%s' is full\n", device);
+				longjmp(err_jmpbuf, 1);
+			}
+
 			close(archive_fh);
 			goto retry;
 		}
@@ -202,6 +259,57 @@ static void Flush()
 }
 
 
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : WriteData
+ *
+ * Purpose   : Writes a block of data file data to the archive. If the
+ *			   backup is compressed and the block gets smaller, it is
+ *			   written as a compressed block.
+ *
+ * Parameters: id		- ARCHIVE_FILEDATA or ARCHIVE_PAGEDATA.
+ *			   page		- First page of block (ARCHIVE_PAGEDATA only).
+ *			   buf		- Data.
+ *			   size		- Number of bytes in buffer.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void WriteData(id, page, buf, size)
+ulong id, page;
+char *buf;
+ulong size;
+{
+	ArchiveZDataHeader	zdatahd;
+	ArchivePageDataHeader pagehd;
+	ArchiveFileDataHeader datahd;
+
+	if( compress && (zdatahd.zsize = lz_compress(buf, size, zbuf, size - 1)) )
+	{
+		zdatahd.id		= ARCHIVE_ZDATA;
+		zdatahd.page	= page;
+		zdatahd.size	= size;
+		Write(&zdatahd, sizeof zdatahd);
+		Write(zbuf, zdatahd.zsize);
+	}
+	else if( id == ARCHIVE_PAGEDATA )
+	{
+		pagehd.id	= id;
+		pagehd.page	= page;
+		pagehd.size	= size;
+		Write(&pagehd, sizeof pagehd);
+		Write(buf, size);
+	}
+	else
+	{
+		datahd.id	= id;
+		datahd.size	= size;
+		Write(&datahd, sizeof datahd);
+		Write(buf, size);
+	}
+}
+
+
 /*--------------------------------------------------------------------------*\
  *
  * Function  : DisplayProgress
@@ -225,112 +333,812 @@ ulong bytes;
 
 /*--------------------------------------------------------------------------*\
  *
- * Function  : BackupDatabase
+ * Function  : TakeChanges
  *
- * Purpose   : Controls the backup.
+ * Purpose   : Reads the change bitmap of each data file and starts a new
+ *			   one, relative to this backup. Writers notice the new bitmaps
+ *			   through chg_gen in shared memory. Must be called while
+ *			   holding the lock.
+ *
+ *			   An incremental backup requires that all data files have
+ *			   change bitmaps relative to the same backup.
  *
  * Parameters: None.
  *
  * Returns   : Nothing.
  *
  */
-static void BackupDatabase()
+static void TakeChanges()
 {
-	ArchiveRecordHeader recordhd;
-	ArchiveTableHeader	tablehd;
-	Record		*rec;
-	ulong		recid;				/* Record ID of current table			*/
-	ulong		recno;				/* Current record in current table		*/
-	ulong		recsize;			/* Record size in current table			*/
-	ulong		bytecount;			/* Number of bytes read in current table*/
-	ulong		numread;			/* Number of bytes read					*/
-	ulong		timeout;
-	int			fh;
-	int			maxread, i, rc;
-	char		fname[128], objname[128];
-	char		buf[INBUF_SIZE];
-	RECORD		filehd;
-	
-	dbd.shm->backup_active = 1;
+	CHGHEAD		head;
+	char		fname[128];
+	long		size;
+	int			i, fh;
+
+	/* Read the current change bitmaps */
+	base_id = 0;
+	for( i=0; i<dbd.header.files; i++ )
+	{
+		if( image_fh[i] == -1 )
+			continue;
+
+		sprintf(fname, "%s/%s.chg", datapath, dbd.file[i].name);
+		if( (fh = os_open(fname, O_RDONLY|CONFIG_O_BINARY, 0)) == -1 )
+			continue;
+
+		size = lseek(fh, 0, SEEK_END) - (long)sizeof head;
+		lseek(fh, 0, SEEK_SET);
+
+		if( read(fh, &head, sizeof head) == sizeof head &&
+			!strcmp(head.id, CHGVERSION_ID) && size >= 0 &&
+			(chg_bits[i] = (uchar *)calloc(size + 1, 1)) )
+		{
+			read(fh, chg_bits[i], size);
+			chg_bytes[i] = size;
+			chg_base[i]	 = head.base;
+
+			if( head.base > base_id )
+				base_id = head.base;
+		}
+		close(fh);
+	}
 
-	for( rec=dbd.record, recid=0; recid<dbd.header.records; recid++, rec++ )
+	if( incremental )
+		for( i=0; i<dbd.header.files; i++ )
+			if( image_fh[i] != -1 && (!chg_bits[i] || chg_base[i] != base_id) )
+			{
+				printf("No full backup to base the incremental backup on ('%s')\n",
+					dbd.file[i].name);
+				ty_unlock();
+				longjmp(err_jmpbuf, 1);
+			}
+
+	/* The backup ID is the time of the backup, but it must be newer than
+	 * the backup the changes are relative to.
+	 */
+	backup_id = time(NULL);
+	if( backup_id <= base_id )
+		backup_id = base_id + 1;
+
+	/* Start the new change bitmaps */
+	memset(&head, 0, sizeof head);
+	strcpy(head.id, CHGVERSION_ID);
+	head.base = backup_id;
+
+	for( i=0; i<dbd.header.files; i++ )
 	{
-		dbd.shm->curr_recid = recid;
+		if( image_fh[i] == -1 )
+			continue;
 
-		sprintf(fname, "%s/%s", datapath, dbd.file[rec->fileid].name);
-		sprintf(objname, "table %s", rec->name);
-		
-		if( (fh = os_open(fname, O_RDONLY|O_BINARY, 0)) == -1 )
+		sprintf(fname, "%s/%s.chg", datapath, dbd.file[i].name);
+		if( (fh = os_open(fname, O_WRONLY|O_CREAT|O_TRUNC|CONFIG_O_BINARY,
+							CONFIG_CREATMASK)) != -1 )
+		{
+			write(fh, &head, sizeof head);
+			close(fh);
+		}
+	}
+
+	dbd.shm->chg_gen++;
+	changes_taken = 1;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : RestoreChanges
+ *
+ * Purpose   : Merges the change bitmaps taken by TakeChanges() back into
+ *			   the current ones after a backup has failed, so the next
+ *			   backup includes the changes. Must be called while holding
+ *			   the lock.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void RestoreChanges()
+{
+	CHGHEAD		head;
+	char		fname[128];
+	uchar		*bits;
+	long		size, n;
+	int			i, fh;
+
+	for( i=0; i<dbd.header.files; i++ )
+	{
+		if( image_fh[i] == -1 )
+			continue;
+
+		sprintf(fname, "%s/%s.chg", datapath, dbd.file[i].name);
+
+		/* Changes were not tracked before this backup */
+		if( !chg_bits[i] )
+		{
+			unlink(fname);
+			continue;
+		}
+
+		if( (fh = os_open(fname, O_RDWR|CONFIG_O_BINARY, 0)) == -1 )
+			continue;
+
+		size = lseek(fh, 0, SEEK_END) - (long)sizeof head;
+		if( size < chg_bytes[i] )
+			size = chg_bytes[i];
+
+		if( (bits = (uchar *)calloc(size + 1, 1)) )
+		{
+			lseek(fh, (long)sizeof head, SEEK_SET);
+			read(fh, bits, size);
+
+			for( n=0; n<chg_bytes[i]; n++ )
+				bits[n] |= chg_bits[i][n];
+
+			memset(&head, 0, sizeof head);
+			strcpy(head.id, CHGVERSION_ID);
+			head.base = chg_base[i];
+
+			lseek(fh, 0, SEEK_SET);
+			write(fh, &head, sizeof head);
+			write(fh, bits, size);
+			free(bits);
+		}
+		close(fh);
+	}
+
+	dbd.shm->chg_gen++;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : SnapBegin
+ *
+ * Purpose   : Starts a snapshot of the data files. The size of each file is
+ *			   written to its snapshot file, and snapshots are then turned on
+ *			   in shared memory. The change bitmaps are taken at the same
+ *			   time. This is done while holding the lock, so the snapshot is
+ *			   taken between two updates.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void SnapBegin()
+{
+	SNAPHEAD	head;
+	char		fname[128];
+	int			i, fh;
+
+	if( !(image_fh = (int *)malloc(dbd.header.files * sizeof(int))) ||
+		!(image_size = (ulong *)malloc(dbd.header.files * sizeof(ulong))) ||
+		!(chg_bits = (uchar **)calloc(dbd.header.files, sizeof(uchar *))) ||
+		!(chg_bytes = (long *)calloc(dbd.header.files, sizeof(long))) ||
+		!(chg_base = (long *)calloc(dbd.header.files, sizeof(long))) )
+	{
+		puts("Cannot allocate file table");
+		longjmp(err_jmpbuf, 1);
+	}
+
+	ty_openlock();
+	ty_lock();
+	snap_started = 1;
+
+	memset(&head, 0, sizeof head);
+	strcpy(head.id, SNAPVERSION_ID);
+	head.gen = dbd.shm->snap_gen + 1;
+
+	for( i=0; i<dbd.header.files; i++ )
+	{
+		image_fh[i] = -1;
+
+		if( dbd.file[i].type != 'd' && dbd.file[i].type != 'v' )
+			continue;
+
+		sprintf(fname, "%s/%s", datapath, dbd.file[i].name);
+		if( (image_fh[i] = os_open(fname, O_RDONLY|CONFIG_O_BINARY, 0)) == -1 )
 		{
 			printf("Cannot open '%s'\n", fname);
-			return;
+			continue;
 		}
 
-		/* Because of referential integrity data, the record size may
-		 * be different from rec->size, so we read the header for H.recsize.
-		 */
-		read(fh, &filehd.H, sizeof filehd.H);
+		image_size[i] = head.size = lseek(image_fh[i], 0, SEEK_END);
 
-		recsize		= filehd.H.recsize;
-		maxread		= INBUF_SIZE / recsize;
-		bytecount	= 0;
-		recno		= 0;
+		strcat(fname, ".snp");
+		if( (fh = os_open(fname, O_WRONLY|O_CREAT|O_TRUNC|CONFIG_O_BINARY,
+							CONFIG_CREATMASK)) != -1 )
+		{
+			write(fh, &head, sizeof head);
+			close(fh);
+		}
+	}
 
-		/* Write table header */
-		strcpy(tablehd.fname, dbd.file[rec->fileid].name);
-		strcpy(tablehd.table, rec->name);
-		tablehd.id		= ARCHIVE_TABLE;
-		tablehd.recsize	= recsize;
-		Write(&tablehd, sizeof tablehd);
+	TakeChanges();
 
-		if( verbose )
-			DisplayProgress(objname, 0);
+	dbd.shm->snap_gen	 = head.gen;
+	dbd.shm->snap_active = 1;
 
-		do
+	ty_unlock();
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : SnapEnd
+ *
+ * Purpose   : Ends the snapshot and removes the snapshot files. If the
+ *			   backup failed the change bitmaps are restored.
+ *
+ * Parameters: ok		- Was the backup completed?
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void SnapEnd(ok)
+int ok;
+{
+	char		fname[128];
+	int			i;
+
+	if( !snap_started )
+		return;
+
+	ty_lock();
+	dbd.shm->snap_active = 0;
+	if( !ok && changes_taken )
+		RestoreChanges();
+	ty_unlock();
+	ty_closelock();
+
+	for( i=0; i<dbd.header.files; i++ )
+		if( image_fh[i] != -1 )
 		{
-			for( i=0; i<maxread; i++ )
-			{
-				dbd.shm->curr_recno = recno;
+			close(image_fh[i]);
+			image_fh[i] = -1;
+
+			sprintf(fname, "%s/%s.snp", datapath, dbd.file[i].name);
+			unlink(fname);
+		}
+
+	snap_started = 0;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : ScanSnapshot
+ *
+ * Purpose   : Reads the page numbers of the before-images that have been
+ *			   added to the snapshot file of the current data file since it
+ *			   was last scanned. Only the first before-image of a page holds
+ *			   the page as it was at the snapshot.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void ScanSnapshot()
+{
+	ulong	page;
+	long	end;
+
+	/* An entry that is being appended is skipped until it is complete */
+	end = lseek(snap_fh, 0, SEEK_END);
+
+	for( ; snap_pos + SNAP_ENTRY <= end; snap_pos += SNAP_ENTRY )
+	{
+		lseek(snap_fh, snap_pos, SEEK_SET);
+		if( read(snap_fh, &page, sizeof page) != sizeof page )
+			break;
+
+		if( page < snap_pages && snap_first[page] == -1 )
+			snap_first[page] = snap_pos;
+	}
+}
 
-				lseek(fh, recno * recsize, SEEK_SET);
-				numread = read(fh, buf, recsize);
 
-				if( numread != recsize )
-					break;
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : SnapOpen
+ *
+ * Purpose   : Opens the snapshot file of a data file.
+ *
+ * Parameters: fileid	- File ID.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void SnapOpen(fileid)
+int fileid;
+{
+	char		fname[128];
+	ulong		page;
 
-				recordhd.id		= ARCHIVE_RECORD;
-				recordhd.recid	= recid;
-				recordhd.recno	= recno;
+	sprintf(fname, "%s/%s.snp", datapath, dbd.file[fileid].name);
 
-				Write(&recordhd, sizeof recordhd);
-				Write(buf, numread);
+	if( (snap_fh = os_open(fname, O_RDONLY|CONFIG_O_BINARY, 0)) == -1 )
+	{
+		printf("Cannot open '%s'\n", fname);
+		longjmp(err_jmpbuf, 1);
+	}
 
-				bytecount += recsize;
-				recno++;
-			}			
+	snap_pages = (image_size[fileid] + SNAP_PAGE - 1) / SNAP_PAGE;
 
-			if( verbose )
-				DisplayProgress(objname, bytecount);
+	if( !(snap_first = (long *)malloc((snap_pages + 1) * sizeof(long))) )
+	{
+		puts("Cannot allocate page table");
+		longjmp(err_jmpbuf, 1);
+	}
+
+	for( page=0; page<snap_pages; page++ )
+		snap_first[page] = -1;
+	snap_pos = sizeof(SNAPHEAD);
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : SnapClose
+ *
+ * Purpose   : Closes the snapshot file opened by SnapOpen().
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void SnapClose()
+{
+	FREE(snap_first);
+	snap_first = NULL;
+
+	if( snap_fh != -1 )
+	{
+		close(snap_fh);
+		snap_fh = -1;
+	}
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : SnapRead
+ *
+ * Purpose   : Reads a part of a data file as it was at the snapshot. The
+ *			   pages that have changed since the snapshot are replaced by
+ *			   their before-images from the snapshot file.
+ *
+ *			   A writer saves the before-image of a page before changing
+ *			   it, so the snapshot file is scanned after the read: every
+ *			   change that the read could have seen is then known.
+ *
+ * Parameters: fileid	- File ID.
+ *			   pos		- Position in file. Must be at a page boundary.
+ *			   buf		- Buffer to read into.
+ *			   size		- Number of bytes to read.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void SnapRead(fileid, pos, buf, size)
+int fileid;
+ulong pos;
+char *buf;
+ulong size;
+{
+	ulong		page, copy;
+	int			i;
+
+	lseek(image_fh[fileid], pos, SEEK_SET);
+	if( read(image_fh[fileid], buf, size) != size )
+	{
+		printf("Cannot read '%s'\n", dbd.file[fileid].name);
+		longjmp(err_jmpbuf, 1);
+	}
+
+	ScanSnapshot();
+
+	for( page = pos / SNAP_PAGE, i = 0; page * SNAP_PAGE < pos + size; page++, i++ )
+		if( snap_first[page] != -1 )
+		{
+			copy = pos + size - page * SNAP_PAGE;
+			if( copy > SNAP_PAGE )
+				copy = SNAP_PAGE;
+
+			lseek(snap_fh, snap_first[page] + (long)sizeof(ulong), SEEK_SET);
+			read(snap_fh, buf + i * SNAP_PAGE, copy);
 		}
-		while( i == maxread );
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : BackupImage
+ *
+ * Purpose   : Writes the image of a data file at the snapshot to the
+ *			   archive. The file is read sequentially.
+ *
+ * Parameters: fileid	- File ID.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void BackupImage(fileid)
+int fileid;
+{
+	ArchiveImageHeader	imagehd;
+	ArchiveFileDataHeader datahd;
+	char		objname[128];
+	char		buf[INBUF_SIZE];
+	ulong		size, pos, numread;
+
+	size = image_size[fileid];
+	sprintf(objname, "file %s", dbd.file[fileid].name);
+
+	SnapOpen(fileid);
+
+	imagehd.id		= ARCHIVE_IMAGE;
+	imagehd.size	= size;
+	strcpy(imagehd.fname, dbd.file[fileid].name);
+	Write(&imagehd, sizeof imagehd);
+
+	datahd.id = ARCHIVE_FILEDATA;
+
+	if( verbose )
+		DisplayProgress(objname, 0);
+
+	for( pos=0; pos<size; pos += numread )
+	{
+		numread = size - pos;
+		if( numread > INBUF_SIZE )
+			numread = INBUF_SIZE;
+
+		SnapRead(fileid, pos, buf, numread);
+		WriteData(ARCHIVE_FILEDATA, 0, buf, numread);
 
 		if( verbose )
-			puts("");
+			DisplayProgress(objname, pos + numread);
+	}
 
-		close(fh);
+	datahd.size = 0;
+	Write(&datahd, sizeof datahd);
+
+	if( verbose )
+		puts("");
+
+	SnapClose();
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : BackupPages
+ *
+ * Purpose   : Writes the pages of a data file that have changed since the
+ *			   last backup to the archive, as they were at the snapshot.
+ *			   Consecutive changed pages are read and written together.
+ *
+ * Parameters: fileid	- File ID.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void BackupPages(fileid)
+int fileid;
+{
+	ArchiveImageHeader	pageshd;
+	ArchivePageDataHeader datahd;
+	char		objname[128];
+	char		buf[INBUF_SIZE];
+	ulong		size, pos, page, pages, n, numread, bytecount = 0;
+
+	size	= image_size[fileid];
+	pages	= (size + SNAP_PAGE - 1) / SNAP_PAGE;
+	sprintf(objname, "file %s", dbd.file[fileid].name);
+
+	SnapOpen(fileid);
+
+	pageshd.id		= ARCHIVE_PAGES;
+	pageshd.size	= size;
+	strcpy(pageshd.fname, dbd.file[fileid].name);
+	Write(&pageshd, sizeof pageshd);
+
+	datahd.id = ARCHIVE_PAGEDATA;
+
+	if( verbose )
+		DisplayProgress(objname, 0);
+
+	for( page=0; page<pages; page += n )
+	{
+		if( !CHANGED(fileid, page) )
+		{
+			n = 1;
+			continue;
+		}
+
+		for( n=1; page+n < pages && n < INBUF_SIZE / SNAP_PAGE && CHANGED(fileid, page+n); n++ )
+			;
+
+		pos		= page * SNAP_PAGE;
+		numread = n * SNAP_PAGE;
+		if( numread > size - pos )
+			numread = size - pos;
+
+		SnapRead(fileid, pos, buf, numread);
+		WriteData(ARCHIVE_PAGEDATA, page, buf, numread);
+
+		bytecount += numread;
+
+		if( verbose )
+			DisplayProgress(objname, bytecount);
 	}
 
-	/* Set curr_recid to max value, so that all changes are logged */
-	dbd.shm->curr_recid = 0xffffffff;
-	dbd.shm->backup_active = 0;
-	
-	/* Wait for last transaction to complete */
-	timeout = 120;
-	while( dbd.shm->num_trans_active > 0 && timeout-- )
-		sleep(1);
+	datahd.page = 0;
+	datahd.size = 0;
+	Write(&datahd, sizeof datahd);
+
+	if( verbose )
+		puts("");
+
+	SnapClose();
 }
 
 
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : BackupDatabase
+ *
+ * Purpose   : Copies the data files from the snapshot while the database is
+ *			   being used. A full backup copies the entire files, and an
+ *			   incremental backup copies the pages that have changed since
+ *			   the previous backup. The index files are rebuilt by
+ *			   tyrestore.
+ *
+ * Parameters: stripe	- Only the files of this stripe are copied.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void BackupDatabase(stripe)
+int stripe;
+{
+	int			i;
+
+	for( i=0; i<dbd.header.files; i++ )
+		if( image_fh[i] != -1 && image_stripe[i] == stripe )
+		{
+			if( incremental )
+				BackupPages(i);
+			else
+				BackupImage(i);
+		}
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : FileLoad
+ *
+ * Purpose   : Returns the number of bytes that will be copied from a data
+ *			   file.
+ *
+ * Parameters: fileid	- File ID.
+ *
+ * Returns   : Number of bytes.
+ *
+ */
+static ulong FileLoad(fileid)
+int fileid;
+{
+	ulong		page, pages, load = 0;
+
+	if( !incremental )
+		return image_size[fileid];
+
+	pages = (image_size[fileid] + SNAP_PAGE - 1) / SNAP_PAGE;
+	for( page=0; page<pages; page++ )
+		if( CHANGED(fileid, page) )
+			load += SNAP_PAGE;
+
+	return load;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : AssignStripes
+ *
+ * Purpose   : Distributes the data files among the stripes, so that each
+ *			   stripe gets about the same number of bytes. The largest
+ *			   files are assigned first, each to the stripe with the
+ *			   fewest bytes so far.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void AssignStripes()
+{
+	ulong		load[STRIPES_MAX], *fileload, max;
+	int			i, n, files[STRIPES_MAX], stripe;
+
+	if( !(fileload = (ulong *)malloc(dbd.header.files * sizeof(ulong))) )
+	{
+		puts("Cannot allocate file table");
+		longjmp(err_jmpbuf, 1);
+	}
+
+	for( i=0; i<dbd.header.files; i++ )
+	{
+		image_stripe[i] = -1;
+		if( image_fh[i] != -1 )
+			fileload[i] = FileLoad(i);
+	}
+
+	for( stripe=0; stripe<stripes; stripe++ )
+		load[stripe] = files[stripe] = 0;
+
+	for( ;; )
+	{
+		/* Find the largest file that has not been assigned */
+		for( i=0, n=-1, max=0; i<dbd.header.files; i++ )
+			if( image_fh[i] != -1 && image_stripe[i] == -1 &&
+				(n == -1 || fileload[i] > max) )
+			{
+				n	= i;
+				max	= fileload[i];
+			}
+
+		if( n == -1 )
+			break;
+
+		for( i=1, stripe=0; i<stripes; i++ )
+			if( load[i] < load[stripe] )
+				stripe = i;
+
+		image_stripe[n] = stripe;
+		load[stripe]   += max;
+		files[stripe]++;
+	}
+
+	if( verbose )
+		for( stripe=0; stripe<stripes; stripe++ )
+			printf("Stripe %d: %-30s %3d files %12s bytes\n", stripe,
+				devices[stripe], files[stripe], printlong(load[stripe]));
+
+	free(fileload);
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : BackupStripe
+ *
+ * Purpose   : Writes one stripe of a striped backup. Called in a child
+ *			   process, which exits when the stripe has been written.
+ *
+ * Parameters: stripe	- Stripe number.
+ *
+ * Returns   : Does not return.
+ *
+ */
+static void BackupStripe(stripe)
+int stripe;
+{
+	ArchiveEnd			end;
+	char				dbdname[20];
+
+	/* The parent process ends the snapshot and cleans up */
+	snap_started = 0;
+	verbose		 = 0;
+	signal(SIGINT,	SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+
+	if( setjmp(err_jmpbuf) )
+	{
+		printf("Stripe %d (%s) failed\n", stripe, device);
+		fflush(stdout);
+		_exit(1);
+	}
+
+	device		= devices[stripe];
+	archive_fh	= stripe_fh[stripe];
+	outbytes	= 0;
+
+	mediahd.stripe = stripe;
+	Write(&mediahd, sizeof mediahd);
+
+	if( stripe == 0 )
+	{
+		sprintf(dbdname, "%s.dbd", dbname);
+		BackupFile(dbdname);
+	}
+
+	BackupDatabase(stripe);
+
+	end.id = ARCHIVE_END;
+	Write(&end, sizeof end);
+	Flush();
+	close(archive_fh);
+
+	fflush(stdout);
+	_exit(0);
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : BackupStriped
+ *
+ * Purpose   : Writes a striped backup. The data files are distributed
+ *			   among the stripes, and each stripe is read, compressed and
+ *			   written by a process of its own, so the files are copied in
+ *			   parallel. All devices are opened before the processes are
+ *			   started.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void BackupStriped()
+{
+	int			i, status, failed = 0;
+	pid_t		pid;
+
+	AssignStripes();
+
+	for( i=0; i<stripes; i++ )
+		if( (stripe_fh[i] = open(devices[i], O_WRONLY|CONFIG_O_BINARY)) == -1 )
+		{
+			printf("Cannot open '%s' (errno %d)\n", devices[i], errno);
+			longjmp(err_jmpbuf, 1);
+		}
+
+	fflush(stdout);
+
+	for( i=0; i<stripes; i++ )
+	{
+		if( (pid = fork()) == 0 )
+			BackupStripe(i);
+
+		if( pid == -1 )
+		{
+			printf("Cannot start process (errno %d)\n", errno);
+			failed = 1;
+			break;
+		}
+
+		stripe_pid[i] = pid;
+	}
+
+	for( i=0; i<stripes; i++ )
+	{
+		if( stripe_pid[i] <= 0 )
+			continue;
+
+		if( failed )
+			kill(stripe_pid[i], SIGTERM);
+
+		if( waitpid(stripe_pid[i], &status, 0) == -1 ||
+			!WIFEXITED(status) || WEXITSTATUS(status) )
+			failed = 1;
+		stripe_pid[i] = 0;
+
+		/* The file position is shared with the child process */
+		total_written += lseek(stripe_fh[i], 0, SEEK_CUR);
+		close(stripe_fh[i]);
+	}
+
+	if( failed )
+		longjmp(err_jmpbuf, 1);
+}
+
 
 /*--------------------------------------------------------------------------*\
  *
@@ -392,9 +1200,12 @@ static void help()
 {
 	puts("Syntax: tybackup database [option]...\n"
 		 "Options:\n"
-		 "    -d<device>      Backup device\n"
+		 "    -d<device>      Backup device. Give several devices to write a\n"
+		 "                    striped backup in parallel\n"
 		 "    -f<path>        Path for data files\n"
-		 "    -v              Be verbose\n");
+		 "    -i              Incremental backup (changes since last backup)\n"
+		 "    -v              Be verbose\n"
+		 "    -z              Compress the data files\n");
 	exit(1);
 }
 
@@ -410,6 +1221,7 @@ char 	*argv[];
 
 	/* The output buffer MUST be bigger than the input buffer */
 	assert(INBUF_SIZE < OUTBUF_SIZE);
+	assert(INBUF_SIZE <= ARCHIVE_ZBLOCK_MAX);
 
 	printf("Typhoon Online Backup version %s\n", VERSION);
 
@@ -425,14 +1237,25 @@ char 	*argv[];
 				switch( argv[i][1] )
 				{
 					case 'd':
-						device = argv[i]+2;
+						if( stripes == STRIPES_MAX )
+						{
+							printf("Too many devices (max %d)\n", STRIPES_MAX);
+							exit(1);
+						}
+						device = devices[stripes++] = argv[i]+2;
 						break;
 					case 'f':
 						datapath = argv[i]+2;
 						break;
+					case 'i':
+						incremental = 1;
+						break;
 					case 'v':
 						verbose = 1;
 						break;
+					case 'z':
+						compress = 1;
+						break;
 					default:
 						printf("Invalid option '%c'\n", argv[i][1]);
 						break;
@@ -452,7 +1275,9 @@ char 	*argv[];
 		return;
 	}
 
-	if( !(outbuf = (char *)malloc(OUTBUF_SIZE)) )
+	if( !(outbuf = (char *)malloc(OUTBUF_SIZE)) ||
+		!(zbuf = (char *)malloc(INBUF_SIZE)) ||
+		!(image_stripe = (int *)calloc(dbd.header.files, sizeof(int))) )
 	{
 		puts("Cannot allocate output buffer");
 		return;
@@ -480,26 +1305,40 @@ char 	*argv[];
 		goto out;
 	}
 
+	SnapBegin();
+
 	/* Initialize media header */
 	memset(&mediahd, 0, sizeof mediahd);
 	strcpy(mediahd.dbname, dbname);
 	mediahd.id		= ARCHIVE_MEDIA;
-	mediahd.date	= time(NULL);
+	mediahd.date	= backup_id;
+	mediahd.base	= incremental ? base_id : 0;
 	mediahd.seqno	= 1;
+	mediahd.stripes	= stripes > 1 ? stripes : 1;
 
-	if( verbose )
-		printf("Backing up to %s\n", device);
+	if( stripes > 1 )
+	{
+		if( verbose )
+			printf("Backing up to %d devices\n", stripes);
 
-	Write(&mediahd, sizeof mediahd);
+		BackupStriped();
+	}
+	else
+	{
+		if( verbose )
+			printf("Backing up to %s\n", device);
 
-	BackupFile(dbdname);
-	BackupDatabase();
-	BackupFile(LOG_FNAME);
+		Write(&mediahd, sizeof mediahd);
 
-	end.id = ARCHIVE_END;
-	Write(&end, sizeof end);
-	Flush();
-	close(archive_fh);
+		BackupFile(dbdname);
+		BackupDatabase(0);
+
+		end.id = ARCHIVE_END;
+		Write(&end, sizeof end);
+		Flush();
+		close(archive_fh);
+	}
+	SnapEnd(1);
 	clock_off();
 
 	if( verbose )
@@ -516,12 +1355,13 @@ char 	*argv[];
 	}
 
 out:
+	SnapEnd(0);
 	free(outbuf);
+	free(zbuf);
+	free(image_stripe);
 	shm_free(&dbd);
 	free(dbd.dbd);
 
-	unlink(LOG_FNAME);
-
 	return 0;
 }
 
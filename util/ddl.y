@@ -254,15 +254,15 @@ foreign_key_decl
 					if( record[records-1].first_foreign == -1 )
 						record[records-1].first_foreign = keys-1;
 
-					key[keys-1].type = KT_FOREIGN | $7 | $10 | $11;
+					/* The update rule has its own cascade bit */
+					key[keys-1].type = KT_FOREIGN | $10 | $11
+						| ($7 == KT_CASCADE ? KT_CASCADEUPD : $7);
 					check_foreign_key($4, &key[keys-1]);
 				}
 			;
 
 action		: T_RESTRICT			{ $$ = KT_RESTRICT;					}
-			| T_CASCADE 			{ $$ = KT_CASCADE;
-									  yyerror("'cascade' not supported");
-				 					}
+			| T_CASCADE 			{ $$ = KT_CASCADE;					}
 			;
 
 
@@ -0,0 +1,74 @@
+/*----------------------------------------------------------------------------
+ * File    : dump.h
+ * Program : tyexport, tyimport
+ * OS      : UNIX, OS/2, DOS
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all 
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN 
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" 
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Binary dump format used by tyexport -b and tyimport -b. A dump file
+ *   holds all records of one record type and consists of
+ *
+ *     - a DUMPHEAD,
+ *     - a DUMPFIELD for each field of the record, taken from the dbd. The
+ *       fields are compared with the dbd when the dump is loaded,
+ *     - a number of blocks. A block consists of a DUMPBLOCK followed by
+ *       <rows> records. Each record is stored as its length as an unsigned
+ *       long followed by the record image without trailing zero bytes.
+ *       The last block has 0 rows.
+ *
+ *   <sum> is the Adler-32 checksum of the records in the block (see
+ *   checksum() in util.c). All numbers are in the byte order of the
+ *   machine.
+ *
+ * $Id$
+ *
+ *--------------------------------------------------------------------------*/
+
+/*------------------------------- Constants --------------------------------*/
+#define DUMPVERSION_ID	"TyDump100"
+#define DUMP_BLOCK		262144L			/* Max. bytes of records per block	*/
+
+/*---------------------------------- Types ---------------------------------*/
+typedef struct {
+	char	id[16];						/* Version id						*/
+	char	record[IDENT_LEN+1];		/* Record name						*/
+	ushort	fields;						/* Number of fields					*/
+	ulong	size;						/* Record size						*/
+} DUMPHEAD;
+
+typedef struct {
+	char	name[IDENT_LEN+1];			/* Field name						*/
+	ushort	type;						/* Field type. See FT_.. constants	*/
+	ushort	nesting;					/* Nesting level					*/
+	ulong	offset;						/* Offset in record					*/
+	ulong	size;						/* Size of field					*/
+} DUMPFIELD;
+
+typedef struct {
+	ulong	rows;						/* Number of records in block		*/
+	ulong	bytes;						/* Number of bytes of records		*/
+	ulong	sum;						/* Checksum of records				*/
+} DUMPBLOCK;
+
+/* end-of-file */
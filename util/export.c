@@ -28,6 +28,24 @@
  * Description:
  *   Typhoon export utility.
  *
+ *   With the -c option the records are dumped in binary columnar form
+ *   instead of text. The dump of each record type is made by a sequential
+ *   scan of its record file (see d_colscan). Only the included fields at
+ *   the outermost level of the record are dumped. The file consists of
+ *
+ *     - a COLHEAD,
+ *     - a COLFIELD for each field,
+ *     - a number of batches. A batch consists of the number of rows as an
+ *       unsigned long, followed by the values of each field in turn. The
+ *       last batch has 0 rows.
+ *
+ *   All numbers are in the byte order of the machine.
+ *
+ *   With the -b option every record type is dumped in the binary format
+ *   described in dump.h, which tyimport -b loads much faster than text.
+ *   No export specification is needed. Records of fixed length are read
+ *   by a sequential scan of the record file (see d_scanopen).
+ *
  *--------------------------------------------------------------------------*/
 
 #include <sys/types.h>
@@ -52,9 +70,27 @@
 #include "ty_prot.h"
 
 #include "export.h"
+#include "dump.h"
+#include "util.h"
 
 static CONFIG_CONST char rcsid[] = "$Id: export.c,v 1.7 1999/10/04 04:11:31 kaz Exp $";
 
+/*---------------------------- Columnar dump format ------------------------*/
+#define COLVERSION_ID	"TyColumns100"
+#define COL_BATCH		4096			/* Number of rows per batch			*/
+
+typedef struct {
+	char	id[16];						/* Version id						*/
+	ushort	fields;						/* Number of fields					*/
+	ushort	spare;
+} COLHEAD;
+
+typedef struct {
+	char	name[IDENT_LEN+1];			/* Field name						*/
+	ushort	type;						/* Field type. See FT_.. constants	*/
+	ushort	size;						/* Size of each value				*/
+} COLFIELD;
+
 /*-------------------------------- prototypes ------------------------------*/
 static void PrintString		PRM( (uchar *, Field *fld); )
 static void	PrintField		PRM( (Field *, unsigned); )
@@ -62,6 +98,10 @@ static int	GetControlField PRM( (Structdef *, unsigned); )
 static int	PrintFields		PRM( (Structdef *, int, unsigned, int); )
 static void	Export			PRM( (char *); )
 static void ExportTable		PRM( (ulong); )
+static void ExportColumns	PRM( (ulong); )
+static void	PutRow			PRM( (void *, unsigned); )
+static void	PutBlock		PRM( (void); )
+static void ExportDump		PRM( (ulong); )
 	   int	yyparse			PRM( (void); )
 	   int	main			PRM( (int, char **); )
 
@@ -69,14 +109,21 @@ static void ExportTable		PRM( (ulong); )
 int dbdfile;
 int nocomma=0;
 int nonull=0;
+int columnar=0;
+int binary=0;
 char *recbuf;
 FILE *outfile;
-FILE *lex_file;
 
 /*------------------------------ local variables ---------------------------*/
+static char		*blockbuf;				/* Records of current dump block	*/
+static unsigned	blocksize;				/* Size of <blockbuf>				*/
+static DUMPBLOCK block;					/* Header of current dump block		*/
+
 static char paramhelp[] = "\
 Syntax: tyexport [option]... database[.dbd]\n\
 Options:\n\
+    -b          Dump all records in binary form (see tyimport -b)\n\
+    -c          Dump records in binary columnar form\n\
     -f<path>    Specify data files path\n\
     -g          Generate export specification\n\
     -n          Strings are not null-terminated\n";
@@ -320,6 +367,235 @@ ulong recid;
 }
 
 
+/*------------------------------ ExportColumns -----------------------------*\
+ *
+ * Purpose	 : Dumps the included fields at the outermost level of a record
+ *			   type in binary columnar form to <outfile>.
+ *
+ * Parameters: recid	- Record number (not record id).
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void ExportColumns(recid)
+ulong recid;
+{
+	Record *rec = &dbd.record[recid];
+	Field *fld = dbd.field + rec->first_field;
+	COLHEAD head;
+	COLFIELD col;
+	ulong *fields, pos = 0, batch;
+	void **columns;
+	unsigned rows;
+	int i, n = 0;
+
+	fields  = (ulong *)malloc(rec->fields * sizeof *fields);
+	columns = (void **)malloc(rec->fields * sizeof *columns);
+	if( !fields || !columns )
+		err_quit("Out of memory");
+
+	memset(&head, 0, sizeof head);
+	strcpy(head.id, COLVERSION_ID);
+	for( i=0; i<rec->fields; i++ )
+		if( !fld[i].nesting && (fld[i].type & FT_INCLUDE)
+		&&  FT_GETBASIC(fld[i].type) != FT_STRUCT )
+			head.fields++;
+	fwrite(&head, sizeof head, 1, outfile);
+
+	for( i=0; i<rec->fields; i++ )
+	{
+		if( fld[i].nesting || !(fld[i].type & FT_INCLUDE)
+		||  FT_GETBASIC(fld[i].type) == FT_STRUCT )
+			continue;
+
+		memset(&col, 0, sizeof col);
+		strcpy(col.name, fld[i].name);
+		col.type = fld[i].type & ~FT_INCLUDE;
+		col.size = fld[i].size;
+		fwrite(&col, sizeof col, 1, outfile);
+
+		fields[n] = INTERN_TO_RECID(recid) + i + 1;
+		if( !(columns[n++] = malloc((size_t) COL_BATCH * fld[i].size)) )
+			err_quit("Out of memory");
+	}
+
+	if( rec->is_vlr )
+		printf("'%s' has variable length and cannot be dumped in columnar form\n",
+			rec->name);
+	else while( d_colscan(INTERN_TO_RECID(recid), n, fields, columns, COL_BATCH,
+					 &pos, &rows) == S_OKAY )
+	{
+		batch = rows;
+		fwrite(&batch, sizeof batch, 1, outfile);
+
+		for( i=0; i<n; i++ )
+			fwrite(columns[i], fld[fields[i] % REC_FACTOR - 1].size, rows, outfile);
+	}
+
+	batch = 0;
+	fwrite(&batch, sizeof batch, 1, outfile);
+
+	for( i=0; i<n; i++ )
+		free(columns[i]);
+	free(columns);
+	free(fields);
+}
+
+
+/*--------------------------------- PutBlock -------------------------------*\
+ *
+ * Purpose	 : Writes the current dump block to <outfile> and starts a new
+ *			   block. A block without rows marks the end of the dump.
+ *
+ * Parameters: None.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void PutBlock()
+{
+	fwrite(&block, sizeof block, 1, outfile);
+
+	if( block.bytes && fwrite(blockbuf, block.bytes, 1, outfile) != 1 )
+		err_quit("Write error");
+
+	block.rows	= 0;
+	block.bytes	= 0;
+	block.sum	= 1;
+}
+
+
+/*---------------------------------- PutRow --------------------------------*\
+ *
+ * Purpose	 : Adds a record image to the current dump block. Trailing zero
+ *			   bytes are not stored.
+ *
+ * Parameters: row		- Record image.
+ *			   size		- Size of record.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void PutRow(row, size)
+void *row;
+unsigned size;
+{
+	ulong len = size;
+	char *p;
+
+	while( len && !((char *)row)[len-1] )
+		len--;
+
+	if( block.bytes + sizeof len + len > blocksize )
+		PutBlock();
+
+	p = blockbuf + block.bytes;
+	memcpy(p, &len, sizeof len);
+	memcpy(p + sizeof len, row, len);
+	block.sum	 = checksum(p, sizeof len + len, block.sum);
+	block.bytes += sizeof len + len;
+	block.rows++;
+}
+
+
+/*------------------------------- ExportDump -------------------------------*\
+ *
+ * Purpose	 : Dumps all records of a record type in binary form to
+ *			   <outfile>.
+ *
+ * Parameters: recid	- Record number (not record id).
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void ExportDump(recid)
+ulong recid;
+{
+	Record *rec = &dbd.record[recid];
+	Field *fld = dbd.field + rec->first_field;
+	DUMPHEAD head;
+	DUMPFIELD df;
+	ulong bounds[2];
+	unsigned maxrows, rows, i;
+	Id keyid;
+	void *scan;
+	char *scanbuf;
+
+	memset(&head, 0, sizeof head);
+	strcpy(head.id, DUMPVERSION_ID);
+	strcpy(head.record, rec->name);
+	head.fields	= rec->fields;
+	head.size	= rec->size;
+	fwrite(&head, sizeof head, 1, outfile);
+
+	for( i=0; i<rec->fields; i++ )
+	{
+		memset(&df, 0, sizeof df);
+		strcpy(df.name, fld[i].name);
+		df.type		= fld[i].type & ~FT_INCLUDE;
+		df.nesting	= fld[i].nesting;
+		df.offset	= fld[i].offset;
+		df.size		= fld[i].size;
+		fwrite(&df, sizeof df, 1, outfile);
+	}
+
+	block.rows	= 0;
+	block.bytes	= 0;
+	block.sum	= 1;
+
+	if( rec->is_vlr )
+	{
+		/* Variable length records cannot be read sequentially, so they are
+		 * read one at a time through a key that contains every record, as
+		 * ExportTable() does.
+		 */
+		for( keyid=rec->first_key, i=0; i<rec->keys; i++, keyid++ )
+			if( KT_GETBASIC(dbd.key[keyid].type) != KT_FOREIGN &&
+				!(dbd.key[keyid].type & KT_OPTIONAL) )
+				break;
+
+		if( i == rec->keys )
+			err_quit("Cannot dump '%s': it has no key that is not optional",
+					 rec->name);
+
+		for( d_keyfrst(keyid); db_status == S_OKAY; d_keynext(keyid) )
+		{
+			memset(recbuf, 0, rec->size);
+			if( d_recread(recbuf) != S_OKAY )
+				err_quit("d_recread: db_status %d", db_status);
+			PutRow(recbuf, rec->size);
+		}
+	}
+	else
+	{
+		/* Read the record file in large chunks */
+		maxrows = blocksize / rec->size;
+
+		if( !(scanbuf = (char *)malloc((size_t) maxrows * rec->size)) )
+			err_quit("Out of memory");
+
+		if( d_scanparts(INTERN_TO_RECID(recid), 1, bounds) != S_OKAY
+		||  d_scanopen(INTERN_TO_RECID(recid), bounds[0], bounds[1], &scan) != S_OKAY )
+			err_quit("Cannot scan '%s' (db_status %d)", rec->name, db_status);
+
+		while( d_scanread(scan, scanbuf, maxrows, &rows) == S_OKAY )
+			for( i=0; i<rows; i++ )
+				PutRow(scanbuf + i * rec->size, rec->size);
+
+		d_scanclose(scan);
+		free(scanbuf);
+	}
+
+	if( block.rows )
+		PutBlock();
+	PutBlock();
+}
+
+
 static void Export(dbname)
 char *dbname;
 {
@@ -331,15 +607,30 @@ char *dbname;
 
 	for( i=0; i<dbd.header.records; i++ )
 	{
-		if( dbd.record[i].aux )
+		if( binary )
+		{
+			sprintf(export_fname, "%s.dmp", dbd.record[i].name);
+
+		 	if( !(outfile = fopen(export_fname, "wb")) )
+				err_quit("Cannot write to '%s'", export_fname);
+
+			printf("dumping to '%s'\n", export_fname);
+			ExportDump(i);
+			if( fclose(outfile) )
+				err_quit("Cannot write to '%s'", export_fname);
+		}
+		else if( dbd.record[i].aux )
 		{
-			sprintf(export_fname, "%s.kom", dbd.record[i].name);
+			sprintf(export_fname, columnar ? "%s.col" : "%s.kom", dbd.record[i].name);
 
-		 	if( !(outfile = fopen(export_fname, "w")) )
+		 	if( !(outfile = fopen(export_fname, columnar ? "wb" : "w")) )
 				err_quit("Cannot write to '%s'", export_fname);
 
 			printf("exporting to '%s'\n", export_fname);
-			ExportTable(i);
+			if( columnar )
+				ExportColumns(i);
+			else
+				ExportTable(i);
 			fclose(outfile);
 		}
 	}
@@ -387,8 +678,12 @@ char *argv[];
 		if( biggest_rec < dbd.record[i].size )
 			biggest_rec = dbd.record[i].size;
 
-	/* Allocate record buffer */
-	if( !(recbuf = (char *)malloc(biggest_rec)) )
+	/* Allocate record buffer and dump block buffer */
+	blocksize = biggest_rec + sizeof(ulong) > DUMP_BLOCK ?
+				biggest_rec + sizeof(ulong) : DUMP_BLOCK;
+
+	if( !(recbuf = (char *)malloc(biggest_rec))
+	||	!(blockbuf = (char *)malloc(blocksize)) )
 		err_quit("Out of memory");
 
 	/* process command line options */
@@ -398,6 +693,12 @@ char *argv[];
 		{
 			switch( argv[i][1] )
 			{
+				case 'b':
+					binary = 1;
+					break;
+				case 'c':
+					columnar = 1;
+					break;
 				case 'f':
 					d_dbfpath(argv[i]+2);
 					break;
@@ -415,13 +716,15 @@ char *argv[];
 			err_quit("unknown command line option");
 	}
 
-	/* Read the export specification */
-	ReadExportSpec(realname);
+	/* Read the export specification. A binary dump does not need one */
+	if( !binary )
+		ReadExportSpec(realname);
 
 	if( !errors )
 		Export(realname);
 
 	free(dbd.dbd);
+	free(blockbuf);
 	free(recbuf);
 	return 0;
 }
@@ -28,6 +28,16 @@
  * Description:
  *   Typhoon import utility.
  *
+ *   The data files are read through a large buffer and parsed into batches
+ *   of records. Each batch is added with d_fillbatch(), which writes the
+ *   records first and then inserts the keys of each index in sorted order.
+ *
+ *   With the -b option the records are loaded from the binary dumps made
+ *   by tyexport -b (see dump.h) instead. No import specification is needed
+ *   and every record type with a dump file is loaded. The layout of each
+ *   dump must match the dbd and the checksum of each block is verified
+ *   before its records are added.
+ *
  *--------------------------------------------------------------------------*/
 
 #include <sys/types.h>
@@ -53,10 +63,20 @@
 
 #include "lex.h"
 #include "import.h"
+#include "dump.h"
+#include "util.h"
 
 static CONFIG_CONST char rcsid[] = "$Id: import.c,v 1.7 1999/10/04 04:11:32 kaz Exp $";
 
+/*--------------------------------- Macros ---------------------------------*/
+#define INBUF_SIZE		65536			/* Size of input buffer				*/
+#define BATCH_SIZE		262144L			/* Bytes of records per batch		*/
+#define GETC()			(inptr < inend ? (uchar)*inptr++ : FillBuffer())
+#define UNGETC(c)		((void)((c) == EOF || inptr--))
+
 /*-------------------------------- prototypes ------------------------------*/
+static int  FillBuffer		PRM( (void); )
+static void SkipComment		PRM( (void); )
 static int  ReadValue		PRM( (int); )
 static int  ReadString		PRM( (void); )
 static int  ReadChar		PRM( (void); )
@@ -64,26 +84,37 @@ static int 	ReadField		PRM( (Field *, unsigned); )
 static int	GetControlField PRM( (Structdef *, unsigned); )
 static int	ReadFields		PRM( (Structdef *, int, unsigned, int); )
 static void	Import			PRM( (char *); )
+static unsigned BatchRows	PRM( (Record *); )
 static void ImportTable		PRM( (ulong); )
+static void	AddBatch		PRM( (ulong, unsigned, int *, ulong); )
+static void ImportDump		PRM( (ulong); )
 	   int	yyparse			PRM( (void); )
 static void import_error	PRM( (char * CONFIG_ELLIPSIS); )
 	   int	main			PRM( (int, char **); )
 
 /*------------------------------ public variables --------------------------*/
-       FILE 	*lex_file;
 static FILE		*infile;
+static char		inbuf[INBUF_SIZE];
+static char		*inptr;
+static char		*inend;
+static char		*batchbuf;
+static unsigned	batchsize;
 static char		*recbuf;
 static char		*fldptr;
 static int		fldtype;
 static int		lineno;
 static char		import_fname[256];
+static char		*open_mode = "s";
+static int		binary = 0;
 
 /*------------------------------ local variables ---------------------------*/
 static char paramhelp[] = "\
 Syntax: tyimport [option]... database[.dbd]\n\
 Options:\n\
+    -b          Load binary dumps made by tyexport -b\n\
     -f<path>    Specify data files path\n\
-    -g          Generate import specification\n";
+    -g          Generate import specification\n\
+    -x          Open the database in exclusive mode (faster)\n";
 
 #ifdef CONFIG_PROTOTYPES
 void err_quit(char *s, ...)
@@ -121,6 +152,49 @@ char *fmt;
 
 
 
+/* Reads the next block of the input file and returns its first character */
+
+static int FillBuffer()
+{
+	size_t n = fread(inbuf, 1, sizeof inbuf, infile);
+
+	inptr = inbuf;
+	inend = inbuf + n;
+
+	return n ? (uchar)*inptr++ : EOF;
+}
+
+
+static void SkipComment()
+{
+	int c, start = lineno;
+
+	for( ;; )
+	{
+		switch( GETC() )
+		{
+			case '*':
+				if( (c = GETC()) == '/' )
+					return;
+				UNGETC(c);
+				break;
+			case '\n':
+				lineno++;
+				break;
+			case '/':
+				if( (c = GETC()) == '*' )		/* nested comment		*/
+					SkipComment();
+				else
+					UNGETC(c);
+				break;
+			case EOF:
+				err_quit("%s: unterminated comment starting in line %d",
+					import_fname, start);
+		}
+	}
+}
+
+
 /* Floats not supported!!! */
 
 static int ReadValue(c)
@@ -133,59 +207,59 @@ int c;
 	if( c == '-' )
 	{
 		negate = 1;
-		c = getc(infile);
+		c = GETC();
 	}
 
 	if( c == '0' )
 	{
 		value = 0;
 
-		c = getc(infile);
+		c = GETC();
 
 		if( c == 'x' )
 		{
-			while( (c = getc(infile)) && isxdigit(c) )
+			while( (c = GETC()) && isxdigit(c) )
 			{
 				if( isdigit(c) )
 					value = value * 16 + c - '0';
 				else
-					value = value * 16 + 6 + tolower(c) - 'a';
+					value = value * 16 + 10 + tolower(c) - 'a';
 			}
-			ungetc(c, infile);
+			UNGETC(c);
 		}
 		else if( isdigit(c) )
 		{
 			do
 			{
 				value = value * 8 + c - '0';
-				c = getc(infile);
+				c = GETC();
 			}
 			while( isdigit(c) );
-			ungetc(c, infile);
+			UNGETC(c);
 		}
 		else
-			ungetc(c, infile);
+			UNGETC(c);
 	}
 	else
 	{
 		value = c - '0';
 
-		c = getc(infile);
+		c = GETC();
 
 		while( isdigit(c) )
 		{
 			value = value * 10 + c - '0';
-			c = getc(infile);
+			c = GETC();
 		}
 
 /*
 		do 
 		{
 			value = value * 10 + c - '0';
-			c = getc(infile);
+			c = GETC();
 		}
 		while( isdigit(c) );*/
-		ungetc(c, infile);
+		UNGETC(c);
 	}
 
 	if( fldtype & FT_UNSIGNED )
@@ -225,11 +299,19 @@ static int ReadString()
 	char *p = fldptr;
 	int c;
 
-	while( (*p = getc(infile)) != '"' )
+	while( (c = GETC()) != '"' )
 	{
+		if( c == EOF )
+		{
+			import_error("unterminated string");
+			break;
+		}
+
+		*p = c;
+
 		if( *p == '\\' )
 		{
-			switch( c = getc(infile) )
+			switch( c = GETC() )
 			{	
 				case 'n':							/* Newline				*/
 					*p = '\n';
@@ -242,21 +324,21 @@ static int ReadString()
 					break;
 				case 'x':							/* Hexadecimal number	*/
 				case 'X':
-					c = getc(infile);
+					c = GETC();
 					if( isxdigit(c) )
 					{
 						*p = isalpha(c) ? tolower(c) - 'a' + 10 : c - '0';
-						c = getc(infile);
+						c = GETC();
 						if( isxdigit(c) )
 						{
 							*p <<= 4;
 							*p += isalpha(c) ? tolower(c) - 'a' + 10 : c - '0';
 						}
 						else
-							ungetc(c, infile);
+							UNGETC(c);
 					}
 /*					*p = 0;
-					c = getc(infile);
+					c = GETC();
 
 					while( isxdigit(c) )
 					{
@@ -264,10 +346,10 @@ static int ReadString()
 		 					*p = *p * 16 + c - '0';
 		 				else
 		 					*p = *p * 16 + 10 + tolower(c) - 'a';
-		 				c = getc(infile);
+		 				c = GETC();
 					}
 
-					ungetc(c, infile);*/
+					UNGETC(c);*/
 					break;
 				default:
 					import_error("illegal character '%c' following '\\'", c);
@@ -285,12 +367,12 @@ static int ReadString()
 
 static int ReadChar()
 {
-	int c = getc(infile);
+	int c = GETC();
 	int value, tmp;
 
 	if( c == '\\' )
 	{
-		switch( tmp = getc(infile) )
+		switch( tmp = GETC() )
 		{
 			case 'n':	value = '\n';	break;
 			case 'r':	value = '\r';	break;
@@ -299,7 +381,7 @@ static int ReadChar()
 			case '\\':
 			case '\'':	value = tmp;	break;
 			case 'x':
-				c = getc(infile);
+				c = GETC();
 				value = 0;
 
 				while( isxdigit(c) )
@@ -308,10 +390,10 @@ static int ReadChar()
 				 		value = value * 16 + c - '0';
 				 	else
 				 		value = value * 16 + 10 + tolower(c) - 'a';
-				 	c = getc(infile);
+				 	c = GETC();
 				}
 
-				ungetc(c, infile);
+				UNGETC(c);
 				break;
 			default:
 				import_error("invalid character constant");
@@ -321,7 +403,7 @@ static int ReadChar()
 	else
 		value = c;
 
-	if( getc(infile) != '\'' )
+	if( GETC() != '\'' )
 		import_error("unterminated character constant");
 
 	switch( FT_GETBASIC(fldtype) )
@@ -347,7 +429,7 @@ unsigned offset;
 
 	for( ;; )
 	{
-		c = getc(infile);
+		c = GETC();
 
 		if( c == ' ' || c == '\t' || c == '{' || c == '}' || c == ',' )
 			;
@@ -361,11 +443,11 @@ unsigned offset;
 			lineno++;
 		else if( c == '/' )
 		{
-			if( (c = getc(infile)) == '*' )	/* C comment   					*/
-				lex_skip_comment();
+			if( (c = GETC()) == '*' )	/* C comment   					*/
+				SkipComment();
 			else if( c == '/' )			   	/* C++ comment 					*/
 			{
-				while( getc(infile) != '\n' && !feof(infile) )
+				while( (c = GETC()) != '\n' && c != EOF )
 					;
 				lineno++;
 			}
@@ -464,22 +546,206 @@ unsigned offset;
 }
 
 
+/*-------------------------------- BatchRows -------------------------------*\
+ *
+ * Purpose	 : Returns the number of records of <rec> that fit in the batch
+ *			   buffer. The buffer is grown if it cannot hold one record.
+ *
+ * Parameters: rec		- Record.
+ *
+ * Returns	 : Number of records.
+ *
+ */
+
+static unsigned BatchRows(rec)
+Record *rec;
+{
+	if( batchsize < rec->size )
+	{
+		if( !(batchbuf = (char *)realloc(batchbuf, rec->size)) )
+			err_quit("Out of memory");
+		batchsize = rec->size;
+	}
+
+	return batchsize / rec->size;
+}
+
+
 static void ImportTable(recid)
 ulong recid;
 {
 	Record *rec = &dbd.record[recid];
+	unsigned rows, maxrows = BatchRows(rec);
+	ulong imported = 0;
+	int *status, eof = 0;
 
 	recid = INTERN_TO_RECID(recid);
 
-	memset(recbuf, 0, rec->size);
+	if( !(status = (int *)malloc(maxrows * sizeof *status)) )
+		err_quit("Out of memory");
+
+	while( !eof )
+	{
+		memset(batchbuf, 0, maxrows * rec->size);
+
+		/* Parse as many records as there is room for in the batch */
+		for( rows=0; rows<maxrows; rows++ )
+		{
+			recbuf = batchbuf + rows * rec->size;
+
+			if( ReadFields(&dbd.structdef[rec->structid], 0, 0, 0) == -1 )
+			{
+				eof = 1;
+				break;
+			}
+		}
+
+		if( !rows )
+			break;
+
+		AddBatch(recid, rows, status, imported);
+		imported += rows;
+	}
+
+	free(status);
+}
+
+
+/*--------------------------------- AddBatch -------------------------------*\
+ *
+ * Purpose	 : Adds the records in <batchbuf> to the database and reports
+ *			   the records that could not be added.
+ *
+ * Parameters: recid	- Record id.
+ *			   rows		- Number of records in <batchbuf>.
+ *			   status	- Array for the status of each record.
+ *			   imported	- Number of records read before this batch.
+ *
+ * Returns	 : Nothing.
+ *
+ */
+
+static void AddBatch(recid, rows, status, imported)
+ulong recid;
+unsigned rows;
+int *status;
+ulong imported;
+{
+	unsigned i;
+
+	if( d_fillbatch(recid, batchbuf, rows, status) != S_OKAY )
+		err_quit("d_fillbatch: db_status %d, db_subcode %ld",
+			db_status, db_subcode);
+
+	for( i=0; i<rows; i++ )
+		if( status[i] != S_OKAY )
+			printf("%s record %lu: db_status %d\n", import_fname,
+				imported + i + 1, status[i]);
+}
+
+
+/*-------------------------------- ImportDump ------------------------------*\
+ *
+ * Purpose	 : Loads a binary dump of a record type from <infile>.
+ *
+ * Parameters: recid	- Record number (not record id).
+ *
+ * Returns	 : Nothing.
+ *
+ */
 
-	while( ReadFields(&dbd.structdef[rec->structid], 0, 0, 0) != -1 )
+static void ImportDump(recid)
+ulong recid;
+{
+	Record *rec = &dbd.record[recid];
+	Field *fld = dbd.field + rec->first_field;
+	unsigned rows = 0, maxrows = BatchRows(rec), i;
+	ulong imported = 0, len, n;
+	DUMPHEAD head;
+	DUMPFIELD df;
+	DUMPBLOCK block;
+	char *blockbuf, *p;
+	int *status;
+
+	/* Check that the dump matches the record in the dbd */
+	if( fread(&head, sizeof head, 1, infile) != 1
+	||	strcmp(head.id, DUMPVERSION_ID) )
+		err_quit("'%s' is not a dump file", import_fname);
+
+	if( strcmp(head.record, rec->name) || head.fields != rec->fields
+	||	head.size != rec->size )
+		err_quit("'%s' does not match the database definition", import_fname);
+
+	for( i=0; i<rec->fields; i++ )
 	{
-		if( d_fillnew(recid, recbuf) != S_OKAY )
-			printf("d_fillnew: db_status %d, db_subcode %ld\n", 
-				db_status, db_subcode);
-		memset(recbuf, 0, rec->size);
+		if( fread(&df, sizeof df, 1, infile) != 1 )
+			err_quit("'%s' is truncated", import_fname);
+
+		if( strcmp(df.name, fld[i].name)
+		||	df.type != (fld[i].type & ~FT_INCLUDE)
+		||	df.nesting != fld[i].nesting
+		||	df.offset != fld[i].offset
+		||	df.size != fld[i].size )
+			err_quit("'%s' does not match the database definition (field '%s')",
+				import_fname, fld[i].name);
 	}
+
+	status	 = (int *)malloc(maxrows * sizeof *status);
+	blockbuf = (char *)malloc(rec->size + sizeof len > DUMP_BLOCK ?
+							  rec->size + sizeof len : DUMP_BLOCK);
+	if( !status || !blockbuf )
+		err_quit("Out of memory");
+
+	recid = INTERN_TO_RECID(recid);
+
+	for( ;; )
+	{
+		if( fread(&block, sizeof block, 1, infile) != 1 )
+			err_quit("'%s' is truncated", import_fname);
+
+		if( !block.rows )
+			break;
+
+		if( block.bytes > DUMP_BLOCK && block.bytes > rec->size + sizeof len )
+			err_quit("'%s' is corrupted", import_fname);
+
+		if( fread(blockbuf, block.bytes, 1, infile) != 1 )
+			err_quit("'%s' is truncated", import_fname);
+
+		if( checksum(blockbuf, block.bytes, 1) != block.sum )
+			err_quit("'%s': checksum error in block after record %lu",
+				import_fname, imported + rows);
+
+		/* Unpack the records of the block into the batch */
+		for( p = blockbuf, n = 0; n < block.rows; n++ )
+		{
+			if( p + sizeof len > blockbuf + block.bytes )
+				err_quit("'%s' is corrupted", import_fname);
+			memcpy(&len, p, sizeof len);
+			p += sizeof len;
+
+			if( len > rec->size || p + len > blockbuf + block.bytes )
+				err_quit("'%s' is corrupted", import_fname);
+
+			recbuf = batchbuf + rows * rec->size;
+			memcpy(recbuf, p, len);
+			memset(recbuf + len, 0, rec->size - len);
+			p += len;
+
+			if( ++rows == maxrows )
+			{
+				AddBatch(recid, rows, status, imported);
+				imported += rows;
+				rows = 0;
+			}
+		}
+	}
+
+	if( rows )
+		AddBatch(recid, rows, status, imported);
+
+	free(blockbuf);
+	free(status);
 }
 
 
@@ -488,21 +754,37 @@ char *dbname;
 {
 	int i;
 
-	if( d_open(dbname, "s") != S_OKAY )
+	if( d_open(dbname, open_mode) != S_OKAY )
 		err_quit("Cannot open database '%s'", dbname);
 
 	for( i=0; i<dbd.header.records; i++ )
 	{
-		if( dbd.record[i].aux )
+		if( binary )
+		{
+			sprintf(import_fname, "%s.dmp", dbd.record[i].name);
+
+			if( !(infile = fopen(import_fname, "rb")) )
+				continue;
+
+			printf("loading from '%s'\n", import_fname);
+			d_loadbegin(INTERN_TO_RECID(i));
+			ImportDump(i);
+			d_loadend();
+			fclose(infile);
+		}
+		else if( dbd.record[i].aux )
 		{
 			lineno = 1;
 			sprintf(import_fname, "%s.kom", dbd.record[i].name);
 
-			if( !(infile = fopen(import_fname, "r")) )
+			if( !(infile = fopen(import_fname, "rb")) )
 				err_quit("Cannot open '%s'", import_fname);
+			inptr = inend = inbuf;
 
 			printf("importing from '%s'\n", import_fname);
+			d_loadbegin(INTERN_TO_RECID(i));
 			ImportTable(i);
+			d_loadend();
 			fclose(infile);
 		}
 	}
@@ -550,8 +832,10 @@ char *argv[];
 		if( biggest_rec < dbd.record[i].size )
 			biggest_rec = dbd.record[i].size;
 
-	/* Allocate record buffer */
-	if( !(recbuf = (char *)malloc(biggest_rec)) )
+	/* Allocate batch buffer. It must be able to hold at least one record */
+	batchsize = biggest_rec > BATCH_SIZE ? biggest_rec : BATCH_SIZE;
+
+	if( !(batchbuf = (char *)malloc(batchsize)) )
 		err_quit("Out of memory");
 
 	/* process command line options */
@@ -561,6 +845,9 @@ char *argv[];
 		{
 			switch( argv[i][1] )
 			{
+				case 'b':
+					binary = 1;
+					break;
 				case 'f':
 					if( d_dbfpath(argv[i]+2) != S_OKAY )
 						err_quit("Invalid data files path");
@@ -568,6 +855,9 @@ char *argv[];
 				case 'g':
 					GenerateImportSpec(realname);
 					exit(1);
+				case 'x':
+					open_mode = "x";
+					break;
 				default:
 					err_quit("unknown command line option");
 			}
@@ -576,14 +866,15 @@ char *argv[];
 			err_quit("unknown command line option");
 	}
 
-	/* Read the import specification */
-	ReadImportSpec(realname);
+	/* Read the import specification. A binary dump does not need one */
+	if( !binary )
+		ReadImportSpec(realname);
 
 	if( !errors )
 		Import(realname);
 
 	free(dbd.dbd);
-	free(recbuf);
+	free(batchbuf);
 	return 0;
 }
 
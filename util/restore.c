@@ -37,6 +37,8 @@ static char rcsid[] = "$Id: restore.c,v 1.2 1999/10/03 23:36:49 kaz Exp $";
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -60,15 +62,31 @@ static char rcsid[] = "$Id: restore.c,v 1.2 1999/10/03 23:36:49 kaz Exp $";
 #define BLOCK_SIZE		512
 #define OUTBUF_SIZE		(BLOCK_SIZE * 128)
 #define INBUF_SIZE		(256 * 1024)
+#define WRITEBUF_SIZE	(1024L * 1024)
+#define ARCHIVES_MAX	64
 
 /*-------------------------- Function prototypes ---------------------------*/
 static void 	SignalHandler			PRM( (int); )
 static void		Read					PRM( (void *, ulong); )
+static ulong	ReadZData				PRM( (ulong *); )
 static void		DisplayProgress			PRM( (char *, ulong); )
+static void		OutputOpen				PRM( (int, char *); )
+static void		OutputFlush				PRM( (void); )
+static void		Output					PRM( (ulong, void *, ulong); )
 static void		RestoreDatabase			PRM( (void); )
+static void		MakeFileName			PRM( (char *, unsigned, char *); )
+static void		RestoreImage			PRM( (void); )
+static void		RestorePages			PRM( (void); )
+static void		RestoreTable			PRM( (void); )
 static void		RestoreFile				PRM( (char *); )
 static void		RestoreDbdFile			PRM( (void); )
 static void		RestoreLogFile			PRM( (void); )
+static int		ReadMediaHeader			PRM( (char *, ArchiveMediaHeader *); )
+static void		CheckMedia				PRM( (int, ArchiveMediaHeader *); )
+static void		GroupStripes			PRM( (void); )
+static void		OpenArchive				PRM( (char *); )
+static void		RestoreStripe			PRM( (char *); )
+static void		RestoreStriped			PRM( (int); )
 static void 	help					PRM( (void); )
        void		FixLog					PRM( (char *); )
 
@@ -78,14 +96,31 @@ static Dbentry	dbd;					/* DBD anchor						*/
 static int		archive_fh = -1;		/* Archive file handle				*/
 static char		dbname[DBNAME_LEN+1];	/* Database name					*/
 static char		*device = "/dev/null";	/* Archive device					*/
+static char		*devices[ARCHIVES_MAX];	/* Full backup and incrementals		*/
+static int		archives = 0;			/* Number of entries in devices[]	*/
+static ArchiveMediaHeader headers[ARCHIVES_MAX];/* Media headers of devices	*/
+static int		header_ok[ARCHIVES_MAX];/* Could the header be read?		*/
+static int		set_first[ARCHIVES_MAX];/* First device of each backup		*/
+static int		set_stripes[ARCHIVES_MAX];/* Number of stripes of each backup*/
+static int		sets = 0;				/* Number of backups				*/
+static pid_t	stripe_pid[ARCHIVES_MAX];/* Processes reading the stripes	*/
+static int		parallel = 0;			/* Restoring a stripe in parallel?	*/
+static char		*zbuf;					/* Compressed data buffer			*/
+static char		*zout;					/* Uncompressed data buffer			*/
+static char		*wbuf;					/* Output buffer					*/
+static ulong	wpos;					/* File position of wbuf[0]			*/
+static ulong	wbytes;					/* Number of bytes in wbuf			*/
+static int		wfh;					/* File being written				*/
+static char		*wfname;				/* Name of file being written		*/
+static long		prev_date;				/* Date of previous archive			*/
 static ulong	curr_id;				/* Current block header id			*/
 static char		*inbuf;					/* Input buffer						*/
 static ulong	inreadpos;				/* Current read position in buffer	*/
 static ulong	inbytes;				/* Number of bytes in outbuf		*/
 static ulong	total_read = 0;			/* Total number of bytes read 		*/
+static int		log_restored = 0;		/* Was a log file restored?			*/
        jmp_buf	err_jmpbuf;				/* Jumped to on error				*/
        char		*datapath = "";			/* Database file path				*/
-       int		db_status;				/* Required by ../read_dbd.c		*/
        int		verbose = 0;			/* Be verbose?						*/
 
 
@@ -104,6 +139,8 @@ static ulong	total_read = 0;			/* Total number of bytes read 		*/
 static void SignalHandler(sig)
 int sig;
 {
+	int i;
+
 	printf("signal %d\n", sig);
 
 	if( sig == SIGSEGV )
@@ -111,6 +148,10 @@ int sig;
 	else if( sig == SIGBUS )
 		puts("Bus error");
 
+	for( i=0; i<archives; i++ )
+		if( stripe_pid[i] > 0 )
+			kill(stripe_pid[i], SIGTERM);
+
 	dbd.shm->restore_active = 0;
 	shm_free(&dbd);
 	d_close();
@@ -163,12 +204,20 @@ ulong size;
 	else
 		copymax = 0;
 
+	/* The stripes are read in parallel, so the media cannot be changed */
+	if( archive_fh == -1 && parallel )
+	{
+		printf("Unexpected end of '%s'\n", device);
+		longjmp(err_jmpbuf, 1);
+	}
+
 	while( archive_fh == -1 )
 	{
 		clock_off();
 		printf("Insert backup media no %d [enter]", mediahd.seqno);
 		fflush(stdout);
-		gets(s);
+		if( !fgets(s, sizeof s, stdin) )
+			s[0] = 'q';
 		
 		if( s[0] == 'q' )
 			longjmp(err_jmpbuf, 2);
@@ -221,6 +270,43 @@ ulong size;
 
 
 
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : ReadZData
+ *
+ * Purpose   : Reads a compressed block of data file data. The block header
+ *			   id has already been read. The data is uncompressed to zout.
+ *
+ * Parameters: page		- Set to the first page of the block.
+ *
+ * Returns   : Number of bytes in zout.
+ *
+ */
+static ulong ReadZData(page)
+ulong *page;
+{
+	ArchiveZDataHeader	zdatahd;
+
+	Read(&zdatahd.page, sizeof(zdatahd) - sizeof(zdatahd.id));
+
+	if( zdatahd.size > ARCHIVE_ZBLOCK_MAX || zdatahd.zsize >= zdatahd.size )
+	{
+		puts("Invalid compressed block");
+		longjmp(err_jmpbuf, 1);
+	}
+
+	Read(zbuf, zdatahd.zsize);
+
+	if( lz_uncompress(zbuf, zdatahd.zsize, zout, zdatahd.size) != (long)zdatahd.size )
+	{
+		puts("Corrupted compressed block");
+		longjmp(err_jmpbuf, 1);
+	}
+
+	*page = zdatahd.page;
+	return zdatahd.size;
+}
+
 
 /*--------------------------------------------------------------------------*\
  *
@@ -246,75 +332,439 @@ ulong bytes;
 
 /*--------------------------------------------------------------------------*\
  *
- * Function  : RestoreDatabase
+ * Function  : OutputOpen
  *
- * Purpose   : 
+ * Purpose   : Starts writing a data file through the output buffer.
+ *
+ * Parameters: fh		- File handle.
+ *			   fname	- File name used in error messages.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void OutputOpen(fh, fname)
+int fh;
+char *fname;
+{
+	wfh		= fh;
+	wfname	= fname;
+	wpos	= 0;
+	wbytes	= 0;
+}
+
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : OutputFlush
+ *
+ * Purpose   : Writes the contents of the output buffer with a single write.
  *
  * Parameters: None.
  *
  * Returns   : Nothing.
  *
  */
-static void RestoreDatabase()
+static void OutputFlush()
 {
-	ArchiveTableHeader	tablehd;
-	ArchiveRecordHeader	recordhd;
+	if( !wbytes )
+		return;
+
+	lseek(wfh, (long) wpos, SEEK_SET);
+	if( write(wfh, wbuf, wbytes) != wbytes )
+	{
+		printf("Cannot write file '%s' (errno %d)\n", wfname, errno);
+		longjmp(err_jmpbuf, 1);
+	}
+
+	wpos  += wbytes;
+	wbytes = 0;
+}
+
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : Output
+ *
+ * Purpose   : Writes <size> bytes at position <pos> of the current data
+ *			   file. Data written at consecutive positions is collected in
+ *			   the output buffer, so a file restored in order is written in
+ *			   large sequential blocks.
+ *
+ * Parameters: pos		- File position.
+ *			   buf		- Data.
+ *			   size		- Number of bytes.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void Output(pos, buf, size)
+ulong pos;
+void *buf;
+ulong size;
+{
+	if( pos != wpos + wbytes || wbytes + size > WRITEBUF_SIZE )
+	{
+		OutputFlush();
+		wpos = pos;
+	}
+
+	memcpy(wbuf + wbytes, buf, size);
+	wbytes += size;
+}
+
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : MakeFileName
+ *
+ * Purpose   : Builds the path of a file in <datapath>. The buffer must also
+ *			   have room for the extension of the free-space bitmap. The
+ *			   restore is aborted if the path is too long.
+ *
+ * Parameters: fname		- Buffer for the path.
+ *			   size			- Size of <fname>.
+ *			   name			- File name.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void MakeFileName(fname, size, name)
+char *fname;
+unsigned size;
+char *name;
+{
+	int len = snprintf(fname, size, "%s/%s", datapath, name);
+
+	if( len < 0 || len + sizeof(".fsm") > size )
+	{
+		printf("File name too long: '%s/%s'\n", datapath, name);
+		longjmp(err_jmpbuf, 1);
+	}
+}
+
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : RestoreImage
+ *
+ * Purpose   : Restores the image of a data file. The file is written
+ *			   sequentially.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void RestoreImage()
+{
+	ArchiveImageHeader	imagehd;
+	ArchiveFileDataHeader datahd;
 	ulong				prev_bytecount;
 	ulong				bytecount;
+	ulong				readmax;
+	ulong				page;
 	char				outbuf[OUTBUF_SIZE];
 	char				fname[128];
-	char				objname[128];
+	char				objname[sizeof imagehd.fname + 8];
 	int					fh;
 
-	Read(&curr_id, sizeof curr_id);
+	Read(&imagehd.size, sizeof(imagehd) - sizeof(imagehd.id));
+
+	MakeFileName(fname, sizeof fname, imagehd.fname);
+	snprintf(objname, sizeof objname, "file %s", imagehd.fname);
+
+	if( (fh = open(fname, O_WRONLY|O_TRUNC|O_CREAT|CONFIG_O_BINARY, CONFIG_CREATMASK)) == -1 )
+	{
+		printf("Cannot open file '%s'\n", fname);
+		longjmp(err_jmpbuf, 1);
+	}
+
+	/* The free-space bitmap of the file is rebuilt when it is opened */
+	strcat(fname, ".fsm");
+	unlink(fname);
+
+	prev_bytecount = bytecount = 0;
+	OutputOpen(fh, imagehd.fname);
 
 	for( ;; )
 	{
-		if( curr_id != ARCHIVE_TABLE )
-			break;
-		
-		Read(&tablehd.recsize, sizeof(tablehd) - sizeof(tablehd.id));
+		Read(&curr_id, sizeof curr_id);
 
-		sprintf(fname, "%s/%s", datapath, tablehd.fname);
-		sprintf(objname, "table %s", tablehd.table);
+		if( curr_id == ARCHIVE_ZDATA )
+		{
+			readmax = ReadZData(&page);
+			Output(bytecount, zout, readmax);
 
-		if( (fh = open(fname, O_WRONLY|O_TRUNC|O_CREAT|O_BINARY, CREATMASK)) == -1 )
+			bytecount += readmax;
+
+			if( verbose && bytecount > prev_bytecount + 100000 )
+			{
+				prev_bytecount = bytecount;
+				DisplayProgress(objname, bytecount);
+			}
+			continue;
+		}
+
+		if( curr_id != ARCHIVE_FILEDATA )
 		{
-			printf("Cannot open file '%s'\n", fname);
+			printf("Unexpected header id %ld in middle of file\n", curr_id);
 			longjmp(err_jmpbuf, 1);
 		}
-		prev_bytecount = bytecount = 0;
 
-		for( ;; )
+		Read(&datahd.size, sizeof(datahd) - sizeof(datahd.id));
+
+		if( !datahd.size )
+			break;
+
+		while( datahd.size > 0 )
 		{
-			Read(&curr_id, sizeof curr_id);
-		
-			if( curr_id != ARCHIVE_RECORD )
-				break;
-	
-			Read(&recordhd.recid, sizeof(recordhd) - sizeof(recordhd.id));
-			Read(outbuf, tablehd.recsize);
+			readmax = sizeof outbuf;
+			if( readmax > datahd.size )
+				readmax = datahd.size;
 
-			lseek(fh, tablehd.recsize * recordhd.recno, SEEK_SET);
-			write(fh, outbuf, tablehd.recsize);
+			Read(outbuf, readmax);
+			Output(bytecount, outbuf, readmax);
 
-			bytecount += tablehd.recsize;
+			bytecount	 += readmax;
+			datahd.size -= readmax;
+		}
 
-			if( verbose && bytecount > prev_bytecount + 100000 )
-			{
-				prev_bytecount = bytecount;
+		if( verbose && bytecount > prev_bytecount + 100000 )
+		{
+			prev_bytecount = bytecount;
+			DisplayProgress(objname, bytecount);
+		}
+	}
+
+	OutputFlush();
+
+	if( verbose )
+	{
+		DisplayProgress(objname, bytecount);
+		puts("");
+	}
+
+	close(fh);
+}
+
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : RestorePages
+ *
+ * Purpose   : Writes the pages of a data file from an incremental backup.
+ *			   The file is given the size it had at the snapshot.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void RestorePages()
+{
+	ArchiveImageHeader	pageshd;
+	ArchivePageDataHeader datahd;
+	ulong				bytecount;
+	ulong				readmax;
+	ulong				pos;
+	char				outbuf[OUTBUF_SIZE];
+	char				fname[128];
+	char				objname[sizeof pageshd.fname + 8];
+	int					fh;
+
+	Read(&pageshd.size, sizeof(pageshd) - sizeof(pageshd.id));
+
+	MakeFileName(fname, sizeof fname, pageshd.fname);
+	snprintf(objname, sizeof objname, "file %s", pageshd.fname);
+
+	if( (fh = open(fname, O_WRONLY|O_CREAT|CONFIG_O_BINARY, CONFIG_CREATMASK)) == -1 )
+	{
+		printf("Cannot open file '%s'\n", fname);
+		longjmp(err_jmpbuf, 1);
+	}
+
+	ftruncate(fh, pageshd.size);
+
+	/* The free-space bitmap of the file is rebuilt when it is opened */
+	strcat(fname, ".fsm");
+	unlink(fname);
+
+	bytecount = 0;
+	OutputOpen(fh, pageshd.fname);
+
+	for( ;; )
+	{
+		Read(&curr_id, sizeof curr_id);
+
+		if( curr_id == ARCHIVE_ZDATA )
+		{
+			readmax = ReadZData(&datahd.page);
+			Output((ulong) datahd.page * SNAP_PAGE, zout, readmax);
+
+			bytecount += readmax;
+
+			if( verbose )
 				DisplayProgress(objname, bytecount);
-			}
+			continue;
+		}
+
+		if( curr_id != ARCHIVE_PAGEDATA )
+		{
+			printf("Unexpected header id %ld in middle of file\n", curr_id);
+			longjmp(err_jmpbuf, 1);
+		}
+
+		Read(&datahd.page, sizeof(datahd) - sizeof(datahd.id));
+
+		if( !datahd.size )
+			break;
+
+		pos = (ulong) datahd.page * SNAP_PAGE;
+
+		while( datahd.size > 0 )
+		{
+			readmax = sizeof outbuf;
+			if( readmax > datahd.size )
+				readmax = datahd.size;
+
+			Read(outbuf, readmax);
+			Output(pos, outbuf, readmax);
+
+			pos			+= readmax;
+			bytecount	 += readmax;
+			datahd.size -= readmax;
 		}
 
 		if( verbose )
+			DisplayProgress(objname, bytecount);
+	}
+
+	OutputFlush();
+
+	if( verbose )
+	{
+		DisplayProgress(objname, bytecount);
+		puts("");
+	}
+
+	close(fh);
+}
+
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : RestoreTable
+ *
+ * Purpose   : Restores a table from an archive made before snapshots.
+ *			   The records are in file order, so consecutive records are
+ *			   collected and written together.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void RestoreTable()
+{
+	ArchiveTableHeader	tablehd;
+	ArchiveRecordHeader	recordhd;
+	ulong				prev_bytecount;
+	ulong				bytecount;
+	char				outbuf[OUTBUF_SIZE];
+	char				fname[128];
+	char				objname[sizeof tablehd.table + 8];
+	int					fh;
+
+	Read(&tablehd.recsize, sizeof(tablehd) - sizeof(tablehd.id));
+
+	MakeFileName(fname, sizeof fname, tablehd.fname);
+	snprintf(objname, sizeof objname, "table %s", tablehd.table);
+
+	if( (fh = open(fname, O_WRONLY|O_TRUNC|O_CREAT|CONFIG_O_BINARY, CONFIG_CREATMASK)) == -1 )
+	{
+		printf("Cannot open file '%s'\n", fname);
+		longjmp(err_jmpbuf, 1);
+	}
+
+	/* The free-space bitmap of the file is rebuilt when it is opened */
+	strcat(fname, ".fsm");
+	unlink(fname);
+
+	prev_bytecount = bytecount = 0;
+	OutputOpen(fh, tablehd.fname);
+
+	for( ;; )
+	{
+		Read(&curr_id, sizeof curr_id);
+	
+		if( curr_id != ARCHIVE_RECORD )
+			break;
+
+		Read(&recordhd.recid, sizeof(recordhd) - sizeof(recordhd.id));
+		Read(outbuf, tablehd.recsize);
+
+		Output((ulong) tablehd.recsize * recordhd.recno, outbuf, tablehd.recsize);
+
+		bytecount += tablehd.recsize;
+
+		if( verbose && bytecount > prev_bytecount + 100000 )
 		{
+			prev_bytecount = bytecount;
 			DisplayProgress(objname, bytecount);
-			puts("");
 		}
-		
-		
-		close(fh);
+	}
+
+	OutputFlush();
+
+	if( verbose )
+	{
+		DisplayProgress(objname, bytecount);
+		puts("");
+	}
+	
+	close(fh);
+}
+
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : RestoreDatabase
+ *
+ * Purpose   : Restores the data files. An archive contains either data
+ *			   file images from a snapshot, the changed pages of the data
+ *			   files (incremental backup) or, if it was made before
+ *			   snapshots, a table for each record type.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void RestoreDatabase()
+{
+	Read(&curr_id, sizeof curr_id);
+
+	for( ;; )
+	{
+		if( curr_id == ARCHIVE_IMAGE || curr_id == ARCHIVE_PAGES )
+		{
+			if( curr_id == ARCHIVE_IMAGE )
+				RestoreImage();
+			else
+				RestorePages();
+			Read(&curr_id, sizeof curr_id);
+		}
+		else if( curr_id == ARCHIVE_TABLE )
+			RestoreTable();				/* Reads the next header id		*/
+		else
+			break;
 	}
 }
 
@@ -341,7 +791,7 @@ char *fname;
 	ulong				readmax;
 	ulong				bytecount=0;
 
-	if( (fh = open(fname, O_WRONLY|O_TRUNC|O_CREAT, CREATMASK)) == -1 )
+	if( (fh = open(fname, O_WRONLY|O_TRUNC|O_CREAT, CONFIG_CREATMASK)) == -1 )
 	{
 		printf("Cannot open '%s'\n", fname);
 		return;
@@ -444,6 +894,267 @@ static void RestoreLogFile()
 	Read(filehd.fname, sizeof(filehd) - sizeof(filehd.id));
 
 	RestoreFile(filehd.fname);
+	log_restored = 1;
+}
+
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : ReadMediaHeader
+ *
+ * Purpose   : Reads the media header of an archive without restoring it.
+ *
+ * Parameters: dev		- Archive device.
+ *			   hd		- Media header.
+ *
+ * Returns   : 0		- Ok.
+ *			   -1		- The header could not be read.
+ *
+ */
+static int ReadMediaHeader(dev, hd)
+char *dev;
+ArchiveMediaHeader *hd;
+{
+	int fh, rc = -1;
+
+	if( (fh = open(dev, O_RDONLY)) == -1 )
+		return -1;
+
+	if( read(fh, hd, sizeof *hd) == sizeof *hd && hd->id == ARCHIVE_MEDIA )
+		rc = 0;
+
+	close(fh);
+	return rc;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : CheckMedia
+ *
+ * Purpose   : Checks that a backup is the next in the chain of a full
+ *			   backup and its incremental backups.
+ *
+ * Parameters: n		- Number of backup in chain.
+ *			   hd		- Media header of (the first stripe of) the backup.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void CheckMedia(n, hd)
+int n;
+ArchiveMediaHeader *hd;
+{
+	if( n == 0 && hd->base )
+	{
+		printf("'%s' is an incremental backup. Restore the full backup first\n",
+			devices[set_first[n]]);
+		longjmp(err_jmpbuf, 1);
+	}
+
+	if( n > 0 && (hd->base != prev_date || strcmp(hd->dbname, dbname)) )
+	{
+		printf("'%s' is not an incremental backup of '%s'\n",
+			devices[set_first[n]], devices[set_first[n-1]]);
+		longjmp(err_jmpbuf, 1);
+	}
+
+	strcpy(dbname, hd->dbname);
+	prev_date = hd->date;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : GroupStripes
+ *
+ * Purpose   : Groups the devices into backups. The stripes of a striped
+ *			   backup must be given together, in stripe order. A device
+ *			   whose header cannot be read yet is a backup of its own.
+ *
+ * Parameters: None.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void GroupStripes()
+{
+	ArchiveMediaHeader *hd;
+	int			i, n;
+
+	for( i=0; i<archives; i += set_stripes[sets++] )
+	{
+		hd = &headers[i];
+		set_first[sets]	  = i;
+		set_stripes[sets] = header_ok[i] && hd->stripes > 1 ? hd->stripes : 1;
+
+		if( set_stripes[sets] > 1 && hd->stripe != 0 )
+		{
+			printf("'%s' is stripe %lu of a backup. Give stripe 0 first\n",
+				devices[i], hd->stripe);
+			longjmp(err_jmpbuf, 1);
+		}
+
+		for( n=1; n<set_stripes[sets]; n++ )
+			if( i+n >= archives || !header_ok[i+n] ||
+				headers[i+n].date != hd->date || headers[i+n].stripe != n ||
+				strcmp(headers[i+n].dbname, hd->dbname) )
+			{
+				printf("Stripe %d of the backup in '%s' is missing\n",
+					n, devices[i]);
+				longjmp(err_jmpbuf, 1);
+			}
+	}
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : OpenArchive
+ *
+ * Purpose   : Opens an archive and reads its media header.
+ *
+ * Parameters: dev		- Archive device.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void OpenArchive(dev)
+char *dev;
+{
+	device		= dev;
+	inbytes		= 0;
+	inreadpos	= 0;
+
+	if( archive_fh != -1 )
+		close(archive_fh);
+
+	/* If the device cannot be opened the user is prompted for it */
+	archive_fh = open(device, O_RDONLY);
+
+	if( verbose )
+		printf("Restoring from %s\n", device);
+
+	Read(&mediahd, sizeof mediahd);
+	if( mediahd.id != ARCHIVE_MEDIA )
+	{
+		printf("Unexpected header id %ld\n", mediahd.id);
+		longjmp(err_jmpbuf, 1);
+	}
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : RestoreStripe
+ *
+ * Purpose   : Restores one stripe of a striped backup. Called in a child
+ *			   process, which exits when the stripe has been restored.
+ *
+ * Parameters: dev		- Archive device.
+ *
+ * Returns   : Does not return.
+ *
+ */
+static void RestoreStripe(dev)
+char *dev;
+{
+	parallel = 1;
+	verbose	 = 0;
+	signal(SIGINT,	SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+
+	if( setjmp(err_jmpbuf) )
+	{
+		printf("Restore of '%s' failed\n", dev);
+		fflush(stdout);
+		_exit(1);
+	}
+
+	OpenArchive(dev);
+
+	if( mediahd.stripe == 0 )
+		RestoreDbdFile();
+	RestoreDatabase();
+
+	if( curr_id != ARCHIVE_END )
+	{
+		printf("Unexpected header id %ld\n", curr_id);
+		longjmp(err_jmpbuf, 1);
+	}
+
+	fflush(stdout);
+	_exit(0);
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : RestoreStriped
+ *
+ * Purpose   : Restores a striped backup. Each stripe is read by a process
+ *			   of its own, so the data files are written in parallel.
+ *
+ * Parameters: n		- Number of backup in chain.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void RestoreStriped(n)
+int n;
+{
+	struct stat	st;
+	int			i, status, failed = 0;
+	pid_t		pid;
+
+	if( archive_fh != -1 )
+	{
+		close(archive_fh);
+		archive_fh = -1;
+	}
+
+	if( verbose )
+		printf("Restoring %d stripes from %s...\n", set_stripes[n],
+			devices[set_first[n]]);
+
+	fflush(stdout);
+
+	for( i=set_first[n]; i<set_first[n] + set_stripes[n]; i++ )
+	{
+		if( (pid = fork()) == 0 )
+			RestoreStripe(devices[i]);
+
+		if( pid == -1 )
+		{
+			printf("Cannot start process (errno %d)\n", errno);
+			failed = 1;
+			break;
+		}
+
+		stripe_pid[i] = pid;
+	}
+
+	for( i=set_first[n]; i<set_first[n] + set_stripes[n]; i++ )
+	{
+		if( stripe_pid[i] <= 0 )
+			continue;
+
+		if( failed )
+			kill(stripe_pid[i], SIGTERM);
+
+		if( waitpid(stripe_pid[i], &status, 0) == -1 ||
+			!WIFEXITED(status) || WEXITSTATUS(status) )
+			failed = 1;
+		stripe_pid[i] = 0;
+
+		if( stat(devices[i], &st) == 0 )
+			total_read += st.st_size;
+	}
+
+	if( failed )
+		longjmp(err_jmpbuf, 1);
 }
 
 
@@ -453,7 +1164,7 @@ char *table;
 ulong records, curr_rec;
 {
 	static int old_percent = 0;
-	int percent = curr_rec * 100 / records;
+	int percent = records ? curr_rec * 100 / records : 100;
 
 	if( curr_rec == 0 )
 	{
@@ -475,8 +1186,12 @@ static void help()
 {
 	puts("Syntax: tyrestore [option]...\n"
 		 "Options:\n"
-		 "    -d<device>      Backup device\n"
+		 "    -d<device>      Backup device. Give the full backup first, followed\n"
+		 "                    by its incremental backups in the order they were made.\n"
+		 "                    Give all stripes of a striped backup, in order\n"
 		 "    -f<path>        Path for data files\n"
+		 "    -j<n>           Rebuild the indexes with <n> processes. Default is\n"
+		 "                    the number of processors\n"
 		 "    -v              Be verbose\n");
 	exit(1);
 }
@@ -489,6 +1204,7 @@ char 	*argv[];
 {
 	char				dbdname[20];
 	int					i;
+	int					procs = 1;
 	struct tm			*tm;
 
 	/* The input buffer MUST be bigger than the output buffer */
@@ -496,6 +1212,10 @@ char 	*argv[];
 
 	printf("Typhoon Restore version %s\n", VERSION);
 
+#ifdef _SC_NPROCESSORS_ONLN
+	procs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
 	if( argc < 2 )
 		help();
 
@@ -508,11 +1228,15 @@ char 	*argv[];
 				switch( argv[i][1] )
 				{
 					case 'd':
-						device = argv[i]+2;
+						if( archives < ARCHIVES_MAX )
+							devices[archives++] = argv[i]+2;
 						break;
 					case 'f':
 						datapath = argv[i]+2;
 						break;
+					case 'j':
+						procs = atoi(argv[i]+2);
+						break;
 					case 'v':
 						verbose = 1;
 						break;
@@ -529,11 +1253,14 @@ char 	*argv[];
 
 	if( *datapath  )
 	{
-		mkdir(datapath);
+		mkdir(datapath, 0777);
 		chmod(datapath, 0777);
 	}
 	
-	if( !(inbuf = (char *)malloc(INBUF_SIZE)) )
+	if( !(inbuf = (char *)malloc(INBUF_SIZE)) ||
+		!(zbuf = (char *)malloc(ARCHIVE_ZBLOCK_MAX)) ||
+		!(zout = (char *)malloc(ARCHIVE_ZBLOCK_MAX)) ||
+		!(wbuf = (char *)malloc(WRITEBUF_SIZE)) )
 	{
 		puts("Cannot allocate output buffer");
 		return;
@@ -548,15 +1275,25 @@ char 	*argv[];
 		goto out;
 	}
 
-	if( verbose )
-		printf("Restoring from %s\n", device);
+	if( !archives )
+		devices[archives++] = device;
 
-	Read(&mediahd, sizeof mediahd);
-	if( mediahd.id != ARCHIVE_MEDIA )
-	{
-		printf("Unexpected header id %d\n", mediahd.id);
-		longjmp(err_jmpbuf, 1);
-	}
+	OpenArchive(devices[0]);
+
+	headers[0]	 = mediahd;
+	header_ok[0] = 1;
+	for( i=1; i<archives; i++ )
+		header_ok[i] = ReadMediaHeader(devices[i], &headers[i]) == 0;
+
+	GroupStripes();
+
+	/* Check the chain of incremental backups before anything is restored.
+	 * An archive that cannot be read yet is checked when it is restored.
+	 */
+	for( i=0; i<sets && header_ok[set_first[i]]; i++ )
+		CheckMedia(i, &headers[set_first[i]]);
+	strcpy(dbname, mediahd.dbname);
+	prev_date = mediahd.date;
 
 	strcpy(dbd.name, mediahd.dbname);
 	if( shm_alloc(&dbd) == -1 )
@@ -583,15 +1320,33 @@ char 	*argv[];
 	clock_off();
 	tm = localtime(&mediahd.date);
 	printf("Database '%s' from %s", mediahd.dbname, asctime(tm));
+	if( sets > 1 )
+		printf("and %d incremental backup%s\n", sets - 1, sets > 2 ? "s" : "");
 	printf("Restore? [y/n]: ");
 	fflush(stdout);
 	if( getchar() != 'y' )
 		goto out;
 	clock_on();
 
-	RestoreDbdFile();
-	RestoreDatabase();
-	RestoreLogFile();
+	for( i=0; i<sets; i++ )
+	{
+		if( set_stripes[i] > 1 )
+		{
+			CheckMedia(i, &headers[set_first[i]]);
+			RestoreStriped(i);
+			continue;
+		}
+
+		if( i > 0 )
+		{
+			OpenArchive(devices[set_first[i]]);
+			CheckMedia(i, &mediahd);
+		}
+
+		RestoreDbdFile();
+		RestoreDatabase();
+		RestoreLogFile();
+	}
 	clock_off();
 
 	if( verbose )
@@ -606,10 +1361,13 @@ char 	*argv[];
 		printf("%s bytes/second\n", printlong(total_read / secs));
 	}
 
-	FixLog(mediahd.dbname);
+	/* Archives made from a snapshot have no log to replay */
+	if( log_restored )
+		FixLog(mediahd.dbname);
 
 	printf("Rebuilding index files");
 	d_keybuild(VerboseFn);
+	d_keybuildprocs(procs > 1 ? procs : 1);
 	d_dbfpath(datapath);
 
 	if( d_open(mediahd.dbname, "o") != S_OKAY )
@@ -622,8 +1380,14 @@ char 	*argv[];
 
 out:
 	free(inbuf);
-	dbd.shm->restore_active = 0;
-	shm_free(&dbd);
+	free(zbuf);
+	free(zout);
+	free(wbuf);
+	if( dbd.shm )
+	{
+		dbd.shm->restore_active = 0;
+		shm_free(&dbd);
+	}
 	free(dbd.dbd);
 	unlink(LOG_FNAME);
 
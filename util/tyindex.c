@@ -0,0 +1,489 @@
+/*----------------------------------------------------------------------------
+ * File    : tyindex.c
+ * Program : tyindex
+ * OS      : UNIX
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS"
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Analyzes the B-trees of the key files and reference files of a
+ *   database. For each file the depth of the tree, the fill of its nodes,
+ *   the length of the delete chain, the part of the file not used by the
+ *   tree and the estimated number of node reads per lookup are shown.
+ *
+ *   With the -c option the files are compacted afterwards: the keys are
+ *   copied in key order into a new file that is built bottom-up, and the
+ *   new file replaces the old one. The database must not be in use.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+#include "btree.h"
+
+static char CONFIG_CONST rcsid[] = "$Id$";
+
+/*---------------------------- Type definitions ----------------------------*/
+typedef struct {					/* Result of walking a B-tree			*/
+	ulong	nodes;					/* Nodes in the tree					*/
+	ulong	keys;					/* Keys in the tree						*/
+	ulong	units;					/* Slot units used (compressed files)	*/
+	ulong	level_nodes[BTREE_DEPTH_MAX+1];	/* Nodes on each level (1 = root)*/
+	ulong	level_keys[BTREE_DEPTH_MAX+1];	/* Keys on each level			*/
+	ulong	fill[11];				/* Nodes by fill in steps of 10%		*/
+	int		depth_min;				/* Level of the highest leaf			*/
+	int		depth_max;				/* Level of the deepest leaf			*/
+	int		error;					/* Could the tree not be walked?		*/
+} TREESTAT;
+
+/*-------------------------- Function prototypes ---------------------------*/
+static INDEX	   *openindex	PRM( (int); )
+static void			walk		PRM( (INDEX *, TREESTAT *, int, ix_addr); )
+static long			analyze		PRM( (int); )
+static int			compact		PRM( (int, int); )
+static int			inuse		PRM( (void); )
+static void			help		PRM( (void); )
+int					main		PRM( (int, char **); )
+
+/*---------------------------- Global variables ----------------------------*/
+static Dbentry		dbd;				/* The dbd-file						*/
+static char			dbdname[256];		/* Name of the dbd-file				*/
+static char		   *datapath = ".";		/* Path for data files				*/
+static char		   *node[BTREE_DEPTH_MAX+1];/* Node buffer of each level	*/
+static int			histograms = 0;		/* Print the fill histograms?		*/
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : openindex
+ *
+ * Purpose   : Open an index file in exclusive mode.
+ *
+ * Parameters: fileid	- File ID.
+ *
+ * Returns   : The index file descriptor, or NULL if it could not be opened.
+ *
+ */
+static INDEX *openindex(fileid)
+int fileid;
+{
+	File *fp = dbd.file + fileid;
+	Key *key;
+	char fname[256];
+	INDEX *I;
+
+	sprintf(fname, "%s/%s", datapath, fp->name);
+
+	if( access(fname, 0) )
+	{
+		printf("%-20s not found\n", fp->name);
+		return NULL;
+	}
+
+	/* The keys are never compared, so no comparison function is needed */
+	if( fp->type == 'r' )
+		I = btree_open(fname, sizeof(REF_ENTRY), fp->pagesize, (CMPFUNC)0,
+					   0, 0);
+	else
+	{
+		key = dbd.key + fp->id;
+		I = btree_open(fname, key->size, fp->pagesize, (CMPFUNC)0,
+					   (key->type & KT_UNIQUE) ? 0 : 1, 0);
+	}
+
+	if( !I )
+		printf("%-20s cannot be opened (db_status %d)\n", fp->name, db_status);
+
+	return I;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : walk
+ *
+ * Purpose   : Walk a subtree and add its nodes and keys to the statistics.
+ *
+ * Parameters: I		- Index file.
+ *			   T		- Statistics.
+ *			   level	- Level of the subtree root. 1 = the root.
+ *			   page		- Page of the subtree root.
+ *
+ * Returns   : Nothing. T->error is set if a node could not be read or the
+ *			   tree is too deep.
+ *
+ */
+static void walk(I, T, level, page)
+INDEX *I;
+TREESTAT *T;
+int level;
+ix_addr page;
+{
+	char *N = node[level];
+	int i, n;
+
+	if( level > BTREE_DEPTH_MAX )
+	{
+		T->error = 1;
+		return;
+	}
+
+	/* An empty index has no root */
+	if( noderead(I, N, page) == (ix_addr)-1 )
+	{
+		if( page != ROOT )
+			T->error = 1;
+		return;
+	}
+
+	if( (n = NSIZE(N)) < 0 || n > I->H.order )
+	{
+		T->error = 1;
+		return;
+	}
+
+	T->nodes++;
+	T->keys += n;
+	T->level_nodes[level]++;
+	T->level_keys[level] += n;
+	T->fill[n >= I->H.order ? 10 : n * 10 / I->H.order]++;
+
+	if( I->map && page < I->map->pages )
+		T->units += I->map->units[page];
+
+	if( !CHILD(N, 0) )
+	{
+		if( !T->depth_min || level < T->depth_min )
+			T->depth_min = level;
+		if( level > T->depth_max )
+			T->depth_max = level;
+		return;
+	}
+
+	for( i=0; i<=n && !T->error; i++ )
+		walk(I, T, level+1, CHILD(N, i));
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : analyze
+ *
+ * Purpose   : Print the statistics of an index file.
+ *
+ * Parameters: fileid	- File ID.
+ *
+ * Returns   : The number of nodes in the tree, or -1 if the file could not
+ *			   be opened or read.
+ *
+ */
+static long analyze(fileid)
+int fileid;
+{
+	TREESTAT T;
+	INDEX *I;
+	ulong pages, chain = 0, unused, nodes, reads = 0, disk = 0;
+	ix_addr page;
+	long size;
+	int level, cached = 0;
+
+	if( !(I = openindex(fileid)) )
+		return -1;
+
+	memset(&T, 0, sizeof T);
+	walk(I, &T, 1, ROOT);
+
+	if( T.error )
+	{
+		printf("%-20s cannot be read\n", dbd.file[fileid].name);
+		btree_close(I);
+		return -1;
+	}
+
+	/* Pages not in the tree are either in the delete chain or lost. In a
+	 * compressed file the waste is the free slot units instead.
+	 */
+	if( I->map )
+	{
+		pages	= I->map->endunit;
+		unused	= pages > T.units ? pages - T.units : 0;
+	}
+	else
+	{
+		size	= lseek(I->fh, 0L, SEEK_END);
+		pages	= size > I->H.nodesize ? size / I->H.nodesize - 1 : 0;
+		unused	= pages > T.nodes ? pages - T.nodes : 0;
+
+		for( page = I->H.first_deleted; page && chain <= pages; chain++ )
+		{
+			lseek(I->fh, (long)page * I->H.nodesize, SEEK_SET);
+			if( read(I->fh, &page, sizeof page) != sizeof page )
+				break;
+		}
+	}
+
+	/* A lookup reads the nodes from the root to the level the key is found
+	 * on. The top levels fit in the node cache of a file opened in exclusive
+	 * mode, so only the levels below are read from disk.
+	 */
+	for( level=1, nodes=0; level<=T.depth_max; level++ )
+	{
+		if( (nodes += T.level_nodes[level]) <= NODECACHE_SIZE )
+			cached = level;
+		reads	+= T.level_keys[level] * level;
+		disk	+= T.level_keys[level] * (level - cached);
+	}
+
+	printf("%-20s %c %9lu %5u %5d %7lu %4lu%% %7lu %5lu%% %5.2f %5.2f\n",
+		dbd.file[fileid].name, dbd.file[fileid].type, T.keys, I->H.order,
+		T.depth_max, T.nodes,
+		T.nodes ? T.keys * 100 / (T.nodes * I->H.order) : 0, chain,
+		pages ? unused * 100 / pages : 0,
+		T.keys ? (double)reads / T.keys : 0.0,
+		T.keys ? (double)disk / T.keys : 0.0);
+
+	if( T.depth_min != T.depth_max )
+		printf("    unbalanced: leaves on levels %d to %d\n", T.depth_min,
+			T.depth_max);
+	if( T.keys != I->H.keys )
+		printf("    the header says %lu keys\n", I->H.keys);
+	if( !I->map && chain + T.nodes < pages )
+		printf("    %lu pages are neither in the tree nor in the delete chain\n",
+			pages - chain - T.nodes);
+
+	if( histograms )
+		for( level=0; level<=10; level++ )
+			if( T.fill[level] )
+				printf("    fill %3d-%3d%%: %lu\n", level * 10,
+					level == 10 ? 100 : level * 10 + 9, T.fill[level]);
+
+	btree_close(I);
+
+	return (long)T.nodes;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : compact
+ *
+ * Purpose   : Compact an index file. The keys are copied into a new file
+ *			   with the same format, which then replaces the old file.
+ *
+ * Parameters: fileid	- File ID.
+ *			   fill		- Percentage of each node to fill (50-100).
+ *
+ * Returns   : 0 if the file was compacted, otherwise -1.
+ *
+ */
+static int compact(fileid, fill)
+int fileid, fill;
+{
+	char fname[256], newname[260];
+	INDEX *I, *to;
+	int rc;
+
+	if( !(I = openindex(fileid)) )
+		return -1;
+
+	sprintf(fname, "%s/%s", datapath, dbd.file[fileid].name);
+	sprintf(newname, "%s.new", fname);
+	unlink(newname);
+
+	/* The new file is compressed if the old one is */
+	typhoon.key_compress = I->map != NULL;
+
+	if( !(to = btree_open(newname, I->H.keysize, I->H.nodesize, (CMPFUNC)0,
+						  I->H.dups, 0)) )
+	{
+		printf("%-20s cannot create '%s'\n", dbd.file[fileid].name, newname);
+		btree_close(I);
+		return -1;
+	}
+
+	rc = btree_copy(I, to, fill);
+
+	btree_close(to);
+	btree_close(I);
+
+	if( rc != S_OKAY || rename(newname, fname) == -1 )
+	{
+		printf("%-20s cannot be compacted (db_status %d)\n",
+			dbd.file[fileid].name, rc);
+		unlink(newname);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : inuse
+ *
+ * Purpose   : Find out if any process has the database open.
+ *
+ * Parameters: None.
+ *
+ * Returns   : 1 if the database is in use, otherwise 0.
+ *
+ */
+static int inuse()
+{
+	struct shmid_ds ds;
+	int shm_id;
+
+	/* Look for the segment created by shm_alloc() without creating it */
+	if( (shm_id = shmget(ftok(dbdname, 30), 0, 0)) == -1 )
+		return 0;
+
+	if( shmctl(shm_id, IPC_STAT, &ds) == -1 )
+		return 0;
+
+	return ds.shm_nattch > 0;
+}
+
+
+static void help()
+{
+	puts("Syntax: tyindex [option]... database [file]...\n"
+		 "Options:\n"
+		 "    -c<fill>        Compact the files, filling each node <fill>%\n"
+		 "                    (50-100)\n"
+		 "    -f<path>        Path for data files\n"
+		 "    -h              Print the fill histograms");
+	exit(1);
+}
+
+
+int main(argc, argv)
+int argc;
+char *argv[];
+{
+	char *dbname = NULL, **names;
+	long nodes;
+	int i, n, fill = 0, selected = 0, nodesize = 0, rc = 0;
+
+	if( !(names = (char **)calloc(argc, sizeof(char *))) )
+		return 1;
+
+	for( i=1; i<argc; i++ )
+	{
+		if( argv[i][0] == '-' )
+			switch( argv[i][1] )
+			{
+				case 'c':
+					fill = atoi(argv[i]+2);
+					if( fill < 50 || fill > 100 )
+					{
+						puts("The fill must be 50-100%");
+						help();
+					}
+					break;
+				case 'f':
+					datapath = argv[i]+2;
+					break;
+				case 'h':
+					histograms = 1;
+					break;
+				default:
+					printf("Invalid option '%c'\n", argv[i][1]);
+					help();
+			}
+		else if( !dbname )
+			dbname = argv[i];
+		else
+			names[selected++] = argv[i];
+	}
+
+	if( !dbname )
+		help();
+
+	memset(&dbd, 0, sizeof dbd);
+	sprintf(dbdname, "%s.dbd", dbname);
+	if( read_dbdfile(&dbd, dbdname) != S_OKAY )
+	{
+		printf("Invalid dbd-file '%s'\n", dbdname);
+		return 1;
+	}
+
+	if( fill && inuse() )
+	{
+		printf("Database '%s' is in use\n", dbname);
+		return 1;
+	}
+
+	for( i=0; i<dbd.header.files; i++ )
+		if( dbd.file[i].pagesize > nodesize )
+			nodesize = dbd.file[i].pagesize;
+
+	for( i=0; i<=BTREE_DEPTH_MAX; i++ )
+		if( !(node[i] = (char *)malloc(nodesize)) )
+		{
+			puts("Cannot allocate node buffers");
+			return 1;
+		}
+
+	printf("%-20s %c %9s %5s %5s %7s %5s %7s %6s %5s %5s\n",
+		"File", 't', "keys", "order", "depth", "nodes", "fill", "deleted",
+		"wasted", "reads", "disk");
+
+	for( i=0; i<dbd.header.files; i++ )
+	{
+		if( dbd.file[i].type != 'k' && dbd.file[i].type != 'r' )
+			continue;
+
+		for( n=0; n<selected && strcmp(names[n], dbd.file[i].name); n++ )
+			;
+		if( selected && n == selected )
+			continue;
+
+		/* Only trees that could be walked are compacted */
+		if( (nodes = analyze(i)) == -1 )
+			rc = 1;
+		else if( fill && nodes )
+		{
+			if( compact(i, fill) == -1 )
+				rc = 1;
+			else
+				analyze(i);
+		}
+	}
+
+	free(dbd.dbd);
+
+	return rc;
+}
+
+/* end-of-file */
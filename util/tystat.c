@@ -0,0 +1,249 @@
+/*----------------------------------------------------------------------------
+ * File    : tystat.c
+ * Program : tystat
+ * OS      : UNIX
+ * Author  : Thomas B. Pedersen
+ *
+ * Copyright (c) 1994 Thomas B. Pedersen.  All rights reserved.
+ *
+ * Permission is hereby granted, without written agreement and without
+ * license or royalty fees, to use, copy, modify, and distribute this
+ * software and its documentation for any purpose, provided that the above
+ * copyright notice and the following two  paragraphs appear (1) in all 
+ * source copies of this software and (2) in accompanying documentation
+ * wherever the programatic interface of this software, or any derivative
+ * of it, is described.
+ *
+ * IN NO EVENT SHALL THOMAS B. PEDERSEN BE LIABLE TO ANY PARTY FOR DIRECT,
+ * INDIRECT, SPECIAL, INCIDENTAL, OR CONSEQUENTIAL DAMAGES ARISING OUT OF
+ * THE USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF HE HAS BEEN 
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * THOMAS B. PEDERSEN SPECIFICALLY DISCLAIMS ANY WARRANTIES, INCLUDING, BUT
+ * NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE.  THE SOFTWARE PROVIDED HEREUNDER IS ON AN "AS IS" 
+ * BASIS, AND THOMAS B. PEDERSEN HAS NO OBLIGATION TO PROVIDE MAINTENANCE,
+ * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+ *
+ * Description:
+ *   Dumps the I/O statistics of a database that is in use. The statistics
+ *   are read from the shared memory segment of the database, so they cover
+ *   all the processes that have the database open. The program must be run
+ *   from the directory the processes opened the database from, because
+ *   the segment is identified by the dbd-file.
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "typhoon.h"
+#include "ty_dbd.h"
+#include "ty_type.h"
+#include "ty_glob.h"
+#include "ty_prot.h"
+
+static char CONFIG_CONST rcsid[] = "$Id$";
+
+/*-------------------------- Function prototypes ---------------------------*/
+static ulong		percentile	PRM( (ulong *, int); )
+static void			printstats	PRM( (char *, int, DB_STATS *); )
+static void			printhist	PRM( (char *, ulong *); )
+static void			help		PRM( (void); )
+int					main		PRM( (int, char **); )
+
+/*---------------------------- Global variables ----------------------------*/
+static int			histograms = 0;		/* Print the latency histograms?	*/
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : percentile
+ *
+ * Purpose   : Find a percentile in a latency histogram.
+ *
+ * Parameters: hist		- Histogram (STAT_BUCKETS buckets).
+ *			   pct		- Percentile (1-100).
+ *
+ * Returns   : The upper limit in microseconds of the bucket that contains
+ *			   the percentile. 0 if the histogram is empty.
+ *
+ */
+static ulong percentile(hist, pct)
+ulong *hist;
+int pct;
+{
+	ulong total = 0, sum = 0;
+	int i;
+
+	for( i=0; i<STAT_BUCKETS; i++ )
+		total += hist[i];
+
+	if( !total )
+		return 0;
+
+	for( i=0; i<STAT_BUCKETS-1; i++ )
+		if( (sum += hist[i]) * 100 >= total * pct )
+			break;
+
+	return 1UL << i;
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : printhist
+ *
+ * Purpose   : Print the non-empty buckets of a latency histogram.
+ *
+ * Parameters: name		- Name of the histogram.
+ *			   hist		- Histogram (STAT_BUCKETS buckets).
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void printhist(name, hist)
+char *name;
+ulong *hist;
+{
+	int i;
+
+	for( i=0; i<STAT_BUCKETS; i++ )
+		if( hist[i] )
+		{
+			printf("    %-6s %s %8lu us: %lu\n", name,
+				i == STAT_BUCKETS-1 ? ">=" : " <",
+				i == STAT_BUCKETS-1 ? 1UL << (i-1) : 1UL << i, hist[i]);
+		}
+}
+
+
+/*--------------------------------------------------------------------------*\
+ *
+ * Function  : printstats
+ *
+ * Purpose   : Print a line of statistics.
+ *
+ * Parameters: name		- File name.
+ *			   type		- File type ('k', 'r', 'd', 'v'). 0 = total.
+ *			   s		- Statistics.
+ *
+ * Returns   : Nothing.
+ *
+ */
+static void printstats(name, type, s)
+char *name;
+int type;
+DB_STATS *s;
+{
+	printf("%-20s %c %9lu %9lu %9lu %6lu %6lu %6lu %5lu/%-6lu %5lu/%-6lu\n",
+		name, type ? type : ' ', s->reads, s->writes, s->cache_hits,
+		s->splits, s->merges, s->reopens,
+		percentile(s->read_time, 50),  percentile(s->read_time, 99),
+		percentile(s->write_time, 50), percentile(s->write_time, 99));
+
+	if( histograms )
+	{
+		printhist("read", s->read_time);
+		printhist("write", s->write_time);
+	}
+}
+
+
+static void help()
+{
+	puts("Syntax: tystat [option]... database\n"
+		 "Options:\n"
+		 "    -h    Print latency histograms");
+	exit(1);
+}
+
+
+int main(argc, argv)
+int argc;
+char *argv[];
+{
+	Dbentry dbd;
+	DB_STATS *stats, total;
+	char dbdname[256], *dbname = NULL;
+	ulong *sum, *add;
+	key_t key;
+	int shm_id, i, n;
+	void *shm;
+
+	for( i=1; i<argc; i++ )
+	{
+		if( argv[i][0] == '-' )
+			switch( argv[i][1] )
+			{
+				case 'h':
+					histograms = 1;
+					break;
+				default:
+					printf("Invalid option '%c'\n", argv[i][1]);
+					help();
+			}
+		else
+			dbname = argv[i];
+	}
+
+	if( !dbname )
+		help();
+
+	memset(&dbd, 0, sizeof dbd);
+	sprintf(dbdname, "%s.dbd", dbname);
+	if( read_dbdfile(&dbd, dbdname) != S_OKAY )
+	{
+		printf("Invalid dbd-file '%s'\n", dbdname);
+		return 1;
+	}
+
+	/* Attach to the segment created by shm_alloc() without creating it */
+	key = ftok(dbdname, 30);
+	if( (shm_id = shmget(key, 0, 0)) == -1 )
+	{
+		printf("Database '%s' is not in use\n", dbname);
+		return 1;
+	}
+
+	if( (shm = shmat(shm_id, 0, SHM_RDONLY)) == (void *)-1 )
+	{
+		printf("Cannot attach to the shared memory of '%s'\n", dbname);
+		return 1;
+	}
+
+	stats = (DB_STATS *)((TyphoonSharedMemory *)shm + 1);
+
+	printf("%-20s %c %9s %9s %9s %6s %6s %6s %12s %12s\n",
+		"File", 't', "reads", "writes", "hits", "splits", "merges",
+		"reopen", "read p50/99", "write p50/99");
+
+	memset(&total, 0, sizeof total);
+	for( i=0; i<=dbd.header.files; i++ )
+	{
+		if( i < dbd.header.files )
+			printstats(dbd.file[i].name, dbd.file[i].type, stats + i);
+
+		sum = (ulong *)&total;
+		add = (ulong *)(stats + i);
+		for( n=0; n<sizeof(DB_STATS)/sizeof(ulong); n++ )
+			*sum++ += *add++;
+	}
+
+	printstats("Total", 0, &total);
+	printf("\n%lu lock requests, p50 %lu us, p99 %lu us\n", total.locks,
+		percentile(total.lock_time, 50), percentile(total.lock_time, 99));
+	if( histograms )
+		printhist("lock", total.lock_time);
+
+	shmdt(shm);
+	free(dbd.dbd);
+
+	return 0;
+}
+
+/* end-of-file */
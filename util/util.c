@@ -1,6 +1,6 @@
 /*----------------------------------------------------------------------------
  * File    : util.c
- * Program : tybackup, tyrestore
+ * Program : tybackup, tyrestore, tyexport, tyimport
  * OS      : UNIX, OS/2, DOS
  * Author  : Thomas B. Pedersen
  *
@@ -26,13 +26,14 @@
  * SUPPORT, UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
  *
  * Description:
- *   Contains miscellaneous function used by tybackup and tyrestore.
+ *   Contains miscellaneous function used by the utilities.
  *
  * Functions:
  *   clock_on			- Start timer.
  *   clock_off			- Stop timer.
  *   clock_secs			- Report number of seconds passed.
  *   printlong			- Print a long with 1000 separators.
+ *   checksum			- Compute the Adler-32 checksum of a buffer.
  *
  *--------------------------------------------------------------------------*/
 
@@ -101,4 +102,48 @@ ulong number;
 	return p;
 }
 
+
+/*-------------------------------- checksum --------------------------------*\
+ *
+ * Purpose	 : Computes the Adler-32 checksum of a buffer. A checksum can be
+ *			   computed in several steps by passing the result of one step
+ *			   to the next.
+ *
+ * Parameters: buf		- Buffer.
+ *			   len		- Number of bytes in <buf>.
+ *			   sum		- Checksum of the preceding data. 1 = no data.
+ *
+ * Returns	 : The checksum.
+ *
+ */
+
+ulong checksum(buf, len, sum)
+void *buf;
+unsigned len;
+ulong sum;
+{
+	uchar *p = (uchar *)buf;
+	ulong a = sum & 0xffff;
+	ulong b = (sum >> 16) & 0xffff;
+	unsigned n;
+
+	while( len )
+	{
+		/* 5552 is the most bytes that can be added before b overflows */
+		n	 = len < 5552 ? len : 5552;
+		len	-= n;
+
+		while( n-- )
+		{
+			a += *p++;
+			b += a;
+		}
+
+		a %= 65521;
+		b %= 65521;
+	}
+
+	return b << 16 | a;
+}
+
 /* end-of-file */
@@ -1,6 +1,6 @@
 /*----------------------------------------------------------------------------
  * File    : util.h
- * Program : tybackup, tyrestore
+ * Program : tybackup, tyrestore, tyexport, tyimport
  * OS      : UNIX, OS/2, DOS
  * Author  : Thomas B. Pedersen
  *
@@ -37,6 +37,7 @@ void	clock_on					PRM( (void); )
 void	clock_off					PRM( (void); )
 ulong	clock_secs					PRM( (void); )
 char	*printlong					PRM( (ulong); )
+ulong	checksum					PRM( (void *, unsigned, ulong); )
 
 
 /* end-of-file */